@@ -0,0 +1,87 @@
+//Benchmark of EntityMeshCollide::TestCollisions (sweep and prune plus the narrowphase in jobs) with 10K spheres and a
+//ground plane, with 1, 2, 4... threads of the JobSystem, compared with testing every pair like the old TestAllCollisions.
+//It checks that both find the same collisions. It does not open a window, build it like test.cpp with the engine sources.
+//Usage: bench_collisions [num_colliders] [max_threads]
+
+#include "src/world/entity.h"
+#include "src/utils/jobsystem.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static unsigned int s_callbacks = 0;
+
+class Ball : public EntityMeshCollide
+{
+public:
+	Ball(Entity* parent) : EntityMeshCollide(parent) {}
+	virtual bool onEntityCollision(EntityMeshCollide*) { s_callbacks++; return true; }
+};
+
+int main(int argc, char **argv)
+{
+	const int N = argc > 1 ? atoi(argv[1]) : 10000;
+	int max_threads = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+	const int REPEAT = 10;
+
+	//spheres spread in a box, some of them static, in two layers, and the ground in the middle of them
+	Entity* root = new Entity();
+	std::vector<EntityMeshCollide*> colliders;
+	srand(9);
+	for (int i = 0; i < N; i++)
+	{
+		Ball* ball = new Ball(root);
+		ball->entity_collision = true;
+		ball->collision_mode = EntityMeshCollide::SPHERE_COLLISION;
+		ball->radius = 1.0f + rand() % 5;
+		ball->model.setTranslation(rand() % 1000, rand() % 200, rand() % 1000);
+		ball->yield = i % 3 == 0;
+		ball->collision_layer = i % 5 == 0 ? 2 : 1;
+		ball->collision_mask = i % 7 == 0 ? 1 : 0xFFFFFFFF;
+		colliders.push_back(ball);
+	}
+	Ball* ground = new Ball(root);
+	ground->entity_collision = true;
+	ground->collision_mode = EntityMeshCollide::PLANE_COLLISION;
+	ground->model.setTranslation(0, 100, 0);
+	colliders.push_back(ground);
+	Entity::updateTransforms();
+
+	//every pair, one thread
+	Clock::time_point start = Clock::now();
+	unsigned int expected = 0;
+	CollisionContact contact;
+	for (size_t i = 0; i < colliders.size(); i++)
+		for (size_t j = i + 1; j < colliders.size(); j++)
+			expected += colliders[i]->findContact(colliders[j], contact);
+	float all_pairs_ms = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	printf("%d colliders, %u collisions\nevery pair             %8.2f ms\n", N + 1, expected, all_pairs_ms);
+
+	int errors = 0;
+	for (int threads = 1; threads <= max_threads || threads == 1; threads *= 2)
+	{
+		JobSystem::deinit();
+		JobSystem::num_threads = threads;
+		JobSystem::init();
+
+		float ms = 0;
+		for (int k = 0; k < REPEAT; k++)
+		{
+			s_callbacks = 0;
+			EntityMeshCollide::TestCollisions(root, root);
+			ms += EntityMeshCollide::s_collision_time;
+		}
+		ms /= REPEAT;
+		bool wrong = EntityMeshCollide::s_collisions != expected || s_callbacks != expected * 2;
+		printf("TestCollisions, %2d threads %8.2f ms  x%.1f  %u pairs %u collisions%s\n", threads, ms, all_pairs_ms / ms, EntityMeshCollide::s_broadphase_pairs, EntityMeshCollide::s_collisions, wrong ? "  WRONG" : "");
+		errors += wrong;
+	}
+
+	JobSystem::deinit();
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,150 @@
+//Benchmark of the frustum culling of culling.cpp: a million random spheres culled with FrustumCuller::cull with 1, 2, 4...
+//threads of the JobSystem, compared with testing them one by one with Camera::sphereInFrustum. Then the same spheres
+//sorted like the world (one root with clusters of children) culled with cullHierarchy. It checks that both give the same
+//result than testing the planes directly. It does not open a window, build it like test.cpp with the engine sources.
+//Usage: bench_culling [num_spheres] [max_threads]
+
+#include "src/gfx/culling.h"
+#include "src/gfx/camera.h"
+#include "src/utils/jobsystem.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float millisecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+static bool sphereVisible(const float frustum[6][4], float x, float y, float z, float radius)
+{
+	for (int p = 0; p < 6; p++)
+		if (frustum[p][0] * x + frustum[p][1] * y + frustum[p][2] * z + frustum[p][3] < -radius)
+			return false;
+	return true;
+}
+
+static Vector3 randomPoint(float range)
+{
+	Vector3 v;
+	v.random(range);
+	return v;
+}
+
+//like the world: the root contains everything and is always visible, every cluster is a parent with its children around it
+static void buildHierarchy(FrustumCuller& culler, size_t num, size_t cluster_size)
+{
+	culler.resize(num);
+	culler.setSphere(0, Vector3(0,0,0), CULLING_ALWAYS_VISIBLE);
+	culler.setSubtree(0, num, AABB(Vector3(0,0,0), Vector3(1e30f, 1e30f, 1e30f)));
+	for (size_t parent = 1; parent < num; parent += cluster_size)
+	{
+		size_t end = std::min(num, parent + cluster_size);
+		Vector3 center = randomPoint(3000);
+		Vector3 min_point = center, max_point = center;
+		for (size_t i = parent; i < end; i++)
+		{
+			Vector3 pos = i == parent ? center : center + randomPoint(50);
+			float radius = (rand() % 100) * 0.05f;
+			culler.setSphere(i, pos, radius);
+			culler.setSubtree(i, i + 1, AABB(pos, Vector3(radius, radius, radius)));
+			min_point.setMin(pos - Vector3(radius, radius, radius));
+			max_point.setMax(pos + Vector3(radius, radius, radius));
+		}
+		culler.setSubtree(parent, end, AABB((min_point + max_point) * 0.5f, (max_point - min_point) * 0.5f));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const size_t N = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+	int max_threads = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+	const int REPEAT = 10;
+
+	Camera camera;
+	camera.setPerspective(70, 1.5f, 1, 2000);
+	camera.lookAt(Vector3(0,0,0), Vector3(1,0.2f,0.5f), Vector3(0,1,0));
+	camera.extractFrustum();
+
+	FrustumCuller culler;
+	culler.resize(N);
+	srand(3);
+	for (size_t i = 0; i < N; i++)
+	{
+		Vector3 center;
+		center.random(3000);
+		culler.setSphere(i, center, (rand() % 100) * 0.5f);
+	}
+
+	size_t expected = 0;
+	for (size_t i = 0; i < N; i++)
+		expected += sphereVisible(camera.frustum, culler.x[i], culler.y[i], culler.z[i], culler.radius[i]);
+
+	//the way the world culled before, one sphere at a time
+	Clock::time_point start = Clock::now();
+	size_t count = 0;
+	for (int k = 0; k < REPEAT; k++)
+		for (size_t i = 0; i < N; i++)
+			count += camera.sphereInFrustum(culler.x[i], culler.y[i], culler.z[i], culler.radius[i]) != Camera::OUTSIDE;
+	float single_ms = millisecondsSince(start) / REPEAT;
+	printf("%u spheres, %u visible\nsphereInFrustum loop   %8.2f ms\n", (unsigned int)N, (unsigned int)expected, single_ms);
+
+	int errors = 0;
+	for (int threads = 1; threads <= max_threads || threads == 1; threads *= 2)
+	{
+		JobSystem::deinit();
+		JobSystem::num_threads = threads;
+		JobSystem::init();
+
+		unsigned int visible = 0;
+		start = Clock::now();
+		for (int k = 0; k < REPEAT; k++)
+			visible = culler.cull(camera.frustum);
+		float ms = millisecondsSince(start) / REPEAT;
+
+		size_t different = 0;
+		for (size_t i = 0; i < N; i++)
+			different += culler.isVisible(i) != sphereVisible(camera.frustum, culler.x[i], culler.y[i], culler.z[i], culler.radius[i]);
+		printf("cull, %2d threads       %8.2f ms  x%.2f  %u visible%s\n", threads, ms, single_ms / ms, visible, different ? "  WRONG" : "");
+		errors += different != 0 || visible != expected;
+	}
+
+	FrustumCuller tree;
+	buildHierarchy(tree, N, 1000);
+	expected = 0;
+	for (size_t i = 0; i < N; i++)
+		expected += tree.radius[i] >= CULLING_ALWAYS_VISIBLE || sphereVisible(camera.frustum, tree.x[i], tree.y[i], tree.z[i], tree.radius[i]);
+	printf("\nhierarchy of %u clusters, %u visible\n", (unsigned int)(N / 1000), (unsigned int)expected);
+
+	for (int threads = 1; threads <= max_threads || threads == 1; threads *= 2)
+	{
+		JobSystem::deinit();
+		JobSystem::num_threads = threads;
+		JobSystem::init();
+
+		float flat_ms = 0, tree_ms = 0;
+		unsigned int flat_visible = 0, tree_visible = 0;
+		start = Clock::now();
+		for (int k = 0; k < REPEAT; k++)
+			flat_visible = tree.cull(camera.frustum);
+		flat_ms = millisecondsSince(start) / REPEAT;
+		start = Clock::now();
+		for (int k = 0; k < REPEAT; k++)
+			tree_visible = tree.cullHierarchy(camera.frustum);
+		tree_ms = millisecondsSince(start) / REPEAT;
+
+		size_t different = 0;
+		for (size_t i = 0; i < N; i++)
+			different += tree.isVisible(i) != (tree.radius[i] >= CULLING_ALWAYS_VISIBLE || sphereVisible(camera.frustum, tree.x[i], tree.y[i], tree.z[i], tree.radius[i]));
+		printf("%2d threads: cull %8.2f ms, cullHierarchy %8.2f ms  %u plane tests%s\n", threads, flat_ms, tree_ms, tree.plane_tests, different || flat_visible != tree_visible ? "  WRONG" : "");
+		errors += different != 0 || tree_visible != expected || flat_visible != expected;
+	}
+
+	JobSystem::deinit();
+	return errors ? 1 : 0;
+}
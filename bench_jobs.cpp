@@ -0,0 +1,97 @@
+//Scaling of the JobSystem: a compute bound loop split with parallelFor and many small jobs with run and a JobCounter,
+//with 1, 2, 4... threads. It checks that every element was processed once. It does not open a window, build it like
+//test.cpp with jobsystem.cpp. Usage: bench_jobs [num_elements] [max_threads]
+
+#include "src/utils/jobsystem.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float millisecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+//enough work per element so the cost of the jobs is small
+static float work(float v)
+{
+	for (int i = 0; i < 16; i++)
+		v = sqrtf(v * v + 1.0f) * 0.999f;
+	return v;
+}
+
+int main(int argc, char **argv)
+{
+	const size_t N = argc > 1 ? (size_t)atol(argv[1]) : 4000000;
+	int max_threads = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+	const int REPEAT = 5;
+	const size_t SMALL_JOBS = 10000;
+
+	std::vector<float> input(N), output(N);
+	for (size_t i = 0; i < N; i++)
+		input[i] = (float)(i % 1000);
+
+	int errors = 0;
+	float parallel_for_single = 0, run_single = 0;
+	for (int threads = 1; threads <= max_threads || threads == 1; threads *= 2)
+	{
+		JobSystem::deinit();
+		JobSystem::num_threads = threads;
+		JobSystem::init();
+		unsigned int stolen_before = JobSystem::getJobsStolen();
+
+		//parallelFor over the whole array
+		std::atomic<size_t> processed(0);
+		Clock::time_point start = Clock::now();
+		for (int k = 0; k < REPEAT; k++)
+			JobSystem::parallelFor(0, N, 4096, [&](size_t first, size_t last) {
+				for (size_t i = first; i < last; i++)
+					output[i] = work(input[i]);
+				processed += last - first;
+			});
+		float parallel_for_ms = millisecondsSince(start) / REPEAT;
+		errors += processed != N * REPEAT;
+
+		//the same work in small jobs of the same size, added from this thread
+		size_t per_job = (N + SMALL_JOBS - 1) / SMALL_JOBS;
+		processed = 0;
+		start = Clock::now();
+		for (int k = 0; k < REPEAT; k++)
+		{
+			JobCounter counter;
+			for (size_t first = 0; first < N; first += per_job)
+			{
+				size_t last = std::min(N, first + per_job);
+				JobSystem::run([&, first, last]() {
+					for (size_t i = first; i < last; i++)
+						output[i] = work(input[i]);
+					processed += last - first;
+				}, &counter);
+			}
+			JobSystem::wait(&counter);
+		}
+		float run_ms = millisecondsSince(start) / REPEAT;
+		errors += processed != N * REPEAT;
+
+		if (threads == 1)
+		{
+			parallel_for_single = parallel_for_ms;
+			run_single = run_ms;
+		}
+		printf("%2d threads: parallelFor %8.2f ms x%.2f, %u jobs with run %8.2f ms x%.2f, %u jobs stolen\n", threads,
+			parallel_for_ms, parallel_for_single / parallel_for_ms, (unsigned int)SMALL_JOBS, run_ms, run_single / run_ms, JobSystem::getJobsStolen() - stolen_before);
+	}
+
+	JobSystem::deinit();
+	if (errors)
+		std::cout << "Some elements were not processed once" << std::endl;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+//Micro benchmark of the matrix operations of math.cpp (and Quaternion::toMatrix) and check that their SSE versions give the same results
+//than the scalar code. The scalar code is copied here as the reference, so one build compares both (build it with
+//math.cpp like test.cpp, without NO_SIMD). It does not open a window. Usage: bench_math [num_matrices]
+
+#include "src/utils/math.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float millisecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+//the scalar versions, the same operations in the same order than math.cpp without USE_SSE
+static void referenceMultiply(const float* a, const float* b, float* result)
+{
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			result[i*4+j] = a[i*4] * b[j] + a[i*4+1] * b[4+j] + a[i*4+2] * b[8+j] + a[i*4+3] * b[12+j];
+}
+
+static void referenceTransform(const float* m, const Vector3& v, Vector3& result)
+{
+	result.x = m[0] * v.x + m[4] * v.y + m[8] * v.z + m[12];
+	result.y = m[1] * v.x + m[5] * v.y + m[9] * v.z + m[13];
+	result.z = m[2] * v.x + m[6] * v.y + m[10] * v.z + m[14];
+}
+
+static bool referenceInverse(const float* m, float* result)
+{
+	float temp[4][4], final[4][4];
+	for (int i = 0; i < 4; i++)
+		for (int k = 0; k < 4; k++)
+		{
+			temp[i][k] = m[i*4+k];
+			final[i][k] = i == k ? 1.0f : 0.0f;
+		}
+
+	for (int i = 0; i < 4; i++)
+	{
+		int swap = i;
+		for (int j = i + 1; j < 4; j++)
+			if ( fabs(temp[j][i]) > fabs(temp[swap][i]) )
+				swap = j;
+		if (swap != i)
+			for (int k = 0; k < 4; k++)
+			{
+				std::swap(temp[i][k], temp[swap][k]);
+				std::swap(final[i][k], final[swap][k]);
+			}
+
+		if ( fabsf(temp[i][i]) <= 0.00001 )
+			return false;
+
+		float t = 1.0f / temp[i][i];
+		for (int k = 0; k < 4; k++)
+		{
+			temp[i][k] *= t;
+			final[i][k] *= t;
+		}
+
+		for (int j = 0; j < 4; j++)
+		{
+			if (j == i)
+				continue;
+			t = temp[j][i];
+			for (int k = 0; k < 4; k++)
+			{
+				temp[j][k] -= temp[i][k] * t;
+				final[j][k] -= final[i][k] * t;
+			}
+		}
+	}
+	memcpy(result, final, sizeof(final));
+	return true;
+}
+
+static void referenceToMatrix(const Quaternion& q, float* m)
+{
+	const float s = 2;
+	const float xx = q.x * q.x * s, yy = q.y * q.y * s, zz = q.z * q.z * s;
+	const float xy = q.x * q.y * s, xz = q.x * q.z * s, yz = q.y * q.z * s;
+	const float wx = q.w * q.x * s, wy = q.w * q.y * s, wz = q.w * q.z * s;
+	const float result[16] = {
+		1.0f - (yy + zz), xy - wz, xz + wy, 0,
+		xy + wz, 1.0f - (xx + zz), yz - wx, 0,
+		xz - wy, yz + wx, 1.0f - (xx + yy), 0,
+		0, 0, 0, 1 };
+	memcpy(m, result, sizeof(result));
+}
+
+static int countDifferent(const float* a, const float* b, size_t num)
+{
+	int different = 0;
+	for (size_t i = 0; i < num; ++i)
+		if (memcmp(a + i, b + i, sizeof(float)) != 0)
+			different++;
+	return different;
+}
+
+static void printResult(const char* name, float library_ms, float reference_ms, int different)
+{
+	printf("%-20s %8.2f ms  scalar %8.2f ms  x%.2f  %s\n", name, library_ms, reference_ms, reference_ms / library_ms, different ? "DIFFERENT" : "identical");
+}
+
+int main(int argc, char **argv)
+{
+	const int N = argc > 1 ? atoi(argv[1]) : 100000;
+	const int REPEAT = 10;
+
+	#ifdef USE_SSE
+		std::cout << "math.cpp built with SSE" << std::endl;
+	#else
+		std::cout << "math.cpp built without SSE, both columns run the scalar code" << std::endl;
+	#endif
+
+	srand(1);
+	std::vector<Matrix44> a(N), b(N), r(N);
+	std::vector<Vector3> points(N), transformed(N);
+	std::vector<float> ref_matrices(N * 16);
+	std::vector<Vector3> ref_points(N);
+	std::vector<Quaternion> rotations(N);
+	for (int i = 0; i < N; i++)
+	{
+		a[i].setRotation((float)i, Vector3(1,2,3));
+		a[i].translate(i % 7, i % 5, i % 3);
+		a[i].scale(Vector3(1.0f + i % 4, 1.0f, 2.0f));
+		b[i].setRotation(i * 0.3f, Vector3(0,1,0));
+		b[i].translateGlobal(1,2,3);
+		points[i].random(100);
+		Vector3 axis;
+		axis.random(1);
+		rotations[i] = Quaternion(axis.length() > 0.01f ? axis.normalize() : Vector3(0,1,0), i * 0.01f);
+	}
+
+	int total_different = 0;
+	Clock::time_point start;
+
+	//multiplyMatrix, through multiplyMatrices
+	start = Clock::now();
+	for (int k = 0; k < REPEAT; k++)
+		multiplyMatrices(&a[0], &b[0], &r[0], N);
+	float library_ms = millisecondsSince(start);
+	start = Clock::now();
+	for (int k = 0; k < REPEAT; k++)
+		for (int i = 0; i < N; i++)
+			referenceMultiply(a[i].m, b[i].m, &ref_matrices[i*16]);
+	float reference_ms = millisecondsSince(start);
+	int different = 0;
+	for (int i = 0; i < N; i++)
+		different += countDifferent(r[i].m, &ref_matrices[i*16], 16);
+	printResult("multiplyMatrices", library_ms, reference_ms, different);
+	total_different += different;
+
+	//transformPoints
+	start = Clock::now();
+	for (int k = 0; k < REPEAT; k++)
+		transformPoints(a[3], &points[0], &transformed[0], N);
+	library_ms = millisecondsSince(start);
+	start = Clock::now();
+	for (int k = 0; k < REPEAT; k++)
+		for (int i = 0; i < N; i++)
+			referenceTransform(a[3].m, points[i], ref_points[i]);
+	reference_ms = millisecondsSince(start);
+	different = countDifferent(transformed[0].v, ref_points[0].v, N * 3);
+	printResult("transformPoints", library_ms, reference_ms, different);
+	total_different += different;
+
+	//inverse
+	start = Clock::now();
+	for (int k = 0; k < REPEAT; k++)
+		for (int i = 0; i < N; i++)
+		{
+			r[i] = a[i];
+			r[i].inverse();
+		}
+	library_ms = millisecondsSince(start);
+	start = Clock::now();
+	for (int k = 0; k < REPEAT; k++)
+		for (int i = 0; i < N; i++)
+			referenceInverse(a[i].m, &ref_matrices[i*16]);
+	reference_ms = millisecondsSince(start);
+	different = 0;
+	for (int i = 0; i < N; i++)
+		different += countDifferent(r[i].m, &ref_matrices[i*16], 16);
+	printResult("inverse", library_ms, reference_ms, different);
+	total_different += different;
+
+	//Quaternion::toMatrix
+	start = Clock::now();
+	for (int k = 0; k < REPEAT; k++)
+		for (int i = 0; i < N; i++)
+			rotations[i].toMatrix(r[i]);
+	library_ms = millisecondsSince(start);
+	start = Clock::now();
+	for (int k = 0; k < REPEAT; k++)
+		for (int i = 0; i < N; i++)
+			referenceToMatrix(rotations[i], &ref_matrices[i*16]);
+	reference_ms = millisecondsSince(start);
+	different = 0;
+	for (int i = 0; i < N; i++)
+		different += countDifferent(r[i].m, &ref_matrices[i*16], 16);
+	printResult("Quaternion::toMatrix", library_ms, reference_ms, different);
+	total_different += different;
+
+	if (total_different)
+	{
+		std::cout << total_different << " floats differ from the scalar code" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,193 @@
+//Benchmark of the OBJ loader: writes grids with 10K, 1M and 10M triangular faces, loads them with the previous loader
+//(tokenize and atof per line, kept below) and then with Mesh::Load using 1, 2, 4... up to one parsing thread per core
+//(Mesh::num_loading_threads). It does not open a window. Build it like test.cpp with the engine sources, with SKIP_COLDET
+//defined in all of them to leave the collision model out of the times. Usage: bench_objload [max_faces] [max_threads]
+
+#include "src/gfx/mesh.h"
+#include "src/utils/fastparse.h"
+#include "src/utils/utils.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float secondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<float>(Clock::now() - start).count();
+}
+
+//side x side vertices with position, uv and normal, and two triangles in every square between them
+static void writeGrid(const char* filename, int side)
+{
+	FILE* f = fopen(filename, "wb");
+	for (int z = 0; z < side; ++z)
+		for (int x = 0; x < side; ++x)
+			fprintf(f, "v %.6f %.6f %.6f\n", x * 0.1f, sinf(x * 0.05f) * cosf(z * 0.05f), z * 0.1f);
+	for (int z = 0; z < side; ++z)
+		for (int x = 0; x < side; ++x)
+			fprintf(f, "vt %.6f %.6f\n", x / (float)side, z / (float)side);
+	for (int z = 0; z < side; ++z)
+		for (int x = 0; x < side; ++x)
+			fprintf(f, "vn 0.000000 1.000000 0.000000\n");
+	for (int z = 0; z < side - 1; ++z)
+		for (int x = 0; x < side - 1; ++x)
+		{
+			int a = z * side + x + 1, b = a + 1, c = a + side + 1, d = a + side;
+			fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c);
+			fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, c, c, c, d, d, d);
+		}
+	fclose(f);
+}
+
+//the loader before the in place parser: a copy of every line, tokenize and atof, one vertex per corner without indices
+static size_t loadOBJLegacy(const char* filename, std::vector<Vector3>& vertices, std::vector<Vector2>& uvs, std::vector<Vector3>& normals)
+{
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL)
+		return 0;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char* data = new char[size + 1];
+	fread(data, size, 1, f);
+	fclose(f);
+	data[size] = 0;
+
+	char* pos = data;
+	char line[255];
+	std::vector<Vector3> indexed_positions;
+	std::vector<Vector3> indexed_normals;
+	std::vector<Vector2> indexed_uvs;
+	while (*pos != 0)
+	{
+		if (*pos == '\n') pos++;
+		if (*pos == '\r') pos++;
+
+		int i = 0;
+		while (i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
+		memcpy(line, pos, i);
+		line[i] = 0;
+		pos = pos + i;
+		if (*line == '#' || *line == 0) continue;
+
+		std::vector<std::string> tokens = tokenize(line, " ");
+		if (tokens.empty()) continue;
+
+		if (tokens[0] == "v" && tokens.size() == 4)
+			indexed_positions.push_back( Vector3( (float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) ) );
+		else if (tokens[0] == "vt" && tokens.size() >= 3)
+			indexed_uvs.push_back( Vector2( (float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()) ) );
+		else if (tokens[0] == "vn" && tokens.size() == 4)
+			indexed_normals.push_back( Vector3( (float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) ) );
+		else if (tokens[0] == "f" && tokens.size() >= 4)
+		{
+			Vector3 v1, v2, v3;
+			v1.parseFromText( tokens[1].c_str(), '/' );
+			for (size_t iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
+			{
+				v2.parseFromText( tokens[iPoly].c_str(), '/' );
+				v3.parseFromText( tokens[iPoly+1].c_str(), '/' );
+				vertices.push_back( indexed_positions[ (unsigned int)v1.x - 1 ] );
+				vertices.push_back( indexed_positions[ (unsigned int)v2.x - 1 ] );
+				vertices.push_back( indexed_positions[ (unsigned int)v3.x - 1 ] );
+				uvs.push_back( indexed_uvs[ (unsigned int)v1.y - 1 ] );
+				uvs.push_back( indexed_uvs[ (unsigned int)v2.y - 1 ] );
+				uvs.push_back( indexed_uvs[ (unsigned int)v3.y - 1 ] );
+				normals.push_back( indexed_normals[ (unsigned int)v1.z - 1 ] );
+				normals.push_back( indexed_normals[ (unsigned int)v2.z - 1 ] );
+				normals.push_back( indexed_normals[ (unsigned int)v3.z - 1 ] );
+			}
+		}
+	}
+	delete[] data;
+	return vertices.size() / 3;
+}
+
+//the parsers alone, over a buffer with the numbers of a typical OBJ line
+static void benchParsers()
+{
+	const char* line = "-12.345678 0.000123 1.5e-3 42 -7 123456";
+	const char* end = line + strlen(line);
+	const int iterations = 10000000;
+	float sum = 0;
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < iterations; ++i)
+	{
+		const char* pos = line;
+		for (int k = 0; k < 6; ++k)
+		{
+			float value = 0;
+			pos = skipBlanks(parseFloat(pos, end, value), end);
+			sum += value;
+		}
+	}
+	float fast = secondsSince(start);
+
+	start = Clock::now();
+	for (int i = 0; i < iterations; ++i)
+	{
+		const char* pos = line;
+		for (int k = 0; k < 6; ++k)
+		{
+			char* next = NULL;
+			sum += (float)strtod(pos, &next);
+			pos = next;
+		}
+	}
+	float slow = secondsSince(start);
+	std::cout << "parseFloat " << fast * 1e9f / (iterations * 6) << " ns/number, strtod " << slow * 1e9f / (iterations * 6) << " ns/number (" << (sum != 0) << ")" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	long max_faces = argc > 1 ? atol(argv[1]) : 10000000;
+	int max_threads = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+	Mesh::use_binary = false; //parse the OBJ every time
+	Mesh::use_vram = false;
+
+	benchParsers();
+
+	const long sizes[] = { 10000, 1000000, 10000000 };
+	for (int i = 0; i < 3 && sizes[i] <= max_faces; ++i)
+	{
+		int side = (int)ceil(sqrt(sizes[i] / 2.0)) + 1; //2 * (side - 1)^2 faces, the size or a bit more
+		char filename[64];
+		sprintf(filename, "bench_grid_%ld.obj", sizes[i]);
+		writeGrid(filename, side);
+
+		{
+			std::vector<Vector3> vertices, normals;
+			std::vector<Vector2> uvs;
+			Clock::time_point start = Clock::now();
+			size_t faces = loadOBJLegacy(filename, vertices, uvs, normals);
+			std::cout << sizes[i] << " faces, previous loader: " << faces << " triangles " << vertices.size() << " vertices in " << secondsSince(start) << " s" << std::endl;
+		}
+
+		float single_thread_time = 0;
+		for (int threads = 1; threads <= max_threads || threads == 1; threads *= 2)
+		{
+			Mesh::num_loading_threads = threads;
+			Clock::time_point start = Clock::now();
+			Mesh* mesh = Mesh::Load(filename, false, true);
+			float time = secondsSince(start);
+			if (!mesh)
+			{
+				std::cout << "Could not load " << filename << std::endl;
+				return 1;
+			}
+			if (threads == 1)
+				single_thread_time = time;
+			std::cout << sizes[i] << " faces, " << threads << " threads: " << mesh->getNumTriangles() << " triangles " << mesh->getNumVertices() << " vertices in " << time << " s (x" << single_thread_time / time << ")" << std::endl;
+			delete mesh;
+		}
+		remove(filename);
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+//Benchmark of the particles of particles.cpp: a burst of a million particles in one emissor (update, billboards and the
+//removal of the dead ones) and then ParticleEmissor::UpdateAll with a thousand emissors with 1, 2, 4... threads of the
+//JobSystem. It does not open a window, build it like test.cpp with the engine sources. Usage: bench_particles [num_particles] [max_threads]
+
+#include "src/gfx/particles.h"
+#include "src/gfx/streambuffer.h"
+#include "src/utils/jobsystem.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float millisecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+static void setup(ParticleEmissor& emissor, int num_particles)
+{
+	emissor.max_particles = num_particles;
+	emissor.num_particles_to_emit = -1; //forever, as many are born as die
+	emissor.particle_life = 2;
+	emissor.time_between_particles = emissor.particle_life / num_particles;
+	emissor.gravity.set(0, -9.8f, 0);
+	emissor.start_alpha = 1;
+	emissor.end_alpha = 0;
+	emissor.start_size = 1;
+	emissor.end_size = 3;
+	emissor.start_color.set(1, 0.5f, 0);
+	emissor.end_color.set(0, 0, 1);
+}
+
+int main(int argc, char **argv)
+{
+	const int N = argc > 1 ? atoi(argv[1]) : 1000000;
+	int max_threads = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+	const int FRAMES = 20;
+	srand(1);
+
+	//one big emissor
+	ParticleEmissor* burst = new ParticleEmissor();
+	setup(*burst, N);
+	burst->num_particles_to_emit = N;
+	burst->time_between_particles = 0; //all of them at once
+	Clock::time_point start = Clock::now();
+	burst->start();
+	printf("burst of %u particles   %8.2f ms, %u alive\n", (unsigned int)N, millisecondsSince(start), (unsigned int)burst->num_alive);
+
+	start = Clock::now();
+	for (int k = 0; k < FRAMES; k++)
+		burst->moveParticles(0.016f);
+	printf("moveParticles          %8.3f ms/frame\n", millisecondsSince(start) / FRAMES);
+
+	std::vector<StreamVertex> vertices(burst->num_alive * 4);
+	unsigned int num_quads = 0;
+	start = Clock::now();
+	for (int k = 0; k < FRAMES; k++)
+		num_quads = burst->buildQuads(Vector3(0,1,0), Vector3(1,0,0), vertices.data());
+	printf("buildQuads             %8.3f ms/frame, %u quads\n", millisecondsSince(start) / FRAMES, num_quads);
+
+	//half of them die in the next update, the last ones take their place
+	for (size_t i = 0; i < burst->num_alive; i += 2)
+		burst->remaining_time[i] = 0.01f;
+	start = Clock::now();
+	burst->moveParticles(0.016f);
+	printf("removing half          %8.3f ms, %u alive\n", millisecondsSince(start), (unsigned int)burst->num_alive);
+	delete burst;
+
+	//many emissors, they move their particles in jobs
+	const int NUM_EMISSORS = 1000;
+	std::vector<ParticleEmissor*> emissors(NUM_EMISSORS);
+	for (int i = 0; i < NUM_EMISSORS; i++)
+	{
+		emissors[i] = new ParticleEmissor();
+		setup(*emissors[i], N / NUM_EMISSORS);
+		emissors[i]->start();
+	}
+	for (int k = 0; k < 200; k++) //until they are full
+		ParticleEmissor::UpdateAll(0.016f);
+
+	float single_thread_ms = 0;
+	for (int threads = 1; threads <= max_threads || threads == 1; threads *= 2)
+	{
+		JobSystem::deinit();
+		JobSystem::num_threads = threads;
+		JobSystem::init();
+
+		start = Clock::now();
+		for (int k = 0; k < FRAMES; k++)
+			ParticleEmissor::UpdateAll(0.016f);
+		float ms = millisecondsSince(start) / FRAMES;
+		if (threads == 1)
+			single_thread_ms = ms;
+
+		size_t alive = 0;
+		for (int i = 0; i < NUM_EMISSORS; i++)
+			alive += emissors[i]->num_alive;
+		printf("UpdateAll, %2d threads  %8.3f ms/frame x%.2f, %u emissors %u alive\n", threads, ms, single_thread_ms / ms, (unsigned int)NUM_EMISSORS, (unsigned int)alive);
+	}
+
+	for (int i = 0; i < NUM_EMISSORS; i++)
+		delete emissors[i];
+	JobSystem::deinit();
+	return 0;
+}
@@ -0,0 +1,197 @@
+//Benchmark of the TGA loader of texture.cpp with 4K textures: the decode (24 and 32 bits, and RLE) and the gamma correct
+//chain of mipmaps with 1, 2, 4... threads of the JobSystem, compared with the previous path (fread, a byte swap per pixel
+//and a box filter of the bytes in one thread, what gluBuild2DMipmaps does with power of two sizes). It checks that both
+//decode the same pixels. It does not open a window, build it like test.cpp with the engine sources.
+//Usage: bench_textures [size] [max_threads]
+
+#include "src/gfx/texture.h"
+#include "src/utils/jobsystem.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static float millisecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+//loadTGA is only for the loader
+class BenchTexture : public Texture
+{
+public:
+	using Texture::loadTGA;
+};
+
+//gradients with some noise, so the RLE packets are short like in a photo. The same pixels for the same size
+static void writeTGA(const char* filename, int size, int bpp, bool rle)
+{
+	srand(5);
+	int bytes_per_pixel = bpp / 8;
+	std::vector<unsigned char> pixels((size_t)size * size * bytes_per_pixel);
+	for (int y = 0; y < size; ++y)
+		for (int x = 0; x < size; ++x)
+		{
+			unsigned char* p = &pixels[((size_t)y * size + x) * bytes_per_pixel];
+			p[0] = (unsigned char)(x * 255 / size);
+			p[1] = (unsigned char)(y * 255 / size);
+			p[2] = (unsigned char)((x ^ y) & 0xF0);
+			if (bytes_per_pixel == 4)
+				p[3] = (unsigned char)(rand() % 4 ? 255 : 128);
+		}
+
+	FILE* f = fopen(filename, "wb");
+	unsigned char header[18] = { 0 };
+	header[2] = rle ? 10 : 2;
+	header[12] = size & 0xFF; header[13] = size >> 8;
+	header[14] = size & 0xFF; header[15] = size >> 8;
+	header[16] = (unsigned char)bpp;
+	fwrite(header, 1, sizeof(header), f);
+	if (!rle)
+		fwrite(&pixels[0], 1, pixels.size(), f);
+	else
+	{
+		size_t num_pixels = (size_t)size * size;
+		for (size_t i = 0; i < num_pixels; )
+		{
+			//a run of the same pixel, or one raw pixel
+			size_t count = 1;
+			while (i + count < num_pixels && count < 128 && memcmp(&pixels[i * bytes_per_pixel], &pixels[(i + count) * bytes_per_pixel], bytes_per_pixel) == 0)
+				count++;
+			unsigned char packet = (unsigned char)(count > 1 ? 0x80 | (count - 1) : 0);
+			fwrite(&packet, 1, 1, f);
+			fwrite(&pixels[i * bytes_per_pixel], 1, bytes_per_pixel, f);
+			i += count;
+		}
+	}
+	fclose(f);
+}
+
+//the previous loadTGA: uncompressed only, BGR(A) to RGB(A) one pixel at a time
+static unsigned char* loadTGALegacy(const char* filename, int& width, int& height, int& bytes_per_pixel)
+{
+	FILE* file = fopen(filename, "rb");
+	unsigned char header[18];
+	if (file == NULL || fread(header, 1, sizeof(header), file) != sizeof(header) || header[2] != 2)
+	{
+		if (file)
+			fclose(file);
+		return NULL;
+	}
+	width = header[13] * 256 + header[12];
+	height = header[15] * 256 + header[14];
+	bytes_per_pixel = header[16] / 8;
+	size_t image_size = (size_t)width * height * bytes_per_pixel;
+	unsigned char* data = (unsigned char*)malloc(image_size);
+	if (fread(data, 1, image_size, file) != image_size)
+	{
+		free(data);
+		fclose(file);
+		return NULL;
+	}
+	for (size_t i = 0; i < image_size; i += bytes_per_pixel)
+	{
+		unsigned char temp = data[i];
+		data[i] = data[i + 2];
+		data[i + 2] = temp;
+	}
+	fclose(file);
+	return data;
+}
+
+//a 2x2 box filter of the bytes for every level, in one thread
+static void buildMipmapsLegacy(const unsigned char* data, int width, int height, int bytes_per_pixel)
+{
+	std::vector<unsigned char> level(data, data + (size_t)width * height * bytes_per_pixel);
+	std::vector<unsigned char> next;
+	while (width > 1 || height > 1)
+	{
+		int next_width = std::max(width / 2, 1), next_height = std::max(height / 2, 1);
+		next.resize((size_t)next_width * next_height * bytes_per_pixel);
+		for (int y = 0; y < next_height; ++y)
+			for (int x = 0; x < next_width; ++x)
+			{
+				int x0 = x * 2, x1 = std::min(x0 + 1, width - 1), y0 = y * 2, y1 = std::min(y0 + 1, height - 1);
+				for (int c = 0; c < bytes_per_pixel; ++c)
+					next[((size_t)y * next_width + x) * bytes_per_pixel + c] = (unsigned char)((
+						level[((size_t)y0 * width + x0) * bytes_per_pixel + c] + level[((size_t)y0 * width + x1) * bytes_per_pixel + c] +
+						level[((size_t)y1 * width + x0) * bytes_per_pixel + c] + level[((size_t)y1 * width + x1) * bytes_per_pixel + c] + 2) / 4);
+			}
+		level.swap(next);
+		width = next_width;
+		height = next_height;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const int SIZE = argc > 1 ? atoi(argv[1]) : 4096;
+	int max_threads = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+
+	const char* files[] = { "bench_texture_24.tga", "bench_texture_32.tga", "bench_texture_32_rle.tga" };
+	writeTGA(files[0], SIZE, 24, false);
+	writeTGA(files[1], SIZE, 32, false);
+	writeTGA(files[2], SIZE, 32, true);
+
+	int errors = 0;
+	BenchTexture texture;
+	unsigned char* reference = NULL;
+	for (int f = 0; f < 3; ++f)
+	{
+		//the previous path, the RLE files were not supported (the RLE one is compared with the uncompressed one)
+		if (f < 2)
+		{
+			free(reference);
+			int width, height, bytes_per_pixel;
+			Clock::time_point start = Clock::now();
+			reference = loadTGALegacy(files[f], width, height, bytes_per_pixel);
+			float decode_ms = millisecondsSince(start);
+			start = Clock::now();
+			buildMipmapsLegacy(reference, width, height, bytes_per_pixel);
+			float mipmaps_ms = millisecondsSince(start);
+			printf("%-26s previous: decode %7.1f ms + mipmaps %7.1f ms = %7.1f ms\n", files[f], decode_ms, mipmaps_ms, decode_ms + mipmaps_ms);
+		}
+
+		for (int threads = 0; threads <= max_threads || threads == 1; threads = threads ? threads * 2 : 1)
+		{
+			//0 is the loader threads path, the mipmaps in the calling thread without jobs
+			if (threads)
+			{
+				JobSystem::deinit();
+				JobSystem::num_threads = threads;
+				JobSystem::init();
+			}
+			Clock::time_point start = Clock::now();
+			auto tgainfo = texture.loadTGA(files[f], threads != 0);
+			float ms = millisecondsSince(start);
+			if (tgainfo == NULL)
+			{
+				std::cout << "Could not load " << files[f] << std::endl;
+				return 1;
+			}
+			printf("%-26s new, %s: decode + %u levels %7.1f ms\n", files[f], threads ? (std::to_string(threads) + " threads").c_str() : "no jobs  ", tgainfo->num_levels, ms);
+
+			//the same pixels in the first level
+			int bytes_per_pixel = f == 0 ? 3 : 4;
+			for (size_t i = 0; i < (size_t)SIZE * SIZE; ++i)
+				errors += memcmp(&tgainfo->data[i * 4], &reference[i * bytes_per_pixel], bytes_per_pixel) != 0 || (bytes_per_pixel == 3 && tgainfo->data[i * 4 + 3] != 255);
+			free(tgainfo->data);
+			delete tgainfo;
+		}
+	}
+	free(reference);
+
+	JobSystem::deinit();
+	for (int f = 0; f < 3; ++f)
+		remove(files[f]);
+	if (errors)
+		std::cout << errors << " pixels are not the same" << std::endl;
+	return errors ? 1 : 0;
+}
@@ -51,6 +51,7 @@ class DemoApp : public Application
 			Entity* teapot = *it;
 			Vector3 pos = teapot->getWorldPosition();
 			teapot->model.setTranslation( pos.x, (sin(time*0.003f + pos.x) + cos(time*0.003f + pos.z)) * 15.0f , pos.z );
+			teapot->markTransformDirty(); //changed outside Entity::update
 		}
 
 		//world->model.rotateLocal( mouse_delta.x * 0.01, Vector3(0,1,0) );
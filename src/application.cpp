@@ -1,5 +1,10 @@
 #include "application.h"
 #include "utils/utils.h"
+#include "utils/resourceloader.h"
+#include "utils/jobsystem.h"
+#include "utils/resource.h"
+#include "world/renderqueue.h"
+#include "gfx/streambuffer.h"
 
 Application::Application()
 {
@@ -110,6 +115,7 @@ SDL_Window* Application::createWindow(const char* caption, int width, int height
 
 void Application::start()
 {
+	JobSystem::init(); //this is the main thread
 	init();
 	mainLoop();
 }
@@ -130,8 +136,15 @@ void Application::mainLoop()
 		//read keyboard state and stored in keystate
 		keystate = SDL_GetKeyboardState(NULL);
 
+		//finish the resources loaded in the background (VBOs and textures need the main thread)
+		ResourceLoader::update();
+		ResourceManager::update(); //frees unused resources if the memory is over budget
+		JobSystem::update(); //the jobs that need OpenGL
+
 		//render frame
 		render();
+		RenderQueue::endFrame(); //the draw and state change counts of this frame go to RenderQueue::last_frame_stats
+		StreamBuffer::endFrame(); //fences the dynamic geometry of this frame, the bytes streamed go to StreamBuffer::last_frame_stats
 
 		//update events
 		while(SDL_PollEvent(&sdlEvent))
@@ -51,9 +51,46 @@ bool CollisionModel3DImpl::collision(CollisionModel3D* other,
   Matrix3D t=( other_transform==NULL ? o->m_Transform : *((Matrix3D*)other_transform) );
   if (m_Static) t *= m_InvTransform;
   else          t *= m_Transform.Inverse();
+  return modelCollision(o,t,MaxProcessingTime,m_ColTri1,m_iColTri1,m_ColTri2,m_iColTri2);
+}
+
+bool CollisionModel3DImpl::collision(const CollisionModel3D* other,
+                                     const float transform[16],
+                                     const float other_transform[16],
+                                     CollisionResult* result,
+                                     int MaxProcessingTime) const
+{
+  const CollisionModel3DImpl* o=static_cast<const CollisionModel3DImpl*>(other);
+  if (!m_Final) throw Inconsistency();
+  if (!o->m_Final) throw Inconsistency();
+  Matrix3D t=*((const Matrix3D*)other_transform);
+  t *= ((const Matrix3D*)transform)->Inverse();
+  Triangle tri1,tri2;
+  int itri1,itri2;
+  if (!modelCollision(o,t,MaxProcessingTime,tri1,itri1,tri2,itri2)) return false;
+  if (result!=NULL)
+  {
+    result->triangle1=itri1;
+    result->triangle2=itri2;
+    *((Vector3D*)&result->tri1[0]) = tri1.v1;
+    *((Vector3D*)&result->tri1[3]) = tri1.v2;
+    *((Vector3D*)&result->tri1[6]) = tri1.v3;
+    *((Vector3D*)&result->tri2[0]) = tri2.v1;
+    *((Vector3D*)&result->tri2[3]) = tri2.v2;
+    *((Vector3D*)&result->tri2[6]) = tri2.v3;
+    *((Vector3D*)result->point) = my_tri_tri_intersect(tri1,tri2);
+  }
+  return true;
+}
+
+bool CollisionModel3DImpl::modelCollision(const CollisionModel3DImpl* o,
+                                          const Matrix3D& t,
+                                          int MaxProcessingTime,
+                                          Triangle& tri1, int& itri1,
+                                          Triangle& tri2, int& itri2) const
+{
   RotationState rs(t);
 
-  if (AccuracyDepth<0) AccuracyDepth=0xFFFFFF;
   if (MaxProcessingTime==0) MaxProcessingTime=0xFFFFFF;
   
   DWORD EndTime,BeginTime = GetTickCount();
@@ -61,11 +98,12 @@ bool CollisionModel3DImpl::collision(CollisionModel3D* other,
   int Allocated=Max(64,(num>>4));
   std::vector<Check> checks(Allocated);
   
+  // the trees are not changed by the test
   int queue_idx=1;
   Check& c=checks[0];
-  c.m_first=&m_Root;
+  c.m_first=const_cast<BoxTreeInnerNode*>(&m_Root);
   c.depth=0;
-  c.m_second=&o->m_Root;
+  c.m_second=const_cast<BoxTreeInnerNode*>(&o->m_Root);
   while (queue_idx>0)
   {
     if (queue_idx>(Allocated/2)) // enlarge the queue.
@@ -100,10 +138,10 @@ bool CollisionModel3DImpl::collision(CollisionModel3D* other,
               BoxedTriangle* bt1=first->getTriangle(j);
               if (tt.intersect(*bt1)) 
               {
-                m_ColTri1=*bt1;
-                m_iColTri1=getTriangleIndex(bt1);
-                m_ColTri2=tt;
-                m_iColTri2=o->getTriangleIndex(bt2);
+                tri1=*bt1;
+                itri1=getTriangleIndex(bt1);
+                tri2=tt;
+                itri2=o->getTriangleIndex(bt2);
                 return true;
               }
             }
@@ -272,8 +310,38 @@ bool CollisionModel3DImpl::sphereCollision(float origin[3], float radius)
     Matrix3D inv=m_Transform.Inverse();
     O=Transform(*(Vector3D*)origin,inv);
   }
+  return localSphereCollision(O,radius,m_ColTri1,m_iColTri1,m_ColPoint);
+}
+
+bool CollisionModel3DImpl::sphereCollision(const float transform[16],
+                                           const float origin[3],
+                                           float radius,
+                                           CollisionResult* result) const
+{
+  Matrix3D inv=((const Matrix3D*)transform)->Inverse();
+  Vector3D O=Transform(*(const Vector3D*)origin,inv);
+  Triangle tri;
+  int itri;
+  Vector3D point;
+  if (!localSphereCollision(O,radius,tri,itri,point)) return false;
+  if (result!=NULL)
+  {
+    result->triangle1=itri;
+    result->triangle2=-1;
+    *((Vector3D*)&result->tri1[0]) = tri.v1;
+    *((Vector3D*)&result->tri1[3]) = tri.v2;
+    *((Vector3D*)&result->tri1[6]) = tri.v3;
+    *((Vector3D*)result->point) = point;
+  }
+  return true;
+}
+
+bool CollisionModel3DImpl::localSphereCollision(const Vector3D& O, float radius,
+                                                Triangle& col_tri, int& col_itri,
+                                                Vector3D& point) const
+{
   std::vector<BoxTreeNode*> checks;
-  checks.push_back(&m_Root);
+  checks.push_back(const_cast<BoxTreeInnerNode*>(&m_Root));
   while (!checks.empty())
   {
     BoxTreeNode* b=checks.back();
@@ -290,10 +358,10 @@ bool CollisionModel3DImpl::sphereCollision(float origin[3], float radius)
         {
           BoxedTriangle* bt=b->getTriangle(tri);
           Triangle* t=static_cast<Triangle*>(bt);
-          if (t->intersect(O,radius,m_ColPoint))
+          if (t->intersect(O,radius,point))
           {
-            m_ColTri1=*bt;
-            m_iColTri1=getTriangleIndex(bt);
+            col_tri=*bt;
+            col_itri=getTriangleIndex(bt);
             return true;
           }
         }
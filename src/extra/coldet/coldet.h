@@ -34,6 +34,21 @@
 #define EXPORT
 #endif
 
+/** Result of the thread safe collision tests.
+    The coordinates are in the space of the model that was tested,
+    apply its transform to move them to world space.
+*/
+struct CollisionResult
+{
+  /** Indices of the triangles that collided, triangle2 is
+      in the other model and only valid in model-model tests. */
+  int   triangle1,triangle2;
+  /** The triangles that collided */
+  float tri1[9],tri2[9];
+  /** The collision point */
+  float point[3];
+};
+
 /** Collision Model.  Will represent the mesh to be tested for
     collisions.  It has to be notified of all triangles, via
     addTriangle()
@@ -85,6 +100,18 @@ public:
                          int MaxProcessingTime=0,
                          float* other_transform=0) = 0;
 
+  /** Same test, but the transforms of both models are given instead
+      of using the ones set with setTransform(), and the information
+      about the collision goes to result (if not NULL) instead of the model.
+      It does not change the models, so the same model can be tested
+      from several threads at once.
+  */
+  virtual bool collision(const CollisionModel3D* other,
+                         const float transform[16],
+                         const float other_transform[16],
+                         CollisionResult* result=0,
+                         int MaxProcessingTime=0) const = 0;
+
   /** Returns true if the ray given in world space coordinates
       intersects with the object.  
       getCollidingTriangles() and getCollisionPoint() can be
@@ -109,6 +136,14 @@ public:
   virtual bool sphereCollision(float origin[3],
                                float radius) = 0;
 
+  /** Thread safe version of sphereCollision(), with the transform
+      of the model given and the information stored in result.
+  */
+  virtual bool sphereCollision(const float transform[16],
+                               const float origin[3],
+                               float radius,
+                               CollisionResult* result=0) const = 0;
+
   /** Retrieve the pair of triangles that collided.
       Only valid after a call to collision() that returned true.
       t1 is this model's triangle and t2 is the other one.
@@ -62,20 +62,39 @@ public:
                  int MaxProcessingTime,
                  float* other_transform);
 
+  bool collision(const CollisionModel3D* other,
+                 const float transform[16],
+                 const float other_transform[16],
+                 CollisionResult* result,
+                 int MaxProcessingTime) const;
+
   bool rayCollision(float origin[3], float direction[3], bool closest,
                     float segmin, float segmax);
   bool sphereCollision(float origin[3], float radius);
+  bool sphereCollision(const float transform[16], const float origin[3],
+                       float radius, CollisionResult* result) const;
 
   bool getCollidingTriangles(float t1[9], float t2[9], bool ModelSpace);
   bool getCollidingTriangles(int& t1, int& t2);
   bool getCollisionPoint(float p[3], bool ModelSpace);
 
 
-  int getTriangleIndex(BoxedTriangle* bt)
+  int getTriangleIndex(const BoxedTriangle* bt) const
   {
     return int(bt-&(*m_Triangles.begin()));
   }
 
+  /** The tests themselves.  They only read the model, the
+      output goes to the arguments and only when they return true.
+      t is the transform from the other model to this one,
+      O the center of the sphere in model space. */
+  bool modelCollision(const CollisionModel3DImpl* o, const Matrix3D& t,
+                      int MaxProcessingTime,
+                      Triangle& tri1, int& itri1,
+                      Triangle& tri2, int& itri2) const;
+  bool localSphereCollision(const Vector3D& O, float radius,
+                            Triangle& col_tri, int& col_itri, Vector3D& point) const;
+
   /** Stores all the actual triangles.  Other objects will use
       pointers into this array.
   */
@@ -5,8 +5,8 @@
 //#include "ShaderSet.h"
 
 #include "texture.h"
-#include "mesh.h"
 #include "shader.h"
+#include "streambuffer.h"
 #include "../utils/math.h"
 #include "../utils/utils.h"
 
@@ -52,7 +52,7 @@ void BitmapFont::deInit()
 	s_loaded_fonts.clear();
 }
 
-BitmapFont::BitmapFont()
+BitmapFont::BitmapFont() : Resource(RESOURCE_FONT)
 {
 	texture = NULL;
 	current_font_size = 16;
@@ -67,12 +67,13 @@ BitmapFont::~BitmapFont()
 {
 	//Done in the texture manager
 	//SAFE_DELETE(texture);
+	if (texture)
+		texture->removeRef();
 }
 
 Vector2 BitmapFont::renderText(const std::string& text, Vector2 start_pos, int window_width, int window_height, int max_width)
 {
-	std::vector<Vector3> corners;
-	std::vector<Vector2> tcoords;
+	touch();
 
 	//count rendereable chars
 	int chars = 0;
@@ -83,9 +84,9 @@ Vector2 BitmapFont::renderText(const std::string& text, Vector2 start_pos, int w
 			chars++;
 	}
 
-	//alloc buffers
-	corners.resize( chars * 4 );
-	tcoords.resize( chars * 4 );
+	//the quads are written straight into the stream buffer
+	StreamVertex* vertices = StreamBuffer::map( chars * 4 );
+	unsigned int color = packColor( current_color.x, current_color.y, current_color.z, current_color.w );
 
 	//fill buffers
 	Vector3 pos = Vector3( start_pos.x, start_pos.y , 0.0 );
@@ -143,17 +144,12 @@ Vector2 BitmapFont::renderText(const std::string& text, Vector2 start_pos, int w
 			{
 				assert( chars_rendered < chars );
 
-				//four corners
-				corners[ chars_rendered * 4 + 0 ] = pos + off * Vector3(1,1,0);
-				corners[ chars_rendered * 4 + 1 ] = pos + off * Vector3(-1,1,0) + Vector3(c.w * scale, 0, 0);
-				corners[ chars_rendered * 4 + 2 ] = pos + off * Vector3(-1,1,0) + Vector3(c.w * scale, c.h * scale, 0);
-				corners[ chars_rendered * 4 + 3 ] = pos + off * Vector3(1,1,0) + Vector3(0, c.h * scale, 0);
-
-				//tex coords
-				tcoords[ chars_rendered * 4 + 0 ] = Vector2( c.x * i_w, c.y * i_h );
-				tcoords[ chars_rendered * 4 + 1 ] = Vector2( (c.x + c.w) * i_w, c.y * i_h );
-				tcoords[ chars_rendered * 4 + 2 ] = Vector2( (c.x + c.w) * i_w, (c.y + c.h) * i_h );
-				tcoords[ chars_rendered * 4 + 3 ] = Vector2( c.x * i_w, (c.y + c.h) * i_h );
+				//four corners with their tex coords
+				StreamVertex* quad = vertices + chars_rendered * 4;
+				quad[0].set( pos + off * Vector3(1,1,0), c.x * i_w, c.y * i_h, color );
+				quad[1].set( pos + off * Vector3(-1,1,0) + Vector3(c.w * scale, 0, 0), (c.x + c.w) * i_w, c.y * i_h, color );
+				quad[2].set( pos + off * Vector3(-1,1,0) + Vector3(c.w * scale, c.h * scale, 0), (c.x + c.w) * i_w, (c.y + c.h) * i_h, color );
+				quad[3].set( pos + off * Vector3(1,1,0) + Vector3(0, c.h * scale, 0), c.x * i_w, (c.y + c.h) * i_h, color );
 
 				chars_rendered++;
 			}
@@ -171,7 +167,10 @@ Vector2 BitmapFont::renderText(const std::string& text, Vector2 start_pos, int w
 	}
 
 	if (chars_rendered == 0)
+	{
+		StreamBuffer::draw( GL_QUADS, 0 );
 		return start_pos;
+	}
 
 	//blending for alpha
 	//glDisable( GL_BLEND );
@@ -181,21 +180,17 @@ Vector2 BitmapFont::renderText(const std::string& text, Vector2 start_pos, int w
 
 	Shader* sh = Shader::getGenericTextureShader();
 	sh->enable();
-	sh->setTexture("texture",texture->texture_id);
+	sh->setTexture(UNIFORM_TEXTURE,texture->texture_id);
 
 	Matrix44 mvp;
 	mvp.ortho(0.0f,window_width,window_height,0.0f,-1.0f,1.0f);
-	sh->setMatrix44("mvp",mvp.m);
-
-	Mesh mesh;
-	mesh.vertices = corners;
-	mesh.uvs = tcoords;
+	sh->setMatrix44(UNIFORM_MVP,mvp.m);
 
 	float maxAniso = 1;
 	glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT,&maxAniso);
 	glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_MAX_ANISOTROPY_EXT,maxAniso);//improve readibility
 
-	mesh.render(0,true);
+	StreamBuffer::draw( GL_QUADS, chars_rendered * 4 );
 
 	pos.x = (float)max_x;
 	sh->disable();
@@ -455,6 +450,7 @@ bool BitmapFont::loadFromXML(const char* filename)
 		std::cerr << "Error: Texture Font not found: " << texture_filename << std::endl; 
 		return false;
 	}
+	texture->addRef();
 
 	//texture->setMinifyingFunction( Texture::MIN_MIPMAP_LINEAR ); //TODO
 
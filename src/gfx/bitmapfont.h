@@ -7,11 +7,12 @@
 #include <vector>
 #include <map>
 #include "../utils/math.h"
+#include "../utils/resource.h"
 
 class Texture;
 class Matrix44;
 
-class BitmapFont {
+class BitmapFont : public Resource {
 
 	std::string font_name;
 	std::string font_filename;
@@ -68,6 +69,9 @@ public:
 	void computeRectangle(const std::string& text, float& x, float& y) const;
 
 	bool loadFromXML(const char* filename);
+
+	size_t getCPUBytes() const { return sizeof(BitmapFont) + chars_map.size() * (sizeof(character) + 32); } //the texture is counted apart
+	size_t getVRAMBytes() const { return 0; }
 };
 
 
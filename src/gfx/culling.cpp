@@ -0,0 +1,340 @@
+#include "culling.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "../utils/jobsystem.h"
+
+#ifdef USE_SSE
+	#include <xmmintrin.h>
+#endif
+
+#define CULLING_MIN_CHUNK 16384 //spheres per job, smaller sets are not worth the jobs
+
+static const unsigned char s_bit_count[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+void FrustumCuller::resize(size_t num)
+{
+	x.resize(num);
+	y.resize(num);
+	z.resize(num);
+	radius.resize(num, CULLING_ALWAYS_VISIBLE);
+	visible.assign((num + 31) / 32, 0xFFFFFFFF);
+	always_visible.assign((num + 31) / 32, 0xFFFFFFFF);
+
+	//a flat set until setSubtree says otherwise
+	subtree_end.resize(num);
+	for (size_t i = 0; i < num; ++i)
+		subtree_end[i] = (unsigned int)i + 1;
+	subtree_box.resize(num);
+	last_plane.assign(num, 0);
+}
+
+void FrustumCuller::setSphere(size_t i, const Vector3& center, float radius)
+{
+	x[i] = center.x;
+	y[i] = center.y;
+	z[i] = center.z;
+	this->radius[i] = radius;
+	if (radius >= CULLING_ALWAYS_VISIBLE)
+		always_visible[i >> 5] |= 1u << (i & 31);
+	else
+		always_visible[i >> 5] &= ~(1u << (i & 31));
+}
+
+unsigned int FrustumCuller::countVisible(size_t start, size_t end) const
+{
+	unsigned int count = 0;
+	for (size_t i = start; i < end; ++i)
+		if ((i & 31) == 0 && i + 32 <= end) //whole word
+		{
+			unsigned int word = visible[i >> 5];
+			for (int j = 0; j < 32; j += 4)
+				count += s_bit_count[(word >> j) & 15];
+			i += 31;
+		}
+		else
+			count += isVisible(i);
+	return count;
+}
+
+//the bits of [start,end) that fall in the word
+static inline unsigned int wordMask(size_t word, size_t start, size_t end)
+{
+	size_t first = std::max(start, word << 5) - (word << 5);
+	size_t num = std::min(end, (word + 1) << 5) - (word << 5) - first;
+	return num == 32 ? 0xFFFFFFFF : ((1u << num) - 1) << first;
+}
+
+void FrustumCuller::fillVisible(size_t start, size_t end, bool all, unsigned int* words, size_t first_word)
+{
+	for (size_t word = start >> 5; word < (end + 31) >> 5; ++word)
+	{
+		unsigned int mask = wordMask(word, start, end);
+		unsigned int value = all ? 0xFFFFFFFF : always_visible[word];
+		unsigned int& bits = words[word - first_word];
+		bits = (bits & ~mask) | (value & mask);
+	}
+}
+
+//unlike Camera::sphereInFrustum it checks all the planes, a sphere that touches one plane can still be outside another
+static inline bool sphereVisible(const FrustumCuller& culler, const float frustum[6][4], size_t i)
+{
+	for (int p = 0; p < 6; p++)
+	{
+		float f = frustum[p][0] * culler.x[i] + frustum[p][1] * culler.y[i] + frustum[p][2] * culler.z[i] + frustum[p][3];
+		if (f < -culler.radius[i])
+			return false;
+	}
+	return true;
+}
+
+static unsigned int cullRange(FrustumCuller& culler, const float frustum[6][4], size_t start, size_t end)
+{
+	unsigned int num_visible = 0;
+	size_t i = start;
+
+#ifdef USE_SSE
+	//scalar until the index is multiple of 8 so every iteration writes a whole byte of the bitset
+	for (; i < end && (i & 7); ++i)
+	{
+		bool v = sphereVisible(culler, frustum, i);
+		culler.setVisible(i, v);
+		num_visible += v;
+	}
+
+	__m128 px[6], py[6], pz[6], pd[6];
+	for (int p = 0; p < 6; p++)
+	{
+		px[p] = _mm_set1_ps(frustum[p][0]);
+		py[p] = _mm_set1_ps(frustum[p][1]);
+		pz[p] = _mm_set1_ps(frustum[p][2]);
+		pd[p] = _mm_set1_ps(frustum[p][3]);
+	}
+
+	const float* x = culler.x.data();
+	const float* y = culler.y.data();
+	const float* z = culler.z.data();
+	const float* r = culler.radius.data();
+	unsigned char* bits = (unsigned char*)culler.visible.data(); //little endian, bit i of the words is bit i of the bytes
+
+	//8 spheres per iteration in two registers
+	__m128 zero = _mm_setzero_ps();
+	for (; i + 8 <= end; i += 8)
+	{
+		__m128 x0 = _mm_loadu_ps(x + i), x1 = _mm_loadu_ps(x + i + 4);
+		__m128 y0 = _mm_loadu_ps(y + i), y1 = _mm_loadu_ps(y + i + 4);
+		__m128 z0 = _mm_loadu_ps(z + i), z1 = _mm_loadu_ps(z + i + 4);
+		__m128 r0 = _mm_sub_ps(zero, _mm_loadu_ps(r + i)), r1 = _mm_sub_ps(zero, _mm_loadu_ps(r + i + 4));
+		__m128 out0 = zero, out1 = zero;
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 f0 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], x0), _mm_mul_ps(py[p], y0)), _mm_mul_ps(pz[p], z0)), pd[p]);
+			__m128 f1 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], x1), _mm_mul_ps(py[p], y1)), _mm_mul_ps(pz[p], z1)), pd[p]);
+			out0 = _mm_or_ps(out0, _mm_cmplt_ps(f0, r0));
+			out1 = _mm_or_ps(out1, _mm_cmplt_ps(f1, r1));
+		}
+		unsigned char mask = (unsigned char)~(_mm_movemask_ps(out0) | (_mm_movemask_ps(out1) << 4));
+		bits[i >> 3] = mask;
+		num_visible += s_bit_count[mask & 15] + s_bit_count[mask >> 4];
+	}
+#endif
+
+	for (; i < end; ++i)
+	{
+		bool v = sphereVisible(culler, frustum, i);
+		culler.setVisible(i, v);
+		num_visible += v;
+	}
+	return num_visible;
+}
+
+unsigned int FrustumCuller::cull(const float frustum[6][4], size_t start, size_t end)
+{
+	end = std::min(end, size());
+	plane_tests = 0;
+	if (start >= end)
+		return 0;
+	plane_tests = (unsigned int)(end - start) * 6; //the vectorized loop always tests all of them
+
+	//the jobs take whole words of the bitset so two of them never write the same one
+	std::atomic<unsigned int> num_visible(0);
+	JobSystem::parallelFor(start >> 5, (end + 31) >> 5, CULLING_MIN_CHUNK / 32, [&](size_t first_word, size_t last_word) {
+		num_visible += cullRange(*this, frustum, std::max(start, first_word << 5), std::min(end, last_word << 5));
+	});
+	return num_visible;
+}
+
+enum { BOX_OUTSIDE, BOX_OVERLAP, BOX_INSIDE };
+
+//tests the box with the planes of the mask, the planes that contain the whole box are removed from it
+static inline char boxInPlanes(const float frustum[6][4], const AABB& box, unsigned char& mask, unsigned char& last_plane, unsigned int& tests)
+{
+	//the plane that rejected it in the last frame will probably reject it again
+	int first = last_plane;
+	for (int n = 0; n < 6; n++)
+	{
+		int p = n == 0 ? first : (n == first ? 0 : n);
+		if (!(mask & (1 << p)))
+			continue;
+		const float* plane = frustum[p];
+		float distance = plane[0] * box.center.x + plane[1] * box.center.y + plane[2] * box.center.z + plane[3];
+		float extent = fabsf(plane[0]) * box.halfsize.x + fabsf(plane[1]) * box.halfsize.y + fabsf(plane[2]) * box.halfsize.z;
+		tests++;
+		if (distance < -extent)
+		{
+			last_plane = (unsigned char)p;
+			return BOX_OUTSIDE;
+		}
+		if (distance >= extent)
+			mask &= ~(1 << p);
+	}
+	return mask ? BOX_OVERLAP : BOX_INSIDE;
+}
+
+static inline bool sphereInPlanes(const FrustumCuller& culler, const float frustum[6][4], size_t i, unsigned char mask, unsigned int& tests)
+{
+	for (int p = 0; p < 6; p++)
+	{
+		if (!(mask & (1 << p)))
+			continue;
+		tests++;
+		float f = frustum[p][0] * culler.x[i] + frustum[p][1] * culler.y[i] + frustum[p][2] * culler.z[i] + frustum[p][3];
+		if (f < -culler.radius[i])
+			return false;
+	}
+	return true;
+}
+
+unsigned int FrustumCuller::cullHierarchy(const float frustum[6][4], size_t start, size_t end)
+{
+	end = std::min(end, size());
+	plane_tests = 0;
+	if (start >= end)
+		return 0;
+
+	size_t chunk = std::max((size_t)CULLING_MIN_CHUNK, (end - start) / (JobSystem::getNumThreads() * 4));
+	if (JobSystem::getNumThreads() == 1 || end - start <= chunk)
+	{
+		plane_tests = cullSubtrees(frustum, start, end, 63, visible.data(), 0);
+		return countVisible(start, end);
+	}
+
+	//the subtrees are independent, every job takes a group of consecutive ones. The ones too big for a job
+	//(like the root of the world, that contains everything) are tested here and their children are split instead
+	std::vector<sSubtreeGroup> groups;
+	splitSubtrees(frustum, start, end, 63, chunk, groups, plane_tests);
+
+	//the groups do not start at a multiple of 32, so every job writes its own copy of the words and they are merged later
+	size_t num_groups = groups.size();
+	std::vector< std::vector<unsigned int> > words(num_groups);
+	std::vector<unsigned int> tests(num_groups);
+	JobSystem::parallelFor(0, num_groups, 1, [&](size_t first, size_t last) {
+		for (size_t k = first; k < last; ++k)
+		{
+			const sSubtreeGroup& group = groups[k];
+			words[k].assign(((group.end + 31) >> 5) - (group.start >> 5), 0);
+			tests[k] = cullSubtrees(frustum, group.start, group.end, group.mask, words[k].data(), group.start >> 5);
+		}
+	});
+
+	for (size_t k = 0; k < num_groups; ++k)
+	{
+		size_t first_word = groups[k].start >> 5;
+		for (size_t w = 0; w < words[k].size(); ++w)
+		{
+			unsigned int mask = wordMask(first_word + w, groups[k].start, groups[k].end);
+			visible[first_word + w] = (visible[first_word + w] & ~mask) | (words[k][w] & mask);
+		}
+		plane_tests += tests[k];
+	}
+	return countVisible(start, end);
+}
+
+void FrustumCuller::splitSubtrees(const float frustum[6][4], size_t start, size_t end, unsigned char mask, size_t chunk, std::vector<sSubtreeGroup>& groups, unsigned int& tests)
+{
+	size_t group_start = start;
+	size_t i = start;
+	while (i < end)
+	{
+		size_t last = std::min((size_t)subtree_end[i], end);
+		if (last - i <= chunk)
+		{
+			i = last;
+			if (i - group_start >= chunk)
+			{
+				sSubtreeGroup group = { group_start, i, mask };
+				groups.push_back(group);
+				group_start = i;
+			}
+			continue;
+		}
+
+		//too big for one job, it closes the current group
+		if (group_start < i)
+		{
+			sSubtreeGroup group = { group_start, i, mask };
+			groups.push_back(group);
+		}
+
+		//the same test than cullSubtrees, but the children go to the groups
+		unsigned char children_mask = mask;
+		char result = boxInPlanes(frustum, subtree_box[i], children_mask, last_plane[i], tests);
+		if (result != BOX_OVERLAP)
+			fillVisible(i, last, result == BOX_INSIDE, visible.data(), 0);
+		else
+		{
+			setVisible(i, radius[i] >= CULLING_ALWAYS_VISIBLE || sphereInPlanes(*this, frustum, i, children_mask, tests));
+			splitSubtrees(frustum, i + 1, last, children_mask, chunk, groups, tests);
+		}
+		i = last;
+		group_start = i;
+	}
+
+	if (group_start < end)
+	{
+		sSubtreeGroup group = { group_start, end, mask };
+		groups.push_back(group);
+	}
+}
+
+unsigned int FrustumCuller::cullSubtrees(const float frustum[6][4], size_t start, size_t end, unsigned char range_mask, unsigned int* words, size_t first_word)
+{
+	unsigned int tests = 0;
+
+	//the subtrees being visited with the planes their descendants still have to test
+	struct sOpenSubtree { size_t end; unsigned char mask; };
+	std::vector<sOpenSubtree> stack;
+
+	size_t i = start;
+	while (i < end)
+	{
+		while (!stack.empty() && i >= stack.back().end)
+			stack.pop_back();
+		unsigned char mask = stack.empty() ? range_mask : stack.back().mask;
+		size_t last = std::min((size_t)subtree_end[i], end);
+
+		char result = boxInPlanes(frustum, subtree_box[i], mask, last_plane[i], tests);
+		if (result != BOX_OVERLAP)
+		{
+			fillVisible(i, last, result == BOX_INSIDE, words, first_word);
+			i = last;
+			continue;
+		}
+
+		//overlaps, the entity itself and its children test the remaining planes
+		unsigned int& bits = words[(i >> 5) - first_word];
+		if (radius[i] >= CULLING_ALWAYS_VISIBLE || sphereInPlanes(*this, frustum, i, mask, tests))
+			bits |= 1u << (i & 31);
+		else
+			bits &= ~(1u << (i & 31));
+		if (last > i + 1)
+		{
+			sOpenSubtree subtree = { last, mask };
+			stack.push_back(subtree);
+		}
+		i++;
+	}
+
+	return tests;
+}
@@ -0,0 +1,62 @@
+/*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
+	Frustum culling of many bounding spheres at once. The spheres are stored as a structure of arrays so they can be
+	tested against the six planes of Camera::frustum several at a time with SSE, the result is a bitset.
+	Big sets are split in jobs of the JobSystem, every job writes its own words of the bitset.
+	If the spheres are sorted like a tree (parents before their children) and every one knows the box of its subtree,
+	cullHierarchy rejects or accepts whole subtrees at once and the children only test the planes their parent overlapped.
+	The subtrees are split between the jobs too, the ones too big for a job are tested first and their children are split.
+*/
+
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <vector>
+#include <cstddef>
+#include "../utils/math.h"
+
+#define CULLING_ALWAYS_VISIBLE 1e30f //radius for the spheres that must never be culled
+
+class FrustumCuller
+{
+public:
+	//world space bounding spheres
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> radius;
+	std::vector<unsigned int> visible; //one bit per sphere
+	std::vector<unsigned int> always_visible; //the bits of the spheres with CULLING_ALWAYS_VISIBLE
+
+	//hierarchy, only for cullHierarchy
+	std::vector<unsigned int> subtree_end; //index after the last descendant of every sphere
+	std::vector<AABB> subtree_box; //encloses the sphere and its descendants
+	std::vector<unsigned char> last_plane; //plane that rejected the subtree the last time, it is tested first
+
+	unsigned int plane_tests; //in the last cull, to compare the methods
+
+	FrustumCuller() { plane_tests = 0; }
+
+	size_t size() const { return x.size(); }
+	void resize(size_t num); //all the spheres are visible until they are culled again
+	void setSphere(size_t i, const Vector3& center, float radius);
+	void setSubtree(size_t i, size_t end, const AABB& box) { subtree_end[i] = (unsigned int)end; subtree_box[i] = box; }
+	void setVisible(size_t i, bool v) { if (v) visible[i >> 5] |= 1u << (i & 31); else visible[i >> 5] &= ~(1u << (i & 31)); }
+	bool isVisible(size_t i) const { return (visible[i >> 5] >> (i & 31)) & 1; }
+	unsigned int countVisible(size_t start, size_t end) const;
+
+	//tests the spheres in [start,end) against the planes (normalized, pointing inside), returns how many are visible
+	unsigned int cull(const float frustum[6][4], size_t start = 0, size_t end = (size_t)-1);
+
+	//the same result testing the subtree boxes first, [start,end) must be whole subtrees
+	unsigned int cullHierarchy(const float frustum[6][4], size_t start = 0, size_t end = (size_t)-1);
+
+private:
+	struct sSubtreeGroup { size_t start, end; unsigned char mask; }; //consecutive subtrees culled by the same job, mask are the planes left by their parents
+
+	//the visibility goes to words, that start in the word first_word of the bitset. mask are the planes the parents of the range did not pass
+	unsigned int cullSubtrees(const float frustum[6][4], size_t start, size_t end, unsigned char mask, unsigned int* words, size_t first_word); //returns the plane tests
+	void splitSubtrees(const float frustum[6][4], size_t start, size_t end, unsigned char mask, size_t chunk, std::vector<sSubtreeGroup>& groups, unsigned int& tests);
+	void fillVisible(size_t start, size_t end, bool all, unsigned int* words, size_t first_word); //all visible or only the always visible ones
+};
+
+#endif
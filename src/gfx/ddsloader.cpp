@@ -141,6 +141,7 @@ bool Texture::loadDDS( const char* filename )
 
 	width = x;
 	height = y;
+	vram_bytes = 0;
 
   GLenum format;
   GLenum cFormat;
@@ -159,6 +160,7 @@ bool Texture::loadDDS( const char* filename )
       fread( data, 1, size, f );
       _glCompressedTexImage2D( GL_TEXTURE_2D, ix, li->internalFormat, x, y, 0, size, data );
       checkGLErrors();
+      vram_bytes += size;
       x = (x+1)>>1;
       y = (y+1)>>1;
       size = max( li->divSize, x )/li->divSize * max( li->divSize, y )/li->divSize * li->blockBytes;
@@ -187,6 +189,7 @@ bool Texture::loadDDS( const char* filename )
       glPixelStorei( GL_UNPACK_ROW_LENGTH, y );
       glTexImage2D( GL_TEXTURE_2D, ix, li->internalFormat, x, y, 0, li->externalFormat, li->type, unpacked );
       checkGLErrors();
+      vram_bytes += size * sizeof( unsigned int );
       x = (x+1)>>1;
       y = (y+1)>>1;
       size = x * y * li->blockBytes;
@@ -208,6 +211,7 @@ bool Texture::loadDDS( const char* filename )
       glPixelStorei( GL_UNPACK_ROW_LENGTH, y );
       glTexImage2D( GL_TEXTURE_2D, ix, li->internalFormat, x, y, 0, li->externalFormat, li->type, data );
       checkGLErrors();
+      vram_bytes += size;
       x = (x+1)>>1;
       y = (y+1)>>1;
       size = x * y * li->blockBytes;
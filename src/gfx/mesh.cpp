@@ -1,15 +1,23 @@
 #include "mesh.h"
 #include "../utils/text.h"
 #include "../utils/utils.h"
+#include "../utils/mappedfile.h"
+#include "../utils/fastparse.h"
+#include "../utils/resourceloader.h"
 #include "../includes.h"
 #include <cassert>
+#include <cstddef>
 #include <iostream>
 #include <limits>
-#include <sys/stat.h>
+#include <thread>
+#include <unordered_map>
 
 std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
 bool Mesh::use_vram = true;
 bool Mesh::use_binary = true;
+bool Mesh::release_cpu_data = false;
+VertexFormat Mesh::default_vertex_format;
+int Mesh::num_loading_threads = 0;
 long Mesh::num_meshes_rendered = 0;
 long Mesh::num_triangles_rendered = 0;
 bool Mesh::s_initialized = false;
@@ -23,8 +31,18 @@ REGISTER_GLEXT( void, glGenBuffersARB, GLsizei n, GLuint* ids )
 REGISTER_GLEXT( void, glBindBufferARB, GLenum target, GLuint id )
 REGISTER_GLEXT( void, glBufferDataARB, GLenum target, GLsizei size, const void* data, GLenum usage )
 REGISTER_GLEXT( void, glDeleteBuffersARB, GLsizei n, const GLuint* ids )
+REGISTER_GLEXT( void, glVertexAttribPointerARB, GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer )
+REGISTER_GLEXT( void, glEnableVertexAttribArrayARB, GLuint index )
+REGISTER_GLEXT( void, glDisableVertexAttribArrayARB, GLuint index )
+REGISTER_GLEXT( void, glDrawArraysInstancedARB, GLenum mode, GLint first, GLsizei count, GLsizei primcount )
+REGISTER_GLEXT( void, glDrawElementsInstancedARB, GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei primcount )
+REGISTER_GLEXT( void, glVertexAttribDivisorARB, GLuint index, GLuint divisor )
+
+#ifndef GL_HALF_FLOAT_ARB
+	#define GL_HALF_FLOAT_ARB 0x140B
+#endif
 
-Mesh* Mesh::Load(const char* filename, bool multimaterial, bool force_load)
+Mesh* Mesh::Load(const char* filename, bool multimaterial, bool force_load, bool optimize)
 {
 	assert(filename);
 
@@ -32,14 +50,87 @@ Mesh* Mesh::Load(const char* filename, bool multimaterial, bool force_load)
 	{
 		std::map<std::string, Mesh*>::iterator it = sMeshesLoaded.find(filename);
 		if (it != sMeshesLoaded.end())
+		{
+			if (it->second->is_loading) //requested with LoadAsync, wait for it
+			{
+				ResourceLoader::flush();
+				it = sMeshesLoaded.find(filename); //if the loading failed it is not in the cache anymore
+				if (it == sMeshesLoaded.end())
+					return NULL;
+			}
 			return it->second;
+		}
+	}
+
+	Mesh* m = new Mesh();
+	if (!m->loadFile(filename, multimaterial, force_load, optimize))
+	{
+		delete m;
+		return NULL;
+	}
+
+	m->evictable = true;
+	sMeshesLoaded[filename] = m;
+	return m;
+}
+
+//reads the file in a worker thread, the VBOs are created in the main thread
+class MeshLoadJob : public ResourceJob
+{
+public:
+	Mesh* mesh;
+	std::string filename;
+	bool multimaterial;
+	bool optimize;
+
+	bool load() { return mesh->loadFile( filename.c_str(), multimaterial, false, optimize ); }
+	void upload()
+	{
+		if (loaded && Mesh::use_vram)
+			mesh->uploadToVRAM();
+		mesh->is_loading = false;
+
+		//the ones holding it keep an empty mesh (isReady is false), but Load and LoadAsync do not return it again
+		if (!loaded)
+		{
+			std::map<std::string, Mesh*>::iterator it = Mesh::sMeshesLoaded.find(filename);
+			if (it != Mesh::sMeshesLoaded.end() && it->second == mesh)
+				Mesh::sMeshesLoaded.erase(it);
+		}
 	}
+};
+
+Mesh* Mesh::LoadAsync(const char* filename, bool multimaterial, bool optimize)
+{
+	assert(filename);
+
+	//registered before it is loaded so requests for the same file share it
+	std::map<std::string, Mesh*>::iterator it = sMeshesLoaded.find(filename);
+	if (it != sMeshesLoaded.end())
+		return it->second;
 
 	Mesh* m = new Mesh();
 	m->name = filename;
+	m->is_loading = true;
+	m->evictable = true;
+	sMeshesLoaded[filename] = m;
+
+	MeshLoadJob* job = new MeshLoadJob();
+	job->mesh = m;
+	job->filename = filename;
+	job->multimaterial = multimaterial;
+	job->optimize = optimize;
+	ResourceLoader::addJob(job);
+	return m;
+}
+
+//can be called from a worker thread, it does not use OpenGL
+bool Mesh::loadFile(const char* filename, bool multimaterial, bool force_load, bool optimize)
+{
+	name = filename;
 
 	char file_format = 0;
-	std::string ext = m->name.substr( m->name.size() - 4,4 );
+	std::string ext = name.size() > 4 ? name.substr( name.size() - 4,4 ) : "";
 
 	if (ext == ".ase" || ext == ".ASE")
 		file_format = FORMAT_ASE;
@@ -50,7 +141,7 @@ Mesh* Mesh::Load(const char* filename, bool multimaterial, bool force_load)
 	else
 	{
 		std::cerr << "Unknown mesh format: " << filename << std::endl;
-		return NULL;
+		return false;
 	}
 	
 
@@ -61,40 +152,43 @@ Mesh* Mesh::Load(const char* filename, bool multimaterial, bool force_load)
 	if (file_format != FORMAT_BIN)
 		binfilename = binfilename + ".bin";
 
-	if (!force_load && use_binary && m->readBin(binfilename.c_str() ))
+	if (!force_load && use_binary && readBin(binfilename.c_str() ))
 	{
-		std::cout << "[OK BIN]  Faces: " << m->vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-		sMeshesLoaded[filename] = m;
-		return m;
+		std::cout << "[OK BIN]  Faces: " << getNumTriangles() << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		return true;
 	}
 	
 	bool loaded = false;
 	if (file_format == FORMAT_OBJ)
-		loaded = m->loadOBJ(filename,multimaterial);
+		loaded = loadOBJ(filename,multimaterial);
 	else if (file_format == FORMAT_ASE)
-		loaded = m->loadASE(filename,multimaterial);
+		loaded = loadASE(filename,multimaterial);
 
-	if (loaded)
+	if (!loaded)
 	{
-		std::cout << "[OK]  Faces: " << m->vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-		if (use_binary)
-		{
-			std::cout << "Writing Bin... ";
-			m->writeBin(filename);
-			std::cout << "[OK]" << std::endl;
-		}
-		sMeshesLoaded[filename] = m;
-		return m;
+		std::cout << "[ERROR]: Mesh not found" << std::endl;
+		return false;
 	}
-	else
+
+	std::cout << "[OK]  Faces: " << getNumTriangles() << " Vertices: " << getNumVertices() << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	if (getIndicesData())
 	{
-		delete m;
-		std::cout << "[ERROR]: Mesh not found" << std::endl;
-		return NULL;
+		VertexCacheStats stats = getVertexCacheStats();
+		std::cout << "\tVertex cache: hit rate " << stats.hit_rate << " ACMR " << stats.acmr << " ATVR " << stats.atvr << std::endl;
 	}
+	if (use_binary)
+	{
+		std::cout << "Writing Bin... ";
+		if (writeBin(filename, optimize))
+			bin_filename = binfilename;
+		std::cout << "[OK]" << std::endl;
+	}
+	else if (optimize)
+		optimizeIndices();
+	return true;
 }
 
-Mesh::Mesh()
+Mesh::Mesh() : Resource(RESOURCE_MESH)
 {
 	//get extensions for VBO
     if(!s_initialized)
@@ -105,13 +199,36 @@ Mesh::Mesh()
 		IMPORT_GLEXT( glBindBufferARB );
 		IMPORT_GLEXT( glBufferDataARB );
 		IMPORT_GLEXT( glDeleteBuffersARB );
+		IMPORT_GLEXT( glVertexAttribPointerARB );
+		IMPORT_GLEXT( glEnableVertexAttribArrayARB );
+		IMPORT_GLEXT( glDisableVertexAttribArrayARB );
+
+		//optional, without them the RenderQueue draws the instances one by one
+		glDrawArraysInstancedARB = (glDrawArraysInstancedARB_func) SDL_GL_GetProcAddress("glDrawArraysInstancedARB");
+		glDrawElementsInstancedARB = (glDrawElementsInstancedARB_func) SDL_GL_GetProcAddress("glDrawElementsInstancedARB");
+		glVertexAttribDivisorARB = (glVertexAttribDivisorARB_func) SDL_GL_GetProcAddress("glVertexAttribDivisorARB");
 	}
 
 
 	radius = 0;
-	vertices_vbo_id = texcoords_vbo_id = normals_vbo_id = colors_vbo_id = 0;
+	vertices_vbo_id = texcoords_vbo_id = normals_vbo_id = colors_vbo_id = indices_vbo_id = 0;
+	vram_bytes = 0;
+	vertex_format = default_vertex_format;
+	vertex_packed = false;
+	bound_arrays = 0;
+
+	mapped_file = NULL;
+	mapped_size = 0;
+	mapped_vertices = mapped_normals = NULL;
+	mapped_uvs = NULL;
+	mapped_colors = NULL;
+	mapped_num_indices = 0;
+	mapped_indices = NULL;
 
 	primitive = GL_TRIANGLES;
+	is_loading = false;
+	cpu_data_released = false;
+	released_num_vertices = released_num_indices = 0;
 	#ifndef SKIP_COLDET
 		collision_model = NULL;
 	#endif
@@ -121,29 +238,36 @@ Mesh::Mesh()
 Mesh::~Mesh()
 {
 	clear();
+
+	//it could be in the cache if it was loaded with Load
+	std::map<std::string, Mesh*>::iterator it = sMeshesLoaded.find(name);
+	if (it != sMeshesLoaded.end() && it->second == this)
+		sMeshesLoaded.erase(it);
+}
+
+size_t Mesh::getCPUBytes() const
+{
+	size_t bytes = sizeof(Mesh);
+	bytes += vertices.capacity() * sizeof(Vector3) + normals.capacity() * sizeof(Vector3) + uvs.capacity() * sizeof(Vector2) + colors.capacity() * sizeof(Vector4);
+	bytes += indices.capacity() * sizeof(unsigned int);
+	if (mapped_file)
+		bytes += mapped_file->size;
+	#ifndef SKIP_COLDET
+		if (collision_model) //ColDet keeps a copy of every triangle plus the box tree, around 160 bytes per triangle
+			bytes += getNumTriangles() * 160;
+	#endif
+	return bytes;
 }
 
 
 void Mesh::clear()
 {
-	//Free VBOs
-	if (vertices_vbo_id) 
-		glDeleteBuffersARB(1,&vertices_vbo_id);
-	if (texcoords_vbo_id) 
-		glDeleteBuffersARB(1,&texcoords_vbo_id);
-	if (normals_vbo_id) 
-		glDeleteBuffersARB(1,&normals_vbo_id);
-	if (colors_vbo_id) 
-		glDeleteBuffersARB(1,&colors_vbo_id);
-
-	//VBOs ids
-	vertices_vbo_id = texcoords_vbo_id = normals_vbo_id = colors_vbo_id = 0;
+	releaseVRAM();
 
 	//buffers
-	vertices.clear();
-	normals.clear();
-	uvs.clear();
-	colors.clear();
+	releaseStreams();
+	cpu_data_released = false;
+	bin_filename.clear();
 	for (size_t i = 0; i < calllist_id.size(); i++)
 		if (calllist_id[i] != 0)
 			glDeleteLists( calllist_id[i], 1 );
@@ -152,18 +276,60 @@ void Mesh::clear()
 	#ifndef SKIP_COLDET
 		if (collision_model)
 			delete collision_model;
+		collision_model = NULL;
 	#endif
 }
 
+//frees the memory, clear() would keep the capacity of the vectors
+void Mesh::releaseStreams()
+{
+	releaseMapping();
+	std::vector< Vector3 >().swap(vertices);
+	std::vector< Vector3 >().swap(normals);
+	std::vector< Vector2 >().swap(uvs);
+	std::vector< Vector4 >().swap(colors);
+	std::vector< unsigned int >().swap(indices);
+}
+
+void Mesh::releaseVRAM()
+{
+	//Free VBOs
+	if (vertices_vbo_id) 
+		glDeleteBuffersARB(1,&vertices_vbo_id);
+	if (texcoords_vbo_id) 
+		glDeleteBuffersARB(1,&texcoords_vbo_id);
+	if (normals_vbo_id) 
+		glDeleteBuffersARB(1,&normals_vbo_id);
+	if (colors_vbo_id) 
+		glDeleteBuffersARB(1,&colors_vbo_id);
+	if (indices_vbo_id) 
+		glDeleteBuffersARB(1,&indices_vbo_id);
+
+	//VBOs ids
+	vertices_vbo_id = texcoords_vbo_id = normals_vbo_id = colors_vbo_id = indices_vbo_id = 0;
+	vram_bytes = 0;
+	vertex_packed = false;
+}
+
 #ifndef SKIP_COLDET
 void Mesh::createCollisionModel()
 {
+	if (cpu_data_released && !reloadCPUData())
+		return;
+
+	const Vector3* vertices = getVerticesData();
+	const unsigned int* indices = getIndicesData();
+	unsigned int num_triangles = getNumTriangles();
+
 	collision_model = newCollisionModel3D();
-	//collision_model->setTriangleNumber(vStrip.size() / 3);
-	for (size_t count = 0; count < vertices.size()/3; count++)
-		collision_model->addTriangle( vertices[count*3].x, vertices[count*3].y, vertices[count*3].z,
-									vertices[count*3+1].x, vertices[count*3+1].y, vertices[count*3+1].z,
-									vertices[count*3+2].x, vertices[count*3+2].y, vertices[count*3+2].z);
+	collision_model->setTriangleNumber(num_triangles);
+	for (size_t count = 0; count < num_triangles; count++)
+	{
+		const Vector3& a = vertices[ indices ? indices[count*3] : count*3 ];
+		const Vector3& b = vertices[ indices ? indices[count*3+1] : count*3+1 ];
+		const Vector3& c = vertices[ indices ? indices[count*3+2] : count*3+2 ];
+		collision_model->addTriangle( a.x, a.y, a.z, b.x, b.y, b.z, c.x, c.y, c.z );
+	}
 
 	collision_model->finalize();
 }
@@ -203,83 +369,445 @@ typedef struct
 	char streams[4]; //Normal|Uvs|Color|Extra
 } sMeshInfo;
 
+//MBIN v2: "MBN2" + sMeshInfoV2, then every stream starts at an offset multiple of MBIN_ALIGNMENT
+//so it can be used straight from the file mapping without copying it
+#define MBIN_VERSION 2
+#define MBIN_ALIGNMENT 16
+
+enum { MBIN_VERTICES, MBIN_NORMALS, MBIN_UVS, MBIN_COLORS, MBIN_INDICES, MBIN_MAX_STREAMS = 8 };
+
+typedef struct
+{
+	int version;
+	int header_size; //sizeof(sMeshInfoV2) when it was written
+	sMeshInfo info; //same info as in v1
+	unsigned int offsets[MBIN_MAX_STREAMS]; //from the start of the file, 0 if the stream is not present
+	unsigned int counts[MBIN_MAX_STREAMS]; //number of elements in every stream
+} sMeshInfoV2;
+
+static void applyMeshInfo(Mesh* mesh, const sMeshInfo& info)
+{
+	mesh->aabb_max = info.aabb_max;
+	mesh->aabb_min = info.aabb_min;
+	mesh->center = info.center;
+	mesh->halfsize = info.halfsize;
+	mesh->radius = info.radius;
+
+	mesh->material_range.clear();
+	for (int i = 0; i < 4; i++)
+		if (info.material_range[i] != -1)
+			mesh->material_range.push_back( info.material_range[i] );
+		else
+			break;
+}
+
+static void fillMeshInfo(const Mesh* mesh, sMeshInfo& info)
+{
+	info.size = mesh->getNumVertices();
+	info.aabb_max = mesh->aabb_max;
+	info.aabb_min = mesh->aabb_min;
+	info.center = mesh->center;
+	info.halfsize = mesh->halfsize;
+	info.radius = mesh->radius;
+
+	info.streams[0] = mesh->getNormalsData() ? 'N' : ' ';
+	info.streams[1] = mesh->getUVsData() ? 'U' : ' ';
+	info.streams[2] = mesh->getColorsData() ? 'C' : ' ';
+	info.streams[3] = ' ';
+
+	for (size_t i = 0; i < 4; i++)
+		info.material_range[i] = mesh->material_range.size() > i ? mesh->material_range[i] : -1;
+}
+
 bool Mesh::readBin(const char* filename)
 {
-	FILE *f;
 	assert(filename);
 
-	struct stat stbuffer;
-
-	stat(filename,&stbuffer);
-	f = fopen(filename,"rb");
-	if (f == NULL) return false;
+	MappedFile* file = new MappedFile();
+	if (!file->open(filename))
+	{
+		delete file;
+		return false;
+	}
 
-	unsigned int size = stbuffer.st_size;
-	char* data = new char[size];
-	fread(data,size,1,f);
-	fclose(f);
+	clear();
 
-	//watermark
-	if ( memcmp(data,"MBIN",4) != 0 )
+	if (!readBinFile(file))
 	{
 		std::cout << "Error in Mesh Bin loader, Wrong content: " << filename << std::endl;
+		clear();
+		return false;
+	}
+
+	#ifndef SKIP_COLDET
+		createCollisionModel();
+	#endif
+
+	bin_filename = filename;
+	return true;
+}
+
+//fills the streams from an opened .bin, the file is deleted unless the mesh keeps it mapped
+bool Mesh::readBinFile(MappedFile* file)
+{
+	bool loaded = false;
+	if (file->size > 4 && memcmp(file->data,"MBN2",4) == 0)
+	{
+		loaded = readBinV2(file->data, file->size);
+		if (loaded)
+			mapped_file = file; //keep the mapping, the streams point inside it
+	}
+	else if (file->size > 4 && memcmp(file->data,"MBIN",4) == 0)
+		loaded = readBinLegacy(file->data, file->size);
+
+	if (mapped_file != file)
+		delete file;
+	return loaded;
+}
+
+bool Mesh::releaseCPUData()
+{
+	if (cpu_data_released)
+		return true;
+	if (vertices_vbo_id == 0 || bin_filename.empty() || is_loading)
+		return false;
+
+	released_num_vertices = getNumVertices();
+	released_num_indices = getNumIndices();
+	releaseStreams();
+	cpu_data_released = true;
+	return true;
+}
+
+bool Mesh::reloadCPUData()
+{
+	if (!cpu_data_released)
+		return true;
+
+	MappedFile* file = new MappedFile();
+	if (!file->open(bin_filename.c_str()))
+	{
+		std::cerr << "Error reloading mesh, bin not found: " << bin_filename << std::endl;
+		delete file;
+		return false;
+	}
+
+	cpu_data_released = false;
+	if (!readBinFile(file) || getNumVertices() != released_num_vertices || getNumIndices() != released_num_indices)
+	{
+		std::cerr << "Error reloading mesh, the bin does not match the mesh in VRAM: " << bin_filename << std::endl;
+		releaseStreams();
+		cpu_data_released = true;
 		return false;
 	}
+	return true;
+}
+
+//v1 files have the streams packed one after the other, they are copied to the vectors
+bool Mesh::readBinLegacy(const char* data, size_t size)
+{
+	const char* pos = data + 4;
+	const char* end = data + size;
+	if (pos + sizeof(sMeshInfo) > end)
+		return false;
 
-	char* pos = data + 4;
 	sMeshInfo info;
 	memcpy(&info,pos,sizeof(sMeshInfo));
 	pos += sizeof(sMeshInfo);
 
-	vertices.resize(info.size);
-	memcpy((void*)&vertices[0],pos,sizeof(Vector3) * info.size);
-	pos += sizeof(Vector3) * info.size;
+	size_t num = info.size;
+	size_t stream_size = sizeof(Vector3) + (info.streams[0] == 'N' ? sizeof(Vector3) : 0) + (info.streams[1] == 'U' ? sizeof(Vector2) : 0) + (info.streams[2] == 'C' ? sizeof(Vector4) : 0);
+	if (info.size <= 0 || num * stream_size > size_t(end - pos))
+		return false;
+
+	vertices.resize(num);
+	memcpy((void*)&vertices[0],pos,sizeof(Vector3) * num);
+	pos += sizeof(Vector3) * num;
 
 	if (info.streams[0] == 'N')
 	{
-		normals.resize(info.size);
-		memcpy((void*)&normals[0],pos,sizeof(Vector3) * info.size);
-		pos += sizeof(Vector3) * info.size;
+		normals.resize(num);
+		memcpy((void*)&normals[0],pos,sizeof(Vector3) * num);
+		pos += sizeof(Vector3) * num;
 	}
 
 	if (info.streams[1] == 'U')
 	{
-		uvs.resize(info.size);
-		memcpy((void*)&uvs[0],pos,sizeof(Vector2) * info.size);
-		pos += sizeof(Vector2) * info.size;
+		uvs.resize(num);
+		memcpy((void*)&uvs[0],pos,sizeof(Vector2) * num);
+		pos += sizeof(Vector2) * num;
 	}
 
 	if (info.streams[2] == 'C')
 	{
-		colors.resize(info.size);
-		memcpy((void*)&colors[0],pos,sizeof(Vector4) * info.size);
-		pos += sizeof(Vector4) * info.size;
+		colors.resize(num);
+		memcpy((void*)&colors[0],pos,sizeof(Vector4) * num);
+		pos += sizeof(Vector4) * num;
 	}
 
-	aabb_max = info.aabb_max;
-	aabb_min = info.aabb_min;
-	center = info.center;
-	halfsize = info.halfsize;
-	radius = info.radius;
+	applyMeshInfo(this, info);
 
-	for (int i = 0; i < 4; i++)
-		if (info.material_range[i] != -1)
-			material_range.push_back( info.material_range[i] );
-		else
-			break;
+	//v1 files were never indexed. The welding is part of reading them, the mesh still matches the .bin
+	//so it is kept in bin_filename (weldVertices clears it) and reloadCPUData can read it again
+	std::string filename = bin_filename;
+	weldVertices();
+	bin_filename = filename;
+	return true;
+}
 
-	delete[] data;
+//v2 files are not copied, the stream pointers are set inside the mapping
+bool Mesh::readBinV2(const char* data, size_t size)
+{
+	if (4 + sizeof(sMeshInfoV2) > size)
+		return false;
 
-	#ifndef SKIP_COLDET
-		createCollisionModel();
-	#endif
+	sMeshInfoV2 header;
+	memcpy(&header, data + 4, sizeof(sMeshInfoV2));
+	if (header.version != MBIN_VERSION || header.header_size < (int)sizeof(sMeshInfoV2) || header.info.size <= 0)
+		return false;
+
+	const size_t element_size[MBIN_INDICES + 1] = { sizeof(Vector3), sizeof(Vector3), sizeof(Vector2), sizeof(Vector4), sizeof(unsigned int) };
+	const void* streams[MBIN_INDICES + 1] = { NULL, NULL, NULL, NULL, NULL };
+	for (int i = 0; i <= MBIN_INDICES; i++)
+	{
+		if (header.offsets[i] == 0)
+			continue;
+		if (header.offsets[i] % MBIN_ALIGNMENT != 0 || (i != MBIN_INDICES && header.counts[i] != (unsigned int)header.info.size) ||
+			header.offsets[i] + (size_t)header.counts[i] * element_size[i] > size)
+			return false;
+		streams[i] = data + header.offsets[i];
+	}
+
+	if (streams[MBIN_VERTICES] == NULL)
+		return false;
+
+	//indices out of range would crash the collision and the driver
+	if (streams[MBIN_INDICES])
+	{
+		const unsigned int* index_stream = (const unsigned int*)streams[MBIN_INDICES];
+		for (unsigned int i = 0; i < header.counts[MBIN_INDICES]; ++i)
+			if (index_stream[i] >= (unsigned int)header.info.size)
+				return false;
+		mapped_num_indices = header.counts[MBIN_INDICES];
+		mapped_indices = index_stream;
+	}
 
+	mapped_size = header.info.size;
+	mapped_vertices = (const Vector3*)streams[MBIN_VERTICES];
+	mapped_normals = (const Vector3*)streams[MBIN_NORMALS];
+	mapped_uvs = (const Vector2*)streams[MBIN_UVS];
+	mapped_colors = (const Vector4*)streams[MBIN_COLORS];
+
+	applyMeshInfo(this, header.info);
 	return true;
 }
 
-bool Mesh::writeBin(const char* filename)
+void Mesh::releaseMapping()
+{
+	if (!mapped_file)
+		return;
+	delete mapped_file;
+	mapped_file = NULL;
+	mapped_size = 0;
+	mapped_vertices = mapped_normals = NULL;
+	mapped_uvs = NULL;
+	mapped_colors = NULL;
+	mapped_num_indices = 0;
+	mapped_indices = NULL;
+}
+
+void Mesh::makeEditable()
+{
+	reloadCPUData();
+	bin_filename.clear(); //the changes are not in the .bin, it cannot be used to reload the mesh anymore
+	if (!mapped_file)
+		return;
+
+	unsigned int num = mapped_size;
+	vertices.assign( mapped_vertices, mapped_vertices + num );
+	if (mapped_normals)
+		normals.assign( mapped_normals, mapped_normals + num );
+	if (mapped_uvs)
+		uvs.assign( mapped_uvs, mapped_uvs + num );
+	if (mapped_colors)
+		colors.assign( mapped_colors, mapped_colors + num );
+	if (mapped_indices)
+		indices.assign( mapped_indices, mapped_indices + mapped_num_indices );
+
+	releaseMapping();
+}
+
+//all the attributes of a vertex, used to find duplicated vertices
+struct sWeldKey
 {
-	assert(vertices.size());
+	Vector3 position;
+	Vector3 normal;
+	Vector2 uv;
+	Vector4 color;
+
+	bool operator == (const sWeldKey& k) const { return memcmp(this, &k, sizeof(sWeldKey)) == 0; }
+};
+static_assert(sizeof(sWeldKey) == 12 * sizeof(float), "the bytes of the key are compared and hashed, it cannot have padding");
+
+struct sWeldKeyHash
+{
+	size_t operator()(const sWeldKey& k) const
+	{
+		//FNV-1a over the bytes
+		const unsigned char* bytes = (const unsigned char*)&k;
+		size_t h = 2166136261u;
+		for (size_t i = 0; i < sizeof(sWeldKey); ++i)
+			h = (h ^ bytes[i]) * 16777619u;
+		return h;
+	}
+};
+
+void Mesh::weldVertices()
+{
+	makeEditable();
+	if (vertices.empty())
+		return;
+
+	//already indexed, weld the referenced vertices and remap the indices
+	std::vector<unsigned int> old_indices;
+	if (!indices.empty())
+		old_indices.swap(indices);
+
+	unsigned int num_corners = old_indices.empty() ? vertices.size() : old_indices.size();
+
+	std::vector< Vector3 > new_vertices, new_normals;
+	std::vector< Vector2 > new_uvs;
+	std::vector< Vector4 > new_colors;
+	std::unordered_map< sWeldKey, unsigned int, sWeldKeyHash > unique;
+	unique.reserve( vertices.size() );
+	indices.resize( num_corners );
+
+	for (unsigned int i = 0; i < num_corners; ++i)
+	{
+		unsigned int v = old_indices.empty() ? i : old_indices[i];
+
+		sWeldKey key; //the members start at zero for the streams the mesh does not have
+		key.position = vertices[v];
+		if (!normals.empty()) key.normal = normals[v];
+		if (!uvs.empty()) key.uv = uvs[v];
+		if (!colors.empty()) key.color = colors[v];
+
+		std::pair< std::unordered_map< sWeldKey, unsigned int, sWeldKeyHash >::iterator, bool > it = unique.insert( std::make_pair(key, (unsigned int)new_vertices.size()) );
+		if (it.second) //new vertex
+		{
+			new_vertices.push_back( vertices[v] );
+			if (!normals.empty()) new_normals.push_back( normals[v] );
+			if (!uvs.empty()) new_uvs.push_back( uvs[v] );
+			if (!colors.empty()) new_colors.push_back( colors[v] );
+		}
+		indices[i] = it.first->second;
+	}
+
+	vertices.swap(new_vertices);
+	normals.swap(new_normals);
+	uvs.swap(new_uvs);
+	colors.swap(new_colors);
+}
+
+//reorders a stream using remap[old_index] = new_index
+template <class T> static void remapStream(std::vector<T>& stream, const std::vector<unsigned int>& remap)
+{
+	if (stream.empty())
+		return;
+	std::vector<T> result( stream.size() );
+	for (size_t i = 0; i < stream.size(); ++i)
+		result[ remap[i] ] = stream[i];
+	stream.swap(result);
+}
+
+void Mesh::optimizeIndices()
+{
+	if (!getIndicesData())
+		weldVertices();
+	makeEditable();
+	if (indices.empty())
+		return;
+
+	VertexCacheStats before = getVertexCacheStats();
+
+	//triangles cannot move between submeshes
+	unsigned int start = 0;
+	for (size_t i = 0; i <= material_range.size(); ++i)
+	{
+		unsigned int end = i < material_range.size() ? material_range[i] * 3 : indices.size();
+		if (end > start)
+			optimizeVertexCache( &indices[start], end - start, vertices.size() );
+		start = end;
+	}
+
+	std::vector<unsigned int> remap;
+	optimizeVertexFetch( &indices[0], indices.size(), vertices.size(), remap );
+	remapStream( vertices, remap );
+	remapStream( normals, remap );
+	remapStream( uvs, remap );
+	remapStream( colors, remap );
+
+	//the buffers in VRAM are outdated, they will be uploaded again when rendering
+	releaseVRAM();
+
+	VertexCacheStats after = getVertexCacheStats();
+	std::cout << "Mesh optimized: " << name << " ACMR " << before.acmr << " -> " << after.acmr << " ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+}
+
+VertexCacheStats Mesh::getVertexCacheStats(unsigned int cache_size) const
+{
+	if (cpu_data_released)
+		return simulateVertexCache( NULL, 0, 0, cache_size );
+	if (getIndicesData())
+		return simulateVertexCache( getIndicesData(), getNumIndices(), getNumVertices(), cache_size );
+
+	//not indexed: every corner is a different vertex
+	std::vector<unsigned int> sequential( getNumVertices() );
+	for (unsigned int i = 0; i < sequential.size(); ++i)
+		sequential[i] = i;
+	return simulateVertexCache( sequential.empty() ? NULL : &sequential[0], sequential.size(), sequential.size(), cache_size );
+}
+
+VertexFormatStats Mesh::getVertexFormatStats(const VertexFormat& format) const
+{
+	std::vector<unsigned char> buffer;
+	unsigned int num_vertices = cpu_data_released ? 0 : getNumVertices();
+	VertexLayout layout = packVertices( format, num_vertices, getVerticesData(), getNormalsData(), getUVsData(), getColorsData(), buffer );
+	return measureVertexFormat( layout, buffer, num_vertices, getVerticesData(), getNormalsData(), getUVsData(), getColorsData() );
+}
+
+unsigned int Mesh::getBytesPerVertex() const
+{
+	if (vertex_packed)
+		return vertex_layout.bytes_per_vertex;
+	if (vertices_vbo_id)
+		return getVertexSize( vertex_format, normals_vbo_id != 0, texcoords_vbo_id != 0, colors_vbo_id != 0 );
+	return getVertexSize( vertex_format, getNormalsData() != NULL, getUVsData() != NULL, getColorsData() != NULL );
+}
+
+static size_t alignOffset(size_t offset)
+{
+	return (offset + MBIN_ALIGNMENT - 1) & ~(size_t)(MBIN_ALIGNMENT - 1);
+}
+
+//writes zeros until the file reaches the offset and then the data
+static void writeStream(FILE* f, size_t& pos, size_t offset, const void* data, size_t size)
+{
+	static const char padding[MBIN_ALIGNMENT] = {0};
+	assert(offset >= pos && offset - pos < MBIN_ALIGNMENT);
+	fwrite(padding, offset - pos, 1, f);
+	fwrite(data, size, 1, f);
+	pos = offset + size;
+}
+
+bool Mesh::writeBin(const char* filename, bool optimize)
+{
+	assert(getNumVertices());
+	if (cpu_data_released && !reloadCPUData())
+		return false;
+	if (optimize)
+		optimizeIndices();
+
 	std::string s_filename = filename;
 	s_filename += ".bin";
 
@@ -290,39 +818,40 @@ bool Mesh::writeBin(const char* filename)
 		return false;
 	}
 
-	//watermark
-	fwrite("MBIN",sizeof(char),4,f);
-
-	sMeshInfo info;
-	info.size = vertices.size();
-	info.aabb_max = aabb_max;
-	info.aabb_min = aabb_min;
-	info.center = center;
-	info.halfsize = halfsize;
-	info.radius = radius;
-
-	info.streams[0] = normals.size() ? 'N' : ' ';
-	info.streams[1] = uvs.size() ? 'U' : ' ';
-	info.streams[2] = colors.size() ? 'C' : ' ';
-	info.streams[3] = ' ';
+	sMeshInfoV2 header = sMeshInfoV2(); //value initialized, so it is zero initialized including the padding
+	header.version = MBIN_VERSION;
+	header.header_size = sizeof(sMeshInfoV2);
+	fillMeshInfo(this, header.info);
+
+	//compute the layout
+	unsigned int num = getNumVertices();
+	const void* streams[MBIN_INDICES + 1] = { getVerticesData(), getNormalsData(), getUVsData(), getColorsData(), getIndicesData() };
+	const size_t element_size[MBIN_INDICES + 1] = { sizeof(Vector3), sizeof(Vector3), sizeof(Vector2), sizeof(Vector4), sizeof(unsigned int) };
+	size_t offset = 4 + sizeof(sMeshInfoV2);
+	for (int i = 0; i <= MBIN_INDICES; i++)
+	{
+		if (!streams[i])
+			continue;
+		offset = alignOffset(offset);
+		header.offsets[i] = offset;
+		header.counts[i] = (i == MBIN_INDICES ? getNumIndices() : num);
+		offset += header.counts[i] * element_size[i];
+	}
 
-	for (size_t i = 0; i < 4; i++)
-		info.material_range[i] = material_range.size() > i ? material_range[i] : -1;
+	//watermark
+	fwrite("MBN2",sizeof(char),4,f);
 
 	//write info
-	fwrite((void*)&info, sizeof(sMeshInfo),1, f);
+	fwrite((void*)&header, sizeof(sMeshInfoV2),1, f);
 
 	//write streams
-	fwrite((void*)&vertices[0], vertices.size() * sizeof(Vector3), 1,f);
-	if (normals.size())
-		fwrite((void*)&normals[0],normals.size() * sizeof(Vector3), 1,f);
-	if (uvs.size())
-		fwrite((void*)&uvs[0], uvs.size() * sizeof(Vector2), 1,f);
-	if (colors.size())
-		fwrite((void*)&colors[0], colors.size() * sizeof(Vector4), 1,f);
+	size_t pos = 4 + sizeof(sMeshInfoV2);
+	for (int i = 0; i <= MBIN_INDICES; i++)
+		if (streams[i])
+			writeStream(f, pos, header.offsets[i], streams[i], header.counts[i] * element_size[i]);
 
 	fclose(f);
-	return false;
+	return true;
 }
 
 bool Mesh::loadASE(const char* filename, bool multimaterial)
@@ -475,6 +1004,9 @@ bool Mesh::loadASE(const char* filename, bool multimaterial)
 		normals[count*3+2]=Vector3(-nX,nZ,nY);
 	}
 
+	//ASE faces reference positions and uvs separately, merge the corners that are equal
+	weldVertices();
+
 	#ifndef SKIP_COLDET
 		createCollisionModel();
 	#endif
@@ -482,125 +1014,321 @@ bool Mesh::loadASE(const char* filename, bool multimaterial)
 	return true;
 }
 
-bool Mesh::loadOBJ(const char* filename, bool multimaterial)
+//OBJ indices of the position, uv and normal of a face corner (starting at 1, 0 means not used)
+struct sOBJVertexKey
 {
-	struct stat stbuffer;
-
-	FILE* f = fopen(filename,"rb");
-	if (f == NULL)
-	{
-		std::cerr << "File not found: " << filename << std::endl;
-		return false;
-	}
+	int position;
+	int uv;
+	int normal;
 
-	stat(filename,&stbuffer);
+	bool operator == (const sOBJVertexKey& k) const { return position == k.position && uv == k.uv && normal == k.normal; }
+};
 
-	unsigned int size = stbuffer.st_size;
-	char* data = new char[size+1];
-	fread(data,size,1,f);
-	fclose(f);
-	data[size] = 0;
+inline unsigned int hashOBJVertexKey(const sOBJVertexKey& k) { return (k.position * 73856093u) ^ (k.uv * 19349663u) ^ (k.normal * 83492791u); }
 
-	char* pos = data;
-	char line[255];
-	int i = 0;
+//which components of a corner were written as negative (relative) indices
+enum { OBJ_RELATIVE_POSITION = 1, OBJ_RELATIVE_UV = 2, OBJ_RELATIVE_NORMAL = 4 };
 
-	std::vector<Vector3> indexed_positions;
-	std::vector<Vector3> indexed_normals;
-	std::vector<Vector2> indexed_uvs;
+struct sOBJRelativeCorner
+{
+	unsigned int corner;
+	unsigned int components;
+};
 
-	const float max_float = 10000000;
-	const float min_float = -10000000;
-	aabb_min.set(max_float,max_float,max_float);
-	aabb_max.set(min_float,min_float,min_float);
+//everything read from the OBJ text, polygons are already split in triangles
+struct sOBJData
+{
+	std::vector<Vector3> positions;
+	std::vector<Vector2> uvs;
+	std::vector<Vector3> normals;
+	std::vector<sOBJVertexKey> corners; //three per triangle
+
+	//relative indices are resolved with the elements of this chunk of the file,
+	//when several chunks are merged they must be moved by the elements of the previous chunks
+	std::vector<sOBJRelativeCorner> relative_corners;
+};
+
+//reads a face corner: v, v/vt, v//vn or v/vt/vn, negative indices are relative to the last element read
+static const char* parseOBJCorner(const char* pos, const char* end, const sOBJData& data, sOBJVertexKey& key, unsigned int& relative)
+{
+	key.position = key.uv = key.normal = 0;
+	relative = 0;
 
-	unsigned int vertex_i = 0;
+	const char* next = parseInt(pos, end, key.position);
+	if (next == pos)
+		return pos;
+	pos = next;
 
-	//parse file
-	while(*pos != 0)
+	if (pos < end && *pos == '/')
 	{
-		if (*pos == '\n') pos++;
-		if (*pos == '\r') pos++;
-
-		//read one line
-		i = 0;
-		while(i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
-		memcpy(line,pos,i);
-		line[i] = 0;
-		pos = pos + i;
+		pos = parseInt(pos + 1, end, key.uv);
+		if (pos < end && *pos == '/')
+			pos = parseInt(pos + 1, end, key.normal);
+	}
 
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
-		if (*line == '#' || *line == 0) continue; //comment
+	if (key.position < 0) { key.position += (int)data.positions.size() + 1; relative |= OBJ_RELATIVE_POSITION; }
+	if (key.uv < 0) { key.uv += (int)data.uvs.size() + 1; relative |= OBJ_RELATIVE_UV; }
+	if (key.normal < 0) { key.normal += (int)data.normals.size() + 1; relative |= OBJ_RELATIVE_NORMAL; }
+	return pos;
+}
 
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line," ");
+static void addOBJCorner(sOBJData& data, const sOBJVertexKey& key, unsigned int relative)
+{
+	if (relative)
+	{
+		sOBJRelativeCorner r;
+		r.corner = (unsigned int)data.corners.size();
+		r.components = relative;
+		data.relative_corners.push_back(r);
+	}
+	data.corners.push_back(key);
+}
 
-		if (tokens.empty()) continue;
+//parses the text directly from the buffer, without copying lines or creating strings
+static bool parseOBJ(const char* pos, const char* end, sOBJData& data)
+{
+	while (pos < end)
+	{
+		pos = skipBlanks(pos, end);
+		if (pos == end)
+			break;
 
-		if (tokens[0] == "v" && tokens.size() == 4)
-		{
-			Vector3 v( (float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_positions.push_back(v);
+		char c = *pos;
+		char c2 = pos + 1 < end ? pos[1] : 0;
 
-			aabb_min.setMin( v );
-			aabb_max.setMax( v );
-		}
-		else if (tokens[0] == "vt" && tokens.size() == 4)
+		if (c == 'v' && isBlank(c2)) //position
 		{
-			Vector2 v( (float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()) );
-			indexed_uvs.push_back(v);
+			Vector3 v;
+			const char* p = skipBlanks(pos + 1, end);
+			p = skipBlanks(parseFloat(p, end, v.x), end);
+			p = skipBlanks(parseFloat(p, end, v.y), end);
+			const char* last = parseFloat(p, end, v.z);
+			if (last != p)
+				data.positions.push_back(v);
+			pos = last;
 		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
+		else if (c == 'v' && c2 == 't' && pos + 2 < end && isBlank(pos[2])) //texture coordinate, the third component is ignored
 		{
-			Vector3 v( (float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_normals.push_back(v);
+			Vector2 v;
+			const char* p = skipBlanks(pos + 2, end);
+			p = skipBlanks(parseFloat(p, end, v.x), end);
+			const char* last = parseFloat(p, end, v.y);
+			if (last != p)
+				data.uvs.push_back(v);
+			pos = last;
 		}
-		else if (tokens[0] == "s") //surface? it appears one time before the faces
+		else if (c == 'v' && c2 == 'n' && pos + 2 < end && isBlank(pos[2])) //normal
 		{
-			//process mesh
-			if (uvs.size() == 0 && indexed_uvs.size() )
-				uvs.resize(1);
+			Vector3 v;
+			const char* p = skipBlanks(pos + 2, end);
+			p = skipBlanks(parseFloat(p, end, v.x), end);
+			p = skipBlanks(parseFloat(p, end, v.y), end);
+			const char* last = parseFloat(p, end, v.z);
+			if (last != p)
+				data.normals.push_back(v);
+			pos = last;
 		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
+		else if (c == 'f' && isBlank(c2)) //face with any number of corners, triangulated as a fan
 		{
-			Vector3 v1,v2,v3;
-			v1.parseFromText( tokens[1].c_str(), '/' );
-
-			for (size_t iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
+			sOBJVertexKey first, previous, key;
+			unsigned int first_relative = 0, previous_relative = 0, relative = 0;
+			int num_corners = 0;
+			pos += 1;
+			while (true)
 			{
-				v2.parseFromText( tokens[iPoly].c_str(), '/' );
-				v3.parseFromText( tokens[iPoly+1].c_str(), '/' );
+				pos = skipBlanks(pos, end);
+				if (pos == end || isEndOfLine(*pos) || *pos == '#')
+					break;
 
-				vertices.push_back( indexed_positions[ unsigned int(v1.x) -1 ] );
-				vertices.push_back( indexed_positions[ unsigned int(v2.x) -1] );
-				vertices.push_back( indexed_positions[ unsigned int(v3.x) -1] );
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
+				const char* next = parseOBJCorner(pos, end, data, key, relative);
+				if (next == pos)
+					return false;
+				pos = next;
 
-				if (indexed_uvs.size() > 0)
+				if (num_corners == 0)
 				{
-					uvs.push_back( indexed_uvs[ unsigned int(v1.y) -1] );
-					uvs.push_back( indexed_uvs[ unsigned int(v2.y) -1] );
-					uvs.push_back( indexed_uvs[ unsigned int(v3.y) -1] );
+					first = key;
+					first_relative = relative;
 				}
-
-				if (indexed_normals.size() > 0)
+				else if (num_corners >= 2)
 				{
-					normals.push_back( indexed_normals[ unsigned int(v1.z) -1] );
-					normals.push_back( indexed_normals[ unsigned int(v2.z) -1] );
-					normals.push_back( indexed_normals[ unsigned int(v3.z) -1] );
+					addOBJCorner(data, first, first_relative);
+					addOBJCorner(data, previous, previous_relative);
+					addOBJCorner(data, key, relative);
 				}
+				previous = key;
+				previous_relative = relative;
+				num_corners++;
 			}
 		}
+
+		//comments, groups, materials, the rest of the line...
+		pos = skipLine(pos, end);
+	}
+
+	return true;
+}
+
+#define OBJ_MIN_CHUNK_SIZE (1 << 20) //smaller files are not worth splitting
+
+//splits the text in chunks that end at a line break and parses every chunk in its own thread,
+//the result is the same as parsing the whole text with parseOBJ
+static bool parseOBJParallel(const char* begin, const char* end, int num_threads, sOBJData& data)
+{
+	std::vector<const char*> limits(num_threads + 1, end);
+	limits[0] = begin;
+	for (int i = 1; i < num_threads; ++i)
+	{
+		const char* pos = begin + (end - begin) / num_threads * i;
+		if (pos < limits[i-1])
+			pos = limits[i-1];
+		limits[i] = skipLine(pos, end);
+	}
+
+	std::vector<sOBJData> chunks(num_threads);
+	std::vector<char> results(num_threads, 0);
+	std::vector<std::thread> threads;
+	for (int i = 1; i < num_threads; ++i)
+		threads.push_back( std::thread( [&, i]() { results[i] = parseOBJ(limits[i], limits[i+1], chunks[i]); } ) );
+	results[0] = parseOBJ(limits[0], limits[1], chunks[0]);
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+
+	for (int i = 0; i < num_threads; ++i)
+		if (!results[i])
+			return false;
+
+	//merge in file order, fixing the relative indices with the elements of the previous chunks
+	size_t num_positions = 0, num_uvs = 0, num_normals = 0, num_corners = 0;
+	for (int i = 0; i < num_threads; ++i)
+	{
+		num_positions += chunks[i].positions.size();
+		num_uvs += chunks[i].uvs.size();
+		num_normals += chunks[i].normals.size();
+		num_corners += chunks[i].corners.size();
+	}
+	data.positions.reserve(num_positions);
+	data.uvs.reserve(num_uvs);
+	data.normals.reserve(num_normals);
+	data.corners.reserve(num_corners);
+
+	for (int i = 0; i < num_threads; ++i)
+	{
+		sOBJData& chunk = chunks[i];
+		for (size_t j = 0; j < chunk.relative_corners.size(); ++j)
+		{
+			sOBJVertexKey& key = chunk.corners[ chunk.relative_corners[j].corner ];
+			unsigned int components = chunk.relative_corners[j].components;
+			if (components & OBJ_RELATIVE_POSITION) key.position += (int)data.positions.size();
+			if (components & OBJ_RELATIVE_UV) key.uv += (int)data.uvs.size();
+			if (components & OBJ_RELATIVE_NORMAL) key.normal += (int)data.normals.size();
+		}
+
+		data.positions.insert( data.positions.end(), chunk.positions.begin(), chunk.positions.end() );
+		data.uvs.insert( data.uvs.end(), chunk.uvs.begin(), chunk.uvs.end() );
+		data.normals.insert( data.normals.end(), chunk.normals.begin(), chunk.normals.end() );
+		data.corners.insert( data.corners.end(), chunk.corners.begin(), chunk.corners.end() );
+		std::vector<sOBJVertexKey>().swap( chunk.corners ); //free memory as soon as possible
+	}
+
+	return true;
+}
+
+bool Mesh::loadOBJ(const char* filename, bool multimaterial)
+{
+	MappedFile file;
+	if (!file.open(filename))
+	{
+		std::cerr << "File not found: " << filename << std::endl;
+		return false;
+	}
+
+	int num_threads = num_loading_threads > 0 ? num_loading_threads : (int)std::thread::hardware_concurrency();
+	if (num_threads > (int)(file.size / OBJ_MIN_CHUNK_SIZE))
+		num_threads = (int)(file.size / OBJ_MIN_CHUNK_SIZE);
+
+	sOBJData data;
+	bool parsed = num_threads > 1 ? parseOBJParallel(file.data, file.data + file.size, num_threads, data) : parseOBJ(file.data, file.data + file.size, data);
+	if (!parsed)
+	{
+		std::cerr << "Wrong face in OBJ: " << filename << std::endl;
+		return false;
+	}
+	file.close();
+
+	const float max_float = 10000000;
+	const float min_float = -10000000;
+	aabb_min.set(max_float,max_float,max_float);
+	aabb_max.set(min_float,min_float,min_float);
+	for (size_t i = 0; i < data.positions.size(); ++i)
+	{
+		aabb_min.setMin( data.positions[i] );
+		aabb_max.setMax( data.positions[i] );
 	}
 
+	bool has_uvs = !data.uvs.empty();
+	bool has_normals = !data.normals.empty();
+
+	//every different position/uv/normal triplet used by the faces becomes one vertex,
+	//they are found using an open addressing table (with the vertex index) so there is no allocation per corner
+	std::vector<sOBJVertexKey> vertex_keys;
+	std::vector<unsigned int> table;
+	const unsigned int empty = (unsigned int)-1;
+	unsigned int table_mask = 0;
+
+	vertex_keys.reserve( data.positions.size() );
+	vertices.reserve( data.positions.size() );
+	indices.reserve( data.corners.size() );
+
+	for (size_t i = 0; i < data.corners.size(); ++i)
+	{
+		sOBJVertexKey key = data.corners[i];
+		if (!has_uvs) key.uv = 0;
+		if (!has_normals) key.normal = 0;
+
+		if (key.position < 1 || key.position > (int)data.positions.size() || key.uv < 0 || key.uv > (int)data.uvs.size() || key.normal < 0 || key.normal > (int)data.normals.size())
+		{
+			std::cerr << "Wrong face index in OBJ: " << filename << std::endl;
+			clear();
+			return false;
+		}
+
+		//keep the table at most half full
+		if (vertex_keys.size() * 2 >= table.size())
+		{
+			table.assign( table.empty() ? 1024 : table.size() * 2, empty );
+			table_mask = (unsigned int)table.size() - 1;
+			for (unsigned int v = 0; v < vertex_keys.size(); ++v)
+			{
+				unsigned int slot = hashOBJVertexKey( vertex_keys[v] ) & table_mask;
+				while (table[slot] != empty)
+					slot = (slot + 1) & table_mask;
+				table[slot] = v;
+			}
+		}
 
+		unsigned int slot = hashOBJVertexKey(key) & table_mask;
+		while (table[slot] != empty && !(vertex_keys[ table[slot] ] == key))
+			slot = (slot + 1) & table_mask;
+
+		if (table[slot] == empty) //first time we see this corner
+		{
+			table[slot] = (unsigned int)vertex_keys.size();
+			vertex_keys.push_back(key);
+			vertices.push_back( data.positions[ key.position - 1 ] );
+			if (has_uvs)
+				uvs.push_back( key.uv ? data.uvs[ key.uv - 1 ] : Vector2() );
+			if (has_normals)
+				normals.push_back( key.normal ? data.normals[ key.normal - 1 ] : Vector3() );
+		}
+		indices.push_back( table[slot] );
+	}
 
 	center = (aabb_max + aabb_min) * 0.5;
 	halfsize = (aabb_max - center) * 2;
 	radius = max( aabb_max.length(), aabb_min.length() );
 
-	material_range.push_back(vertices.size() / 3.0);
+	material_range.push_back(indices.size() / 3);
 
 	#ifndef SKIP_COLDET
 		createCollisionModel();
@@ -608,192 +1336,432 @@ bool Mesh::loadOBJ(const char* filename, bool multimaterial)
 	return true;
 }
 
-
 void Mesh::render(unsigned int submesh_id, bool ignore_vram )
 {
-	//int count;
-	assert(vertices.size() && "No vertices in this mesh");
+	if (!bind(ignore_vram))
+		return;
+	draw(submesh_id);
+	unbind();
+}
 
-	bool creating_calllist = false;
+//enables the arrays of the mesh, several submeshes or copies can be drawn before calling unbind
+bool Mesh::bind(bool ignore_vram)
+{
+	if (is_loading) //still in the ResourceLoader
+		return false;
+	touch();
 
-	num_meshes_rendered++;
-	num_triangles_rendered += vertices.size() / 3;
+	unsigned int num_vertices = getNumVertices();
+	assert(num_vertices && "No vertices in this mesh");
+	assert(bound_arrays == 0 && "Mesh already bound");
 
-	//first time rendering
-	/*
-	if ((use_vram && !ignore_vram ) && calllist_id.empty())
-	{
-		calllist_id.resize( material_range.size() );
-		for (int i = 0; i < calllist_id.size(); i++)
-			calllist_id[i] = 0;
-	}
+	bool vbos = use_vram && !ignore_vram;
+	if (!vbos && cpu_data_released && !reloadCPUData()) //vertex arrays need the streams
+		return false;
+	if (vbos && vertices_vbo_id == 0)
+		uploadToVRAM(); //it could release the streams, from here the VBO ids tell which streams there are
 
-	if (!ignore_vram)
-	{	
-		//create
-		if (calllist_id[ submesh_id ] == 0)
-		{
-			calllist_id[ submesh_id ] = glGenLists(1);
-			glNewList(calllist_id[ submesh_id ], GL_COMPILE );
-			creating_calllist = true;
-		}  
-		else //use
-		{
-			glCallList( calllist_id[ submesh_id ] );
-			return;
-		}
-	}
-	*/
+	bound_arrays = BOUND_VERTICES;
+	if (vbos)
+		bound_arrays |= BOUND_VBOS;
 
 	//use vbos
-	if (use_vram && !ignore_vram) //vertex buffer objects
+	if (vbos && vertex_packed) //enablePackedArrays takes care of all the attributes
+	{
+		bound_arrays |= BOUND_PACKED;
+		enablePackedArrays();
+	}
+	else if (vbos) //vertex buffer objects
 	{
-		if (vertices_vbo_id == 0)
-			uploadToVRAM();
-
 		glEnableClientState(GL_VERTEX_ARRAY);
 		glBindBufferARB( GL_ARRAY_BUFFER_ARB, vertices_vbo_id );
 		glVertexPointer( 3, GL_FLOAT, 0, (char *) NULL );
 
-		if (normals.size())
+		if (normals_vbo_id)
 		{
+			bound_arrays |= BOUND_NORMALS;
 			glEnableClientState(GL_NORMAL_ARRAY);
 			glBindBufferARB( GL_ARRAY_BUFFER_ARB, normals_vbo_id );
 			glNormalPointer(GL_FLOAT, 0, (char *) NULL );
 		}
 
-		if (uvs.size())
+		if (texcoords_vbo_id)
 		{
+			bound_arrays |= BOUND_UVS;
 			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 			glBindBufferARB( GL_ARRAY_BUFFER_ARB, texcoords_vbo_id );
 			glTexCoordPointer( 2, GL_FLOAT, 0, (char *) NULL );
 		}
 
-		if (colors.size())
+		if (colors_vbo_id)
 		{
+			bound_arrays |= BOUND_COLORS;
 			glEnableClientState(GL_COLOR_ARRAY );
 			glBindBufferARB( GL_ARRAY_BUFFER_ARB, colors_vbo_id );
-			glColorPointer(4,GL_FLOAT, 0, &colors[0] );
+			glColorPointer(4,GL_FLOAT, 0, (char *) NULL );
 		}
 	}
 	else //vertex arrays
 	{
-		if (normals.size())
+		if (getNormalsData())
 		{
+			bound_arrays |= BOUND_NORMALS;
 			glEnableClientState(GL_NORMAL_ARRAY);
-			glNormalPointer(GL_FLOAT, 0, &normals[0] );
+			glNormalPointer(GL_FLOAT, 0, getNormalsData() );
 		}
 		
-		if (uvs.size())
+		if (getUVsData())
 		{
+			bound_arrays |= BOUND_UVS;
 			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-			glTexCoordPointer(2,GL_FLOAT, 0, &uvs[0] );
+			glTexCoordPointer(2,GL_FLOAT, 0, getUVsData() );
 		}
 
-		if (colors.size())
+		if (getColorsData())
 		{
+			bound_arrays |= BOUND_COLORS;
 			glEnableClientState(GL_COLOR_ARRAY );
-			glColorPointer(4,GL_FLOAT, 0, &colors[0] );
+			glColorPointer(4,GL_FLOAT, 0, getColorsData() );
 		}
 
 		glEnableClientState(GL_VERTEX_ARRAY);
-		glVertexPointer(3, GL_FLOAT, 0, &vertices[0] );
+		glVertexPointer(3, GL_FLOAT, 0, getVerticesData() );
 	}
 
-	int start = 0;
-	if (submesh_id > 0) 
-		material_range[submesh_id-1] *= 3;
-	int size = vertices.size();
+	return true;
+}
+
+//the indices (or vertices if it is not indexed) of a submesh
+void Mesh::getSubmeshRange(unsigned int submesh_id, unsigned int& start, unsigned int& size) const
+{
+	//material_range stores the triangle where every submesh ends
+	start = 0;
+	size = getNumIndices() > 0 ? getNumIndices() : getNumVertices();
 	if (!material_range.empty())
+	{
+		assert(submesh_id < material_range.size());
+		start = (submesh_id > 0 ? material_range[submesh_id-1] : 0) * 3;
 		size = material_range[submesh_id]*3 - start;
+	}
+}
 
-	glDrawArrays(primitive, start, size);
-	//glDrawArrays(primitive, 0, vertices.size() ); //all
+//draws a submesh with the arrays enabled by bind and the current modelview
+void Mesh::draw(unsigned int submesh_id)
+{
+	assert(bound_arrays && "Mesh not bound");
 
-	if (vertices_vbo_id)
+	bool indexed = getNumIndices() > 0;
+	unsigned int start, size;
+	getSubmeshRange(submesh_id, start, size);
+
+	num_meshes_rendered++;
+	num_triangles_rendered += size / 3;
+
+	//the quantized positions are relative to the bounding box, it is undone in the modelview
+	bool decode_positions = (bound_arrays & BOUND_PACKED) && vertex_layout.format.position != POSITION_FLOAT;
+	if (decode_positions)
+	{
+		glPushMatrix();
+		glTranslatef( vertex_layout.position_bias.x, vertex_layout.position_bias.y, vertex_layout.position_bias.z );
+		float scale = vertex_layout.position_scale;
+		glScalef( scale, scale, scale );
+	}
+
+	if (indexed)
+	{
+		if (bound_arrays & BOUND_VBOS)
+		{
+			glBindBufferARB( GL_ELEMENT_ARRAY_BUFFER_ARB, indices_vbo_id );
+			glDrawElements(primitive, size, GL_UNSIGNED_INT, (char *) NULL + start * sizeof(unsigned int) );
+			glBindBufferARB( GL_ELEMENT_ARRAY_BUFFER_ARB, 0 );
+		}
+		else
+			glDrawElements(primitive, size, GL_UNSIGNED_INT, getIndicesData() + start );
+	}
+	else
+		glDrawArrays(primitive, start, size);
+
+	if (decode_positions)
+		glPopMatrix();
+}
+
+bool Mesh::supportsInstancing()
+{
+	return glDrawArraysInstancedARB && glDrawElementsInstancedARB && glVertexAttribDivisorARB;
+}
+
+bool Mesh::getPositionDecode(Vector3& bias, float& scale) const
+{
+	if ((bound_arrays & BOUND_PACKED) && vertex_layout.format.position != POSITION_FLOAT)
+	{
+		bias = vertex_layout.position_bias;
+		scale = vertex_layout.position_scale;
+		return true;
+	}
+	bias.set(0,0,0);
+	scale = 1;
+	return false;
+}
+
+//one copy of the submesh per instance, the model and color of every copy come from the instance attributes
+void Mesh::drawInstanced(unsigned int submesh_id, unsigned int num_instances, const InstanceData* instances)
+{
+	assert(bound_arrays && "Mesh not bound");
+	assert(supportsInstancing());
+	if (num_instances == 0)
+		return;
+
+	bool indexed = getNumIndices() > 0;
+	unsigned int start, size;
+	getSubmeshRange(submesh_id, start, size);
+
+	num_meshes_rendered += num_instances;
+	num_triangles_rendered += size / 3 * num_instances;
+
+	const char* base = (const char*)instances;
+	for (int i = 0; i < 4; ++i)
+	{
+		glEnableVertexAttribArrayARB( VERTEX_ATTRIB_INSTANCE_MODEL + i );
+		glVertexAttribPointerARB( VERTEX_ATTRIB_INSTANCE_MODEL + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), base + offsetof(InstanceData, model) + i * 4 * sizeof(float) );
+		glVertexAttribDivisorARB( VERTEX_ATTRIB_INSTANCE_MODEL + i, 1 );
+	}
+	glEnableVertexAttribArrayARB( VERTEX_ATTRIB_INSTANCE_COLOR );
+	glVertexAttribPointerARB( VERTEX_ATTRIB_INSTANCE_COLOR, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), base + offsetof(InstanceData, color) );
+	glVertexAttribDivisorARB( VERTEX_ATTRIB_INSTANCE_COLOR, 1 );
+
+	if (indexed)
+	{
+		if (bound_arrays & BOUND_VBOS)
+		{
+			glBindBufferARB( GL_ELEMENT_ARRAY_BUFFER_ARB, indices_vbo_id );
+			glDrawElementsInstancedARB( primitive, size, GL_UNSIGNED_INT, (char *) NULL + start * sizeof(unsigned int), num_instances );
+			glBindBufferARB( GL_ELEMENT_ARRAY_BUFFER_ARB, 0 );
+		}
+		else
+			glDrawElementsInstancedARB( primitive, size, GL_UNSIGNED_INT, getIndicesData() + start, num_instances );
+	}
+	else
+		glDrawArraysInstancedARB( primitive, start, size, num_instances );
+
+	//the divisors stay in the attributes, the regular draws must find them at 0
+	for (int i = 0; i < 4; ++i)
+	{
+		glVertexAttribDivisorARB( VERTEX_ATTRIB_INSTANCE_MODEL + i, 0 );
+		glDisableVertexAttribArrayARB( VERTEX_ATTRIB_INSTANCE_MODEL + i );
+	}
+	glVertexAttribDivisorARB( VERTEX_ATTRIB_INSTANCE_COLOR, 0 );
+	glDisableVertexAttribArrayARB( VERTEX_ATTRIB_INSTANCE_COLOR );
+}
+
+void Mesh::unbind()
+{
+	if (bound_arrays & BOUND_PACKED)
+		disablePackedArrays();
+
+	if (bound_arrays & BOUND_VBOS)
 		glBindBufferARB( GL_ARRAY_BUFFER_ARB, 0 );
 
 	glDisableClientState(GL_VERTEX_ARRAY);
 
-	if (normals.size())
+	if (bound_arrays & BOUND_NORMALS)
 		glDisableClientState(GL_NORMAL_ARRAY);
-	if (uvs.size())
+	if (bound_arrays & BOUND_UVS)
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-	if (colors.size())
+	if (bound_arrays & BOUND_COLORS)
 		glDisableClientState(GL_COLOR_ARRAY);
 
-	if (creating_calllist)
+	bound_arrays = 0;
+}
+
+//binds the single VBO of a packed format, the quantized uvs are decoded with the texture matrix (the positions in draw)
+void Mesh::enablePackedArrays()
+{
+	const VertexLayout& layout = vertex_layout;
+	const VertexFormat& format = layout.format;
+	char* base = NULL;
+
+	glBindBufferARB( GL_ARRAY_BUFFER_ARB, vertices_vbo_id );
+	glPushAttrib( GL_ENABLE_BIT | GL_TRANSFORM_BIT );
+
+	if (layout.position_scale != 1.0f)
+		glEnable( GL_RESCALE_NORMAL ); //the uniform scale used to decode the positions would change the length of the normals
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer( 3, format.position == POSITION_FLOAT ? GL_FLOAT : (format.position == POSITION_HALF ? GL_HALF_FLOAT_ARB : GL_SHORT), layout.strides[VERTEX_POSITION], base + layout.offsets[VERTEX_POSITION] );
+
+	if (layout.offsets[VERTEX_NORMAL] != -1)
 	{
-		glEndList();
-		glCallList( calllist_id[ submesh_id ] );
+		if (format.normal == NORMAL_OCT16)
+		{
+			glEnableVertexAttribArrayARB( VERTEX_ATTRIB_OCT_NORMAL );
+			glVertexAttribPointerARB( VERTEX_ATTRIB_OCT_NORMAL, 2, GL_SHORT, GL_TRUE, layout.strides[VERTEX_NORMAL], base + layout.offsets[VERTEX_NORMAL] );
+		}
+		else
+		{
+			glEnableClientState(GL_NORMAL_ARRAY);
+			glNormalPointer( format.normal == NORMAL_FLOAT ? GL_FLOAT : GL_BYTE, layout.strides[VERTEX_NORMAL], base + layout.offsets[VERTEX_NORMAL] );
+		}
+	}
+
+	if (layout.offsets[VERTEX_UV] != -1)
+	{
+		if (format.uv != UV_FLOAT)
+		{
+			glMatrixMode( GL_TEXTURE );
+			glPushMatrix();
+			glLoadIdentity();
+			glTranslatef( layout.uv_bias.x, layout.uv_bias.y, 0 );
+			glScalef( layout.uv_scale.x, layout.uv_scale.y, 1 );
+			glMatrixMode( GL_MODELVIEW );
+		}
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer( 2, format.uv == UV_FLOAT ? GL_FLOAT : GL_SHORT, layout.strides[VERTEX_UV], base + layout.offsets[VERTEX_UV] );
+	}
+
+	if (layout.offsets[VERTEX_COLOR] != -1)
+	{
+		glEnableClientState(GL_COLOR_ARRAY);
+		glColorPointer( 4, format.color == COLOR_FLOAT ? GL_FLOAT : GL_UNSIGNED_BYTE, layout.strides[VERTEX_COLOR], base + layout.offsets[VERTEX_COLOR] );
 	}
 }
 
+void Mesh::disablePackedArrays()
+{
+	const VertexLayout& layout = vertex_layout;
+	const VertexFormat& format = layout.format;
+
+	if (layout.offsets[VERTEX_NORMAL] != -1)
+	{
+		if (format.normal == NORMAL_OCT16)
+			glDisableVertexAttribArrayARB( VERTEX_ATTRIB_OCT_NORMAL );
+		else
+			glDisableClientState(GL_NORMAL_ARRAY);
+	}
+	if (layout.offsets[VERTEX_UV] != -1)
+	{
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		if (format.uv != UV_FLOAT)
+		{
+			glMatrixMode( GL_TEXTURE );
+			glPopMatrix();
+		}
+	}
+	if (layout.offsets[VERTEX_COLOR] != -1)
+		glDisableClientState(GL_COLOR_ARRAY);
+
+	glPopAttrib(); //restores the matrix mode and GL_RESCALE_NORMAL
+}
+
 void Mesh::uploadToVRAM()
 {
-	assert(vertices.size() && vertices_vbo_id == 0);
+	unsigned int num_vertices = getNumVertices();
+	assert(num_vertices && vertices_vbo_id == 0);
 	if (glGenBuffersARB == 0)
 	{
 		std::cout << "Error: your graphics cards dont support VBOs. Sorry." << std::endl;
 		exit(0);
 	}
 
-	// Vertices
-	glGenBuffersARB( 1, &vertices_vbo_id );
-	glBindBufferARB( GL_ARRAY_BUFFER_ARB, vertices_vbo_id );
-	glBufferDataARB( GL_ARRAY_BUFFER_ARB, vertices.size()*3*sizeof(float), &vertices[0], GL_STATIC_DRAW_ARB );
-
-	// UVs
-	if (uvs.size())
+	//packed formats go in a single VBO
+	if (!vertex_format.isDefault())
 	{
-		glGenBuffersARB( 1, &texcoords_vbo_id );
-		glBindBufferARB( GL_ARRAY_BUFFER_ARB, texcoords_vbo_id );
-		glBufferDataARB( GL_ARRAY_BUFFER_ARB, uvs.size()*2*sizeof(float), &uvs[0], GL_STATIC_DRAW_ARB );
-	}
+		std::vector<unsigned char> buffer;
+		vertex_layout = packVertices( vertex_format, num_vertices, getVerticesData(), getNormalsData(), getUVsData(), getColorsData(), buffer );
+		vertex_packed = true;
 
-	// Normals
-	if (normals.size())
+		glGenBuffersARB( 1, &vertices_vbo_id );
+		glBindBufferARB( GL_ARRAY_BUFFER_ARB, vertices_vbo_id );
+		glBufferDataARB( GL_ARRAY_BUFFER_ARB, buffer.size(), &buffer[0], GL_STATIC_DRAW_ARB );
+		glBindBufferARB( GL_ARRAY_BUFFER_ARB, 0 );
+		vram_bytes = buffer.size();
+
+		VertexFormatStats stats = measureVertexFormat( vertex_layout, buffer, num_vertices, getVerticesData(), getNormalsData(), getUVsData(), getColorsData() );
+		std::cout << "Mesh packed: " << name << " " << stats.float_bytes_per_vertex << " -> " << stats.bytes_per_vertex << " bytes per vertex, max error: position " << stats.position_error
+			<< " normal " << stats.normal_error << "deg uv " << stats.uv_error << " color " << stats.color_error << std::endl;
+	}
+	else
 	{
-		glGenBuffersARB( 1, &normals_vbo_id );
-		glBindBufferARB( GL_ARRAY_BUFFER_ARB, normals_vbo_id );
-		glBufferDataARB( GL_ARRAY_BUFFER_ARB, normals.size()*3*sizeof(float), &normals[0], GL_STATIC_DRAW_ARB );
+		// Vertices
+		glGenBuffersARB( 1, &vertices_vbo_id );
+		glBindBufferARB( GL_ARRAY_BUFFER_ARB, vertices_vbo_id );
+		glBufferDataARB( GL_ARRAY_BUFFER_ARB, num_vertices*3*sizeof(float), getVerticesData(), GL_STATIC_DRAW_ARB );
+
+		// UVs
+		if (getUVsData())
+		{
+			glGenBuffersARB( 1, &texcoords_vbo_id );
+			glBindBufferARB( GL_ARRAY_BUFFER_ARB, texcoords_vbo_id );
+			glBufferDataARB( GL_ARRAY_BUFFER_ARB, num_vertices*2*sizeof(float), getUVsData(), GL_STATIC_DRAW_ARB );
+		}
+
+		// Normals
+		if (getNormalsData())
+		{
+			glGenBuffersARB( 1, &normals_vbo_id );
+			glBindBufferARB( GL_ARRAY_BUFFER_ARB, normals_vbo_id );
+			glBufferDataARB( GL_ARRAY_BUFFER_ARB, num_vertices*3*sizeof(float), getNormalsData(), GL_STATIC_DRAW_ARB );
+		}
+
+		// Colors
+		if (getColorsData())
+		{
+			glGenBuffersARB( 1, &colors_vbo_id );
+			glBindBufferARB( GL_ARRAY_BUFFER_ARB, colors_vbo_id );
+			glBufferDataARB( GL_ARRAY_BUFFER_ARB, num_vertices*4*sizeof(float), getColorsData(), GL_STATIC_DRAW_ARB );
+		}
+
+		glBindBufferARB( GL_ARRAY_BUFFER_ARB, 0 );
+		vram_bytes = num_vertices * sizeof(float) * (3 + (getUVsData() ? 2 : 0) + (getNormalsData() ? 3 : 0) + (getColorsData() ? 4 : 0));
 	}
 
-	// Colors
-	if (colors.size())
+	// Indices
+	if (getIndicesData())
 	{
-		glGenBuffersARB( 1, &colors_vbo_id );
-		glBindBufferARB( GL_ARRAY_BUFFER_ARB, colors_vbo_id );
-		glBufferDataARB( GL_ARRAY_BUFFER_ARB, colors.size()*4*sizeof(float), &colors[0], GL_STATIC_DRAW_ARB );
+		glGenBuffersARB( 1, &indices_vbo_id );
+		glBindBufferARB( GL_ELEMENT_ARRAY_BUFFER_ARB, indices_vbo_id );
+		glBufferDataARB( GL_ELEMENT_ARRAY_BUFFER_ARB, getNumIndices()*sizeof(unsigned int), getIndicesData(), GL_STATIC_DRAW_ARB );
+		glBindBufferARB( GL_ELEMENT_ARRAY_BUFFER_ARB, 0 );
 	}
 
-	glBindBufferARB( GL_ARRAY_BUFFER_ARB, 0 );
-
 	checkGLErrors();
 
+	vram_bytes += (getIndicesData() ? getNumIndices() : 0) * sizeof(unsigned int);
+
 	//clear buffers to save memory
+	if (release_cpu_data)
+		releaseCPUData();
 }
 
 void Mesh::renderDebug()
 {
+	if (cpu_data_released && !reloadCPUData())
+		return;
+
 	size_t count;
+	size_t num_vertices = getNumVertices();
+	const Vector3* vertices = getVerticesData();
+	const Vector3* normals = getNormalsData();
+	const unsigned int* indices = getIndicesData();
+	size_t num_corners = indices ? getNumIndices() : num_vertices;
 	glPointSize(3.0f);
 	glColor3f(1.0f,0.0f,0.0f);
 
 	glBegin(GL_POINTS);
-	for(count=0;count<vertices.size();count++)
+	for(count=0;count<num_vertices;count++)
 		glVertex3f(vertices[count].x,vertices[count].y,vertices[count].z);
 	glEnd();
 
 	glColor3f(0.3f,0.3f,0.3f);
 	glBegin(GL_TRIANGLES);
-		for(count=0;count<vertices.size();count++)
-			glVertex3f(vertices[count].x,vertices[count].y,vertices[count].z);
+		for(count=0;count<num_corners;count++)
+			glVertex3fv( vertices[ indices ? indices[count] : count ].v );
 	glEnd();
 
+	if (!normals)
+		return;
+
 	glColor3f(0.0f,1.0f,0.0f);
 	glBegin(GL_LINES);
-	for(count=0;count<normals.size();count++)
+	for(count=0;count<num_vertices;count++)
 	{
 		glVertex3fv( vertices[count].v );
 		glVertex3fv( (vertices[count] + normals[count] * 3).v );
@@ -832,6 +1800,7 @@ void Mesh::createSolidBox(float sizex, float sizey, float sizez)
 		vertices[i] *= size;
 
 	material_range.push_back(vertices.size()/3);
+	weldVertices();
 }
 
 void Mesh::createWireBox(float sizex, float sizey, float sizez)
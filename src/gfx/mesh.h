@@ -3,17 +3,33 @@
 
 #include <vector>
 #include "../utils/math.h"
+#include "../utils/resource.h"
 #include "../extra/coldet/coldet.h"
+#include "meshoptimizer.h"
+#include "vertexformat.h"
 
 #include <map>
 #include <string>
 
-class Mesh
+class MappedFile;
+
+//per instance attributes of Mesh::drawInstanced, the shaders read them from VERTEX_ATTRIB_INSTANCE_MODEL and _COLOR
+struct InstanceData
+{
+	float model[16]; //modelworld, not a Matrix44 so the stride has no padding
+	Vector4 color;
+};
+static_assert(sizeof(InstanceData) == 20 * sizeof(float), "it is uploaded as is, the stride must be 80 bytes");
+
+class Mesh : public Resource
 {
 public:
 	static std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
 	static bool use_vram;
 	static bool use_binary;
+	static bool release_cpu_data; //frees the streams once they are in VRAM, they are read again from the .bin when needed
+	static VertexFormat default_vertex_format; //format of the new meshes, floats in separated VBOs unless changed
+	static int num_loading_threads; //threads used to parse OBJ files, 0 uses one per core, 1 parses in the calling thread
 	static long num_meshes_rendered;
 	static long num_triangles_rendered;
 	static bool s_initialized;
@@ -27,6 +43,18 @@ public:
 	std::vector< Vector3 > normals;	 //here we store the normals
 	std::vector< Vector2 > uvs;	 //here we store the texture coordinates
 	std::vector< Vector4 > colors; //here we store the colors
+	std::vector< unsigned int > indices; //triangles using the vertices, empty if the mesh is not indexed
+
+	//when loaded from a MBIN v2 file the streams are not copied to the vectors,
+	//they point straight into the file mapping until the mesh is modified (see makeEditable)
+	MappedFile* mapped_file;
+	unsigned int mapped_size;
+	const Vector3* mapped_vertices;
+	const Vector3* mapped_normals;
+	const Vector2* mapped_uvs;
+	const Vector4* mapped_colors;
+	unsigned int mapped_num_indices;
+	const unsigned int* mapped_indices;
 
 	Vector3 aabb_min;
 	Vector3	aabb_max;
@@ -40,12 +68,40 @@ public:
 	unsigned int texcoords_vbo_id;
 	unsigned int normals_vbo_id;
 	unsigned int colors_vbo_id;
+	unsigned int indices_vbo_id;
+	size_t vram_bytes; //size of the VBOs
+
+	VertexFormat vertex_format; //how the vertices are stored in VRAM, change it before they are uploaded
+	VertexLayout vertex_layout; //filled when uploaded with a packed format, everything goes to vertices_vbo_id
+	bool vertex_packed;
+
+	enum { BOUND_VERTICES = 1, BOUND_VBOS = 2, BOUND_PACKED = 4, BOUND_NORMALS = 8, BOUND_UVS = 16, BOUND_COLORS = 32 };
+	char bound_arrays; //what bind enabled, 0 when not bound
+
+	//when the streams are released (see release_cpu_data) the counts are kept so the mesh can still be rendered from the VBOs
+	bool cpu_data_released;
+	unsigned int released_num_vertices;
+	unsigned int released_num_indices;
+	std::string bin_filename; //.bin the mesh was read from or written to, empty if it cannot be reloaded
+
+	bool is_loading; //true while a worker thread fills the mesh (see LoadAsync), it must not be used until then
 
 	Mesh();
 	~Mesh();
 
 	void clear();
-	void render(unsigned int submesh_id = 0, bool ignore_vram = false);
+	void render(unsigned int submesh_id = 0, bool ignore_vram = false); //bind, draw and unbind
+
+	//to draw several submeshes or copies of the mesh without enabling the arrays every time
+	bool bind(bool ignore_vram = false); //false if it cannot be rendered yet
+	void draw(unsigned int submesh_id = 0);
+	void unbind();
+
+	//several copies of a submesh in one call, only with a shader that reads the instance attributes. instances is the pointer
+	//for the attributes, an offset in the VBO bound to GL_ARRAY_BUFFER or an address in RAM. The shader decodes the positions
+	static bool supportsInstancing();
+	void drawInstanced(unsigned int submesh_id, unsigned int num_instances, const InstanceData* instances);
+	bool getPositionDecode(Vector3& bias, float& scale) const; //the bound positions are bias + position * scale, false if they are not quantized
 	void renderDebug();
 	void renderAABB();
 
@@ -53,7 +109,33 @@ public:
 	void createSolidBox(float sizex, float sizey, float sizez);
 
 	bool readBin(const char* filename);
-	bool writeBin(const char* filename);
+	bool writeBin(const char* filename, bool optimize = false);
+
+	//stream access, works for both owned and mapped data
+	bool isMapped() const { return mapped_file != NULL; }
+	unsigned int getNumVertices() const { return cpu_data_released ? released_num_vertices : (mapped_file ? mapped_size : vertices.size()); }
+	const Vector3* getVerticesData() const { return mapped_file ? mapped_vertices : (vertices.empty() ? NULL : &vertices[0]); }
+	const Vector3* getNormalsData() const { return mapped_file ? mapped_normals : (normals.empty() ? NULL : &normals[0]); }
+	const Vector2* getUVsData() const { return mapped_file ? mapped_uvs : (uvs.empty() ? NULL : &uvs[0]); }
+	const Vector4* getColorsData() const { return mapped_file ? mapped_colors : (colors.empty() ? NULL : &colors[0]); }
+	unsigned int getNumIndices() const { return cpu_data_released ? released_num_indices : (mapped_file ? mapped_num_indices : indices.size()); }
+	const unsigned int* getIndicesData() const { return mapped_file ? mapped_indices : (indices.empty() ? NULL : &indices[0]); }
+	unsigned int getNumTriangles() const { return (getNumIndices() ? getNumIndices() : getNumVertices()) / 3; }
+	bool isReady() const { return !is_loading && getNumVertices() > 0; } //false while loading or if the loading failed
+	void makeEditable(); //copies the mapped streams to the vectors and releases the mapping
+	bool hasCPUData() const { return !cpu_data_released; }
+	bool releaseCPUData(); //frees the streams of a mesh already in VRAM, only if it can be reloaded from its .bin
+	bool reloadCPUData(); //reads the streams again from the .bin, the VBOs and the collision model are not touched
+
+	void weldVertices(); //merges identical vertices and creates the indices
+	void optimizeIndices(); //reorders triangles for the vertex cache and vertices for fetch locality
+	VertexCacheStats getVertexCacheStats(unsigned int cache_size = DEFAULT_VERTEX_CACHE_SIZE) const;
+	VertexFormatStats getVertexFormatStats(const VertexFormat& format) const; //packs the streams in memory to measure the size and the error
+	unsigned int getBytesPerVertex() const; //in VRAM, or the one it will have when uploaded
+
+	size_t getCPUBytes() const;
+	size_t getVRAMBytes() const { return vram_bytes; }
+	bool isBusy() const { return is_loading; }
 
 	unsigned int getNumSubmaterials() { return material_name.size(); }
 	unsigned int getNumSubmeshes() { return material_range.size(); }
@@ -64,9 +146,23 @@ public:
 		bool testRayCollision(Matrix44 model, Vector3 start, Vector3 front, Vector3& collision, Vector3& normal);
 	#endif
 
-	static Mesh* Load(const char* filename, bool multimaterial = false, bool force_load = false);
+	static Mesh* Load(const char* filename, bool multimaterial = false, bool force_load = false, bool optimize = false);
+	static Mesh* LoadAsync(const char* filename, bool multimaterial = false, bool optimize = false); //returns an empty mesh that is filled later
 
 private:
+	friend class MeshLoadJob;
+
+	bool loadFile(const char* filename, bool multimaterial, bool force_load, bool optimize);
+	void releaseMapping();
+	void releaseStreams();
+	void releaseVRAM();
+	void enablePackedArrays();
+	void disablePackedArrays();
+	void getSubmeshRange(unsigned int submesh_id, unsigned int& start, unsigned int& size) const;
+	bool readBinLegacy(const char* data, size_t size);
+	bool readBinV2(const char* data, size_t size);
+	bool readBinFile(MappedFile* file);
+
 	bool loadASE(const char* filename, bool multimaterial = false);
 	bool loadOBJ(const char* filename, bool multimaterial = false);
 	void uploadToVRAM();
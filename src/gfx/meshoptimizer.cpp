@@ -0,0 +1,216 @@
+#include "meshoptimizer.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+VertexCacheStats simulateVertexCache(const unsigned int* indices, unsigned int num_indices, unsigned int num_vertices, unsigned int cache_size)
+{
+	VertexCacheStats stats;
+	stats.num_triangles = num_indices / 3;
+	stats.num_vertices = 0;
+	stats.cache_misses = 0;
+	stats.hit_rate = stats.acmr = stats.atvr = 0.0f;
+
+	if (num_indices == 0 || num_vertices == 0)
+		return stats;
+
+	assert(cache_size > 0);
+
+	//instead of moving entries in a FIFO we store when every vertex entered the cache,
+	//it is still inside if less than cache_size vertices have entered after it
+	std::vector<unsigned int> cache_time(num_vertices, 0);
+	std::vector<bool> used(num_vertices, false);
+	unsigned int time = cache_size + 1;
+
+	for (unsigned int i = 0; i < num_indices; ++i)
+	{
+		unsigned int index = indices[i];
+		assert(index < num_vertices);
+
+		if (!used[index])
+		{
+			used[index] = true;
+			stats.num_vertices++;
+		}
+
+		if (time - cache_time[index] > cache_size)
+		{
+			cache_time[index] = time++;
+			stats.cache_misses++;
+		}
+	}
+
+	stats.hit_rate = 1.0f - stats.cache_misses / (float)num_indices;
+	if (stats.num_triangles)
+		stats.acmr = stats.cache_misses / (float)stats.num_triangles;
+	stats.atvr = stats.cache_misses / (float)stats.num_vertices;
+	return stats;
+}
+
+//Forsyth scoring: vertices recently used and vertices with few triangles left are preferred
+static float vertexScore(int cache_position, unsigned int remaining_triangles, unsigned int cache_size)
+{
+	if (remaining_triangles == 0)
+		return -1.0f; //not used anymore
+
+	float score = 0.0f;
+	if (cache_position >= 0)
+	{
+		if (cache_position < 3) //used by the last triangle, fixed score so it is not reused too soon
+			score = 0.75f;
+		else
+			score = powf( 1.0f - (cache_position - 3) / float(cache_size - 3), 1.5f );
+	}
+
+	//boost the vertices with few triangles left so they do not become lonely triangles
+	score += 2.0f / sqrtf( (float)remaining_triangles );
+	return score;
+}
+
+void optimizeVertexCache(unsigned int* indices, unsigned int num_indices, unsigned int num_vertices, unsigned int cache_size)
+{
+	assert(num_indices % 3 == 0 && cache_size > 3);
+	unsigned int num_triangles = num_indices / 3;
+	if (num_triangles == 0)
+		return;
+
+	//triangles using every vertex
+	std::vector<unsigned int> remaining(num_vertices, 0);
+	for (unsigned int i = 0; i < num_indices; ++i)
+		remaining[ indices[i] ]++;
+
+	std::vector<unsigned int> offsets(num_vertices + 1, 0);
+	for (unsigned int v = 0; v < num_vertices; ++v)
+		offsets[v+1] = offsets[v] + remaining[v];
+
+	std::vector<unsigned int> vertex_triangles(num_indices);
+	std::vector<unsigned int> filled(offsets.begin(), offsets.end() - 1);
+	for (unsigned int i = 0; i < num_indices; ++i)
+		vertex_triangles[ filled[ indices[i] ]++ ] = i / 3;
+
+	std::vector<int> cache_position(num_vertices, -1);
+	std::vector<float> vertex_score(num_vertices);
+	for (unsigned int v = 0; v < num_vertices; ++v)
+		vertex_score[v] = vertexScore(-1, remaining[v], cache_size);
+
+	std::vector<float> triangle_score(num_triangles);
+	std::vector<bool> emitted(num_triangles, false);
+	unsigned int best_triangle = 0;
+	for (unsigned int t = 0; t < num_triangles; ++t)
+	{
+		triangle_score[t] = vertex_score[ indices[t*3] ] + vertex_score[ indices[t*3+1] ] + vertex_score[ indices[t*3+2] ];
+		if (triangle_score[t] > triangle_score[best_triangle])
+			best_triangle = t;
+	}
+
+	std::vector<unsigned int> result;
+	result.reserve(num_indices);
+
+	std::vector<unsigned int> cache, new_cache;
+	cache.reserve(cache_size + 3);
+	new_cache.reserve(cache_size + 3);
+
+	unsigned int scan_position = 0; //used to find a new start when the cache has no candidates
+
+	while (result.size() < num_indices)
+	{
+		if (best_triangle == (unsigned int)-1)
+		{
+			while (emitted[scan_position])
+				scan_position++;
+			best_triangle = scan_position;
+		}
+
+		unsigned int t = best_triangle;
+		emitted[t] = true;
+
+		//emit and move its vertices to the front of the cache
+		new_cache.clear();
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int v = indices[t*3+k];
+			result.push_back(v);
+			new_cache.push_back(v);
+
+			//remove the triangle from the vertex list
+			unsigned int* begin = &vertex_triangles[ offsets[v] ];
+			unsigned int* end = begin + remaining[v];
+			for (unsigned int* it = begin; it != end; ++it)
+				if (*it == t)
+				{
+					*it = *(end - 1);
+					break;
+				}
+			remaining[v]--;
+		}
+
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			unsigned int v = cache[i];
+			if (v != indices[t*3] && v != indices[t*3+1] && v != indices[t*3+2])
+				new_cache.push_back(v);
+		}
+
+		//update the scores of the vertices that moved in the cache and of their triangles
+		for (size_t i = 0; i < new_cache.size(); ++i)
+		{
+			unsigned int v = new_cache[i];
+			cache_position[v] = i < cache_size ? (int)i : -1;
+
+			float score = vertexScore( cache_position[v], remaining[v], cache_size );
+			float delta = score - vertex_score[v];
+			vertex_score[v] = score;
+
+			for (unsigned int j = 0; j < remaining[v]; ++j)
+				triangle_score[ vertex_triangles[ offsets[v] + j ] ] += delta;
+		}
+
+		if (new_cache.size() > cache_size)
+			new_cache.resize(cache_size);
+		cache.swap(new_cache);
+
+		//next triangle is the best one using a vertex in the cache
+		best_triangle = (unsigned int)-1;
+		float best_score = -1.0f;
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			unsigned int v = cache[i];
+			for (unsigned int j = 0; j < remaining[v]; ++j)
+			{
+				unsigned int tri = vertex_triangles[ offsets[v] + j ];
+				if (triangle_score[tri] > best_score)
+				{
+					best_score = triangle_score[tri];
+					best_triangle = tri;
+				}
+			}
+		}
+	}
+
+	memcpy(indices, &result[0], num_indices * sizeof(unsigned int));
+}
+
+unsigned int optimizeVertexFetch(unsigned int* indices, unsigned int num_indices, unsigned int num_vertices, std::vector<unsigned int>& remap)
+{
+	const unsigned int unused = (unsigned int)-1;
+	remap.assign(num_vertices, unused);
+
+	unsigned int next = 0;
+	for (unsigned int i = 0; i < num_indices; ++i)
+	{
+		unsigned int& r = remap[ indices[i] ];
+		if (r == unused)
+			r = next++;
+		indices[i] = r;
+	}
+	unsigned int num_used = next;
+
+	//vertices not used by any triangle go at the end
+	for (unsigned int v = 0; v < num_vertices; ++v)
+		if (remap[v] == unused)
+			remap[v] = next++;
+
+	return num_used;
+}
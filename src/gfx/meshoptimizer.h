@@ -0,0 +1,34 @@
+/*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
+	Tools to measure and improve how indexed meshes use the GPU post-transform vertex cache.
+	They only work with index data so they can run without an OpenGL context.
+*/
+
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <vector>
+
+#define DEFAULT_VERTEX_CACHE_SIZE 16
+#define OPTIMIZER_CACHE_SIZE 32 //the LRU cache modeled when optimizing, bigger than the real one works better
+
+struct VertexCacheStats
+{
+	unsigned int num_triangles;
+	unsigned int num_vertices; //unique vertices referenced by the indices
+	unsigned int cache_misses; //vertices that had to be transformed
+	float hit_rate; //fraction of the indices found in the cache
+	float acmr; //average cache miss ratio: transformed vertices per triangle (3.0 is the worst)
+	float atvr; //average transformed vertex ratio: transformed vertices per unique vertex (1.0 is the best)
+};
+
+//simulates a FIFO vertex cache of the given size over a triangle list
+VertexCacheStats simulateVertexCache(const unsigned int* indices, unsigned int num_indices, unsigned int num_vertices, unsigned int cache_size = DEFAULT_VERTEX_CACHE_SIZE);
+
+//reorders the triangles so consecutive ones share vertices (Tom Forsyth's linear-speed algorithm)
+void optimizeVertexCache(unsigned int* indices, unsigned int num_indices, unsigned int num_vertices, unsigned int cache_size = OPTIMIZER_CACHE_SIZE);
+
+//renumbers the vertices in the order the triangles use them, remap[old_index] = new_index
+//the indices are rewritten, the vertex streams must be reordered by the caller using the remap
+unsigned int optimizeVertexFetch(unsigned int* indices, unsigned int num_indices, unsigned int num_vertices, std::vector<unsigned int>& remap);
+
+#endif
@@ -8,9 +8,17 @@
 
 #include "texture.h"
 #include "camera.h"
-#include "mesh.h"
+#include "streambuffer.h"
 
 #include "../utils/utils.h"
+#include "../utils/jobsystem.h"
+
+#ifdef USE_SSE
+	#include <xmmintrin.h>
+#endif
+
+#define PARTICLE_EMISSORS_PER_JOB 8
+#define PARTICLES_PER_JOB 65536 //a big emissor moves its particles in several jobs
 
 
 std::list<ParticleEmissor*> ParticleEmissor::sParticleEmissors;
@@ -19,11 +27,13 @@ bool ParticleEmissor::render_debug = false;
 ParticleEmissor::ParticleEmissor()
 {
 	sParticleEmissors.push_back(this);
+	texture = NULL;
 	ParticleEmissor::init();
 }
 
 ParticleEmissor::~ParticleEmissor()
 {
+	setTexture(NULL);
 	std::list<ParticleEmissor*>::iterator it = std::find(sParticleEmissors.begin(),sParticleEmissors.end(),this);
 	if (it != sParticleEmissors.end() )
 		sParticleEmissors.erase(it);
@@ -33,7 +43,7 @@ void ParticleEmissor::init()
 {
 	time_since_last_particle = 0;
 	num_particles_to_emit = 0;
-	texture = NULL;
+	setTexture(NULL);
 	emissor_state = 0;
 	num_particles_to_emit = 100;
 	max_particles = 100;
@@ -46,11 +56,21 @@ void ParticleEmissor::init()
 	velocity_dependant = false;
 	front_aligned = false;
 	emissor_front.set(0,0,-1);
+	num_alive = 0;
+}
+
+void ParticleEmissor::setTexture(Texture* texture)
+{
+	if (texture)
+		texture->addRef();
+	if (this->texture)
+		this->texture->removeRef();
+	this->texture = texture;
 }
 
 void ParticleEmissor::renderParticles()
 {
-	if (particles.empty())
+	if (num_alive == 0)
 		return;
 
 	if (texture == NULL)
@@ -109,76 +129,141 @@ void ParticleEmissor::renderParticles()
 	else
 		texture->bind();
 
-	Vector4 color;
+	//written straight into the VBO, the mapping is for all the particles although some could be invisible
+	StreamVertex* vertices = StreamBuffer::map(num_alive * 4);
+	StreamBuffer::draw(GL_QUADS, buildQuads(up, right, vertices) * 4);
 
-	static Mesh mesh;
+	glDisable( GL_BLEND );
+	glDisable( GL_TEXTURE_2D );
+}
 
-	mesh.primitive = GL_QUADS;
-	mesh.vertices.resize(particles.size() * 4);
-	mesh.uvs.resize(particles.size() * 4);
-	mesh.colors.resize(particles.size() * 4);
+struct sParticleLook { float alpha[4], size[4], r[4], g[4], b[4]; };
 
-	int painted_particles = 0;
-	for (size_t i = 0; i < particles.size(); ++i)
+//alpha, size and color of 4 particles interpolated with their age
+static inline void computeLook(const ParticleEmissor* e, const float* time, float inv_life, sParticleLook& look)
+{
+#ifdef USE_SSE
+	__m128 factor = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_loadu_ps(time), _mm_set1_ps(inv_life)));
+	#define LERP(a, b) _mm_add_ps(_mm_set1_ps((float)(a)), _mm_mul_ps(_mm_set1_ps((float)((b) - (a))), factor))
+	_mm_storeu_ps(look.alpha, LERP(e->start_alpha, e->end_alpha));
+	_mm_storeu_ps(look.size, LERP(e->start_size, e->end_size));
+	_mm_storeu_ps(look.r, LERP(e->start_color.x, e->end_color.x));
+	_mm_storeu_ps(look.g, LERP(e->start_color.y, e->end_color.y));
+	_mm_storeu_ps(look.b, LERP(e->start_color.z, e->end_color.z));
+	#undef LERP
+#else
+	for (int k = 0; k < 4; ++k)
 	{
-		Particle& p = particles[i];
-		if (p.reamining_time <= 0)
-			continue;
-
-		double factor = 1 - (p.reamining_time / particle_life);
-		double alpha = start_alpha * (1-factor) + end_alpha * factor;
-		if (alpha <= 0.01)	continue;
-
-		double size = (start_size * (1-factor) + end_size * factor);
+		float factor = 1.0f - time[k] * inv_life;
+		look.alpha[k] = (float)(e->start_alpha + (e->end_alpha - e->start_alpha) * factor);
+		look.size[k] = (float)(e->start_size + (e->end_size - e->start_size) * factor);
+		look.r[k] = e->start_color.x + (e->end_color.x - e->start_color.x) * factor;
+		look.g[k] = e->start_color.y + (e->end_color.y - e->start_color.y) * factor;
+		look.b[k] = e->start_color.z + (e->end_color.z - e->start_color.z) * factor;
+	}
+#endif
+}
 
-		color = start_color * (1-factor) + end_color * factor;
-		color.a = alpha;
+unsigned int ParticleEmissor::buildQuads(const Vector3& up, const Vector3& right, StreamVertex* vertices)
+{
+	float inv_life = particle_life > 0 ? (float)(1.0 / particle_life) : 0.0f;
+	unsigned int painted = 0;
+	sParticleLook look;
+	for (size_t i = 0; i < num_alive; i += 4)
+	{
+		size_t num = std::min((size_t)4, num_alive - i);
+		float time[4] = { 0, 0, 0, 0 };
+		std::copy(&remaining_time[i], &remaining_time[i] + num, time);
+		computeLook(this, time, inv_life, look);
 
-		mesh.colors[painted_particles*4] = color;
-		mesh.colors[painted_particles*4+1] = color;
-		mesh.colors[painted_particles*4+2] = color;
-		mesh.colors[painted_particles*4+3] = color;
+		for (size_t k = 0; k < num; ++k)
+		{
+			if (look.alpha[k] <= 0.01f)
+				continue;
+
+			//the buffer can be write combined memory, every vertex is written once and in order
+			Vector3 pos(pos_x[i+k], pos_y[i+k], pos_z[i+k]);
+			Vector3 u = up * look.size[k];
+			Vector3 r = right * look.size[k];
+			unsigned int color = packColor(look.r[k], look.g[k], look.b[k], look.alpha[k]);
+			StreamVertex* quad = vertices + painted * 4;
+			quad[0].set(pos + u - r, 0, 0, color);
+			quad[1].set(pos - u - r, 0, 1, color);
+			quad[2].set(pos - u + r, 1, 1, color);
+			quad[3].set(pos + u + r, 1, 0, color);
+			painted++;
+		}
+	}
 
-		mesh.uvs[painted_particles*4].set(0,0);
-		mesh.uvs[painted_particles*4+1].set(0,1);
-		mesh.uvs[painted_particles*4+2].set(1,1);
-		mesh.uvs[painted_particles*4+3].set(1,0);
+	return painted;
+}
 
-		mesh.vertices[painted_particles*4] = p.pos + up * size - right * size;
-		mesh.vertices[painted_particles*4+1] = p.pos - up * size - right * size;
-		mesh.vertices[painted_particles*4+2] = p.pos - up * size + right * size;
-		mesh.vertices[painted_particles*4+3] = p.pos + up * size + right * size;
+void ParticleEmissor::updateParticles(float seconds_elapsed)
+{
+	moveParticles(seconds_elapsed);
+	emitParticles(seconds_elapsed);
+}
 
-		painted_particles++;
+//the positions and directions of the particles in [start,end)
+static void integrate(ParticleEmissor* e, size_t start, size_t end, float seconds)
+{
+	float* px = e->pos_x.data(); float* py = e->pos_y.data(); float* pz = e->pos_z.data();
+	float* dx = e->dir_x.data(); float* dy = e->dir_y.data(); float* dz = e->dir_z.data();
+	float* time = e->remaining_time.data();
+	float gx = e->gravity.x * seconds, gy = e->gravity.y * seconds, gz = e->gravity.z * seconds;
+
+	size_t i = start;
+#ifdef USE_SSE
+	__m128 t = _mm_set1_ps(seconds);
+	__m128 vgx = _mm_set1_ps(gx), vgy = _mm_set1_ps(gy), vgz = _mm_set1_ps(gz);
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(dx + i), y = _mm_loadu_ps(dy + i), z = _mm_loadu_ps(dz + i);
+		_mm_storeu_ps(time + i, _mm_sub_ps(_mm_loadu_ps(time + i), t));
+		_mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(x, t)));
+		_mm_storeu_ps(py + i, _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(y, t)));
+		_mm_storeu_ps(pz + i, _mm_add_ps(_mm_loadu_ps(pz + i), _mm_mul_ps(z, t)));
+		_mm_storeu_ps(dx + i, _mm_add_ps(x, vgx));
+		_mm_storeu_ps(dy + i, _mm_add_ps(y, vgy));
+		_mm_storeu_ps(dz + i, _mm_add_ps(z, vgz));
 	}
-
-	if (painted_particles)
+#endif
+	for (; i < end; ++i)
 	{
-		mesh.vertices.resize(painted_particles*4);
-		mesh.uvs.resize(painted_particles*4);
-		mesh.colors.resize(painted_particles*4);
-
-		mesh.render(0,true);
+		time[i] -= seconds;
+		px[i] += dx[i] * seconds;
+		py[i] += dy[i] * seconds;
+		pz[i] += dz[i] * seconds;
+		dx[i] += gx;
+		dy[i] += gy;
+		dz[i] += gz;
 	}
-
-	glDisable( GL_BLEND );
-	glDisable( GL_TEXTURE_2D );
 }
 
-void ParticleEmissor::updateParticles(float seconds_elapsed)
+void ParticleEmissor::moveParticles(float seconds_elapsed)
 {
-	//update
-	for (size_t i = 0; i < particles.size(); ++i)
+	JobSystem::parallelFor(0, num_alive, PARTICLES_PER_JOB, [&](size_t start, size_t end) {
+		integrate(this, start, end, seconds_elapsed);
+	});
+
+	//the dead ones are replaced by the last alive
+	size_t i = 0;
+	while (i < num_alive)
 	{
-		Particle& p = particles[i];
-		if (p.reamining_time <= 0)
+		if (remaining_time[i] > 0)
+		{
+			i++;
 			continue;
-
-		p.reamining_time -= seconds_elapsed;
-		p.pos = p.pos + p.dir * seconds_elapsed;
-		p.dir = p.dir + gravity * seconds_elapsed;
+		}
+		size_t last = --num_alive;
+		pos_x[i] = pos_x[last]; pos_y[i] = pos_y[last]; pos_z[i] = pos_z[last];
+		dir_x[i] = dir_x[last]; dir_y[i] = dir_y[last]; dir_z[i] = dir_z[last];
+		remaining_time[i] = remaining_time[last];
 	}
+}
 
+void ParticleEmissor::emitParticles(float seconds_elapsed)
+{
 	if (emissor_state == 0)
 		return;
 
@@ -196,11 +281,11 @@ void ParticleEmissor::updateParticles(float seconds_elapsed)
 void ParticleEmissor::start()
 {
 	emissor_state = 1;
-	if (particles.size() < (size_t)max_particles)
+	if (pos_x.size() < (size_t)max_particles)
 	{
-		int old = particles.size();
-		particles.resize(max_particles);
-		memset( (void*)&particles[old], 0, (max_particles - old) * sizeof( Particle ) );
+		pos_x.resize(max_particles); pos_y.resize(max_particles); pos_z.resize(max_particles);
+		dir_x.resize(max_particles); dir_y.resize(max_particles); dir_z.resize(max_particles);
+		remaining_time.resize(max_particles);
 	}
 
 	updateParticles(0);
@@ -214,35 +299,41 @@ void ParticleEmissor::stop()
 void ParticleEmissor::createParticle()
 {
 	time_since_last_particle = 0;
-	for (size_t i = 0; i < particles.size(); ++i)
-		if ( particles[i].reamining_time <= 0)
-		{
-			particles[i].pos = emissor_position + (emissor_last_position - emissor_position) * ((rand()%1000)/1000.0);
-
-
-			Vector3 r;
-			if (front_aligned)
-			{
-				particles[i].dir = emissor_front;
-			}
-			else
-			{
-				r.random(max_velocity - min_velocity);
-				r = r + min_velocity;
-				particles[i].dir = r;
-			}
-			
-			if (velocity_dependant)
-				particles[i].dir += start_velocity;
-
-			particles[i].reamining_time = particle_life;
-
-			if (num_particles_to_emit > 0)
-				num_particles_to_emit--;
-			if (num_particles_to_emit == 0)
-				stop();
-			return;
-		}
+	if (num_alive >= pos_x.size())
+		return;
+
+	size_t i = num_alive++;
+	Vector3 pos = emissor_position + (emissor_last_position - emissor_position) * ((rand()%1000)/1000.0);
+
+	Vector3 dir;
+	if (front_aligned)
+		dir = emissor_front;
+	else
+	{
+		dir.random(max_velocity - min_velocity);
+		dir = dir + min_velocity;
+	}
+	if (velocity_dependant)
+		dir += start_velocity;
+
+	pos_x[i] = pos.x; pos_y[i] = pos.y; pos_z[i] = pos.z;
+	dir_x[i] = dir.x; dir_y[i] = dir.y; dir_z[i] = dir.z;
+	remaining_time[i] = (float)particle_life;
+
+	if (num_particles_to_emit > 0)
+		num_particles_to_emit--;
+	if (num_particles_to_emit == 0)
+		stop();
+}
+
+Particle ParticleEmissor::getParticle(size_t i) const
+{
+	assert(i < num_alive);
+	Particle p;
+	p.pos.set(pos_x[i], pos_y[i], pos_z[i]);
+	p.dir.set(dir_x[i], dir_y[i], dir_z[i]);
+	p.reamining_time = remaining_time[i];
+	return p;
 }
 
 void ParticleEmissor::scale(float f)
@@ -288,7 +379,15 @@ void ParticleEmissor::RenderAll()
 
 void ParticleEmissor::UpdateAll(float seconds_elapsed)
 {
-	std::list<ParticleEmissor*>::iterator it = sParticleEmissors.begin();
-		for (; it != sParticleEmissors.end(); it++)
-			(*it)->updateParticles(seconds_elapsed);
+	static std::vector<ParticleEmissor*> emissors; //keeps the memory between frames
+	emissors.assign(sParticleEmissors.begin(), sParticleEmissors.end());
+
+	//the emissors move their particles in parallel, the new ones use rand() so they are created here in the same order as always
+	JobSystem::parallelFor(0, emissors.size(), PARTICLE_EMISSORS_PER_JOB, [&](size_t start, size_t end) {
+		for (size_t i = start; i < end; ++i)
+			emissors[i]->moveParticles(seconds_elapsed);
+	});
+
+	for (size_t i = 0; i < emissors.size(); ++i)
+		emissors[i]->emitParticles(seconds_elapsed);
 }
@@ -15,11 +15,13 @@ public:
 };
 
 class Texture;
+struct StreamVertex;
 
 //******************************
 class ParticleEmissor
 {
 	static std::list<ParticleEmissor*> sParticleEmissors;
+	Texture* texture; //holds a reference so the ResourceManager does not free it, see setTexture
 
 public:
 	static bool render_debug;
@@ -73,8 +75,6 @@ public:
 	bool vertical_align;
 	bool velocity_dependant;
 
-	Texture* texture;
-
 	//Emissor
 	char emissor_state; //0 -> stopped, 1 -> emiting, -1 -> finished
 	double particle_life;	//duration in seconds
@@ -88,21 +88,33 @@ public:
 
 	double time_since_last_particle;
 
-	std::vector<Particle> particles;
+	//the particles as a structure of arrays, so the update works with several at once. The alive ones are always
+	//the first num_alive: a new one goes to the end and a dead one is replaced by the last one, no dead slots are visited
+	std::vector<float> pos_x, pos_y, pos_z;
+	std::vector<float> dir_x, dir_y, dir_z;
+	std::vector<float> remaining_time;
+	size_t num_alive;
 
 	ParticleEmissor();
 	virtual ~ParticleEmissor();
 
 	void init();
 
-	void createParticle();
+	void setTexture(Texture* texture);
+	Texture* getTexture() const { return texture; }
+
+	void createParticle(); //nothing if there are already max_particles alive
+	Particle getParticle(size_t i) const; //i < num_alive
 	void start();
 	void stop();
 
 	void scale(float f);
 
 	void renderParticles();
-	void updateParticles(float seconds_elapsed);
+	unsigned int buildQuads(const Vector3& up, const Vector3& right, StreamVertex* vertices); //the billboards of the visible particles, 4 vertices each, returns how many
+	void updateParticles(float seconds_elapsed); //moveParticles and emitParticles
+	void moveParticles(float seconds_elapsed); //only changes this emissor, it can run in any thread. Removes the dead ones
+	void emitParticles(float seconds_elapsed); //uses rand()
 
 	static void RenderAll();
 	static void UpdateAll(float seconds_elapsed);
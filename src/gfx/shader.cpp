@@ -1,6 +1,15 @@
 #include "shader.h"
+#include "vertexformat.h"
+#include "../utils/resourceloader.h"
 #include <cassert>
 #include <iostream>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
 
 typedef unsigned int GLhandleARB;
 
@@ -20,6 +29,7 @@ REGISTER_GLEXT( void, glActiveTexture, GLenum texture )
 REGISTER_GLEXT( void, glGetInfoLogARB, GLhandleARB obj, GLsizei maxLength, GLsizei *length, GLcharARB *infoLog )
 REGISTER_GLEXT( GLint, glGetUniformLocationARB, GLhandleARB programObj, const GLcharARB *name)
 REGISTER_GLEXT( GLint, glGetAttribLocationARB, GLhandleARB programObj, const GLcharARB *name)
+REGISTER_GLEXT( void, glBindAttribLocationARB, GLhandleARB programObj, GLuint index, const GLcharARB *name)
 REGISTER_GLEXT( void, glUniform1iARB, GLint location, GLint v0 )
 REGISTER_GLEXT( void, glUniform2iARB, GLint location, GLint v0, GLint v1 )
 REGISTER_GLEXT( void, glUniform3iARB, GLint location, GLint v0, GLint v1, GLint v2 )
@@ -38,16 +48,53 @@ REGISTER_GLEXT( void, glUniform3fvARB, GLint location, GLsizei count, const GLfl
 REGISTER_GLEXT( void, glUniform4fvARB, GLint location, GLsizei count, const GLfloat *value)
 REGISTER_GLEXT( void, glUniformMatrix4fvARB, GLint location, GLsizei count, GLboolean transpose, const GLfloat *value )
 
+//optional (GL 4.1 or ARB_get_program_binary), without them the programs are always compiled
+REGISTER_GLEXT( void, glGetProgramiv, GLuint program, GLenum pname, GLint* params )
+REGISTER_GLEXT( void, glGetProgramBinary, GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary )
+REGISTER_GLEXT( void, glProgramBinary, GLuint program, GLenum binaryFormat, const void* binary, GLsizei length )
+REGISTER_GLEXT( void, glProgramParameteri, GLuint program, GLenum pname, GLint value )
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+	#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+	#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+	#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+#define PROGRAM_CACHE_VERSION 1 //change it when the attributes bound before linking change, the old .prog files are ignored
+
+//after the watermark of the .prog files
+struct sProgramCacheHeader
+{
+	unsigned int version;
+	unsigned int format; //binaryFormat of glGetProgramBinary
+	unsigned long long key;
+	unsigned int size;
+};
+
 
 std::map<std::string,Shader*> Shader::s_Shaders;
 bool Shader::s_ready = false;
+bool Shader::use_program_cache = true;
+ShaderLoadStats Shader::load_stats = ShaderLoadStats();
+
+static bool s_program_binaries = false; //the driver can save and load them
+static std::string s_driver; //vendor, renderer and version, a binary is only valid for the same one
 
 
-Shader::Shader()
+Shader::Shader() : Resource(RESOURCE_SHADER)
 {
 	if(!Shader::s_ready)
 		Shader::init();
 	compiled = false;
+	is_loading = false;
+	vs = fs = program = 0;
+	frame_uniforms_version = 0;
+	cache_key = 0;
+	cached_format = 0;
 }
 
 Shader::~Shader()
@@ -71,14 +118,13 @@ bool Shader::load(const std::string& vsf, const std::string& psf)
 	
 	printf("Vertex shader:\n%s\n", vsf.c_str());
 	printf("Fragment shader:\n%s\n", psf.c_str());
-	std::string vsm,psm;
-	if (!readFile(vsf,vsm) || !readFile(psf,psm))
+	if (!prepare())
 		return false;
 
-	//printf("Vertex shader from memory:\n%s\n", vsm.c_str());
-	//printf("Fragment shader from memory:\n%s\n", psm.c_str());
+	//printf("Vertex shader from memory:\n%s\n", vs_source.c_str());
+	//printf("Fragment shader from memory:\n%s\n", ps_source.c_str());
 
-	if (!compileFromMemory(vsm,psm))
+	if (!link())
 		return false;
 
 	assert (glGetError() == GL_NO_ERROR);
@@ -86,20 +132,285 @@ bool Shader::load(const std::string& vsf, const std::string& psf)
 	return true;
 }
 
-Shader* Shader::Load(const char* vsf, const char* psf)
+//"FOG  ALPHA_TEST" and "ALPHA_TEST FOG" are the same variant
+static std::string sortMacros(const char* macros)
+{
+	std::vector<std::string> names;
+	std::istringstream stream(macros ? macros : "");
+	std::string name;
+	while (stream >> name)
+		names.push_back(name);
+	std::sort(names.begin(), names.end());
+	names.erase( std::unique(names.begin(), names.end()), names.end() );
+
+	std::string result;
+	for (size_t i = 0; i < names.size(); ++i)
+		result += (i ? " " : "") + names[i];
+	return result;
+}
+
+//the #defines go after the #version line, it has to be the first one
+static std::string addMacros(const std::string& source, const std::string& macros)
+{
+	if (macros.empty())
+		return source;
+
+	std::string defines;
+	std::istringstream stream(macros);
+	std::string name;
+	while (stream >> name)
+		defines += "#define " + name + "\n";
+
+	size_t pos = 0;
+	int line = 1;
+	size_t version = source.find("#version");
+	if (version != std::string::npos)
+	{
+		pos = source.find('\n', version);
+		pos = pos == std::string::npos ? source.size() : pos + 1;
+		line += (int)std::count(source.begin(), source.begin() + pos, '\n');
+	}
+
+	//the errors keep the line numbers of the file
+	std::ostringstream result;
+	result << source.substr(0, pos) << defines << "#line " << line << "\n" << source.substr(pos);
+	return result.str();
+}
+
+//FNV-1a
+static unsigned long long hashString(const std::string& str, unsigned long long hash = 14695981039346656037ULL)
+{
+	for (size_t i = 0; i < str.size(); ++i)
+	{
+		hash ^= (unsigned char)str[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash ^ str.size(); //so "ab"+"c" and "a"+"bc" are different
+}
+
+bool Shader::prepare()
+{
+	if (!readFile(vs_filename,vs_source) || !readFile(ps_filename,ps_source))
+		return false;
+	vs_source = addMacros(vs_source, macros);
+	ps_source = addMacros(ps_source, macros);
+
+	cache_key = hashString(vs_source);
+	cache_key = hashString(ps_source, cache_key);
+	cache_key = hashString(s_driver, cache_key);
+	cached_binary.clear();
+	if (use_program_cache && s_program_binaries)
+		readProgramCache();
+	return true;
+}
+
+bool Shader::link()
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	bool from_cache = linkProgramCache();
+	bool done = from_cache || compileFromMemory(vs_source, ps_source);
+	if (done && !from_cache)
+		writeProgramCache();
+
+	float time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	if (from_cache)
+	{
+		load_stats.cached++;
+		load_stats.cache_time += time;
+	}
+	else if (done)
+	{
+		load_stats.compiled++;
+		load_stats.compile_time += time;
+	}
+	if (done)
+		std::cout << "Shader: " << vs_filename << "," << ps_filename << (macros.size() ? " [" + macros + "]" : "") << (from_cache ? " [OK CACHE]" : " [OK]") << " Time: " << time << "ms" << std::endl;
+
+	//not needed anymore
+	std::string().swap(vs_source);
+	std::string().swap(ps_source);
+	std::vector<char>().swap(cached_binary);
+	return done;
+}
+
+//one file per variant: the vertex shader, a hash of the pixel shader and the macros, and .prog
+std::string Shader::getCacheFilename() const
+{
+	char key[32];
+	sprintf(key, ".%08x.prog", (unsigned int)hashString(ps_filename + "," + macros));
+	return vs_filename + key;
+}
+
+bool Shader::readProgramCache()
+{
+	FILE* f = fopen(getCacheFilename().c_str(), "rb");
+	if (f == NULL)
+		return false;
+
+	char watermark[4];
+	sProgramCacheHeader header;
+	bool valid = fread(watermark, 1, 4, f) == 4 && memcmp(watermark, "PRG1", 4) == 0 &&
+		fread(&header, sizeof(header), 1, f) == 1 && header.version == PROGRAM_CACHE_VERSION && header.key == cache_key; //other sources or driver
+	if (valid)
+	{
+		//a damaged file cannot make it allocate more than what is left in it
+		long start = ftell(f);
+		fseek(f, 0, SEEK_END);
+		long end = ftell(f);
+		fseek(f, start, SEEK_SET);
+		valid = start >= 0 && end >= start && header.size <= (unsigned long)(end - start);
+	}
+	if (valid)
+	{
+		cached_binary.resize(header.size);
+		valid = header.size > 0 && fread(&cached_binary[0], 1, header.size, f) == header.size;
+		cached_format = header.format;
+	}
+	fclose(f);
+
+	if (!valid)
+		cached_binary.clear();
+	return valid;
+}
+
+bool Shader::linkProgramCache()
+{
+	if (cached_binary.empty())
+		return false;
+
+	program = glCreateProgramObjectARB();
+	glProgramBinary(program, cached_format, &cached_binary[0], (GLsizei)cached_binary.size());
+	glGetError(); //a format the driver does not accept anymore, it is compiled again
+
+	GLint linked = 0;
+	glGetObjectParameterivARB(program,GL_OBJECT_LINK_STATUS_ARB,&linked);
+	glGetError();
+	if (!linked)
+	{
+		glDeleteObjectARB(program);
+		program = 0;
+		return false;
+	}
+
+	compiled = true;
+	resolveLocations();
+	frame_uniforms_version = 0;
+	return true;
+}
+
+void Shader::writeProgramCache()
 {
-	std::string name = std::string(vsf) + "," + std::string(psf);
+	if (!use_program_cache || !s_program_binaries || vs_filename.empty())
+		return;
+
+	GLint size = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0)
+		return;
+	std::vector<char> binary(size);
+	GLenum format = 0;
+	GLsizei length = 0;
+	glGetProgramBinary(program, size, &length, &format, &binary[0]);
+	if (glGetError() != GL_NO_ERROR || length <= 0)
+		return;
+
+	std::string filename = getCacheFilename();
+	FILE* f = fopen(filename.c_str(), "wb");
+	if (f == NULL)
+	{
+		std::cout << "Error writing program cache: " << filename << std::endl;
+		return;
+	}
+
+	sProgramCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.version = PROGRAM_CACHE_VERSION;
+	header.format = format;
+	header.key = cache_key;
+	header.size = length;
+	fwrite("PRG1", 1, 4, f);
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(&binary[0], 1, length, f);
+	fclose(f);
+}
+
+Shader* Shader::Load(const char* vsf, const char* psf, const char* macros)
+{
+	std::string sorted = sortMacros(macros);
+	std::string name = std::string(vsf) + "," + std::string(psf) + (sorted.size() ? "," + sorted : "");
 	std::map<std::string,Shader*>::iterator it = s_Shaders.find(name);
 	if (it != s_Shaders.end())
+	{
+		if (it->second->is_loading) //requested with LoadAsync, wait for it
+		{
+			ResourceLoader::flush();
+			it = s_Shaders.find(name); //if it failed it is not in the cache anymore
+			if (it == s_Shaders.end())
+				return NULL;
+		}
 		return it->second;
+	}
 
 	Shader* sh = new Shader();
+	sh->macros = sorted;
 	if (sh->load(vsf,psf) == NULL)
 		return NULL;
 	s_Shaders[name] = sh;
 	return sh;
 }
 
+//the files are read (and the cached program) in a worker thread, the program is created in the main thread
+class ShaderLoadJob : public ResourceJob
+{
+public:
+	Shader* shader;
+	std::string name;
+
+	bool load() { return shader->prepare(); }
+	void upload()
+	{
+		shader->is_loading = false;
+		if (loaded && shader->link())
+			return;
+		std::cout << "[ERROR]: Shader not loaded: " << shader->getInfoLog() << std::endl;
+
+		//the ones holding it keep a shader that does nothing, but Load and LoadAsync do not return it again
+		std::map<std::string,Shader*>::iterator it = Shader::s_Shaders.find(name);
+		if (it != Shader::s_Shaders.end() && it->second == shader)
+			Shader::s_Shaders.erase(it);
+	}
+};
+
+Shader* Shader::LoadAsync(const char* vsf, const char* psf, const char* macros)
+{
+	//registered before it is loaded so requests for the same variant share it
+	std::string sorted = sortMacros(macros);
+	std::string name = std::string(vsf) + "," + std::string(psf) + (sorted.size() ? "," + sorted : "");
+	std::map<std::string,Shader*>::iterator it = s_Shaders.find(name);
+	if (it != s_Shaders.end())
+		return it->second;
+
+	Shader* sh = new Shader();
+	sh->macros = sorted;
+	sh->setFilenames(vsf,psf);
+	sh->is_loading = true;
+	s_Shaders[name] = sh;
+
+	ShaderLoadJob* job = new ShaderLoadJob();
+	job->shader = sh;
+	job->name = name;
+	ResourceLoader::addJob(job);
+	return sh;
+}
+
+void Shader::dumpStats()
+{
+	const ShaderLoadStats& s = load_stats;
+	std::cout << "Shaders: " << s.cached << " from cache in " << s.cache_time << "ms, " << s.compiled << " compiled in " << s.compile_time << "ms"
+		<< (s_program_binaries ? "" : " (no program binaries in this driver)") << std::endl;
+}
+
 void Shader::ReloadAll()
 {
 	for( std::map<std::string,Shader*>::iterator it = s_Shaders.begin(); it!=s_Shaders.end();it++)
@@ -181,6 +492,14 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 		return false;
 	}
 
+	//meshes with octahedral normals send them in this attribute and instanced draws their model and color in these (see vertexformat.h)
+	glBindAttribLocationARB(program, VERTEX_ATTRIB_OCT_NORMAL, VERTEX_ATTRIB_OCT_NORMAL_NAME);
+	glBindAttribLocationARB(program, VERTEX_ATTRIB_INSTANCE_MODEL, VERTEX_ATTRIB_INSTANCE_MODEL_NAME);
+	glBindAttribLocationARB(program, VERTEX_ATTRIB_INSTANCE_COLOR, VERTEX_ATTRIB_INSTANCE_COLOR_NAME);
+
+	if (s_program_binaries)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
 	glLinkProgramARB(program);
 	assert (glGetError() == GL_NO_ERROR);
 
@@ -200,6 +519,8 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 #endif
 
 	compiled = true;
+	resolveLocations();
+	frame_uniforms_version = 0; //a new program has the default values
 
 	return true;
 }
@@ -291,12 +612,14 @@ void Shader::release()
 		program = 0;
 	}
 
+	uniform_locations.clear(); //the next program can have other locations
 	compiled = false;
 }
 
 
 void Shader::enable()
 {
+	touch();
 	glUseProgramObjectARB(program);
 	assert (glGetError() == GL_NO_ERROR);
 
@@ -304,6 +627,12 @@ void Shader::enable()
 }
 
 
+void Shader::resetTextureSlots()
+{
+	last_slot = 0;
+	glActiveTexture(GL_TEXTURE0);
+}
+
 void Shader::disable()
 {
 	glUseProgramObjectARB(0);
@@ -338,32 +667,82 @@ void Shader::saveInfoLog(GLhandleARB obj)
 	}
 }
 
-GLint Shader::getLocation(const char* varname,loctable* table)
+//the names of the slots of the handles, the engine uniforms first
+static const char* s_engine_uniform_names[NUM_ENGINE_UNIFORMS] = {
+	"model", "modelt", "mvp", "camera_pos", "light_color", "light_dir", "fog_color", "fog_density",
+	"texture", "time", "emissive_color", "specular", "specular_gloss", "ground_color", "ambient_color",
+	"discard_up"
+};
+struct sLessStr
 {
-	if(varname == 0 || table == 0)
-		return 0;
-
-	GLint loc = 0;
-	loctable* locs = table;
-
-	loctable::iterator cur = locs->find(varname);
-	
-	if(cur == locs->end()) //not found in the locations table
-	{
-		loc = glGetUniformLocationARB(program, varname);
-		if (loc == -1)
-		{
-			return -1;
-		}
+	bool operator()(const char* s1, const char* s2) const { return strcmp(s1, s2) < 0; }
+};
+static std::deque<std::string> s_uniform_names; //a deque so the keys of s_uniform_slots do not move
+static std::map<const char*,int,sLessStr> s_uniform_slots;
 
-		//insert the new value
-		locs->insert(loctable::value_type(varname,loc));
-	}
-	else //found in the table
+static void registerEngineUniforms()
+{
+	if (!s_uniform_names.empty())
+		return;
+	for (int i = 0; i < NUM_ENGINE_UNIFORMS; ++i)
 	{
-		loc = (*cur).second;
+		s_uniform_names.push_back(s_engine_uniform_names[i]);
+		s_uniform_slots[s_uniform_names.back().c_str()] = i;
 	}
-	return loc;
+}
+
+//-1 if the name has no handle, it does not register it
+static int findUniformSlot(const char* varname)
+{
+	registerEngineUniforms();
+	std::map<const char*,int,sLessStr>::iterator it = s_uniform_slots.find(varname);
+	return it != s_uniform_slots.end() ? it->second : -1;
+}
+
+UniformHandle Shader::getUniformHandle(const char* varname)
+{
+	int found = findUniformSlot(varname);
+	if (found != -1)
+		return UniformHandle(found);
+
+	int slot = (int)s_uniform_names.size();
+	s_uniform_names.push_back(varname);
+	s_uniform_slots[s_uniform_names.back().c_str()] = slot;
+	return UniformHandle(slot);
+}
+
+const char* Shader::getUniformName(UniformHandle uniform)
+{
+	if (uniform.slot < 0 || uniform.slot >= (int)s_uniform_names.size())
+		return "";
+	return s_uniform_names[uniform.slot].c_str();
+}
+
+void Shader::resolveLocations()
+{
+	registerEngineUniforms();
+	uniform_locations.resize(s_uniform_names.size());
+	for (size_t i = 0; i < uniform_locations.size(); ++i)
+		uniform_locations[i] = glGetUniformLocationARB(program, s_uniform_names[i].c_str());
+}
+
+//a name registered after the program was linked, or a handle that is not valid
+GLint Shader::resolveLocation(int slot)
+{
+	if (slot < 0 || slot >= (int)s_uniform_names.size() || !program)
+		return -1;
+	if ((size_t)slot >= uniform_locations.size())
+		uniform_locations.resize(slot + 1, UNIFORM_UNRESOLVED);
+	uniform_locations[slot] = glGetUniformLocationARB(program, s_uniform_names[slot].c_str());
+	return uniform_locations[slot];
+}
+
+GLint Shader::getLocationByName(const char* varname)
+{
+	int slot = findUniformSlot(varname);
+	if (slot != -1)
+		return getLocation(UniformHandle(slot));
+	return program ? glGetUniformLocationARB(program, varname) : -1;
 }
 
 int Shader::getAttribLocation(const char* varname)
@@ -380,7 +759,7 @@ int Shader::getAttribLocation(const char* varname)
 
 int Shader::getUniformLocation(const char* varname)
 {
-	int loc = getLocation(varname, &locations);
+	int loc = getLocationByName(varname);
 	if (loc == -1)
 	{
 		return loc;
@@ -400,7 +779,7 @@ void Shader::setTexture(const char* varname, unsigned int tex)
 
 void Shader::setUniform1(const char* varname, int input1)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform1iARB(loc, input1);
 	assert (glGetError() == GL_NO_ERROR);
@@ -408,7 +787,7 @@ void Shader::setUniform1(const char* varname, int input1)
 
 void Shader::setUniform2(const char* varname, int input1, int input2)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform2iARB(loc, input1, input2);
 	assert (glGetError() == GL_NO_ERROR);
@@ -416,7 +795,7 @@ void Shader::setUniform2(const char* varname, int input1, int input2)
 
 void Shader::setUniform3(const char* varname, int input1, int input2, int input3)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform3iARB(loc, input1, input2, input3);
 	assert (glGetError() == GL_NO_ERROR);
@@ -424,7 +803,7 @@ void Shader::setUniform3(const char* varname, int input1, int input2, int input3
 
 void Shader::setUniform4(const char* varname, const int input1, const int input2, const int input3, const int input4)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform4iARB(loc, input1, input2, input3, input4);
 	assert (glGetError() == GL_NO_ERROR);
@@ -432,7 +811,7 @@ void Shader::setUniform4(const char* varname, const int input1, const int input2
 
 void Shader::setUniform1Array(const char* varname, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform1ivARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
@@ -440,7 +819,7 @@ void Shader::setUniform1Array(const char* varname, const int* input, const int c
 
 void Shader::setUniform2Array(const char* varname, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform2ivARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
@@ -448,7 +827,7 @@ void Shader::setUniform2Array(const char* varname, const int* input, const int c
 
 void Shader::setUniform3Array(const char* varname, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform3ivARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
@@ -456,7 +835,7 @@ void Shader::setUniform3Array(const char* varname, const int* input, const int c
 
 void Shader::setUniform4Array(const char* varname, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform4ivARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
@@ -464,7 +843,7 @@ void Shader::setUniform4Array(const char* varname, const int* input, const int c
 
 void Shader::setUniform1(const char* varname, const float input1)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform1fARB(loc, input1);
 	assert (glGetError() == GL_NO_ERROR);
@@ -472,7 +851,7 @@ void Shader::setUniform1(const char* varname, const float input1)
 
 void Shader::setUniform2(const char* varname, const float input1, const float input2)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform2fARB(loc, input1, input2);
 	assert (glGetError() == GL_NO_ERROR);
@@ -480,7 +859,7 @@ void Shader::setUniform2(const char* varname, const float input1, const float in
 
 void Shader::setUniform3(const char* varname, const float input1, const float input2, const float input3)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform3fARB(loc, input1, input2, input3);
 	assert (glGetError() == GL_NO_ERROR);
@@ -488,7 +867,7 @@ void Shader::setUniform3(const char* varname, const float input1, const float in
 
 void Shader::setUniform4(const char* varname, const float input1, const float input2, const float input3, const float input4)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform4fARB(loc, input1, input2, input3, input4);
 	assert (glGetError() == GL_NO_ERROR);
@@ -496,7 +875,7 @@ void Shader::setUniform4(const char* varname, const float input1, const float in
 
 void Shader::setUniform1Array(const char* varname, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform1fvARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
@@ -504,7 +883,7 @@ void Shader::setUniform1Array(const char* varname, const float* input, const int
 
 void Shader::setUniform2Array(const char* varname, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform2fvARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
@@ -512,7 +891,7 @@ void Shader::setUniform2Array(const char* varname, const float* input, const int
 
 void Shader::setUniform3Array(const char* varname, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform3fvARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
@@ -520,7 +899,7 @@ void Shader::setUniform3Array(const char* varname, const float* input, const int
 
 void Shader::setUniform4Array(const char* varname, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniform4fvARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
@@ -528,7 +907,7 @@ void Shader::setUniform4Array(const char* varname, const float* input, const int
 
 void Shader::setMatrix44(const char* varname, const float* m)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniformMatrix4fvARB(loc, 1, GL_FALSE, m);
 	assert (glGetError() == GL_NO_ERROR);
@@ -536,12 +915,61 @@ void Shader::setMatrix44(const char* varname, const float* m)
 
 void Shader::setMatrix44(const char* varname, const Matrix44 &m)
 {
-	GLint loc = getLocation(varname, &locations);
+	GLint loc = getLocationByName(varname);
 	CHECK_SHADER_VAR(loc,varname);
 	glUniformMatrix4fvARB(loc, 1, GL_FALSE, m.m);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
+void Shader::setUniform1(UniformHandle uniform, const int input)
+{
+	GLint loc = getLocation(uniform);
+	CHECK_SHADER_VAR(loc,getUniformName(uniform));
+	glUniform1iARB(loc, input);
+	assert (glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setUniform1(UniformHandle uniform, const float input)
+{
+	GLint loc = getLocation(uniform);
+	CHECK_SHADER_VAR(loc,getUniformName(uniform));
+	glUniform1fARB(loc, input);
+	assert (glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setUniform3Array(UniformHandle uniform, const float* input, const int count)
+{
+	GLint loc = getLocation(uniform);
+	CHECK_SHADER_VAR(loc,getUniformName(uniform));
+	glUniform3fvARB(loc,count,input);
+	assert (glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setUniform4Array(UniformHandle uniform, const float* input, const int count)
+{
+	GLint loc = getLocation(uniform);
+	CHECK_SHADER_VAR(loc,getUniformName(uniform));
+	glUniform4fvARB(loc,count,input);
+	assert (glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setMatrix44(UniformHandle uniform, const float* m)
+{
+	GLint loc = getLocation(uniform);
+	CHECK_SHADER_VAR(loc,getUniformName(uniform));
+	glUniformMatrix4fvARB(loc, 1, GL_FALSE, m);
+	assert (glGetError() == GL_NO_ERROR);
+}
+
+void Shader::setTexture(UniformHandle uniform, unsigned int tex)
+{
+	glActiveTexture(GL_TEXTURE0 + last_slot);
+	glBindTexture(GL_TEXTURE_2D,tex);
+	setUniform1(uniform,last_slot);
+	last_slot++;
+	glActiveTexture(GL_TEXTURE0 + last_slot);
+}
+
 //*****************************************
 
 const char* texture_vertex_shader = "\
@@ -573,6 +1001,47 @@ Shader* Shader::getGenericTextureShader()
 	return texture_shader;
 }
 
+//the fixed function look (texture modulated by the color, no lighting) for the instances drawn by the RenderQueue
+const char* instancing_vertex_shader =
+	"attribute mat4 " VERTEX_ATTRIB_INSTANCE_MODEL_NAME ";\n"
+	"attribute vec4 " VERTEX_ATTRIB_INSTANCE_COLOR_NAME ";\n"
+	"uniform vec3 position_bias;\n"
+	"uniform float position_scale;\n"
+	"varying vec4 v_color;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 position = vec4(gl_Vertex.xyz * position_scale + position_bias, 1.0);\n"
+	"	gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+	"	v_color = " VERTEX_ATTRIB_INSTANCE_COLOR_NAME ";\n"
+	"	gl_Position = gl_ModelViewProjectionMatrix * (" VERTEX_ATTRIB_INSTANCE_MODEL_NAME " * position);\n"
+	"}\n";
+
+const char* instancing_pixel_shader =
+	"uniform sampler2D texture;\n"
+	"uniform float textured;\n"
+	"varying vec4 v_color;\n"
+	"void main()\n"
+	"{\n"
+	"	gl_FragColor = textured > 0.5 ? v_color * texture2D(texture,gl_TexCoord[0].st) : v_color;\n"
+	"}\n";
+
+Shader* instancing_shader = NULL;
+
+Shader* Shader::getInstancingShader()
+{
+	static bool failed = false;
+	if (instancing_shader || failed) return instancing_shader;
+	Shader* sh = new Shader();
+	if (!sh->compileFromMemory(instancing_vertex_shader,instancing_pixel_shader))
+	{
+		std::cout << "Instancing shader: " << sh->getInfoLog() << std::endl;
+		failed = true;
+		delete sh;
+		return NULL;
+	}
+	instancing_shader = sh;
+	return instancing_shader;
+}
 
 void Shader::init()
 {
@@ -594,6 +1063,7 @@ void Shader::init()
 		IMPORT_GLEXT( glGetInfoLogARB );
 		IMPORT_GLEXT( glGetUniformLocationARB );
 		IMPORT_GLEXT( glGetAttribLocationARB );
+		IMPORT_GLEXT( glBindAttribLocationARB );
 		IMPORT_GLEXT( glUniform1iARB );
 		IMPORT_GLEXT( glUniform2iARB );
 		IMPORT_GLEXT( glUniform3iARB );
@@ -611,6 +1081,19 @@ void Shader::init()
 		IMPORT_GLEXT( glUniform3fvARB );
 		IMPORT_GLEXT( glUniform4fvARB );
 		IMPORT_GLEXT( glUniformMatrix4fvARB );
+
+		glGetProgramiv = (glGetProgramiv_func) SDL_GL_GetProcAddress("glGetProgramiv");
+		glGetProgramBinary = (glGetProgramBinary_func) SDL_GL_GetProcAddress("glGetProgramBinary");
+		glProgramBinary = (glProgramBinary_func) SDL_GL_GetProcAddress("glProgramBinary");
+		glProgramParameteri = (glProgramParameteri_func) SDL_GL_GetProcAddress("glProgramParameteri");
+		GLint num_formats = 0;
+		if (glGetProgramiv && glGetProgramBinary && glProgramBinary && glProgramParameteri)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+		s_program_binaries = num_formats > 0;
+
+		const char* strings[] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION) };
+		for (int i = 0; i < 3; ++i)
+			s_driver += std::string(strings[i] ? strings[i] : "") + "\n";
 	}
 	
 	firsttime = false;
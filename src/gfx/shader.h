@@ -1,5 +1,8 @@
 /*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
 	This allows to use compile and use shaders when rendering. Used for advanced lighting.
+	A pair of files can be loaded with a list of macros (like "ALPHA_TEST FOG"), every list is a different variant
+	and the sources see them as #defines. When the driver supports program binaries the linked programs are kept
+	in .prog files next to the vertex shader, so the next launch does not compile them again.
 */
 
 #ifndef SHADER_H
@@ -7,18 +10,45 @@
 
 #include "../includes.h"
 #include "../utils/math.h"
+#include "../utils/resource.h"
 #include <string>
+#include <vector>
 #include <map>
 
 #ifdef _DEBUG
 	#define CHECK_SHADER_VAR(a,b) if (a == -1) return
-	//#define CHECK_SHADER_VAR(a,b) if (a == -1) { std::cout << "Shader error: Var not found in shader: " << b << std::endl; return; } 
+	//#define CHECK_SHADER_VAR(a,b) if (a == -1) { std::cout << "Shader error: Var not found in shader: " << b << std::endl; return; } //b is the name, see getUniformName
 #else
 	#define CHECK_SHADER_VAR(a,b) if (a == -1) return
 #endif
 
+//the uniforms set by the engine, they have the same handle in every shader
+enum eEngineUniform {
+	UNIFORM_MODEL, UNIFORM_MODELT, UNIFORM_MVP, UNIFORM_CAMERA_POS, UNIFORM_LIGHT_COLOR, UNIFORM_LIGHT_DIR, UNIFORM_FOG_COLOR, UNIFORM_FOG_DENSITY,
+	UNIFORM_TEXTURE, UNIFORM_TIME, UNIFORM_EMISSIVE_COLOR, UNIFORM_SPECULAR, UNIFORM_SPECULAR_GLOSS, UNIFORM_GROUND_COLOR, UNIFORM_AMBIENT_COLOR,
+	UNIFORM_DISCARD_UP,
+	NUM_ENGINE_UNIFORMS
+};
+
+#define UNIFORM_UNRESOLVED -2 //in the location table, the name has not been looked up in the program yet
+
+//slot of a uniform name in the location table of the shaders, get it once with Shader::getUniformHandle and keep it
+struct UniformHandle
+{
+	int slot;
+	UniformHandle(eEngineUniform uniform) : slot(uniform) {}
+	explicit UniformHandle(int slot = -1) : slot(slot) {}
+};
 
-class Shader
+struct ShaderLoadStats
+{
+	unsigned int compiled; //programs compiled and linked from the sources
+	unsigned int cached; //programs created from a .prog file
+	float compile_time; //milliseconds in the main thread for the compiled ones
+	float cache_time; //milliseconds in the main thread for the cached ones
+};
+
+class Shader : public Resource
 {
 	int last_slot;
 
@@ -34,19 +64,41 @@ public:
 
 	virtual bool load(const std::string& vsf, const std::string& psf);
 
+	//load split in two: prepare reads the sources and the cached program (no OpenGL, it can run in a worker thread)
+	//and link creates the program from the cached binary or compiling the sources (main thread)
+	bool prepare();
+	bool link();
+
 	//internal functions
 	virtual bool compileFromMemory(const std::string& vsm, const std::string& psm);
 	virtual void release();
 	virtual void enable();
 	virtual void disable();
+	void resetTextureSlots(); //the next setTexture uses the first unit again, for several objects drawn with the shader enabled
 
 	static void init();
 	static void disableShaders();
 
 	static Shader* getGenericTextureShader();
+	static Shader* getInstancingShader(); //for Mesh::drawInstanced, NULL if it cannot be compiled
 
 	//uniform exist
 	virtual bool IsVar(const char* varname) { return (getUniformLocation(varname) != -1); }
+	bool IsVar(UniformHandle uniform) { return getLocation(uniform) != -1; }
+
+	//the same name always gets the same handle, the engine uniforms have theirs in eEngineUniform.
+	//Every name registered adds a slot to the location table of all the shaders, the setters by name do not register them
+	static UniformHandle getUniformHandle(const char* varname);
+	static const char* getUniformName(UniformHandle uniform); //"" if it is not a valid handle
+
+	//upload with handles, a table access instead of the search of the name
+	void setUniform1(UniformHandle uniform, const int input);
+	void setUniform1(UniformHandle uniform, const float input);
+	void setUniform3(UniformHandle uniform, const Vector3& input) { setUniform3Array(uniform, input.v, 1); }
+	void setUniform3Array(UniformHandle uniform, const float* input, const int count);
+	void setUniform4Array(UniformHandle uniform, const float* input, const int count);
+	void setMatrix44(UniformHandle uniform, const float* m);
+	void setTexture(UniformHandle uniform, const unsigned int tex);
 
 	//upload
 	virtual void setFloat(const char* varname, const float& input) { setUniform1(varname, input); }
@@ -80,13 +132,36 @@ public:
 	virtual int getAttribLocation(const char* varname);
 	virtual int getUniformLocation(const char* varname);
 
+	//-1 if the program does not use it
+	GLint getLocation(UniformHandle uniform)
+	{
+		if ((size_t)uniform.slot < uniform_locations.size() && uniform_locations[uniform.slot] != UNIFORM_UNRESOLVED)
+			return uniform_locations[uniform.slot];
+		return resolveLocation(uniform.slot);
+	}
+
 	std::string getInfoLog() const;
 	bool hasInfoLog() const;
 
-	static Shader* Load(const char* vsf, const char* psf);
+	//the compiled program size is not known, only the CPU side is measured
+	size_t getCPUBytes() const { return sizeof(Shader) + vs_filename.size() + ps_filename.size() + macros.size() + info_log.size() + log.size() + uniform_locations.size() * sizeof(GLint); }
+	size_t getVRAMBytes() const { return 0; }
+
+	//macros separated by spaces, the order does not matter
+	static Shader* Load(const char* vsf, const char* psf, const char* macros = NULL);
+	static Shader* LoadAsync(const char* vsf, const char* psf, const char* macros = NULL); //not compiled (enable does nothing) until ResourceLoader uploads it
 	static void ReloadAll();
 	static std::map<std::string,Shader*> s_Shaders;
 
+	static bool use_program_cache; //read and write the .prog files
+	static ShaderLoadStats load_stats;
+	static void dumpStats();
+
+	std::string macros; //of the variant, sorted
+	bool is_loading; //requested with LoadAsync and not linked yet
+
+	unsigned int frame_uniforms_version; //of the frame constants it has (see World::uploadFrameUniforms), 0 after linking
+
 protected:
 
 	bool readFile(const std::string& filename, std::string& content);
@@ -108,22 +183,22 @@ protected:
 	GLhandleARB program;
 	std::string log;
 
-//this is a hack to speed up shader usage (save info locally)
-private: 
-
-	struct ltstr
-	{
-		bool operator()(const char* s1, const char* s2) const
-		{
-			return strcmp(s1, s2) < 0;
-		}
-	};	
-	typedef std::map<const char*, int, ltstr> loctable;
-
-public:
-	GLint getLocation(const char* varname, loctable* table);
-	loctable locations;	
-
+	//between prepare and link
+	std::string vs_source;
+	std::string ps_source;
+	unsigned long long cache_key; //hash of the sources, the macros and the driver
+	unsigned int cached_format;
+	std::vector<char> cached_binary;
+
+	std::string getCacheFilename() const;
+	bool readProgramCache();
+	bool linkProgramCache();
+	void writeProgramCache();
+
+	std::vector<GLint> uniform_locations; //by the slot of the handles, filled when linked and when new names are used
+	void resolveLocations(); //all the names with a handle
+	GLint resolveLocation(int slot);
+	GLint getLocationByName(const char* varname); //for the setters by name, the table if the name has a handle, otherwise asks the program
 };
 
 #endif
\ No newline at end of file
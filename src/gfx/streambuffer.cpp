@@ -0,0 +1,317 @@
+#include "streambuffer.h"
+
+#include "../includes.h"
+
+#include <cassert>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#define STREAM_FENCE_TIMEOUT 1000000000 //nanoseconds
+
+//registered in mesh.cpp
+typedef void (APIENTRY * glGenBuffersARB_func)(GLsizei n, GLuint* ids); extern glGenBuffersARB_func glGenBuffersARB;
+typedef void (APIENTRY * glBindBufferARB_func)(GLenum target, GLuint id); extern glBindBufferARB_func glBindBufferARB;
+typedef void (APIENTRY * glBufferDataARB_func)(GLenum target, GLsizei size, const void* data, GLenum usage); extern glBufferDataARB_func glBufferDataARB;
+typedef void (APIENTRY * glDeleteBuffersARB_func)(GLsizei n, const GLuint* ids); extern glDeleteBuffersARB_func glDeleteBuffersARB;
+
+REGISTER_GLEXT( void, glBufferSubDataARB, GLenum target, GLintptrARB offset, GLsizeiptrARB size, const void* data )
+REGISTER_GLEXT( void*, glMapBufferRange, GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access )
+REGISTER_GLEXT( GLboolean, glUnmapBufferARB, GLenum target )
+REGISTER_GLEXT( GLsync, glFenceSync, GLenum condition, GLbitfield flags )
+REGISTER_GLEXT( GLenum, glClientWaitSync, GLsync sync, GLbitfield flags, GLuint64 timeout )
+REGISTER_GLEXT( void, glDeleteSync, GLsync sync )
+
+size_t StreamBuffer::ring_size = 4 * 1024 * 1024;
+bool StreamBuffer::use_vram = true;
+StreamBufferStats StreamBuffer::stats = StreamBufferStats();
+StreamBufferStats StreamBuffer::last_frame_stats = StreamBufferStats();
+
+//the region written by a frame, [start,end) or [start,ring_size) and [0,end) if it wrapped
+struct sFrameRegion
+{
+	GLsync fence;
+	size_t start;
+	size_t end;
+	bool wrapped;
+};
+
+static bool s_initialized = false;
+static GLuint s_vbo = 0;
+static size_t s_vbo_size = 0;
+static size_t s_head = 0; //where the next mapping starts
+static sFrameRegion s_frame = { 0, 0, 0, false }; //the one being written, without fence yet
+static std::deque<sFrameRegion> s_fenced; //oldest first
+static std::vector<char> s_ram; //the vertices when they are not mapped from the VBO
+static size_t s_mapped_offset = 0;
+static size_t s_mapped_bytes = 0;
+static bool s_mapped = false;
+static bool s_mapped_ring = false; //the vertices go to the VBO at s_mapped_offset
+static bool s_mapped_vbo = false; //the pointer comes from glMapBufferRange, otherwise from s_ram
+static bool s_bound = false; //unmapData left the VBO bound
+
+static void init()
+{
+	s_initialized = true;
+	if (!glGenBuffersARB) //Mesh imports them in its first constructor
+	{
+		IMPORT_GLEXT( glGenBuffersARB );
+		IMPORT_GLEXT( glBindBufferARB );
+		IMPORT_GLEXT( glBufferDataARB );
+		IMPORT_GLEXT( glDeleteBuffersARB );
+	}
+	IMPORT_GLEXT( glBufferSubDataARB );
+
+	//optional, without them the data is uploaded with glBufferSubData and the buffer orphaned every time it wraps
+	glMapBufferRange = (glMapBufferRange_func) SDL_GL_GetProcAddress("glMapBufferRange");
+	glUnmapBufferARB = (glUnmapBufferARB_func) SDL_GL_GetProcAddress("glUnmapBufferARB");
+	glFenceSync = (glFenceSync_func) SDL_GL_GetProcAddress("glFenceSync");
+	glClientWaitSync = (glClientWaitSync_func) SDL_GL_GetProcAddress("glClientWaitSync");
+	glDeleteSync = (glDeleteSync_func) SDL_GL_GetProcAddress("glDeleteSync");
+	if (!glUnmapBufferARB)
+		glMapBufferRange = NULL;
+	if (!glClientWaitSync || !glDeleteSync)
+		glFenceSync = NULL;
+}
+
+static bool regionOverlaps(const sFrameRegion& region, size_t offset, size_t bytes)
+{
+	if (region.wrapped)
+		return offset < region.end || offset + bytes > region.start;
+	return offset < region.end && offset + bytes > region.start;
+}
+
+static void deleteFences()
+{
+	for (size_t i = 0; i < s_fenced.size(); ++i)
+		glDeleteSync(s_fenced[i].fence);
+	s_fenced.clear();
+}
+
+static void allocateStorage(size_t size)
+{
+	s_vbo_size = size;
+	glBufferDataARB( GL_ARRAY_BUFFER_ARB, (GLsizei)size, NULL, GL_STREAM_DRAW_ARB );
+	s_head = 0;
+	s_frame.start = s_frame.end = 0;
+	s_frame.wrapped = false;
+}
+
+//a new storage for the buffer, the driver keeps the old one until the GPU has finished with it
+static void orphan(size_t size)
+{
+	deleteFences();
+	allocateStorage(size);
+	StreamBuffer::stats.orphans++;
+}
+
+//finds where the bytes go in the ring, the buffer must be bound
+static size_t reserve(size_t bytes)
+{
+	s_head = (s_head + 15) & ~(size_t)15; //other layouts can follow the vertices
+	if (bytes > s_vbo_size)
+	{
+		while (StreamBuffer::ring_size < bytes)
+			StreamBuffer::ring_size *= 2;
+		orphan(StreamBuffer::ring_size);
+	}
+
+	if (s_head + bytes > s_vbo_size) //wrap
+	{
+		if (s_frame.wrapped || !glFenceSync) //it would write over this frame, or nothing tells when the GPU has finished with the old data
+			orphan(s_vbo_size);
+		else
+		{
+			if (s_frame.start == s_frame.end)
+				s_frame.start = 0;
+			else
+				s_frame.wrapped = true;
+			s_head = s_frame.end = 0;
+		}
+	}
+
+	//the region of this frame has no fence yet, the only way to write over it is a new buffer
+	if (s_frame.wrapped && regionOverlaps(s_frame, s_head, bytes))
+		orphan(s_vbo_size);
+
+	//the newest frame using the region, the older ones have finished if it has
+	int newest = -1;
+	for (int i = 0; i < (int)s_fenced.size(); ++i)
+		if (regionOverlaps(s_fenced[i], s_head, bytes))
+			newest = i;
+	if (newest >= 0)
+	{
+		GLenum result = glClientWaitSync(s_fenced[newest].fence, GL_SYNC_FLUSH_COMMANDS_BIT, STREAM_FENCE_TIMEOUT);
+		if (result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED)
+			orphan(s_vbo_size);
+		else
+		{
+			StreamBuffer::stats.waits++;
+			for (int i = 0; i <= newest; ++i)
+				glDeleteSync(s_fenced[i].fence);
+			s_fenced.erase(s_fenced.begin(), s_fenced.begin() + newest + 1);
+		}
+	}
+
+	size_t offset = s_head;
+	s_head += bytes;
+	s_frame.end = s_head;
+	return offset;
+}
+
+void* StreamBuffer::mapData(size_t bytes)
+{
+	assert(!s_mapped && "StreamBuffer already mapped");
+	if (!s_initialized)
+		init();
+
+	s_mapped = true;
+	s_mapped_bytes = bytes;
+	s_mapped_ring = false;
+	s_mapped_vbo = false;
+	if (bytes == 0)
+		return NULL;
+
+	if (!use_vram || !glGenBuffersARB)
+	{
+		if (s_ram.size() < bytes)
+			s_ram.resize(bytes);
+		return &s_ram[0];
+	}
+
+	if (s_vbo == 0)
+	{
+		glGenBuffersARB( 1, &s_vbo );
+		glBindBufferARB( GL_ARRAY_BUFFER_ARB, s_vbo );
+		allocateStorage(ring_size);
+	}
+	else
+		glBindBufferARB( GL_ARRAY_BUFFER_ARB, s_vbo );
+
+	s_mapped_offset = reserve(bytes);
+	s_mapped_ring = true;
+
+	void* data = NULL;
+	if (glMapBufferRange) //the ring already keeps the GPU away from this region
+		data = glMapBufferRange( GL_ARRAY_BUFFER_ARB, s_mapped_offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT );
+	glBindBufferARB( GL_ARRAY_BUFFER_ARB, 0 );
+
+	if (data)
+	{
+		s_mapped_vbo = true;
+		return data;
+	}
+
+	//written in RAM and uploaded in unmapData
+	if (s_ram.size() < bytes)
+		s_ram.resize(bytes);
+	return &s_ram[0];
+}
+
+const char* StreamBuffer::unmapData(size_t bytes)
+{
+	assert(s_mapped && "StreamBuffer::unmapData without map");
+	assert(bytes <= s_mapped_bytes);
+	s_mapped = false;
+	stats.bytes += bytes;
+
+	if (!s_mapped_ring)
+	{
+		if (glBindBufferARB) //the address would be read as an offset in the VBO of a mesh
+			glBindBufferARB( GL_ARRAY_BUFFER_ARB, 0 );
+		return bytes ? &s_ram[0] : NULL;
+	}
+
+	//the part that was not written is given back to the ring
+	s_head = s_frame.end = s_mapped_offset + bytes;
+
+	glBindBufferARB( GL_ARRAY_BUFFER_ARB, s_vbo );
+	s_bound = true;
+	if (s_mapped_vbo)
+		glUnmapBufferARB( GL_ARRAY_BUFFER_ARB );
+	else if (bytes)
+		glBufferSubDataARB( GL_ARRAY_BUFFER_ARB, s_mapped_offset, bytes, &s_ram[0] );
+	return (const char*)NULL + s_mapped_offset;
+}
+
+void StreamBuffer::unbind()
+{
+	if (s_bound)
+		glBindBufferARB( GL_ARRAY_BUFFER_ARB, 0 );
+	s_bound = false;
+}
+
+void StreamBuffer::draw(unsigned int primitive, unsigned int num_vertices)
+{
+	const char* base = unmapData(num_vertices * sizeof(StreamVertex));
+	if (num_vertices == 0)
+	{
+		unbind();
+		return;
+	}
+	stats.draws++;
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer( 3, GL_FLOAT, sizeof(StreamVertex), base + offsetof(StreamVertex, position) );
+	glTexCoordPointer( 2, GL_FLOAT, sizeof(StreamVertex), base + offsetof(StreamVertex, uv) );
+	glColorPointer( 4, GL_UNSIGNED_BYTE, sizeof(StreamVertex), base + offsetof(StreamVertex, color) );
+
+	glDrawArrays( primitive, 0, num_vertices );
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
+	unbind();
+}
+
+void StreamBuffer::endFrame()
+{
+	assert(!s_mapped && !s_bound && "StreamBuffer mapped at the end of the frame");
+	bool frame_empty = s_frame.start == s_frame.end && !s_frame.wrapped;
+	if (s_vbo && glFenceSync && !frame_empty)
+	{
+		s_frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		s_fenced.push_back(s_frame);
+	}
+
+	//the frames the GPU has finished, so the ones that never get overwritten do not pile up
+	while (!s_fenced.empty())
+	{
+		GLenum result = glClientWaitSync(s_fenced.front().fence, 0, 0);
+		if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+			break;
+		glDeleteSync(s_fenced.front().fence);
+		s_fenced.pop_front();
+	}
+	s_frame.fence = 0;
+	s_frame.start = s_frame.end = s_head;
+	s_frame.wrapped = false;
+
+	last_frame_stats = stats;
+	memset(&stats, 0, sizeof(StreamBufferStats));
+}
+
+void StreamBuffer::dumpStats()
+{
+	const StreamBufferStats& s = last_frame_stats;
+	std::cout << "StreamBuffer: " << (s.bytes / 1024) << " KB streamed in " << s.draws << " draws, waits " << s.waits << " orphans " << s.orphans
+		<< " ring " << (s_vbo_size / 1024) << " KB" << std::endl;
+}
+
+void StreamBuffer::release()
+{
+	assert(!s_mapped);
+	if (s_vbo)
+	{
+		deleteFences();
+		glDeleteBuffersARB( 1, &s_vbo );
+	}
+	s_vbo = 0;
+	s_vbo_size = 0;
+	s_head = 0;
+	s_frame.start = s_frame.end = 0;
+	s_frame.wrapped = false;
+	std::vector<char>().swap(s_ram);
+}
@@ -0,0 +1,62 @@
+/*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
+	Ring buffer in VRAM for the geometry that is generated every frame (particles, text, debug lines).
+	The producers map some vertices, write them straight into the buffer and draw them, there are no copies in between.
+	Every frame writes after the previous one and leaves a fence, when the ring wraps it only waits for the frames that
+	used the region it is going to overwrite. Without fences (or when a frame needs the whole ring) the buffer is orphaned.
+	Only from the main thread, one mapping at a time. The mappings start at multiples of 16 bytes.
+*/
+
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <cstddef>
+#include "../utils/math.h"
+
+struct StreamVertex
+{
+	Vector3 position;
+	Vector2 uv;
+	unsigned int color; //RGBA bytes, see packColor
+
+	void set(const Vector3& position, float u, float v, unsigned int color) { this->position = position; uv.set(u,v); this->color = color; }
+};
+
+inline unsigned int packColor(float r, float g, float b, float a)
+{
+	#define COLOR_BYTE(x) ((unsigned int)((x) <= 0.0f ? 0 : ((x) >= 1.0f ? 255 : (x) * 255.0f + 0.5f)))
+	return COLOR_BYTE(r) | (COLOR_BYTE(g) << 8) | (COLOR_BYTE(b) << 16) | (COLOR_BYTE(a) << 24);
+	#undef COLOR_BYTE
+}
+
+struct StreamBufferStats
+{
+	size_t bytes; //written to the ring
+	unsigned int draws;
+	unsigned int waits; //times it had to wait for the GPU before reusing a region
+	unsigned int orphans; //times the whole buffer was replaced
+};
+
+class StreamBuffer
+{
+public:
+	static size_t ring_size; //bytes of the VBO, it grows if a single draw needs more. Change it before the first use
+	static bool use_vram; //false draws from RAM with vertex arrays, like Mesh::render(0,true) did
+	static StreamBufferStats stats; //of the frame being rendered
+	static StreamBufferStats last_frame_stats;
+
+	//space for num_vertices, NULL if num_vertices is 0. Write them and call draw, it can draw less than mapped
+	static StreamVertex* map(unsigned int num_vertices) { return (StreamVertex*)mapData(num_vertices * sizeof(StreamVertex)); }
+	static void draw(unsigned int primitive, unsigned int num_vertices); //always after map, with 0 it only unmaps
+
+	//the same for other layouts (like per instance attributes): unmapData binds the buffer and returns the pointer
+	//for the gl*Pointer calls (an offset in the VBO or an address in RAM), call unbind once they are set
+	static void* mapData(size_t bytes);
+	static const char* unmapData(size_t bytes_written);
+	static void unbind();
+
+	static void endFrame(); //fences the region written in the frame and moves stats to last_frame_stats
+	static void dumpStats();
+	static void release(); //frees the VBO, it is created again when needed
+};
+
+#endif
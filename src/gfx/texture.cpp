@@ -1,26 +1,60 @@
 #include "texture.h"
 #include "../utils/utils.h"
+#include "../utils/math.h"
+#include "../utils/resourceloader.h"
+#include "../utils/jobsystem.h"
 
 #include <iostream> //to output
 #include <cmath>
+#include <vector>
+#include <algorithm>
+
+#ifdef USE_SSE
+	#include <emmintrin.h>
+#endif
+
+#define TGA_MIPMAP_ROWS 64 //rows of a mipmap per job, the small levels are done in the calling thread
+#define TGA_MAX_SIZE 16384 //bigger files are rejected before allocating, the chain of mipmaps of this one already takes 1.4GB
 
 std::map<std::string, Texture*> Texture::sTexturesLoaded;
 glGenerateMipmapEXT_func glGenerateMipmapEXT = NULL;
+static GLuint s_placeholder_id = 0;
 
-Texture::Texture()
+Texture::Texture() : Resource(RESOURCE_TEXTURE)
 {
+	texture_id = 0;
 	width = 0;
 	height = 0;
 	hasMipmaps = false;
+	is_loading = false;
+	vram_bytes = 0;
 
 	if(glGenerateMipmapEXT == NULL) //get the extension
 		glGenerateMipmapEXT = (glGenerateMipmapEXT_func) SDL_GL_GetProcAddress("glGenerateMipmapEXT");
 }
 
+Texture::~Texture()
+{
+	if (texture_id && texture_id != s_placeholder_id)
+		glDeleteTextures(1, &texture_id);
+
+	//it could be in the cache if it was loaded with Load
+	std::map<std::string, Texture*>::iterator it = sTexturesLoaded.find(filename);
+	if (it != sTexturesLoaded.end() && it->second == this)
+		sTexturesLoaded.erase(it);
+}
 
 Texture* Texture::Load(const char* filename)
 {
 	std::map<std::string, Texture*>::iterator it = sTexturesLoaded.find(filename);
+	if (it != sTexturesLoaded.end() && it->second->is_loading) //requested with LoadAsync, wait for it
+	{
+		ResourceLoader::flush();
+		it = sTexturesLoaded.find(filename); //if it failed it is not in the cache anymore
+		if (it == sTexturesLoaded.end())
+			return NULL;
+	}
+
 	if (it == sTexturesLoaded.end())
 	{
 		std::cout << "Texture loading: " << filename << " ... ";
@@ -33,12 +67,97 @@ Texture* Texture::Load(const char* filename)
 			return NULL;
 		}
 		std::cout << "[OK] Size: " << t->width << "," << t->height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		t->filename = filename;
+		t->evictable = true;
 		sTexturesLoaded[filename] = t;
 		return t;
 	}
 	return it->second;
 }
 
+//TGAs are decoded in a worker thread and uploaded in the main thread, DDS files are loaded in the main thread
+class TextureLoadJob : public ResourceJob
+{
+public:
+	Texture* texture;
+	std::string filename;
+	Texture::TGAInfo* tgainfo;
+
+	TextureLoadJob() { tgainfo = NULL; }
+
+	bool isTGA() { std::string ext = filename.size() > 4 ? filename.substr( filename.size() - 4, 4 ) : ""; return ext == ".tga" || ext == ".TGA"; }
+
+	bool load()
+	{
+		if (!isTGA())
+			return true;
+		tgainfo = texture->loadTGA( filename.c_str(), false ); //the loader threads are not from the JobSystem
+		return tgainfo != NULL;
+	}
+
+	void upload()
+	{
+		GLuint placeholder_id = texture->texture_id;
+		bool done = false;
+		if (tgainfo)
+		{
+			texture->filename = filename;
+			done = texture->uploadTGA(tgainfo);
+		}
+		else if (loaded)
+			done = texture->load( filename.c_str() );
+
+		if (done)
+			std::cout << "Texture loaded: " << filename << " Size: " << texture->width << "," << texture->height << std::endl;
+		else
+		{
+			//the ones holding it keep showing the placeholder, but Load and LoadAsync do not return it again
+			texture->texture_id = placeholder_id;
+			std::cout << "[ERROR]: Texture not found: " << filename << std::endl;
+			std::map<std::string, Texture*>::iterator it = Texture::sTexturesLoaded.find(filename);
+			if (it != Texture::sTexturesLoaded.end() && it->second == texture)
+				Texture::sTexturesLoaded.erase(it);
+		}
+		texture->is_loading = false;
+	}
+};
+
+Texture* Texture::LoadAsync(const char* filename)
+{
+	//registered before it is loaded so requests for the same file share it
+	std::map<std::string, Texture*>::iterator it = sTexturesLoaded.find(filename);
+	if (it != sTexturesLoaded.end())
+		return it->second;
+
+	Texture* t = new Texture();
+	t->texture_id = getPlaceholderId();
+	t->width = t->height = 1;
+	t->is_loading = true;
+	t->filename = filename;
+	t->evictable = true;
+	sTexturesLoaded[filename] = t;
+
+	TextureLoadJob* job = new TextureLoadJob();
+	job->texture = t;
+	job->filename = filename;
+	ResourceLoader::addJob(job);
+	return t;
+}
+
+GLuint Texture::getPlaceholderId()
+{
+	if (s_placeholder_id == 0)
+	{
+		GLubyte white[4] = {255, 255, 255, 255};
+		glGenTextures(1, &s_placeholder_id);
+		glBindTexture(GL_TEXTURE_2D, s_placeholder_id);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+	}
+	return s_placeholder_id;
+}
+
 bool Texture::load(const char* filename)
 {
 	std::string str = filename;
@@ -46,23 +165,11 @@ bool Texture::load(const char* filename)
 
 	if (ext == ".tga" || ext == ".TGA")
 	{
-		TGAInfo* tgainfo = loadTGA(filename);
-		if (tgainfo == NULL)
+		TGAInfo* tgainfo = loadTGA(filename, true);
+		if (tgainfo == NULL || !uploadTGA(tgainfo))
 			return false;
 
 		this->filename = filename;
-
-		//How to store a texture in VRAM
-		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
-		glBindTexture(GL_TEXTURE_2D, texture_id);	//we activate this id to tell opengl we are going to use this texture
-		//glTexImage2D(GL_TEXTURE_2D, 0, 3, tgainfo->width, tgainfo->height, 0, GL_RGB, GL_UNSIGNED_BYTE, tgainfo->data); //upload without mipmaps
-		gluBuild2DMipmaps(GL_TEXTURE_2D, ( tgainfo->bpp == 24 ? 3 : 4), tgainfo->width, tgainfo->height, ( tgainfo->bpp == 24 ? GL_RGB : GL_RGBA) , GL_UNSIGNED_BYTE, tgainfo->data); //upload the texture and create their mipmaps
-		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR); //set the mag filter
-		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);	//set the min filter
-		width = tgainfo->width;
-		height = tgainfo->height;
-		delete tgainfo->data;
-		delete tgainfo;
 		return true;
 	}
 	else if (ext == ".dds" || ext == ".DDS")
@@ -74,8 +181,65 @@ bool Texture::load(const char* filename)
 	return false;
 }
 
+//GL 2.0 accepts any size, before it only with the extension
+static bool supportsNPOT()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		const char* version = (const char*)glGetString(GL_VERSION);
+		const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+		supported = (version && atoi(version) >= 2) || (extensions && strstr(extensions, "GL_ARB_texture_non_power_of_two"));
+	}
+	return supported != 0;
+}
+
+//creates the texture in VRAM and frees the TGA, false if it is too big for this driver
+bool Texture::uploadTGA(TGAInfo* tgainfo)
+{
+	GLint max_size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	if (max_size > 0 && (tgainfo->width > (GLuint)max_size || tgainfo->height > (GLuint)max_size))
+	{
+		std::cerr << "TGA of " << tgainfo->width << "x" << tgainfo->height << " is bigger than GL_MAX_TEXTURE_SIZE " << max_size << std::endl;
+		free(tgainfo->data);
+		delete tgainfo;
+		return false;
+	}
+
+	//How to store a texture in VRAM
+	glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
+	glBindTexture(GL_TEXTURE_2D, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLint format = tgainfo->bpp == 24 ? GL_RGB : GL_RGBA;
+	bool power_of_two = (tgainfo->width & (tgainfo->width - 1)) == 0 && (tgainfo->height & (tgainfo->height - 1)) == 0;
+	if (power_of_two || supportsNPOT())
+	{
+		//the mipmaps were built by loadTGA
+		GLubyte* level = tgainfo->data;
+		GLuint w = tgainfo->width, h = tgainfo->height;
+		for (GLuint i = 0; i < tgainfo->num_levels; ++i)
+		{
+			glTexImage2D(GL_TEXTURE_2D, i, format, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, level);
+			level += (size_t)w * h * 4;
+			w = std::max(w / 2, 1u);
+			h = std::max(h / 2, 1u);
+		}
+	}
+	else
+		gluBuild2DMipmaps(GL_TEXTURE_2D, format, tgainfo->width, tgainfo->height, GL_RGBA, GL_UNSIGNED_BYTE, tgainfo->data); //rescales it to a power of two
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR); //set the mag filter
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);	//set the min filter
+	width = tgainfo->width;
+	height = tgainfo->height;
+	vram_bytes = (size_t)tgainfo->width * tgainfo->height * 4 * 4 / 3; //drivers store RGB as RGBA, plus the mipmaps
+	free(tgainfo->data); //allocated with malloc in loadTGA
+	delete tgainfo;
+	return true;
+}
+
 void Texture::bind()
 {
+	touch();
 	glEnable( GL_TEXTURE_2D ); //enable the textures 
 	glBindTexture( GL_TEXTURE_2D, texture_id );	//enable the id of the texture we are going to use
 }
@@ -94,68 +258,296 @@ void Texture::generateMipmaps()
 	glGenerateMipmapEXT(GL_TEXTURE_2D);
 }
 
-Texture::TGAInfo* Texture::loadTGA(const char* filename)
-{
-    GLubyte TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    GLubyte TGAcompare[12];
-    GLubyte header[6];
-    GLuint bytesPerPixel;
-    GLuint imageSize;
-    GLuint temp;
-    GLuint type = GL_RGBA;
-
-    FILE * file = fopen(filename, "rb");
-    
-    if (file == NULL || fread(TGAcompare, 1, sizeof(TGAcompare), file) != sizeof(TGAcompare) ||
-        memcmp(TGAheader, TGAcompare, sizeof(TGAheader)) != 0 ||
-        fread(header, 1, sizeof(header), file) != sizeof(header))
-    {
-        if (file == NULL)
-            return NULL;
-        else
-        {
-			std::cerr << "TGA file has wrong encoding" << std::endl;
-            fclose(file);
-            return NULL;
-        }
-    }
+static inline void bgrToRGBA(const GLubyte* p, GLubyte* d)
+{
+	GLubyte b = p[0], g = p[1], r = p[2];
+	d[0] = r; d[1] = g; d[2] = b; d[3] = 255;
+}
 
-	TGAInfo* tgainfo = new TGAInfo;
-    
-    tgainfo->width = header[1] * 256 + header[0];
-    tgainfo->height = header[3] * 256 + header[2];
-    
-    if (tgainfo->width <= 0 || tgainfo->height <= 0 || (header[4] != 24 && header[4] != 32))
-    {
-        fclose(file);
-		delete tgainfo;
-        return NULL;
-    }
-    
-    tgainfo->bpp = header[4];
-    bytesPerPixel = tgainfo->bpp / 8;
-    imageSize = tgainfo->width * tgainfo->height * bytesPerPixel;
-    
-    tgainfo->data = (GLubyte*)malloc(imageSize);
-    
-    if (tgainfo->data == NULL || fread(tgainfo->data, 1, imageSize, file) != imageSize)
-    {
-        if (tgainfo->data != NULL)
-            free(tgainfo->data);
-            
-        fclose(file);
-		delete tgainfo;
-        return NULL;
-    }
-    
-    for (GLuint i = 0; i < int(imageSize); i += bytesPerPixel)
-    {
-        temp = tgainfo->data[i];
-        tgainfo->data[i] = tgainfo->data[i + 2];
-        tgainfo->data[i + 2] = temp;
-    }
-    
-    fclose(file);
+//BGR or BGRA pixels of the file to RGBA, the 24 bits ones get alpha 255. src can be dst (the pixels read in place)
+static void swizzleToRGBA(const GLubyte* src, GLubyte* dst, size_t num_pixels, GLuint bytes_per_pixel)
+{
+	if (bytes_per_pixel == 4)
+	{
+		size_t i = 0;
+#ifdef USE_SSE
+		//4 pixels per iteration, every one is a 32 bits lane 0xAARRGGBB that becomes 0xAABBGGRR
+		__m128i mask_ag = _mm_set1_epi32(0xFF00FF00);
+		__m128i mask_b = _mm_set1_epi32(0x000000FF);
+		for (; i + 4 <= num_pixels; i += 4)
+		{
+			__m128i p = _mm_loadu_si128((const __m128i*)(src + i * 4));
+			__m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), mask_b);
+			__m128i b = _mm_slli_epi32(_mm_and_si128(p, mask_b), 16);
+			_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(_mm_and_si128(p, mask_ag), _mm_or_si128(r, b)));
+		}
+#endif
+		for (; i < num_pixels; ++i)
+		{
+			const GLubyte* p = src + i * 4;
+			GLubyte* d = dst + i * 4;
+			GLubyte b = p[0];
+			d[0] = p[2]; d[1] = p[1]; d[2] = b; d[3] = p[3];
+		}
+		return;
+	}
+
+	//from the end, so the bigger RGBA pixels do not overwrite the ones still to be read
+	size_t i = num_pixels;
+#ifdef USE_SSE
+	//4 pixels per iteration, a block reads 16 bytes so the last pixels (the ones read past the end) are done one by one
+	size_t sse_end = num_pixels >= 6 ? ((num_pixels - 6) / 4 + 1) * 4 : 0;
+	for (; i > sse_end; --i)
+		bgrToRGBA(src + (i - 1) * 3, dst + (i - 1) * 4);
+
+	//every pixel of the 12 bytes goes to the low 24 bits of a 32 bits lane 0x??RRGGBB that becomes 0xFFBBGGRR
+	__m128i mask_g = _mm_set1_epi32(0x0000FF00);
+	__m128i mask_b = _mm_set1_epi32(0x000000FF);
+	__m128i alpha = _mm_set1_epi32(0xFF000000);
+	for (; i >= 4; i -= 4)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i*)(src + (i - 4) * 3));
+		__m128i p01 = _mm_unpacklo_epi32(p, _mm_srli_si128(p, 3));
+		__m128i p23 = _mm_unpacklo_epi32(_mm_srli_si128(p, 6), _mm_srli_si128(p, 9));
+		__m128i q = _mm_unpacklo_epi64(p01, p23);
+		__m128i r = _mm_and_si128(_mm_srli_epi32(q, 16), mask_b);
+		__m128i b = _mm_slli_epi32(_mm_and_si128(q, mask_b), 16);
+		_mm_storeu_si128((__m128i*)(dst + (i - 4) * 4), _mm_or_si128(_mm_or_si128(_mm_and_si128(q, mask_g), alpha), _mm_or_si128(r, b)));
+	}
+#endif
+	for (; i-- > 0; )
+		bgrToRGBA(src + i * 3, dst + i * 4);
+}
+
+//type 10, packets of repeated pixels or of raw ones. False if the data ends before the image
+static bool decodeRLE(const GLubyte* src, size_t size, GLubyte* dst, size_t num_pixels, GLuint bytes_per_pixel)
+{
+	const GLubyte* end = src + size;
+	size_t i = 0;
+	while (i < num_pixels)
+	{
+		if (src >= end)
+			return false;
+		GLubyte packet = *src++;
+		size_t count = std::min((size_t)(packet & 0x7F) + 1, num_pixels - i);
+		if (packet & 0x80)
+		{
+			if (src + bytes_per_pixel > end)
+				return false;
+			GLubyte pixel[4];
+			swizzleToRGBA(src, pixel, 1, bytes_per_pixel);
+			src += bytes_per_pixel;
+			for (size_t j = 0; j < count; ++j)
+				memcpy(dst + (i + j) * 4, pixel, 4);
+		}
+		else
+		{
+			if (src + count * bytes_per_pixel > end)
+				return false;
+			swizzleToRGBA(src, dst + i * 4, count, bytes_per_pixel);
+			src += count * bytes_per_pixel;
+		}
+		i += count;
+	}
+	return true;
+}
+
+//the colors are averaged in linear space (sRGB decoded) with 14 bits, so the sum of four fits in 16 bits. Alpha is linear
+struct sGammaTables
+{
+	unsigned short to_linear[256];
+	unsigned char to_srgb[1 << 14];
+
+	sGammaTables()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			float c = i / 255.0f;
+			float l = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			to_linear[i] = (unsigned short)(l * 16383.0f + 0.5f);
+		}
+		for (int i = 0; i < (1 << 14); ++i)
+		{
+			float l = i / 16383.0f;
+			float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+			to_srgb[i] = (unsigned char)std::min(c * 255.0f + 0.5f, 255.0f);
+		}
+	}
+};
+
+static const sGammaTables& getGammaTables()
+{
+	static sGammaTables tables; //loadTGA runs in several threads, the initialization of a local static is thread safe
+	return tables;
+}
+
+static void rowToLinear(const sGammaTables& tables, const GLubyte* src, unsigned short* dst, GLuint num_pixels)
+{
+	for (GLuint i = 0; i < num_pixels; ++i, src += 4, dst += 4)
+	{
+		dst[0] = tables.to_linear[src[0]];
+		dst[1] = tables.to_linear[src[1]];
+		dst[2] = tables.to_linear[src[2]];
+		dst[3] = (unsigned short)((src[3] * 16383 + 127) / 255);
+	}
+}
+
+//rows [first_row,last_row) of the next level with a 2x2 box filter, the odd sizes lose their last row or column like in GL
+static void downsampleRows(const GLubyte* src, GLuint src_width, GLuint src_height, GLubyte* dst, GLuint dst_width, size_t first_row, size_t last_row)
+{
+	const sGammaTables& tables = getGammaTables();
+	std::vector<unsigned short> row0((size_t)src_width * 4), row1((size_t)src_width * 4), sum((size_t)dst_width * 4);
+	unsigned short* r0 = &row0[0];
+	unsigned short* r1 = &row1[0];
+	unsigned short* s = &sum[0];
+	GLuint num_pairs = src_width > 1 ? dst_width : 0; //with one column there is nothing to add horizontally
+
+	for (size_t y = first_row; y < last_row; ++y)
+	{
+		rowToLinear(tables, src + std::min(y * 2, (size_t)src_height - 1) * src_width * 4, r0, src_width);
+		rowToLinear(tables, src + std::min(y * 2 + 1, (size_t)src_height - 1) * src_width * 4, r1, src_width);
+
+		GLuint x = 0;
+#ifdef USE_SSE
+		//two pixels of the next level per iteration: the pixels 0,1,2,3 of both rows give (0+1, 2+3)
+		__m128i round = _mm_set1_epi16(2);
+		for (; x + 2 <= num_pairs; x += 2)
+		{
+			__m128i a = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(r0 + x * 8)), _mm_loadu_si128((const __m128i*)(r1 + x * 8)));
+			__m128i b = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(r0 + x * 8 + 8)), _mm_loadu_si128((const __m128i*)(r1 + x * 8 + 8)));
+			__m128i total = _mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+			_mm_storeu_si128((__m128i*)(s + x * 4), _mm_srli_epi16(_mm_add_epi16(total, round), 2));
+		}
+#endif
+		for (; x < dst_width; ++x)
+		{
+			GLuint x0 = x * 2, x1 = std::min(x0 + 1, src_width - 1);
+			for (int c = 0; c < 4; ++c)
+				s[x * 4 + c] = (unsigned short)((r0[x0 * 4 + c] + r0[x1 * 4 + c] + r1[x0 * 4 + c] + r1[x1 * 4 + c] + 2) >> 2);
+		}
+
+		GLubyte* d = dst + y * dst_width * 4;
+		for (GLuint i = 0; i < dst_width; ++i, d += 4)
+		{
+			d[0] = tables.to_srgb[s[i * 4]];
+			d[1] = tables.to_srgb[s[i * 4 + 1]];
+			d[2] = tables.to_srgb[s[i * 4 + 2]];
+			d[3] = (GLubyte)((s[i * 4 + 3] * 255 + 8191) / 16383);
+		}
+	}
+}
+
+static size_t getMipmapChainSize(GLuint width, GLuint height, GLuint& num_levels)
+{
+	size_t size = 0;
+	num_levels = 0;
+	while (true)
+	{
+		size += (size_t)width * height * 4;
+		num_levels++;
+		if (width == 1 && height == 1)
+			return size;
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+}
+
+//fills the levels that follow the image in data. With use_jobs the rows of every level are split in jobs, only from
+//the threads of the JobSystem (parallelFor would init it from any other thread)
+static void buildMipmaps(GLubyte* data, GLuint width, GLuint height, bool use_jobs)
+{
+	while (width > 1 || height > 1)
+	{
+		GLuint next_width = std::max(width / 2, 1u);
+		GLuint next_height = std::max(height / 2, 1u);
+		GLubyte* next = data + (size_t)width * height * 4;
+		if (use_jobs)
+			JobSystem::parallelFor(0, next_height, TGA_MIPMAP_ROWS, [&](size_t first, size_t last) {
+				downsampleRows(data, width, height, next, next_width, first, last);
+			});
+		else
+			downsampleRows(data, width, height, next, next_width, 0, next_height);
+		data = next;
+		width = next_width;
+		height = next_height;
+	}
+}
+
+//can be called from a worker thread, it does not use OpenGL. Uncompressed (type 2) and RLE (type 10) files of 24 or 32 bits
+Texture::TGAInfo* Texture::loadTGA(const char* filename, bool use_jobs)
+{
+	FILE * file = fopen(filename, "rb");
+	if (file == NULL)
+		return NULL;
+
+	GLubyte header[18];
+	if (fread(header, 1, sizeof(header), file) != sizeof(header) || header[1] != 0 || (header[2] != 2 && header[2] != 10)) //no color maps, only true color
+	{
+		std::cerr << "TGA file has wrong encoding" << std::endl;
+		fclose(file);
+		return NULL;
+	}
+
+	GLuint width = header[13] * 256 + header[12];
+	GLuint height = header[15] * 256 + header[14];
+	GLuint bpp = header[16];
+	GLuint num_levels;
+	GLubyte* data = NULL;
+	if (width > 0 && height > 0 && width <= TGA_MAX_SIZE && height <= TGA_MAX_SIZE && (bpp == 24 || bpp == 32))
+		data = (GLubyte*)malloc(getMipmapChainSize(width, height, num_levels));
+	if (data == NULL)
+	{
+		std::cerr << "TGA file has a wrong size or format: " << width << "x" << height << " " << bpp << " bits" << std::endl;
+		fclose(file);
+		return NULL;
+	}
+
+	GLuint bytesPerPixel = bpp / 8;
+	size_t num_pixels = (size_t)width * height;
+	fseek(file, header[0], SEEK_CUR); //the image id
+
+	bool decoded;
+	if (header[2] == 10)
+	{
+		//the rest of the file, it is smaller than the image
+		long start = ftell(file);
+		fseek(file, 0, SEEK_END);
+		std::vector<GLubyte> packets(std::max(ftell(file) - start, 0L));
+		fseek(file, start, SEEK_SET);
+		decoded = packets.size() && fread(&packets[0], 1, packets.size(), file) == packets.size() &&
+			decodeRLE(&packets[0], packets.size(), data, num_pixels, bytesPerPixel);
+	}
+	else if ((decoded = fread(data, bytesPerPixel, num_pixels, file) == num_pixels))
+		swizzleToRGBA(data, data, num_pixels, bytesPerPixel); //in place, straight from the file
+	fclose(file);
+
+	if (!decoded)
+	{
+		free(data);
+		return NULL;
+	}
 
+	//OpenGL wants the bottom row first, like the TGAs with the default origin
+	if (header[17] & 0x20)
+	{
+		std::vector<GLubyte> row((size_t)width * 4);
+		for (GLuint y = 0; y < height / 2; ++y)
+		{
+			GLubyte* a = data + (size_t)y * width * 4;
+			GLubyte* b = data + (size_t)(height - 1 - y) * width * 4;
+			memcpy(&row[0], a, width * 4);
+			memcpy(a, b, width * 4);
+			memcpy(b, &row[0], width * 4);
+		}
+	}
+
+	buildMipmaps(data, width, height, use_jobs);
+
+	TGAInfo* tgainfo = new TGAInfo;
+	tgainfo->width = width;
+	tgainfo->height = height;
+	tgainfo->bpp = bpp;
+	tgainfo->num_levels = num_levels;
+	tgainfo->data = data;
 	return tgainfo;
 }
@@ -2,6 +2,7 @@
 #define TEXTURE_H
 
 #include "../includes.h"
+#include "../utils/resource.h"
 #include <map>
 #include <string>
 
@@ -10,13 +11,14 @@ typedef void (APIENTRY *glGenerateMipmapEXT_func)( GLenum target );
 extern "C" glGenerateMipmapEXT_func glGenerateMipmapEXT;
 
 
-class Texture
+class Texture : public Resource
 {
 	typedef struct sTGAInfo //a general struct to store all the information about a TGA file
 	{
 		GLuint width;
 		GLuint height;
-		GLuint bpp; //bits per pixel
+		GLuint bpp; //bits per pixel in the file, the data is always RGBA
+		GLuint num_levels; //the image and its mipmaps, one after the other in data
 		GLubyte* data; //bytes with the pixel information
 	} TGAInfo;
 
@@ -28,17 +30,29 @@ public:
 	float height;
 	std::string filename;
 	bool hasMipmaps;
+	bool is_loading; //true while a worker thread reads the file (see LoadAsync), meanwhile it shows a placeholder
+	size_t vram_bytes; //memory used by the image and its mipmaps
 
 	static Texture* Load(const char* filename);
+	static Texture* LoadAsync(const char* filename); //returns a texture with a placeholder image that is replaced when loaded
+	static GLuint getPlaceholderId(); //1x1 white texture
 	Texture();
+	~Texture();
 	void bind();
 	static void unbind();
 	bool load(const char* filename);
 
 	void generateMipmaps();
 
+	size_t getCPUBytes() const { return sizeof(Texture) + filename.size(); }
+	size_t getVRAMBytes() const { return vram_bytes; }
+	bool isBusy() const { return is_loading; }
+
 protected:
-	TGAInfo* loadTGA(const char* filename);
+	friend class TextureLoadJob;
+
+	TGAInfo* loadTGA(const char* filename, bool use_jobs); //use_jobs only from the main thread or a job, it builds the mipmaps in jobs
+	bool uploadTGA(TGAInfo* tgainfo);
 	bool loadDDS(const char* filename);
 };
 
@@ -0,0 +1,371 @@
+#include "vertexformat.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#ifndef M_PI
+	#define M_PI 3.14159265358979323846
+#endif
+
+static const unsigned int position_sizes[] = { 12, 8, 8 }; //half and snorm16 are padded to 4 components so every attribute starts aligned
+static const unsigned int normal_sizes[] = { 12, 4, 4 };
+static const unsigned int uv_sizes[] = { 8, 4 };
+static const unsigned int color_sizes[] = { 16, 4 };
+
+VertexFormat::VertexFormat(bool interleaved, char position, char normal, char uv, char color)
+{
+	this->interleaved = interleaved;
+	this->position = position;
+	this->normal = normal;
+	this->uv = uv;
+	this->color = color;
+}
+
+bool VertexFormat::isDefault() const
+{
+	return !interleaved && position == POSITION_FLOAT && normal == NORMAL_FLOAT && uv == UV_FLOAT && color == COLOR_FLOAT;
+}
+
+VertexFormat VertexFormat::compact()
+{
+	return VertexFormat(true, POSITION_SNORM16, NORMAL_OCT16, UV_UNORM16, COLOR_RGBA8);
+}
+
+VertexLayout::VertexLayout()
+{
+	for (int i = 0; i < NUM_VERTEX_ATTRIBUTES; ++i)
+	{
+		offsets[i] = -1;
+		strides[i] = 0;
+	}
+	bytes_per_vertex = 0;
+	position_scale = 1.0f;
+	uv_scale = Vector2(1.0f, 1.0f);
+}
+
+unsigned int getVertexSize(const VertexFormat& format, bool normals, bool uvs, bool colors)
+{
+	return position_sizes[ (int)format.position ] + (normals ? normal_sizes[ (int)format.normal ] : 0) +
+		(uvs ? uv_sizes[ (int)format.uv ] : 0) + (colors ? color_sizes[ (int)format.color ] : 0);
+}
+
+unsigned short floatToHalf(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(float));
+
+	unsigned int sign = (bits >> 16) & 0x8000;
+	unsigned int float_exponent = (bits >> 23) & 0xff;
+	unsigned int mantissa = bits & 0x7fffff;
+	int exponent = (int)float_exponent - 127 + 15;
+
+	if (float_exponent == 0xff) //inf or nan
+		return (unsigned short)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	if (exponent >= 31) //too big, clamped to the biggest half
+		return (unsigned short)(sign | 0x7bff);
+	if (exponent <= 0) //subnormal half
+	{
+		if (exponent < -10)
+			return (unsigned short)sign;
+		mantissa |= 0x800000;
+		unsigned int shift = 14 - exponent;
+		unsigned int half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1) //round to nearest
+			half++;
+		return (unsigned short)(sign | half);
+	}
+
+	unsigned int half = ((unsigned int)exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000) //round to nearest, a carry moves to the exponent which is still right
+		half++;
+	if (half >= 0x7c00)
+		half = 0x7bff;
+	return (unsigned short)(sign | half);
+}
+
+float halfToFloat(unsigned short value)
+{
+	unsigned int sign = (value & 0x8000) << 16;
+	unsigned int exponent = (value >> 10) & 0x1f;
+	unsigned int mantissa = value & 0x3ff;
+
+	if (exponent == 0) //zero or subnormal
+	{
+		float result = mantissa / 16777216.0f; //2^-24
+		return sign ? -result : result;
+	}
+
+	unsigned int bits;
+	if (exponent == 31)
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	else
+		bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	float result;
+	memcpy(&result, &bits, sizeof(float));
+	return result;
+}
+
+static short toSnorm16(float value)
+{
+	value = std::max(-1.0f, std::min(1.0f, value));
+	return (short)floor(value * 32767.0f + 0.5f);
+}
+
+static signed char toSnorm8(float value)
+{
+	value = std::max(-1.0f, std::min(1.0f, value));
+	return (signed char)floor(value * 127.0f + 0.5f);
+}
+
+static unsigned char toUnorm8(float value)
+{
+	value = std::max(0.0f, std::min(1.0f, value));
+	return (unsigned char)floor(value * 255.0f + 0.5f);
+}
+
+static float signNotZero(float value)
+{
+	return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+//projects the normal on an octahedron and unfolds the lower half over the upper one
+void encodeOctahedral(const Vector3& normal, short& x, short& y)
+{
+	float sum = fabs(normal.x) + fabs(normal.y) + fabs(normal.z);
+	if (sum == 0.0f)
+	{
+		x = y = 0;
+		return;
+	}
+
+	float u = normal.x / sum;
+	float v = normal.y / sum;
+	if (normal.z < 0.0f)
+	{
+		float old_u = u;
+		u = (1.0f - fabs(v)) * signNotZero(old_u);
+		v = (1.0f - fabs(old_u)) * signNotZero(v);
+	}
+	x = toSnorm16(u);
+	y = toSnorm16(v);
+}
+
+Vector3 decodeOctahedral(short x, short y)
+{
+	float u = std::max(x / 32767.0f, -1.0f);
+	float v = std::max(y / 32767.0f, -1.0f);
+	Vector3 normal(u, v, 1.0f - fabs(u) - fabs(v));
+	if (normal.z < 0.0f)
+	{
+		normal.x = (1.0f - fabs(v)) * signNotZero(u);
+		normal.y = (1.0f - fabs(u)) * signNotZero(v);
+	}
+	normal.normalize();
+	return normal;
+}
+
+VertexLayout packVertices(const VertexFormat& format, unsigned int num_vertices, const Vector3* positions, const Vector3* normals, const Vector2* uvs, const Vector4* colors, std::vector<unsigned char>& buffer)
+{
+	assert(positions || num_vertices == 0);
+
+	VertexLayout layout;
+	layout.format = format;
+
+	//the size of every attribute, 0 if the mesh does not have it
+	unsigned int sizes[NUM_VERTEX_ATTRIBUTES];
+	sizes[VERTEX_POSITION] = position_sizes[ (int)format.position ];
+	sizes[VERTEX_NORMAL] = normals ? normal_sizes[ (int)format.normal ] : 0;
+	sizes[VERTEX_UV] = uvs ? uv_sizes[ (int)format.uv ] : 0;
+	sizes[VERTEX_COLOR] = colors ? color_sizes[ (int)format.color ] : 0;
+
+	//interleaved: offsets inside the vertex, planar: every attribute in its own block one after the other
+	unsigned int offset = 0;
+	for (int i = 0; i < NUM_VERTEX_ATTRIBUTES; ++i)
+	{
+		if (!sizes[i])
+			continue;
+		layout.offsets[i] = offset;
+		layout.bytes_per_vertex += sizes[i];
+		offset += format.interleaved ? sizes[i] : sizes[i] * num_vertices;
+	}
+	for (int i = 0; i < NUM_VERTEX_ATTRIBUTES; ++i)
+		if (sizes[i])
+			layout.strides[i] = format.interleaved ? layout.bytes_per_vertex : sizes[i];
+
+	//bounding boxes for the quantized attributes
+	if (format.position != POSITION_FLOAT && num_vertices)
+	{
+		Vector3 min_pos = positions[0], max_pos = positions[0];
+		for (unsigned int i = 1; i < num_vertices; ++i)
+			for (int j = 0; j < 3; ++j)
+			{
+				min_pos.v[j] = std::min(min_pos.v[j], positions[i].v[j]);
+				max_pos.v[j] = std::max(max_pos.v[j], positions[i].v[j]);
+			}
+		layout.position_bias = (min_pos + max_pos) * 0.5f;
+		float extent = std::max( std::max(max_pos.x - min_pos.x, max_pos.y - min_pos.y), max_pos.z - min_pos.z ) * 0.5f;
+		if (format.position == POSITION_SNORM16)
+			layout.position_scale = extent > 0.0f ? extent / 32767.0f : 1.0f;
+	}
+
+	Vector2 min_uv, max_uv;
+	if (uvs && format.uv == UV_UNORM16 && num_vertices)
+	{
+		min_uv = max_uv = uvs[0];
+		for (unsigned int i = 1; i < num_vertices; ++i)
+			for (int j = 0; j < 2; ++j)
+			{
+				min_uv.value[j] = std::min(min_uv.value[j], uvs[i].value[j]);
+				max_uv.value[j] = std::max(max_uv.value[j], uvs[i].value[j]);
+			}
+		//stored as signed shorts because GL does not accept unsigned texture coordinates, biased by 32768
+		for (int j = 0; j < 2; ++j)
+		{
+			float range = max_uv.value[j] - min_uv.value[j];
+			if (range <= 0.0f)
+				range = 1.0f;
+			layout.uv_scale.value[j] = range / 65535.0f;
+			layout.uv_bias.value[j] = min_uv.value[j] + 32768.0f * layout.uv_scale.value[j];
+		}
+	}
+
+	buffer.assign( layout.bytes_per_vertex * num_vertices, 0 );
+	unsigned char* data = buffer.empty() ? NULL : &buffer[0];
+
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		unsigned char* dest = data + layout.offsets[VERTEX_POSITION] + i * layout.strides[VERTEX_POSITION];
+		if (format.position == POSITION_FLOAT)
+			memcpy(dest, positions[i].v, sizeof(Vector3));
+		else if (format.position == POSITION_HALF)
+		{
+			unsigned short* half = (unsigned short*)dest;
+			for (int j = 0; j < 3; ++j)
+				half[j] = floatToHalf( positions[i].v[j] - layout.position_bias.v[j] );
+		}
+		else
+		{
+			short* snorm = (short*)dest;
+			for (int j = 0; j < 3; ++j)
+				snorm[j] = toSnorm16( (positions[i].v[j] - layout.position_bias.v[j]) / layout.position_scale / 32767.0f );
+		}
+
+		if (normals)
+		{
+			dest = data + layout.offsets[VERTEX_NORMAL] + i * layout.strides[VERTEX_NORMAL];
+			if (format.normal == NORMAL_FLOAT)
+				memcpy(dest, normals[i].v, sizeof(Vector3));
+			else if (format.normal == NORMAL_SNORM8)
+			{
+				for (int j = 0; j < 3; ++j)
+					((signed char*)dest)[j] = toSnorm8( normals[i].v[j] );
+			}
+			else
+				encodeOctahedral( normals[i], ((short*)dest)[0], ((short*)dest)[1] );
+		}
+
+		if (uvs)
+		{
+			dest = data + layout.offsets[VERTEX_UV] + i * layout.strides[VERTEX_UV];
+			if (format.uv == UV_FLOAT)
+				memcpy(dest, uvs[i].value, sizeof(Vector2));
+			else
+			{
+				for (int j = 0; j < 2; ++j)
+				{
+					float stored = (uvs[i].value[j] - min_uv.value[j]) / (layout.uv_scale.value[j] * 65535.0f);
+					((short*)dest)[j] = (short)( (int)floor( std::max(0.0f, std::min(1.0f, stored)) * 65535.0f + 0.5f ) - 32768 );
+				}
+			}
+		}
+
+		if (colors)
+		{
+			dest = data + layout.offsets[VERTEX_COLOR] + i * layout.strides[VERTEX_COLOR];
+			if (format.color == COLOR_FLOAT)
+				memcpy(dest, colors[i].v, sizeof(Vector4));
+			else
+				for (int j = 0; j < 4; ++j)
+					dest[j] = toUnorm8( colors[i].v[j] );
+		}
+	}
+
+	return layout;
+}
+
+VertexFormatStats measureVertexFormat(const VertexLayout& layout, const std::vector<unsigned char>& buffer, unsigned int num_vertices, const Vector3* positions, const Vector3* normals, const Vector2* uvs, const Vector4* colors)
+{
+	VertexFormatStats stats;
+	stats.bytes_per_vertex = layout.bytes_per_vertex;
+	stats.float_bytes_per_vertex = sizeof(Vector3) + (normals ? sizeof(Vector3) : 0) + (uvs ? sizeof(Vector2) : 0) + (colors ? sizeof(Vector4) : 0);
+	stats.bytes = buffer.size();
+	stats.position_error = stats.normal_error = stats.uv_error = stats.color_error = 0.0f;
+
+	if (buffer.size() < (size_t)layout.bytes_per_vertex * num_vertices || num_vertices == 0)
+		return stats;
+
+	const VertexFormat& format = layout.format;
+	const unsigned char* data = &buffer[0];
+	float min_normal_cos = 1.0f;
+
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		const unsigned char* src = data + layout.offsets[VERTEX_POSITION] + i * layout.strides[VERTEX_POSITION];
+		Vector3 position;
+		for (int j = 0; j < 3; ++j)
+		{
+			if (format.position == POSITION_FLOAT)
+				position.v[j] = ((const float*)src)[j];
+			else if (format.position == POSITION_HALF)
+				position.v[j] = layout.position_bias.v[j] + halfToFloat( ((const unsigned short*)src)[j] );
+			else
+				position.v[j] = layout.position_bias.v[j] + ((const short*)src)[j] * layout.position_scale;
+		}
+		stats.position_error = std::max( stats.position_error, position.distance( positions[i] ) );
+
+		if (normals && layout.offsets[VERTEX_NORMAL] != -1)
+		{
+			src = data + layout.offsets[VERTEX_NORMAL] + i * layout.strides[VERTEX_NORMAL];
+			Vector3 normal;
+			if (format.normal == NORMAL_FLOAT)
+				memcpy(normal.v, src, sizeof(Vector3));
+			else if (format.normal == NORMAL_SNORM8)
+			{
+				for (int j = 0; j < 3; ++j)
+					normal.v[j] = std::max( ((const signed char*)src)[j] / 127.0f, -1.0f );
+			}
+			else
+				normal = decodeOctahedral( ((const short*)src)[0], ((const short*)src)[1] );
+
+			Vector3 original = normals[i];
+			float lengths = (float)(original.length() * normal.length());
+			if (lengths > 0.0f)
+				min_normal_cos = std::min( min_normal_cos, (float)original.dot(normal) / lengths );
+		}
+
+		if (uvs && layout.offsets[VERTEX_UV] != -1)
+		{
+			src = data + layout.offsets[VERTEX_UV] + i * layout.strides[VERTEX_UV];
+			for (int j = 0; j < 2; ++j)
+			{
+				float uv = format.uv == UV_FLOAT ? ((const float*)src)[j] : layout.uv_bias.value[j] + ((const short*)src)[j] * layout.uv_scale.value[j];
+				stats.uv_error = std::max( stats.uv_error, (float)fabs(uv - uvs[i].value[j]) );
+			}
+		}
+
+		if (colors && layout.offsets[VERTEX_COLOR] != -1)
+		{
+			src = data + layout.offsets[VERTEX_COLOR] + i * layout.strides[VERTEX_COLOR];
+			for (int j = 0; j < 4; ++j)
+			{
+				float color = format.color == COLOR_FLOAT ? ((const float*)src)[j] : src[j] / 255.0f;
+				stats.color_error = std::max( stats.color_error, (float)fabs(color - colors[i].v[j]) );
+			}
+		}
+	}
+
+	stats.normal_error = (float)(acos( std::max(-1.0f, std::min(1.0f, min_normal_cos)) ) * 180.0 / M_PI);
+	return stats;
+}
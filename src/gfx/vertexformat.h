@@ -0,0 +1,90 @@
+/*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
+	Layouts for the vertex data of the meshes in VRAM. By default every stream goes to its own VBO as floats,
+	a VertexFormat can interleave them in a single VBO and quantize the attributes to save memory and bandwidth.
+	Quantized positions and uvs are stored relative to their bounding box and Mesh::render undoes it with the
+	modelview and texture matrices, so shaders must use gl_ModelViewMatrix and gl_TextureMatrix[0] with them.
+	Octahedral normals can only be used with shaders, they arrive in the attribute a_oct_normal and are decoded with:
+		vec3 n = vec3(a_oct_normal, 1.0 - abs(a_oct_normal.x) - abs(a_oct_normal.y));
+		if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * (step(0.0, n.xy) * 2.0 - 1.0);
+		n = normalize(n);
+	Packing and measuring do not use OpenGL.
+*/
+
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <vector>
+#include "../utils/math.h"
+
+enum ePositionFormat { POSITION_FLOAT, POSITION_HALF, POSITION_SNORM16 };
+enum eNormalFormat { NORMAL_FLOAT, NORMAL_SNORM8, NORMAL_OCT16 };
+enum eUVFormat { UV_FLOAT, UV_UNORM16 };
+enum eColorFormat { COLOR_FLOAT, COLOR_RGBA8 };
+
+enum { VERTEX_POSITION, VERTEX_NORMAL, VERTEX_UV, VERTEX_COLOR, NUM_VERTEX_ATTRIBUTES };
+
+//generic attribute used for the octahedral normals, Shader binds the name to it before linking
+#define VERTEX_ATTRIB_OCT_NORMAL 6
+#define VERTEX_ATTRIB_OCT_NORMAL_NAME "a_oct_normal"
+
+//generic attributes of the instanced draws (see Mesh::drawInstanced), also bound by Shader before linking.
+//They alias the texture coordinates 1 to 5 in the drivers that share the locations with the fixed function arrays
+#define VERTEX_ATTRIB_INSTANCE_MODEL 9 //mat4, one column per location from 9 to 12
+#define VERTEX_ATTRIB_INSTANCE_MODEL_NAME "a_instance_model"
+#define VERTEX_ATTRIB_INSTANCE_COLOR 13
+#define VERTEX_ATTRIB_INSTANCE_COLOR_NAME "a_instance_color"
+
+struct VertexFormat
+{
+	bool interleaved; //all the attributes of a vertex together in a single VBO
+	char position; //ePositionFormat
+	char normal; //eNormalFormat
+	char uv; //eUVFormat
+	char color; //eColorFormat
+
+	VertexFormat(bool interleaved = false, char position = POSITION_FLOAT, char normal = NORMAL_FLOAT, char uv = UV_FLOAT, char color = COLOR_FLOAT);
+	bool isDefault() const; //floats in separated VBOs, uploaded straight from the streams
+	static VertexFormat compact(); //interleaved snorm16 positions, octahedral normals, unorm16 uvs and rgba8 colors (20 bytes instead of 48)
+};
+
+//where every attribute is inside a packed buffer and how to decode the quantized ones
+struct VertexLayout
+{
+	VertexFormat format;
+	int offsets[NUM_VERTEX_ATTRIBUTES]; //bytes from the start of the buffer, -1 if the mesh does not have the attribute
+	unsigned int strides[NUM_VERTEX_ATTRIBUTES];
+	unsigned int bytes_per_vertex;
+	Vector3 position_bias; //position = position_bias + stored * position_scale
+	float position_scale; //the same for every axis so the normals are not distorted
+	Vector2 uv_bias; //uv = uv_bias + stored * uv_scale
+	Vector2 uv_scale;
+
+	VertexLayout();
+};
+
+struct VertexFormatStats
+{
+	unsigned int bytes_per_vertex;
+	unsigned int float_bytes_per_vertex; //the same attributes stored as floats
+	size_t bytes;
+	float position_error; //max distance between the original and the decoded positions
+	float normal_error; //max angle in degrees
+	float uv_error; //max difference in a coordinate
+	float color_error; //max difference in a channel
+};
+
+//bytes used by every vertex with that format and attributes
+unsigned int getVertexSize(const VertexFormat& format, bool normals, bool uvs, bool colors);
+
+//packs the streams in the buffer, only the positions are required
+VertexLayout packVertices(const VertexFormat& format, unsigned int num_vertices, const Vector3* positions, const Vector3* normals, const Vector2* uvs, const Vector4* colors, std::vector<unsigned char>& buffer);
+
+//decodes a packed buffer and compares it with the streams it was packed from
+VertexFormatStats measureVertexFormat(const VertexLayout& layout, const std::vector<unsigned char>& buffer, unsigned int num_vertices, const Vector3* positions, const Vector3* normals, const Vector2* uvs, const Vector4* colors);
+
+unsigned short floatToHalf(float value);
+float halfToFloat(unsigned short value);
+void encodeOctahedral(const Vector3& normal, short& x, short& y);
+Vector3 decodeOctahedral(short x, short y);
+
+#endif
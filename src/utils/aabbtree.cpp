@@ -0,0 +1,452 @@
+#include "aabbtree.h"
+
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+
+float AABBTree::fat_margin = 0.1f;
+
+static inline float surfaceArea(const Vector3& min, const Vector3& max)
+{
+	Vector3 size = max - min;
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static inline float unionArea(const Vector3& min_a, const Vector3& max_a, const Vector3& min_b, const Vector3& max_b)
+{
+	Vector3 min = min_a;
+	Vector3 max = max_a;
+	min.setMin(min_b);
+	max.setMax(max_b);
+	return surfaceArea(min, max);
+}
+
+static inline bool overlaps(const Vector3& min_a, const Vector3& max_a, const Vector3& min_b, const Vector3& max_b)
+{
+	return min_a.x <= max_b.x && max_a.x >= min_b.x && min_a.y <= max_b.y && max_a.y >= min_b.y && min_a.z <= max_b.z && max_a.z >= min_b.z;
+}
+
+static inline bool contains(const Vector3& min_a, const Vector3& max_a, const Vector3& min_b, const Vector3& max_b)
+{
+	return min_a.x <= min_b.x && min_a.y <= min_b.y && min_a.z <= min_b.z && max_a.x >= max_b.x && max_a.y >= max_b.y && max_a.z >= max_b.z;
+}
+
+static inline bool overlapsSphere(const Vector3& min, const Vector3& max, const Vector3& center, float radius)
+{
+	//distance from the center to the closest point of the box
+	float distance2 = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		float v = center.v[i] < min.v[i] ? min.v[i] - center.v[i] : (center.v[i] > max.v[i] ? center.v[i] - max.v[i] : 0.0f);
+		distance2 += v * v;
+	}
+	return distance2 <= radius * radius;
+}
+
+//slab test, inv_direction can have infinites. entry is the distance where the ray enters the box (0 if it starts inside)
+static inline bool overlapsRay(const Vector3& min, const Vector3& max, const Vector3& origin, const Vector3& inv_direction, float max_distance, float& entry)
+{
+	float tmin = 0.0f;
+	float tmax = max_distance;
+	for (int i = 0; i < 3; ++i)
+	{
+		float t1 = (min.v[i] - origin.v[i]) * inv_direction.v[i];
+		float t2 = (max.v[i] - origin.v[i]) * inv_direction.v[i];
+		if (t1 != t1 || t2 != t2) //0 * inf, the ray is parallel and in the plane of the slab
+			continue;
+		tmin = std::max(tmin, std::min(t1, t2));
+		tmax = std::min(tmax, std::max(t1, t2));
+		if (tmin > tmax)
+			return false;
+	}
+	entry = tmin;
+	return true;
+}
+
+enum { PLANES_OUTSIDE, PLANES_OVERLAP, PLANES_INSIDE };
+
+//the planes that contain the whole box are removed from the mask
+static inline char boxInPlanes(const float frustum[6][4], const Vector3& min, const Vector3& max, unsigned char& mask)
+{
+	Vector3 center = (min + max) * 0.5f;
+	Vector3 halfsize = max - center;
+	for (int p = 0; p < 6; ++p)
+	{
+		if (!(mask & (1 << p)))
+			continue;
+		const float* plane = frustum[p];
+		float distance = plane[0] * center.x + plane[1] * center.y + plane[2] * center.z + plane[3];
+		float extent = fabsf(plane[0]) * halfsize.x + fabsf(plane[1]) * halfsize.y + fabsf(plane[2]) * halfsize.z;
+		if (distance < -extent)
+			return PLANES_OUTSIDE;
+		if (distance >= extent)
+			mask &= ~(1 << p);
+	}
+	return mask ? PLANES_OVERLAP : PLANES_INSIDE;
+}
+
+AABBTree::AABBTree()
+{
+	root = -1;
+	free_list = -1;
+	num_proxies = 0;
+	nodes_visited = 0;
+}
+
+void AABBTree::clear()
+{
+	nodes.clear();
+	root = -1;
+	free_list = -1;
+	num_proxies = 0;
+}
+
+int AABBTree::allocateNode()
+{
+	if (free_list == -1)
+	{
+		sNode node;
+		node.height = -1;
+		nodes.push_back(node);
+		free_list = (int)nodes.size() - 1;
+		nodes[free_list].parent = -1;
+	}
+
+	int id = free_list;
+	free_list = nodes[id].parent;
+	sNode& node = nodes[id];
+	node.parent = -1;
+	node.child1 = node.child2 = -1;
+	node.height = 0;
+	node.data = NULL;
+	return id;
+}
+
+void AABBTree::freeNode(int id)
+{
+	nodes[id].parent = free_list;
+	nodes[id].height = -1;
+	free_list = id;
+}
+
+int AABBTree::insert(const AABB& box, void* data)
+{
+	int id = allocateNode();
+	sNode& node = nodes[id];
+	node.box_min = box.center - box.halfsize;
+	node.box_max = box.center + box.halfsize;
+	float margin = std::max(fat_margin, std::max(box.halfsize.x, std::max(box.halfsize.y, box.halfsize.z)) * 0.1f);
+	node.min = node.box_min - Vector3(margin, margin, margin);
+	node.max = node.box_max + Vector3(margin, margin, margin);
+	node.data = data;
+	insertLeaf(id);
+	num_proxies++;
+	return id;
+}
+
+void AABBTree::remove(int proxy)
+{
+	assert(proxy >= 0 && proxy < (int)nodes.size() && nodes[proxy].isLeaf() && nodes[proxy].height == 0);
+	removeLeaf(proxy);
+	freeNode(proxy);
+	num_proxies--;
+}
+
+bool AABBTree::move(int proxy, const AABB& box)
+{
+	sNode& node = nodes[proxy];
+	node.box_min = box.center - box.halfsize;
+	node.box_max = box.center + box.halfsize;
+	if (contains(node.min, node.max, node.box_min, node.box_max))
+		return false;
+
+	void* data = node.data;
+	removeLeaf(proxy);
+	float margin = std::max(fat_margin, std::max(box.halfsize.x, std::max(box.halfsize.y, box.halfsize.z)) * 0.1f);
+	nodes[proxy].min = nodes[proxy].box_min - Vector3(margin, margin, margin);
+	nodes[proxy].max = nodes[proxy].box_max + Vector3(margin, margin, margin);
+	nodes[proxy].data = data;
+	insertLeaf(proxy);
+	return true;
+}
+
+void AABBTree::refit(int id)
+{
+	sNode& node = nodes[id];
+	const sNode& child1 = nodes[node.child1];
+	const sNode& child2 = nodes[node.child2];
+	node.min = child1.min;
+	node.max = child1.max;
+	node.min.setMin(child2.min);
+	node.max.setMax(child2.max);
+	node.height = 1 + std::max(child1.height, child2.height);
+}
+
+//finds the sibling that grows the least the area of the tree, like the dynamic trees of Box2D and Bullet
+void AABBTree::insertLeaf(int leaf)
+{
+	if (root == -1)
+	{
+		root = leaf;
+		nodes[root].parent = -1;
+		return;
+	}
+
+	Vector3 leaf_min = nodes[leaf].min;
+	Vector3 leaf_max = nodes[leaf].max;
+	int index = root;
+	while (!nodes[index].isLeaf())
+	{
+		const sNode& node = nodes[index];
+		float area = surfaceArea(node.min, node.max);
+		float combined_area = unionArea(node.min, node.max, leaf_min, leaf_max);
+
+		//cost of creating a new parent for this node and the leaf, and the minimum cost of pushing the leaf further down
+		float cost = 2.0f * combined_area;
+		float inheritance_cost = 2.0f * (combined_area - area);
+
+		float child_costs[2];
+		for (int i = 0; i < 2; ++i)
+		{
+			const sNode& child = nodes[i == 0 ? node.child1 : node.child2];
+			float grown_area = unionArea(child.min, child.max, leaf_min, leaf_max);
+			child_costs[i] = (child.isLeaf() ? grown_area : grown_area - surfaceArea(child.min, child.max)) + inheritance_cost;
+		}
+
+		if (cost < child_costs[0] && cost < child_costs[1])
+			break;
+		index = child_costs[0] < child_costs[1] ? node.child1 : node.child2;
+	}
+
+	int sibling = index;
+	int old_parent = nodes[sibling].parent;
+	int new_parent = allocateNode();
+	nodes[new_parent].parent = old_parent;
+	nodes[new_parent].child1 = sibling;
+	nodes[new_parent].child2 = leaf;
+	nodes[sibling].parent = new_parent;
+	nodes[leaf].parent = new_parent;
+	refit(new_parent);
+
+	if (old_parent != -1)
+	{
+		if (nodes[old_parent].child1 == sibling)
+			nodes[old_parent].child1 = new_parent;
+		else
+			nodes[old_parent].child2 = new_parent;
+	}
+	else
+		root = new_parent;
+
+	//fix the boxes and heights up to the root
+	index = nodes[leaf].parent;
+	while (index != -1)
+	{
+		index = balance(index);
+		refit(index);
+		index = nodes[index].parent;
+	}
+}
+
+void AABBTree::removeLeaf(int leaf)
+{
+	if (leaf == root)
+	{
+		root = -1;
+		return;
+	}
+
+	int parent = nodes[leaf].parent;
+	int grand_parent = nodes[parent].parent;
+	int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+	if (grand_parent == -1)
+	{
+		root = sibling;
+		nodes[sibling].parent = -1;
+		freeNode(parent);
+		return;
+	}
+
+	//the sibling takes the place of the parent
+	if (nodes[grand_parent].child1 == parent)
+		nodes[grand_parent].child1 = sibling;
+	else
+		nodes[grand_parent].child2 = sibling;
+	nodes[sibling].parent = grand_parent;
+	freeNode(parent);
+
+	int index = grand_parent;
+	while (index != -1)
+	{
+		index = balance(index);
+		refit(index);
+		index = nodes[index].parent;
+	}
+}
+
+//if a child of a is two levels taller than the other one it is rotated up, returns the node that takes the place of a
+int AABBTree::balance(int a)
+{
+	if (nodes[a].isLeaf() || nodes[a].height < 2)
+		return a;
+
+	int b = nodes[a].child1;
+	int c = nodes[a].child2;
+	int difference = nodes[c].height - nodes[b].height;
+	if (difference >= -1 && difference <= 1)
+		return a;
+
+	//the taller child goes up, a goes down and keeps the shorter grandchild
+	bool c_is_taller = difference > 1;
+	int up = c_is_taller ? c : b;
+	int f = nodes[up].child1;
+	int g = nodes[up].child2;
+
+	nodes[up].child1 = a;
+	nodes[up].parent = nodes[a].parent;
+	nodes[a].parent = up;
+	if (nodes[up].parent != -1)
+	{
+		if (nodes[nodes[up].parent].child1 == a)
+			nodes[nodes[up].parent].child1 = up;
+		else
+			nodes[nodes[up].parent].child2 = up;
+	}
+	else
+		root = up;
+
+	int keep = nodes[f].height > nodes[g].height ? f : g; //stays with the node that goes up
+	int give = keep == f ? g : f; //goes to a
+	nodes[up].child2 = keep;
+	if (c_is_taller)
+		nodes[a].child2 = give;
+	else
+		nodes[a].child1 = give;
+	nodes[give].parent = a;
+
+	refit(a);
+	refit(up);
+	return up;
+}
+
+void AABBTree::queryBox(const AABB& box, std::vector<void*>& result) const
+{
+	nodes_visited = 0;
+	if (root == -1)
+		return;
+	Vector3 min = box.center - box.halfsize;
+	Vector3 max = box.center + box.halfsize;
+
+	std::vector<int> stack;
+	stack.push_back(root);
+	while (!stack.empty())
+	{
+		const sNode& node = nodes[stack.back()];
+		stack.pop_back();
+		nodes_visited++;
+		if (!overlaps(node.min, node.max, min, max))
+			continue;
+		if (!node.isLeaf())
+		{
+			stack.push_back(node.child1);
+			stack.push_back(node.child2);
+		}
+		else if (overlaps(node.box_min, node.box_max, min, max))
+			result.push_back(node.data);
+	}
+}
+
+void AABBTree::querySphere(const Vector3& center, float radius, std::vector<void*>& result) const
+{
+	nodes_visited = 0;
+	if (root == -1)
+		return;
+
+	std::vector<int> stack;
+	stack.push_back(root);
+	while (!stack.empty())
+	{
+		const sNode& node = nodes[stack.back()];
+		stack.pop_back();
+		nodes_visited++;
+		if (!overlapsSphere(node.min, node.max, center, radius))
+			continue;
+		if (!node.isLeaf())
+		{
+			stack.push_back(node.child1);
+			stack.push_back(node.child2);
+		}
+		else if (overlapsSphere(node.box_min, node.box_max, center, radius))
+			result.push_back(node.data);
+	}
+}
+
+//the nodes inside all the planes add all their leaves without testing them
+void AABBTree::queryFrustum(const float frustum[6][4], std::vector<void*>& result) const
+{
+	nodes_visited = 0;
+	if (root == -1)
+		return;
+
+	struct sItem { int id; unsigned char mask; };
+	std::vector<sItem> stack;
+	sItem first = { root, 63 };
+	stack.push_back(first);
+	while (!stack.empty())
+	{
+		sItem item = stack.back();
+		stack.pop_back();
+		const sNode& node = nodes[item.id];
+		nodes_visited++;
+
+		if (item.mask)
+		{
+			const Vector3& min = node.isLeaf() ? node.box_min : node.min;
+			const Vector3& max = node.isLeaf() ? node.box_max : node.max;
+			if (boxInPlanes(frustum, min, max, item.mask) == PLANES_OUTSIDE)
+				continue;
+		}
+
+		if (node.isLeaf())
+			result.push_back(node.data);
+		else
+		{
+			sItem child1 = { node.child1, item.mask };
+			sItem child2 = { node.child2, item.mask };
+			stack.push_back(child1);
+			stack.push_back(child2);
+		}
+	}
+}
+
+void AABBTree::queryRay(const Vector3& origin, const Vector3& direction, float max_distance, std::vector<void*>& result, std::vector<float>* distances) const
+{
+	nodes_visited = 0;
+	if (root == -1)
+		return;
+	Vector3 inv_direction(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+	std::vector<int> stack;
+	stack.push_back(root);
+	while (!stack.empty())
+	{
+		const sNode& node = nodes[stack.back()];
+		stack.pop_back();
+		nodes_visited++;
+		float entry;
+		if (!overlapsRay(node.min, node.max, origin, inv_direction, max_distance, entry))
+			continue;
+		if (!node.isLeaf())
+		{
+			stack.push_back(node.child1);
+			stack.push_back(node.child2);
+		}
+		else if (overlapsRay(node.box_min, node.box_max, origin, inv_direction, max_distance, entry))
+		{
+			result.push_back(node.data);
+			if (distances)
+				distances->push_back(entry);
+		}
+	}
+}
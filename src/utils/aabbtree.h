@@ -0,0 +1,67 @@
+/*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
+	Dynamic bounding volume tree to find quickly the objects inside a box, sphere, frustum or along a ray.
+	Every object is a leaf with a fattened box, so moving it a little does not change the tree. The tree is
+	kept balanced with rotations so the queries visit a logarithmic number of nodes.
+	The objects are identified by the proxy id returned by insert, the queries return their data pointers.
+*/
+
+#ifndef AABBTREE_H
+#define AABBTREE_H
+
+#include <cstddef>
+#include <vector>
+#include "math.h"
+
+class AABBTree
+{
+public:
+	static float fat_margin; //minimum growth of the boxes of the leaves, they also grow a 10% of their size
+
+	mutable unsigned int nodes_visited; //in the last query
+
+	AABBTree();
+
+	int insert(const AABB& box, void* data); //returns the proxy
+	void remove(int proxy);
+	bool move(int proxy, const AABB& box); //only changes the tree if the box leaves the fattened one, returns true then
+	void clear();
+
+	void* getData(int proxy) const { return nodes[proxy].data; }
+	size_t size() const { return num_proxies; }
+	int getHeight() const { return root == -1 ? 0 : nodes[root].height; }
+
+	//the queries add to result the data of the objects whose box (not the fattened one) is touched
+	void queryBox(const AABB& box, std::vector<void*>& result) const;
+	void querySphere(const Vector3& center, float radius, std::vector<void*>& result) const;
+	void queryFrustum(const float frustum[6][4], std::vector<void*>& result) const; //planes pointing inside, like Camera::frustum
+	void queryRay(const Vector3& origin, const Vector3& direction, float max_distance, std::vector<void*>& result, std::vector<float>* distances = NULL) const; //direction normalized, distances gets where the ray enters every box
+
+private:
+	struct sNode
+	{
+		Vector3 min; //fattened for the leaves
+		Vector3 max;
+		Vector3 box_min; //the box given by the user, only in the leaves
+		Vector3 box_max;
+		void* data;
+		int parent; //next free node when it is not used
+		int child1; //-1 in the leaves
+		int child2;
+		int height; //0 in the leaves, -1 in the free nodes
+		bool isLeaf() const { return child1 == -1; }
+	};
+
+	std::vector<sNode> nodes;
+	int root;
+	int free_list;
+	size_t num_proxies;
+
+	int allocateNode();
+	void freeNode(int id);
+	void insertLeaf(int leaf);
+	void removeLeaf(int leaf);
+	int balance(int id);
+	void refit(int id); //box and height of an internal node from its children
+};
+
+#endif
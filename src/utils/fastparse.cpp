@@ -0,0 +1,145 @@
+#include "fastparse.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <string>
+
+//powers of ten that can be represented exactly with a double
+static const double exact_powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+#define MAX_EXACT_POWER_OF_TEN 22
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+
+const char* parseInt(const char* pos, const char* end, int& value)
+{
+	const char* start = pos;
+	bool negative = false;
+	if (pos < end && (*pos == '-' || *pos == '+'))
+	{
+		negative = *pos == '-';
+		pos++;
+	}
+
+	if (pos == end || !isDigit(*pos))
+		return start;
+
+	//like strtol, a number out of range is clamped but all its digits are read
+	unsigned int limit = negative ? (unsigned int)INT_MAX + 1 : (unsigned int)INT_MAX;
+	unsigned int result = 0;
+	while (pos < end && isDigit(*pos))
+	{
+		unsigned int digit = *pos++ - '0';
+		result = result > (limit - digit) / 10 ? limit : result * 10 + digit;
+	}
+
+	value = negative ? (int)(0u - result) : (int)result;
+	return pos;
+}
+
+//for the rare cases (inf, nan, hexadecimal, too many digits...) we use the C library over a null terminated copy
+static const char* parseFloatSlow(const char* pos, const char* end, float& value)
+{
+	char buffer[64];
+	size_t len = skipWord(pos, end) - pos;
+	std::string long_number; //only for the numbers that do not fit in the buffer
+	char* str = buffer;
+	if (len < sizeof(buffer))
+	{
+		memcpy(buffer, pos, len);
+		buffer[len] = 0;
+	}
+	else
+	{
+		long_number.assign(pos, len);
+		str = &long_number[0];
+	}
+
+	char* last = NULL;
+	double result = strtod(str, &last);
+	if (last == str)
+		return pos;
+	value = (float)result;
+	return pos + (last - str);
+}
+
+const char* parseFloat(const char* pos, const char* end, float& value)
+{
+	const char* start = pos;
+	bool negative = false;
+	if (pos < end && (*pos == '-' || *pos == '+'))
+	{
+		negative = *pos == '-';
+		pos++;
+	}
+
+	//all the digits go to an integer mantissa, the ones that do not fit only change the exponent
+	unsigned long long mantissa = 0;
+	int num_digits = 0;
+	int exponent = 0;
+	bool has_digits = false;
+
+	while (pos < end && isDigit(*pos))
+	{
+		if (num_digits < 19)
+		{
+			mantissa = mantissa * 10 + (*pos - '0');
+			if (mantissa)
+				num_digits++;
+		}
+		else
+			exponent++;
+		has_digits = true;
+		pos++;
+	}
+
+	if (pos < end && *pos == '.')
+	{
+		pos++;
+		while (pos < end && isDigit(*pos))
+		{
+			if (num_digits < 19)
+			{
+				mantissa = mantissa * 10 + (*pos - '0');
+				if (mantissa)
+					num_digits++;
+				exponent--;
+			}
+			has_digits = true;
+			pos++;
+		}
+	}
+
+	if (!has_digits)
+		return parseFloatSlow(start, end, value);
+
+	if (pos < end && (*pos == 'e' || *pos == 'E'))
+	{
+		int exp_value = 0;
+		const char* exp_end = parseInt(pos + 1, end, exp_value);
+		if (exp_end != pos + 1) //an 'e' without number is not part of the float
+		{
+			exponent += exp_value;
+			pos = exp_end;
+		}
+	}
+
+	//the result is only correctly rounded if the mantissa and the power of ten are exact doubles,
+	//otherwise (more than 15 digits or a big exponent) it would be rounded twice
+	if (mantissa > MAX_EXACT_MANTISSA || (mantissa != 0 && (exponent > MAX_EXACT_POWER_OF_TEN || exponent < -MAX_EXACT_POWER_OF_TEN)))
+		return parseFloatSlow(start, end, value);
+
+	double result = (double)mantissa;
+	if (mantissa != 0 && exponent != 0)
+	{
+		if (exponent > 0)
+			result *= exact_powers_of_ten[exponent];
+		else
+			result /= exact_powers_of_ten[-exponent];
+	}
+
+	value = (float)(negative ? -result : result);
+	return pos;
+}
@@ -0,0 +1,43 @@
+/*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
+	Allocation free helpers to read numbers and words straight from a text buffer (used by the mesh loaders).
+	All of them work with a [pos,end) range so the buffer does not need to be null terminated,
+	and return the position after what was read (or the same position if nothing could be read).
+*/
+
+#ifndef FASTPARSE_H
+#define FASTPARSE_H
+
+inline bool isBlank(char c) { return c == ' ' || c == '\t'; }
+inline bool isEndOfLine(char c) { return c == '\n' || c == '\r'; }
+inline bool isDigit(char c) { return (unsigned char)(c - '0') < 10; }
+
+inline const char* skipBlanks(const char* pos, const char* end)
+{
+	while (pos < end && isBlank(*pos))
+		pos++;
+	return pos;
+}
+
+//returns the start of the next line
+inline const char* skipLine(const char* pos, const char* end)
+{
+	while (pos < end && *pos != '\n')
+		pos++;
+	return pos < end ? pos + 1 : end;
+}
+
+//returns the end of the word (a word ends with a blank or the end of the line)
+inline const char* skipWord(const char* pos, const char* end)
+{
+	while (pos < end && !isBlank(*pos) && !isEndOfLine(*pos))
+		pos++;
+	return pos;
+}
+
+//reads an integer with an optional sign
+const char* parseInt(const char* pos, const char* end, int& value);
+
+//reads a float in decimal or scientific notation without using the C locale (like std::from_chars)
+const char* parseFloat(const char* pos, const char* end, float& value);
+
+#endif
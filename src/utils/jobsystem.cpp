@@ -0,0 +1,313 @@
+#include "jobsystem.h"
+
+#include <cstdlib>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+
+#define JOBS_PER_THREAD 4 //chunks of parallelFor per thread, so the threads that finish first can steal the rest
+
+struct sJob
+{
+	std::function<void()> function;
+	JobCounter* counter;
+	bool main_thread;
+};
+
+struct sJobQueue
+{
+	std::mutex mutex;
+	std::deque<sJob*> jobs;
+};
+
+int JobSystem::num_threads = 0;
+
+static std::vector<sJobQueue*> s_queues; //one per thread of the pool, the main thread uses the first one
+static std::vector<std::thread*> s_workers;
+static sJobQueue s_main_queue; //the jobs that only the main thread can run
+static std::thread::id s_main_thread;
+static thread_local int s_thread_index = -1; //its queue in s_queues, -1 in the threads that are not from the pool
+static std::atomic<bool> s_running(false);
+static std::atomic<int> s_num_queued(0); //jobs in s_queues, the workers sleep when there are none
+static std::atomic<int> s_num_sleeping(0);
+static std::atomic<unsigned int> s_jobs_stolen(0);
+static std::mutex s_sleep_mutex;
+static std::condition_variable s_job_added;
+
+static void push(sJob* job);
+
+static void execute(sJob* job)
+{
+	job->function();
+	JobCounter* counter = job->counter;
+	delete job;
+	if (!counter)
+		return;
+
+	//the counter is not touched after the mutex is unlocked, wait() locks it before returning so it can be destroyed then
+	std::vector<sJob*> ready;
+	{
+		std::lock_guard<std::mutex> lock(counter->mutex);
+		if (--counter->pending == 0)
+			ready.swap(counter->waiting);
+	}
+	for (size_t i = 0; i < ready.size(); ++i)
+		push(ready[i]);
+}
+
+static void push(sJob* job)
+{
+	if (job->main_thread)
+	{
+		std::lock_guard<std::mutex> lock(s_main_queue.mutex);
+		s_main_queue.jobs.push_back(job);
+		return;
+	}
+
+	if (s_workers.empty()) //nobody else would take it
+	{
+		execute(job);
+		return;
+	}
+
+	sJobQueue* queue = s_queues[s_thread_index >= 0 ? s_thread_index : 0];
+	{
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->jobs.push_back(job);
+	}
+
+	//a worker counts itself as sleeping before checking s_num_queued, so one of both sees the change of the other
+	s_num_queued++;
+	if (s_num_sleeping > 0)
+	{
+		std::lock_guard<std::mutex> lock(s_sleep_mutex);
+		s_job_added.notify_one();
+	}
+}
+
+//the newest job of its own queue or the oldest of another one
+static sJob* takeJob(int index)
+{
+	int num = (int)s_queues.size();
+	int first = index >= 0 ? index : 0;
+	for (int i = 0; i < num; ++i)
+	{
+		int victim = (first + i) % num;
+		sJobQueue* queue = s_queues[victim];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (queue->jobs.empty())
+			continue;
+
+		sJob* job;
+		if (victim == index)
+		{
+			job = queue->jobs.back();
+			queue->jobs.pop_back();
+		}
+		else
+		{
+			job = queue->jobs.front();
+			queue->jobs.pop_front();
+			s_jobs_stolen++;
+		}
+		s_num_queued--;
+		return job;
+	}
+	return NULL;
+}
+
+static sJob* takeMainJob()
+{
+	std::lock_guard<std::mutex> lock(s_main_queue.mutex);
+	if (s_main_queue.jobs.empty())
+		return NULL;
+	sJob* job = s_main_queue.jobs.front();
+	s_main_queue.jobs.pop_front();
+	return job;
+}
+
+static void workerLoop(int index)
+{
+	s_thread_index = index;
+	while (s_running)
+	{
+		sJob* job = takeJob(index);
+		if (job)
+		{
+			execute(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(s_sleep_mutex);
+		s_num_sleeping++;
+		while (s_running && s_num_queued == 0)
+			s_job_added.wait(lock);
+		s_num_sleeping--;
+	}
+}
+
+void JobSystem::init()
+{
+	if (s_running)
+		return;
+
+	int count = num_threads;
+	if (count <= 0)
+		count = (int)std::thread::hardware_concurrency();
+	if (count < 1)
+		count = 1;
+
+	s_running = true;
+	s_main_thread = std::this_thread::get_id();
+	s_thread_index = 0;
+	for (int i = 0; i < count; ++i)
+		s_queues.push_back( new sJobQueue() );
+	for (int i = 1; i < count; ++i)
+		s_workers.push_back( new std::thread(workerLoop, i) );
+
+	static bool registered = false;
+	if (!registered) //threads must be stopped before the static objects are destroyed
+	{
+		registered = true;
+		atexit( JobSystem::deinit );
+	}
+}
+
+void JobSystem::deinit()
+{
+	if (!s_running)
+		return;
+
+	//somebody could be waiting for the jobs still queued
+	while (sJob* job = takeJob(s_thread_index))
+		execute(job);
+	update();
+
+	{
+		std::lock_guard<std::mutex> lock(s_sleep_mutex);
+		s_running = false;
+	}
+	s_job_added.notify_all();
+
+	for (size_t i = 0; i < s_workers.size(); ++i)
+	{
+		s_workers[i]->join();
+		delete s_workers[i];
+	}
+	s_workers.clear();
+	for (size_t i = 0; i < s_queues.size(); ++i)
+		delete s_queues[i];
+	s_queues.clear();
+	s_thread_index = -1;
+}
+
+int JobSystem::getNumThreads()
+{
+	init();
+	return (int)s_workers.size() + 1;
+}
+
+bool JobSystem::isMainThread()
+{
+	return !s_running || std::this_thread::get_id() == s_main_thread;
+}
+
+unsigned int JobSystem::getJobsStolen()
+{
+	return s_jobs_stolen;
+}
+
+static void addJob(const std::function<void()>& function, JobCounter* counter, JobCounter* dependency, bool main_thread)
+{
+	JobSystem::init();
+
+	sJob* job = new sJob();
+	job->function = function;
+	job->counter = counter;
+	job->main_thread = main_thread;
+	if (counter)
+		counter->pending++;
+
+	if (dependency)
+	{
+		std::lock_guard<std::mutex> lock(dependency->mutex);
+		if (dependency->pending > 0) //the last job of the dependency will queue it
+		{
+			dependency->waiting.push_back(job);
+			return;
+		}
+	}
+	push(job);
+}
+
+void JobSystem::run(const std::function<void()>& function, JobCounter* counter, JobCounter* dependency)
+{
+	addJob(function, counter, dependency, false);
+}
+
+void JobSystem::runInMainThread(const std::function<void()>& function, JobCounter* counter, JobCounter* dependency)
+{
+	addJob(function, counter, dependency, true);
+}
+
+void JobSystem::wait(JobCounter* counter)
+{
+	if (!counter)
+		return;
+
+	bool main_thread = isMainThread();
+	while (counter->pending > 0)
+	{
+		sJob* job = main_thread ? takeMainJob() : NULL;
+		if (!job)
+			job = takeJob(s_thread_index);
+		if (job)
+			execute(job);
+		else
+			std::this_thread::yield(); //the jobs left are running in other threads
+	}
+
+	std::lock_guard<std::mutex> lock(counter->mutex); //the last job could still be releasing the waiting ones
+}
+
+void JobSystem::parallelFor(size_t start, size_t end, size_t min_chunk, const std::function<void(size_t, size_t)>& function)
+{
+	if (end <= start)
+		return;
+
+	size_t num = end - start;
+	int threads = getNumThreads();
+	size_t chunks = std::min(num / std::max(min_chunk, (size_t)1), (size_t)threads * JOBS_PER_THREAD);
+	if (chunks <= 1 || threads == 1)
+	{
+		function(start, end);
+		return;
+	}
+
+	JobCounter counter;
+	size_t begin = start;
+	for (size_t i = 0; i < chunks; ++i)
+	{
+		size_t next = start + num * (i + 1) / chunks;
+		run( [&function, begin, next]() { function(begin, next); }, &counter );
+		begin = next;
+	}
+	wait(&counter);
+}
+
+void JobSystem::update()
+{
+	if (!s_running || !isMainThread())
+		return;
+
+	//only the ones already queued, a job that queues another one would never let it return
+	size_t num;
+	{
+		std::lock_guard<std::mutex> lock(s_main_queue.mutex);
+		num = s_main_queue.jobs.size();
+	}
+	for (size_t i = 0; i < num; ++i)
+		if (sJob* job = takeMainJob())
+			execute(job);
+}
@@ -0,0 +1,59 @@
+/*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
+	Runs small jobs in a pool of worker threads so the work of the frame uses all the cores.
+	Every thread has its own queue: it takes the jobs it added from the back and, when it has none, it steals from the front
+	of the queue of another thread, so the jobs spawned by a job tend to run in the same core.
+	A JobCounter counts the jobs that have not finished, wait() runs other jobs until it reaches zero (it never sleeps, so a job
+	can wait for the jobs it spawned) and a job can depend on a counter so it does not start until those jobs have finished.
+	The jobs that use OpenGL are added with runInMainThread, only the main thread takes them (in wait and update).
+*/
+
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <cstddef>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <functional>
+
+struct sJob;
+
+//it must not be destroyed until wait() has returned, even if isDone() says so
+class JobCounter
+{
+public:
+	JobCounter() : pending(0) {}
+	bool isDone() const { return pending == 0; }
+
+	//only for the JobSystem
+	std::atomic<int> pending;
+	std::mutex mutex; //protects waiting
+	std::vector<sJob*> waiting; //jobs that depend on this counter, they are queued when it reaches zero
+};
+
+class JobSystem
+{
+public:
+	static int num_threads; //including the main thread, 0 uses one per core, 1 runs everything in the calling thread. Set it before init
+
+	static void init(); //called by the first job if it was not called before, the thread that calls it is the main thread
+	static void deinit(); //runs the jobs still queued and stops the workers
+
+	static int getNumThreads(); //workers plus the main thread, the most jobs that can run at once
+	static bool isMainThread();
+	static unsigned int getJobsStolen(); //since init, taken from the queue of another thread
+
+	//queues the function, counter (if any) counts it until it has finished. It does not start until dependency (if any) is done
+	static void run(const std::function<void()>& function, JobCounter* counter = NULL, JobCounter* dependency = NULL);
+	static void runInMainThread(const std::function<void()>& function, JobCounter* counter = NULL, JobCounter* dependency = NULL);
+
+	static void wait(JobCounter* counter); //runs jobs until the counter is done
+
+	//calls function(start,end) for chunks of [start,end) of at least min_chunk elements in parallel and waits for all of them,
+	//the calling thread runs chunks too. The chunks never overlap and together they cover the whole range
+	static void parallelFor(size_t start, size_t end, size_t min_chunk, const std::function<void(size_t, size_t)>& function);
+
+	static void update(); //main thread, runs the main thread jobs that are ready
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "mappedfile.h"
+
+#ifdef WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+	data = NULL;
+	size = 0;
+#ifdef WIN32
+	file_handle = NULL;
+	mapping_handle = NULL;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+
+#ifdef WIN32
+	HANDLE file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if (mapping == NULL)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	if (view == NULL)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	file_handle = file;
+	mapping_handle = mapping;
+	data = (const char*)view;
+	size = (size_t)file_size.QuadPart;
+#else
+	int fd = ::open( filename, O_RDONLY );
+	if (fd == -1)
+		return false;
+
+	struct stat stbuffer;
+	if (fstat(fd, &stbuffer) != 0 || stbuffer.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* view = mmap( NULL, stbuffer.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	::close(fd); //the mapping keeps its own reference to the file
+	if (view == MAP_FAILED)
+		return false;
+
+	data = (const char*)view;
+	size = stbuffer.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data == NULL)
+		return;
+
+#ifdef WIN32
+	UnmapViewOfFile( data );
+	CloseHandle( (HANDLE)mapping_handle );
+	CloseHandle( (HANDLE)file_handle );
+	mapping_handle = file_handle = NULL;
+#else
+	munmap( (void*)data, size );
+#endif
+
+	data = NULL;
+	size = 0;
+}
@@ -0,0 +1,34 @@
+/*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
+	Read-only memory mapping of a file, used to access binary assets without copying them to RAM.
+*/
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+
+class MappedFile
+{
+public:
+	const char* data; //start of the mapping (page aligned), NULL if not open
+	size_t size; //size of the file in bytes
+
+	MappedFile();
+	~MappedFile();
+
+	bool open(const char* filename);
+	void close();
+	bool isOpen() const { return data != NULL; }
+
+private:
+#ifdef WIN32
+	void* file_handle;
+	void* mapping_handle;
+#endif
+
+	//not copyable, the mapping belongs to one object
+	MappedFile(const MappedFile&);
+	MappedFile& operator = (const MappedFile&);
+};
+
+#endif
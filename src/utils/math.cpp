@@ -5,6 +5,11 @@
 #include <cmath> //for sqrt (square root) function
 #include <math.h> //atan2
 
+//the SSE versions of the matrix operations do the same operations in the same order than the scalar code, so the results are identical
+#ifdef USE_SSE
+	#include <xmmintrin.h>
+#endif
+
 
 
 #define M_PI_2 1.57079632679489661923
@@ -70,24 +75,24 @@ void Vector2::parseFromText(const char* text)
 // **************************************
 const Vector3 Vector3::zero(0.0,0.0,0.0);
 
-double Vector3::length() 
+float Vector3::length() 
 {
-	return sqrt(x*x + y*y + z*z);
+	return sqrtf(x*x + y*y + z*z);
 }
 
-double Vector3::length() const
+float Vector3::length() const
 {
-	return sqrt(x*x + y*y + z*z);
+	return sqrtf(x*x + y*y + z*z);
 }
 
-double Vector3::length2() const
+float Vector3::length2() const
 {
 	return x*x + y*y + z*z;
 }
 
 Vector3& Vector3::normalize()
 {
-	double len = length();
+	float len = length();
 	x /= len;
 	y /= len;
 	z /= len;
@@ -203,6 +208,20 @@ Matrix44::Matrix44()
 	setIdentity();
 }
 
+Matrix44::Matrix44(const Matrix44& matrix)
+{
+	memcpy(m, matrix.m, 16*sizeof(float));
+	dirty = true;
+}
+
+//assigning always marks it as changed, even if the source was clean
+Matrix44& Matrix44::operator = (const Matrix44& matrix)
+{
+	memcpy(m, matrix.m, 16*sizeof(float));
+	dirty = true;
+	return *this;
+}
+
 void Matrix44::set()
 {
 	glMatrixMode( GL_MODELVIEW );
@@ -212,6 +231,7 @@ void Matrix44::set()
 void Matrix44::clear()
 {
 	memset(m, 0, 16*sizeof(float));
+	dirty = true;
 }
 
 void Matrix44::setIdentity()
@@ -220,12 +240,14 @@ void Matrix44::setIdentity()
 	m[1]=0; m[5]=1; m[9]=0; m[13]=0;
 	m[2]=0; m[6]=0; m[10]=1; m[14]=0;
 	m[3]=0; m[7]=0; m[11]=0; m[15]=1;
+	dirty = true;
 }
 
 void Matrix44::transpose()
 {
    std::swap(m[1],m[4]); std::swap(m[2],m[8]); std::swap(m[3],m[12]);
    std::swap(m[6],m[9]); std::swap(m[7],m[13]); std::swap(m[11],m[14]);
+   dirty = true;
 }
 
 Vector3 Matrix44::rotateVector(const Vector3& v) const
@@ -296,6 +318,7 @@ Matrix44& Matrix44::setTranslation(float x, float y, float z)
 void Matrix44::removeTranslation()
 {
 	m[12] = m[13] = m[14] = 0.0;
+	dirty = true;
 }
 
 //To create a rotation matrix
@@ -382,25 +405,73 @@ void Matrix44::copyOrientationTo( Matrix44& mat ) const
 	memcpy( &mat.m[0], &m[0], sizeof(float) * 3);
 	memcpy( &mat.m[4], &m[4], sizeof(float) * 3);
 	memcpy( &mat.m[8], &m[8], sizeof(float) * 3);
+	mat.dirty = true;
+}
+
+//result = a * b, result can be a or b
+static inline void multiplyMatrix(const float* a, const float* b, float* result)
+{
+#ifdef USE_SSE
+	__m128 b0 = _mm_loadu_ps(b);
+	__m128 b1 = _mm_loadu_ps(b + 4);
+	__m128 b2 = _mm_loadu_ps(b + 8);
+	__m128 b3 = _mm_loadu_ps(b + 12);
+	for (int i = 0; i < 16; i += 4)
+	{
+		//row i of the result is the rows of b weighted by the row i of a
+		__m128 row = _mm_mul_ps(_mm_set1_ps(a[i]), b0);
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i+1]), b1));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i+2]), b2));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i+3]), b3));
+		_mm_storeu_ps(result + i, row);
+	}
+#else
+	float temp[16];
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			temp[i*4+j] = a[i*4] * b[j] + a[i*4+1] * b[4+j] + a[i*4+2] * b[8+j] + a[i*4+3] * b[12+j];
+	memcpy(result, temp, sizeof(temp));
+#endif
+}
+
+static inline void transformPoint(const Matrix44& matrix, const Vector3& v, Vector3& result)
+{
+#ifdef USE_SSE
+	__m128 r = _mm_mul_ps(_mm_loadu_ps(matrix.m), _mm_set1_ps(v.x));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(matrix.m + 4), _mm_set1_ps(v.y)));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(matrix.m + 8), _mm_set1_ps(v.z)));
+	r = _mm_add_ps(r, _mm_loadu_ps(matrix.m + 12));
+	_mm_storel_pi((__m64*)result.v, r);
+	_mm_store_ss(result.v + 2, _mm_movehl_ps(r, r));
+#else
+	float x = matrix.m[0] * v.x + matrix.m[4] * v.y + matrix.m[8] * v.z + matrix.m[12];
+	float y = matrix.m[1] * v.x + matrix.m[5] * v.y + matrix.m[9] * v.z + matrix.m[13];
+	float z = matrix.m[2] * v.x + matrix.m[6] * v.y + matrix.m[10] * v.z + matrix.m[14];
+	result.set(x,y,z);
+#endif
 }
 
 //Multiply a matrix by another and returns the result
 Matrix44 Matrix44::operator*(const Matrix44& matrix) const
 {
 	Matrix44 ret;
+	multiplyMatrix(m, matrix.m, ret.m);
+	return ret;
+}
 
-	unsigned int i,j,k;
-	for (i=0;i<4;i++) 	
+void multiplyMatrices(const Matrix44* a, const Matrix44* b, Matrix44* result, unsigned int num)
+{
+	for (unsigned int i = 0; i < num; ++i)
 	{
-		for (j=0;j<4;j++) 
-		{
-			ret.M[i][j]=0.0;
-			for (k=0;k<4;k++) 
-				ret.M[i][j] += M[i][k] * matrix.M[k][j];
-		}
+		multiplyMatrix(a[i].m, b[i].m, result[i].m);
+		result[i].dirty = true;
 	}
+}
 
-	return ret;
+void transformPoints(const Matrix44& matrix, const Vector3* points, Vector3* result, unsigned int num)
+{
+	for (unsigned int i = 0; i < num; ++i)
+		transformPoint(matrix, points[i], result[i]);
 }
 
 
@@ -443,10 +514,9 @@ Vector3 operator * (const Vector3& a, float v)
 //Multiplies a vector by a matrix and returns the new vector
 Vector3 operator * (const Matrix44& matrix, const Vector3& v) 
 {   
-   float x = matrix.m[0] * v.x + matrix.m[4] * v.y + matrix.m[8] * v.z + matrix.m[12]; 
-   float y = matrix.m[1] * v.x + matrix.m[5] * v.y + matrix.m[9] * v.z + matrix.m[13]; 
-   float z = matrix.m[2] * v.x + matrix.m[6] * v.y + matrix.m[10] * v.z + matrix.m[14];
-   return Vector3(x,y,z);
+	Vector3 result;
+	transformPoint(matrix, v, result);
+	return result;
 }
 
 void Matrix44::setUpAndOrthonormalize(Vector3 up)
@@ -483,6 +553,7 @@ void Matrix44::setUpAndOrthonormalize(Vector3 up)
 	m[0] = right.x;
 	m[1] = right.y;
 	m[2] = right.z;
+	dirty = true;
 }
 
 void Matrix44::setFrontAndOrthonormalize(Vector3 front)
@@ -519,9 +590,57 @@ void Matrix44::setFrontAndOrthonormalize(Vector3 front)
 	m[0] = right.x;
 	m[1] = right.y;
 	m[2] = right.z;
-	
+	dirty = true;
 }
 
+#ifdef USE_SSE
+//the same Gauss-Jordan elimination than the scalar version, but every row operation is done in a single instruction
+bool Matrix44::inverse()
+{
+	union { __m128 row[4]; float M[4][4]; } temp, final;
+	for (int i = 0; i < 4; i++)
+	{
+		temp.row[i] = _mm_loadu_ps(m + i*4);
+		final.row[i] = _mm_setzero_ps();
+		final.M[i][i] = 1.0f;
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		//look for largest element in column
+		int swap = i;
+		for (int j = i + 1; j < 4; j++)
+			if ( fabs(temp.M[j][i]) > fabs(temp.M[swap][i]) )
+				swap = j;
+		if (swap != i)
+		{
+			std::swap(temp.row[i], temp.row[swap]);
+			std::swap(final.row[i], final.row[swap]);
+		}
+
+		if ( fabsf(temp.M[i][i]) <= 0.00001 ) //singular, see the scalar version
+			return false;
+
+		__m128 t = _mm_set1_ps(1.0f / temp.M[i][i]);
+		temp.row[i] = _mm_mul_ps(temp.row[i], t);
+		final.row[i] = _mm_mul_ps(final.row[i], t);
+
+		for (int j = 0; j < 4; j++)
+		{
+			if (j == i)
+				continue;
+			t = _mm_set1_ps(temp.M[j][i]);
+			temp.row[j] = _mm_sub_ps(temp.row[j], _mm_mul_ps(temp.row[i], t));
+			final.row[j] = _mm_sub_ps(final.row[j], _mm_mul_ps(final.row[i], t));
+		}
+	}
+
+	for (int i = 0; i < 4; i++)
+		_mm_storeu_ps(m + i*4, final.row[i]);
+	dirty = true;
+	return true;
+}
+#else
 bool Matrix44::inverse()
 {
    unsigned int i, j, k, swap;
@@ -594,6 +713,7 @@ bool Matrix44::inverse()
 
    return true;
 }
+#endif
 
 void Matrix44::perspective(float fov, float aspect, float near_plane, float far_plane)
 {
@@ -890,6 +1010,23 @@ float Quaternion::squaredLength() const
 
 void Quaternion::toMatrix(Matrix44& matrix) const
 {
+#ifdef USE_SSE
+	//the same products and sums than the scalar code, a row per register. s is 2 like below, the last lane of two is 0
+	//so the last lane of the products is 0 too
+	__m128 v = _mm_loadu_ps(q);
+	__m128 two = _mm_set_ps(0.0f, 2.0f, 2.0f, 2.0f);
+	__m128 squares = _mm_mul_ps(_mm_mul_ps(v, v), two); //xx yy zz 0
+	__m128 diagonal = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_shuffle_ps(squares, squares, _MM_SHUFFLE(3,0,0,1)), _mm_shuffle_ps(squares, squares, _MM_SHUFFLE(3,1,2,2)))); //1-(yy+zz) 1-(xx+zz) 1-(xx+yy)
+	__m128 a = _mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3,1,0,0)), _mm_shuffle_ps(v, v, _MM_SHUFFLE(3,2,2,1))), two); //xy xz yz 0
+	__m128 b = _mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3,3,3,3)), _mm_shuffle_ps(v, v, _MM_SHUFFLE(3,0,1,2))), two); //wz wy wx 0
+	__m128 sum = _mm_add_ps(a, b);
+	__m128 difference = _mm_sub_ps(a, b);
+
+	_mm_storeu_ps(matrix.m, _mm_shuffle_ps(_mm_unpacklo_ps(diagonal, difference), sum, _MM_SHUFFLE(3,1,1,0)));
+	_mm_storeu_ps(matrix.m + 4, _mm_shuffle_ps(_mm_unpacklo_ps(sum, diagonal), difference, _MM_SHUFFLE(3,2,3,0)));
+	_mm_storeu_ps(matrix.m + 8, _mm_shuffle_ps(_mm_shuffle_ps(difference, sum, _MM_SHUFFLE(2,2,1,1)), _mm_unpackhi_ps(diagonal, _mm_setzero_ps()), _MM_SHUFFLE(1,0,2,0)));
+	_mm_storeu_ps(matrix.m + 12, _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+#else
 	/*
 	If q is guaranteed to be a unit quaternion, s will always
 	be 2.  In that case, this calculation can be optimized out.
@@ -946,6 +1083,8 @@ void Quaternion::toMatrix(Matrix44& matrix) const
 	matrix._14 = matrix._24 = matrix._34 = 0;
 	matrix._41 = matrix._42 = matrix._43 = 0;
 	matrix._44 = 1;
+#endif
+	matrix.dirty = true;
 }
 
 float DotProduct(const Quaternion& q1, const Quaternion& q2)
@@ -18,6 +18,11 @@
 
 #define MYRAND(x) ((rand() / (double)RAND_MAX) * 2 * x - x)
 
+//SSE is used when the build targets SSE2 (x64 or /arch:SSE2), define NO_SIMD to use only the scalar code
+#if !defined(NO_SIMD) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__))
+	#define USE_SSE
+#endif
+
 class Vector2
 {
 public:
@@ -82,9 +87,9 @@ public:
 	Vector3(float x, float y, float z) { this->x = x; this->y = y; this->z = z;	}
 	Vector3(float* v) { x = v[0]; y = v[1]; z = v[2]; }
 
-	double length();
-	double length() const;
-	double length2() const;
+	float length();
+	float length() const;
+	float length2() const;
 
 	Vector3& set(float x, float y, float z) { this->x = x; this->y = y; this->z = z; return *this; }
 
@@ -147,9 +152,12 @@ class Matrix44
 			float M[4][4]; //[row][column]
 			float m[16];
 		};
+		bool dirty; //set by every method that changes the matrix, the owner clears it (the entities only recompute the moved transforms)
 
 		Matrix44();
 		Matrix44(const float* v);
+		Matrix44(const Matrix44& matrix);
+		Matrix44& operator = (const Matrix44& matrix);
 
 		void set();
 		void clear();
@@ -284,6 +292,10 @@ Vector3 operator + (const Vector3& a, const Vector3& b);
 Vector3 operator - (const Vector3& a, const Vector3& b);
 Vector3 operator * (const Vector3& a, float v);
 
+//batch versions of the operators, they avoid the temporaries of calling them in a loop. The result can be one of the inputs
+void transformPoints(const Matrix44& matrix, const Vector3* points, Vector3* result, unsigned int num); //result[i] = matrix * points[i]
+void multiplyMatrices(const Matrix44* a, const Matrix44* b, Matrix44* result, unsigned int num); //result[i] = a[i] * b[i]
+
 float DotProduct(const Vector3& a, const Vector3& b);
 Vector3 CrossProduct(const Vector3& a, const Vector3& b);
 
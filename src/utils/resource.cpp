@@ -0,0 +1,169 @@
+#include "resource.h"
+
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+unsigned int ResourceManager::frame = 0;
+size_t ResourceManager::cpu_budget = 0;
+size_t ResourceManager::vram_budget = 0;
+unsigned int ResourceManager::min_unused_frames = 60;
+
+static std::vector<Resource*> s_resources;
+static const char* s_type_names[] = { "Meshes", "Textures", "Shaders", "Fonts", "Audio" };
+
+Resource::Resource(char type)
+{
+	resource_type = type;
+	ref_count = 0;
+	last_used_frame = ResourceManager::frame;
+	evictable = false;
+	ResourceManager::add(this);
+}
+
+Resource::~Resource()
+{
+	assert(ref_count == 0 && "resource deleted while in use");
+	ResourceManager::remove(this);
+}
+
+void Resource::removeRef()
+{
+	assert(ref_count > 0);
+	ref_count--;
+	touch(); //so it is not freed just after being released
+}
+
+void Resource::touch()
+{
+	last_used_frame = ResourceManager::frame;
+}
+
+void ResourceManager::add(Resource* resource)
+{
+	s_resources.push_back(resource);
+}
+
+void ResourceManager::remove(Resource* resource)
+{
+	std::vector<Resource*>::iterator it = std::find(s_resources.begin(), s_resources.end(), resource);
+	if (it == s_resources.end())
+		return;
+	*it = s_resources.back();
+	s_resources.pop_back();
+}
+
+void ResourceManager::update()
+{
+	frame++;
+	if (cpu_budget == 0 && vram_budget == 0)
+		return;
+
+	size_t cpu_target = cpu_budget ? cpu_budget : (size_t)-1;
+	size_t vram_target = vram_budget ? vram_budget : (size_t)-1;
+	if (getCPUBytes() > cpu_target || getVRAMBytes() > vram_target)
+		evict(cpu_target, vram_target);
+}
+
+static bool sortByLastUse(const Resource* a, const Resource* b)
+{
+	return a->last_used_frame < b->last_used_frame;
+}
+
+unsigned int ResourceManager::evict(size_t cpu_target, size_t vram_target)
+{
+	size_t cpu_bytes = getCPUBytes();
+	size_t vram_bytes = getVRAMBytes();
+
+	std::vector<Resource*> candidates;
+	for (size_t i = 0; i < s_resources.size(); ++i)
+	{
+		Resource* r = s_resources[i];
+		if (r->evictable && r->ref_count == 0 && !r->isBusy() && frame - r->last_used_frame >= min_unused_frames)
+			candidates.push_back(r);
+	}
+	std::sort(candidates.begin(), candidates.end(), sortByLastUse);
+
+	unsigned int num_evicted = 0;
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		if (cpu_bytes <= cpu_target && vram_bytes <= vram_target)
+			break;
+
+		Resource* r = candidates[i];
+		size_t cpu = r->getCPUBytes();
+		size_t vram = r->getVRAMBytes();
+		if ( !(cpu_bytes > cpu_target && cpu) && !(vram_bytes > vram_target && vram) )
+			continue; //freeing it does not help
+
+		delete r; //the destructor removes it from the cache of its class and from the manager
+		cpu_bytes -= cpu;
+		vram_bytes -= vram;
+		num_evicted++;
+	}
+
+	if (num_evicted)
+		std::cout << "ResourceManager: " << num_evicted << " resources evicted" << std::endl;
+	return num_evicted;
+}
+
+size_t ResourceManager::getCPUBytes(int type)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < s_resources.size(); ++i)
+		if ((type == -1 || s_resources[i]->resource_type == type) && !s_resources[i]->isBusy())
+			total += s_resources[i]->getCPUBytes();
+	return total;
+}
+
+size_t ResourceManager::getVRAMBytes(int type)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < s_resources.size(); ++i)
+		if ((type == -1 || s_resources[i]->resource_type == type) && !s_resources[i]->isBusy())
+			total += s_resources[i]->getVRAMBytes();
+	return total;
+}
+
+std::string ResourceManager::getStats()
+{
+	unsigned int count[NUM_RESOURCE_TYPES] = {0};
+	unsigned int referenced[NUM_RESOURCE_TYPES] = {0};
+	size_t cpu[NUM_RESOURCE_TYPES] = {0};
+	size_t vram[NUM_RESOURCE_TYPES] = {0};
+	for (size_t i = 0; i < s_resources.size(); ++i)
+	{
+		Resource* r = s_resources[i];
+		int type = (int)r->resource_type;
+		count[ type ]++;
+		if (r->ref_count)
+			referenced[ type ]++;
+		if (r->isBusy())
+			continue;
+		cpu[ type ] += r->getCPUBytes();
+		vram[ type ] += r->getVRAMBytes();
+	}
+
+	std::string str;
+	char line[256];
+	size_t total_cpu = 0, total_vram = 0;
+	for (int i = 0; i < NUM_RESOURCE_TYPES; ++i)
+	{
+		sprintf(line, "%-10s %5u (%5u referenced)  CPU %9.2f KB  VRAM %9.2f KB\n", s_type_names[i], count[i], referenced[i], cpu[i] / 1024.0, vram[i] / 1024.0);
+		str += line;
+		total_cpu += cpu[i];
+		total_vram += vram[i];
+	}
+	sprintf(line, "Total      %5u                    CPU %9.2f KB  VRAM %9.2f KB\n", (unsigned int)s_resources.size(), total_cpu / 1024.0, total_vram / 1024.0);
+	str += line;
+	sprintf(line, "Budget     CPU %.2f KB  VRAM %.2f KB (0 means no limit)\n", cpu_budget / 1024.0, vram_budget / 1024.0);
+	str += line;
+	return str;
+}
+
+void ResourceManager::dumpStats()
+{
+	std::cout << getStats();
+}
@@ -0,0 +1,60 @@
+/*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
+	Base class for the resources (meshes, textures, shaders, fonts and sounds) so the memory they use can be measured,
+	and the ResourceManager, that frees the least recently used ones when the memory goes over budget.
+	Only resources loaded by their Load functions can be freed, and only when no one holds a reference (see addRef)
+	and they have not been used in the last frames. Everything here must be called from the main thread.
+*/
+
+#ifndef RESOURCE_H
+#define RESOURCE_H
+
+#include <cstddef>
+#include <string>
+
+enum eResourceType { RESOURCE_MESH, RESOURCE_TEXTURE, RESOURCE_SHADER, RESOURCE_FONT, RESOURCE_AUDIO, NUM_RESOURCE_TYPES };
+
+class Resource
+{
+public:
+	char resource_type;
+	int ref_count; //objects using it, it is never freed while there are references
+	unsigned int last_used_frame; //for the LRU
+	bool evictable; //set when it is stored in the cache of its class, the ones created by the user are never freed
+
+	Resource(char type);
+	virtual ~Resource();
+
+	void addRef() { ref_count++; }
+	void removeRef();
+	void touch(); //marks it as used in this frame
+
+	virtual size_t getCPUBytes() const = 0; //memory in RAM
+	virtual size_t getVRAMBytes() const = 0; //memory in the graphics card (approximated)
+	virtual bool isBusy() const { return false; } //true while a worker thread is filling it, it is not freed nor measured
+
+private:
+	Resource(const Resource&);
+	Resource& operator = (const Resource&);
+};
+
+class ResourceManager
+{
+public:
+	static unsigned int frame;
+	static size_t cpu_budget; //bytes, 0 means no limit
+	static size_t vram_budget; //bytes, 0 means no limit
+	static unsigned int min_unused_frames; //resources used more recently than this are never freed
+
+	static void add(Resource* resource);
+	static void remove(Resource* resource);
+
+	static void update(); //once per frame, evicts resources if it is over budget
+	static unsigned int evict(size_t cpu_target, size_t vram_target); //frees unused resources until the bytes are under the targets
+
+	static size_t getCPUBytes(int type = -1); //-1 for all the types
+	static size_t getVRAMBytes(int type = -1);
+	static std::string getStats();
+	static void dumpStats();
+};
+
+#endif
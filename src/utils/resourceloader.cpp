@@ -0,0 +1,157 @@
+#include "resourceloader.h"
+
+#include <cstdlib>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+int ResourceLoader::num_threads = 0;
+float ResourceLoader::upload_budget = 4;
+
+//all the state is shared between the workers and the main thread, so it is only accessed with the mutex locked
+static std::mutex s_mutex;
+static std::condition_variable s_job_added; //wakes up the workers
+static std::condition_variable s_job_loaded; //wakes up the main thread in flush
+static std::deque<ResourceJob*> s_pending_jobs; //waiting for a worker
+static std::deque<ResourceJob*> s_loaded_jobs; //waiting for the main thread
+static std::vector<std::thread*> s_workers;
+static unsigned int s_num_jobs = 0; //added and not uploaded
+static bool s_running = false;
+
+static void workerLoop()
+{
+	std::unique_lock<std::mutex> lock(s_mutex);
+	while (true)
+	{
+		while (s_running && s_pending_jobs.empty())
+			s_job_added.wait(lock);
+		if (!s_running)
+			break;
+
+		ResourceJob* job = s_pending_jobs.front();
+		s_pending_jobs.pop_front();
+
+		lock.unlock();
+		job->loaded = job->load();
+		lock.lock();
+
+		s_loaded_jobs.push_back(job);
+		s_job_loaded.notify_one();
+	}
+}
+
+void ResourceLoader::init()
+{
+	if (s_running)
+		return;
+
+	int count = num_threads;
+	if (count <= 0)
+		count = (int)std::thread::hardware_concurrency() - 1;
+	if (count < 1)
+		count = 1;
+
+	s_running = true;
+	for (int i = 0; i < count; ++i)
+		s_workers.push_back( new std::thread(workerLoop) );
+
+	static bool registered = false;
+	if (!registered) //threads must be stopped before the static objects are destroyed
+	{
+		registered = true;
+		atexit( ResourceLoader::deinit );
+	}
+}
+
+void ResourceLoader::deinit()
+{
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		if (!s_running)
+			return;
+		s_running = false;
+	}
+	s_job_added.notify_all();
+
+	for (size_t i = 0; i < s_workers.size(); ++i)
+	{
+		s_workers[i]->join();
+		delete s_workers[i];
+	}
+	s_workers.clear();
+
+	//the jobs not uploaded are discarded, the resources stay in their loading state
+	while (!s_pending_jobs.empty())
+	{
+		delete s_pending_jobs.front();
+		s_pending_jobs.pop_front();
+	}
+	while (!s_loaded_jobs.empty())
+	{
+		delete s_loaded_jobs.front();
+		s_loaded_jobs.pop_front();
+	}
+	s_num_jobs = 0;
+}
+
+void ResourceLoader::addJob(ResourceJob* job)
+{
+	init();
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		s_pending_jobs.push_back(job);
+		s_num_jobs++;
+	}
+	s_job_added.notify_one();
+}
+
+void ResourceLoader::update(float budget)
+{
+	if (budget < 0)
+		budget = upload_budget;
+
+	//at least one job is uploaded every frame so big uploads do not stall the queue
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	while (true)
+	{
+		ResourceJob* job = NULL;
+		{
+			std::lock_guard<std::mutex> lock(s_mutex);
+			if (s_loaded_jobs.empty())
+				return;
+			job = s_loaded_jobs.front();
+			s_loaded_jobs.pop_front();
+		}
+
+		job->upload();
+		delete job;
+
+		std::lock_guard<std::mutex> lock(s_mutex);
+		s_num_jobs--;
+		if (std::chrono::duration<float, std::milli>( std::chrono::steady_clock::now() - start ).count() >= budget)
+			return;
+	}
+}
+
+void ResourceLoader::flush()
+{
+	while (true)
+	{
+		update( 1e10f );
+
+		std::unique_lock<std::mutex> lock(s_mutex);
+		if (s_num_jobs == 0)
+			return;
+		while (s_loaded_jobs.empty())
+			s_job_loaded.wait(lock);
+	}
+}
+
+unsigned int ResourceLoader::getNumPending()
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	return s_num_jobs;
+}
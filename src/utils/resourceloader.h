@@ -0,0 +1,40 @@
+/*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
+	Loads resources in worker threads so the main thread does not stop while files are read and parsed.
+	Every resource load is split in two: load() runs in a worker (file access and decoding, no OpenGL calls)
+	and upload() runs in the main thread (OpenGL calls and making the resource available).
+	The main thread calls ResourceLoader::update every frame, it uploads as many finished jobs as fit in the time budget.
+*/
+
+#ifndef RESOURCELOADER_H
+#define RESOURCELOADER_H
+
+class ResourceJob
+{
+public:
+	bool loaded; //result of load(), upload() must check it
+
+	ResourceJob() { loaded = false; }
+	virtual ~ResourceJob() {}
+
+	virtual bool load() = 0; //worker thread
+	virtual void upload() = 0; //main thread, called even if load() failed
+};
+
+class ResourceLoader
+{
+public:
+	static int num_threads; //worker threads, 0 uses one per core (leaving one for the main thread)
+	static float upload_budget; //milliseconds per frame spent in upload()
+
+	static void init(); //called by addJob if it was not called before
+	static void deinit(); //waits for the jobs being loaded and stops the workers
+
+	static void addJob(ResourceJob* job); //the loader deletes the job after calling upload()
+
+	static void update(float budget = -1); //main thread, -1 uses upload_budget
+	static void flush(); //main thread, blocks until every job has been loaded and uploaded
+
+	static unsigned int getNumPending(); //jobs added that have not been uploaded yet
+};
+
+#endif
@@ -3,12 +3,16 @@
 #include <cassert>
 
 #include "../gfx/camera.h"
+#include "resourceloader.h"
 
 std::map<std::string, AudioFile*> AudioFile::sSamplesLoaded;
 
 AudioFile* AudioFile::Load(const char* filename, bool allows_3d)
 {
 	std::map<std::string, AudioFile*>::iterator it = sSamplesLoaded.find(filename);
+	if (it != sSamplesLoaded.end() && it->second->is_loading) //requested with LoadAsync, wait for it
+		ResourceLoader::flush();
+
 	if (it == sSamplesLoaded.end() )
 	{
 		AudioFile* a = new AudioFile();
@@ -19,19 +23,74 @@ AudioFile* AudioFile::Load(const char* filename, bool allows_3d)
 			return NULL;
 		}
 		std::cout << "Audio loaded: " << filename << std::endl;
+		a->evictable = true;
 		sSamplesLoaded[filename] = a;
 		return a;
 	}
 	return it->second;
 }
 
-AudioFile::AudioFile()
+//the sample is loaded in a worker thread into its own AudioFile and moved to the shared one in the main thread
+class AudioLoadJob : public ResourceJob
+{
+public:
+	AudioFile* audio;
+	AudioFile loaded_audio;
+	std::string filename;
+	bool allows_3d;
+
+	AudioLoadJob() { loaded_audio.is_loading = true; } //so the ResourceManager does not measure it
+
+	bool load() { return loaded_audio.load( filename.c_str(), allows_3d ); }
+	void upload()
+	{
+		if (loaded)
+			std::cout << "Audio loaded: " << filename << std::endl;
+		else
+			std::cout << "Error: Audio not found: " << filename << std::endl;
+		audio->hSample = loaded_audio.hSample;
+		audio->data_size = loaded_audio.data_size;
+		loaded_audio.hSample = 0;
+		audio->is_loading = false;
+	}
+};
+
+AudioFile* AudioFile::LoadAsync(const char* filename, bool allows_3d)
+{
+	//registered before it is loaded so requests for the same file share it
+	std::map<std::string, AudioFile*>::iterator it = sSamplesLoaded.find(filename);
+	if (it != sSamplesLoaded.end())
+		return it->second;
+
+	AudioFile* a = new AudioFile();
+	a->is_loading = true;
+	a->evictable = true;
+	sSamplesLoaded[filename] = a;
+
+	AudioLoadJob* job = new AudioLoadJob();
+	job->audio = a;
+	job->filename = filename;
+	job->allows_3d = allows_3d;
+	ResourceLoader::addJob(job);
+	return a;
+}
+
+AudioFile::AudioFile() : Resource(RESOURCE_AUDIO)
 {
 	hSample = 0;
+	is_loading = false;
+	data_size = 0;
 }
 
 AudioFile::~AudioFile()
 {
+	for (std::map<std::string, AudioFile*>::iterator it = sSamplesLoaded.begin(); it != sSamplesLoaded.end(); ++it)
+		if (it->second == this)
+		{
+			sSamplesLoaded.erase(it);
+			break;
+		}
+
 #ifdef BASS_SOUND
 	if (hSample != 0) 
 		BASS_SampleFree(hSample);
@@ -52,6 +111,7 @@ bool AudioFile::load(const char* filename, bool allows_3d)
 
 	BASS_SAMPLE info;
 	BASS_SampleGetInfo(hSample, &info);
+	data_size = info.length;
 	//info.volume = volume; //set data
 	
 	BASS_SampleSetInfo(hSample, &info);
@@ -66,6 +126,8 @@ AudioSample::AudioSample(const char* filename, bool allows_3d)
 {
 	hSampleChannel = 0;
 	sample = AudioFile::Load(filename, allows_3d);
+	if (sample)
+		sample->addRef();
 	min_distance = 0;
 	max_distance = 0;
 	is_3d = allows_3d;
@@ -79,11 +141,16 @@ AudioSample::~AudioSample()
 	if(hSampleChannel)
 		BASS_ChannelStop(hSampleChannel);
 #endif
+	if (sample)
+		sample->removeRef();
 }
 
 void AudioSample::play(float volume, bool loop)
 {
 	assert(sample);
+	if (sample->is_loading)
+		return;
+	sample->touch();
 	BOOL result = TRUE;
 	is_loop = loop;
 	this->volume = volume;
@@ -122,6 +189,10 @@ void AudioSample::play3D(float volume, Vector3& pos, Vector3& vel, bool loop)
 	assert(sample);
 	BOOL result = TRUE;
 
+	if (sample->is_loading)
+		return;
+	sample->touch();
+
 	if (sample->hSample == 0)
 	{
 		std::cerr << "Error no sample id" << std::endl;
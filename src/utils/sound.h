@@ -10,11 +10,12 @@
 #include <string>
 
 #include "../utils/math.h"
+#include "../utils/resource.h"
 
 class Camera;
 
 
-class AudioFile
+class AudioFile : public Resource
 {
 public:
 
@@ -24,12 +25,20 @@ public:
 	int hSample;
 #endif
 
+	bool is_loading; //true while a worker thread loads it (see LoadAsync), it plays nothing until then
+	size_t data_size; //bytes of the decoded sample
+
 	static std::map<std::string, AudioFile*> sSamplesLoaded;
 	static AudioFile* Load(const char* filename, bool allows_3d);
+	static AudioFile* LoadAsync(const char* filename, bool allows_3d);
 
 	AudioFile();
 	~AudioFile();
 	bool load(const char* filename, bool allows_3d);
+
+	size_t getCPUBytes() const { return sizeof(AudioFile) + data_size; }
+	size_t getVRAMBytes() const { return 0; }
+	bool isBusy() const { return is_loading; }
 };
 
 class AudioSample
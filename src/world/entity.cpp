@@ -6,25 +6,62 @@
 #include <set>
 #include <list>
 #include <string>
+#include <chrono>
+#include <cfloat>
+#include <mutex>
+#include <typeinfo>
 
 #include "../gfx/mesh.h"
 #include "../gfx/texture.h"
 #include "../gfx/camera.h"
 #include "../gfx/shader.h"
+#include "../gfx/culling.h"
+#include "../gfx/streambuffer.h"
 
 #include "../utils/utils.h"
+#include "../utils/aabbtree.h"
+#include "../utils/jobsystem.h"
 #include "world.h" //used for the global camera
 #include "controller.h"
 
+#define ENTITY_CHILDREN_PER_JOB 4 //with parallel_update
+
+static std::mutex s_destroy_mutex;
+static std::mutex s_transform_mutex; //markTransformDirty is called from the jobs of parallel_update
+
 //std::map<std::string, Entity*> Entity::s_registered_entities;
 tEntitySet Entity::s_entities_to_destroy;
-tEntityList Entity::s_entities_with_alpha;
+RenderQueue Entity::s_render_queue;
+AABBTree Entity::s_spatial_index;
 tEntitySet Entity::s_entities_registered;
 
 bool Entity::s_enable_culling = true;
 bool Entity::s_enable_debug_render = false;
 bool Entity::s_rendering_alpha_entities = false;
 unsigned int Entity::s_entities_rendered = 0;
+unsigned int Entity::s_entities_moved = 0;
+unsigned int Entity::s_entities_visible = 0;
+unsigned int Entity::s_culling_plane_tests = 0;
+bool Entity::s_hierarchical_culling = true;
+bool EntityMesh::s_enable_async_loading = false;
+
+//flat version of the trees used by updateTransforms, the parents are always before their children
+struct sTransformNode
+{
+	Entity* entity;
+	int parent; //index in the array, -1 for the roots
+	int end; //index after the last node of its subtree
+	bool moved; //the world matrix changed in this pass
+	bool bounding; //the aabb changed in this pass
+	bool children_bounding; //the aabb_children of some child changed
+	bool ancestor; //in s_transform_ancestors
+};
+static std::vector<sTransformNode> s_transform_nodes;
+static bool s_transform_order_dirty = true; //an entity was created, deleted or moved to another parent, every node is updated
+static std::vector<Entity*> s_transform_dirty; //marked with markTransformDirty since the last updateTransforms
+static std::vector<int> s_transform_roots; //their indices in s_transform_nodes, kept to reuse the memory
+static std::vector<int> s_transform_ancestors; //of the subtrees updated, their aabb_children change too
+static FrustumCuller s_culler; //the bounding spheres and subtree boxes of the nodes, in the same order
 
 Entity::Entity()
 {
@@ -73,6 +110,7 @@ void Entity::markToDestroy()
 	#ifdef _DEBUG
 		std::cout << "Entity marked to destroy: " << name << std::endl;
 	#endif
+	std::lock_guard<std::mutex> lock(s_destroy_mutex); //the children with parallel_update can be marked from several jobs
 	s_entities_to_destroy.insert(this);
 }
 
@@ -90,6 +128,7 @@ void Entity::registerEntity()
 {
 	assert( s_entities_registered.find(this) == s_entities_registered.end() ); //already in
 	s_entities_registered.insert( this );
+	s_transform_order_dirty = true;
 }
 
 void Entity::unregisterEntity()
@@ -97,6 +136,13 @@ void Entity::unregisterEntity()
 	tEntitySetIt it = s_entities_registered.find(this);
 	assert( it != s_entities_registered.end() );
 	s_entities_registered.erase(it);
+	s_transform_order_dirty = true;
+
+	if (spatial_proxy != -1)
+	{
+		s_spatial_index.remove(spatial_proxy);
+		spatial_proxy = -1;
+	}
 }
 
 bool Entity::isRegistered()
@@ -120,6 +166,11 @@ void Entity::init()
 	controller = NULL;
 	is_entitymeshcollide = false;
 	distance_to_camera = 0;
+	bounding_dirty = true;
+	transform_pending = false;
+	transform_index = -1;
+	spatial_proxy = -1;
+	parallel_update = false;
 }
 
 void Entity::addChild(Entity* child)
@@ -129,12 +180,14 @@ void Entity::addChild(Entity* child)
 	if (child->parent)
 	{
 		//erase from parent
-		tEntityList::iterator it = std::find( child->parent->children.begin(), child->parent->children.end(), this );
+		tEntityList::iterator it = std::find( child->parent->children.begin(), child->parent->children.end(), child );
 		child->parent->children.erase( it );
 	}
 
 	child->parent = this;
 	children.push_back(child);
+	child->model.dirty = true; //its world matrix depends on the new parent
+	s_transform_order_dirty = true;
 }
 
 Entity* Entity::getChild(unsigned int num, const char* filter)
@@ -173,11 +226,37 @@ Entity* Entity::getChildByName(const char* name)
 
 void Entity::render()
 {
-	//bool in_frustrum = true;
-	Vector3 pos = modelworld.getTranslation();
-	if (max_visible_distance && World::instance->current_camera->eye.distance(pos) > max_visible_distance)
+	//render can be called while the queue is being submitted (like the skybox inside World::renderEntity)
+	RenderQueue nested_queue;
+	bool nested = s_render_queue.isSubmitting();
+	RenderQueue& queue = nested ? nested_queue : s_render_queue;
+
+	queue.clear();
+	queue.far_plane = World::instance->current_camera->far_plane;
+	fillRenderQueue(queue);
+	queue.sort();
+	queue.submit(false);
+	if (nested) //nobody will call renderAlphaEntities for it
+		queue.submit(true);
+}
+
+void Entity::fillRenderQueue(RenderQueue& queue)
+{
+	Camera* camera = World::instance->current_camera;
+	float distance = camera->eye.distance( modelworld.getTranslation() );
+	if (max_visible_distance && distance > max_visible_distance)
 		return;
 
+	if (radius != 0.0)
+	{
+		distance_to_camera = distance;
+		if (distance_to_camera)
+			visibility = (10 * radius) / (camera->tan_fov * distance_to_camera); //average normalized screen space
+		else
+			visibility = 1.0;
+	}
+	inside_frustum = transform_index == -1 || s_culler.isVisible(transform_index); //the new entities are not culled until the next frame
+
 	/*
 	if(enable_culling && radius)
 	{
@@ -186,31 +265,18 @@ void Entity::render()
 	}
 	*/
 
-	//glPushMatrix();
-	//model.set();
 	if ( (!s_enable_culling || (s_enable_culling && inside_frustum)) && visible)
-	{
-		if (this->alpha < 1.0 && !s_rendering_alpha_entities)
-			s_entities_with_alpha.push_back(this);
-		else
-		{
-			glLoadMatrixf( (modelworld * World::instance->current_camera->view_matrix).m );
-			glPushAttrib( GL_ALL_ATTRIB_BITS );
-			renderEntity();
-			if (s_enable_debug_render)
-			{
-				renderBounding();
-				renderDebug();
-			}
-			glPopAttrib();
-		}
-	}
-	//glPopMatrix();
+		addToRenderQueue(queue, distance);
 
 	//children propagation
 	if (render_children)
 		for (tEntityList::iterator it = children.begin(); it != children.end(); it++)
-			(*it)->render();
+			(*it)->fillRenderQueue(queue);
+}
+
+void Entity::addToRenderQueue(RenderQueue& queue, float distance)
+{
+	queue.addEntity(this, distance);
 }
 
 void Entity::renderBounding()
@@ -247,23 +313,15 @@ void Entity::renderDebug()
 	Vector3 right = model.rotateVector(Vector3(1,0,0));
 	Vector3 up = model.rotateVector(Vector3(0,1,0));
 
-	glBegin( GL_LINES );
-		glColor3f(0,0,1);
-		glVertex3fv(pos.v);
-		front = pos + front * 20;
-		glVertex3fv(front.v);
-
-		glColor3f(1,0,0);
-		glVertex3fv(pos.v);
-		right = pos + right * 20;
-		glVertex3fv(right.v);
-
-		glColor3f(0,1,0);
-		glVertex3fv(pos.v);
-		up = pos + up * 20;
-		glVertex3fv(up.v);
-
-	glEnd();
+	unsigned int blue = packColor(0,0,1,1), red = packColor(1,0,0,1), green = packColor(0,1,0,1);
+	StreamVertex* lines = StreamBuffer::map(6);
+	lines[0].set(pos, 0, 0, blue);
+	lines[1].set(pos + front * 20, 0, 0, blue);
+	lines[2].set(pos, 0, 0, red);
+	lines[3].set(pos + right * 20, 0, 0, red);
+	lines[4].set(pos, 0, 0, green);
+	lines[5].set(pos + up * 20, 0, 0, green);
+	StreamBuffer::draw(GL_LINES, 6);
 }
 
 void Entity::setEntityColor(Vector3 color)
@@ -277,11 +335,20 @@ void Entity::setEntityColor(Vector3 color)
 
 Matrix44 Entity::getModelWorld()
 {
-	modelworld = ( parent ? model * parent->getModelWorld() : model );
+	if (isTransformDirty())
+		modelworld = ( parent ? model * parent->getModelWorld() : model );
 	return modelworld;
 	//return ( parent ? parent->getModelWorld() * model : model );
 }
 
+bool Entity::isTransformDirty()
+{
+	for (Entity* e = this; e; e = e->parent)
+		if (e->model.dirty)
+			return true;
+	return false;
+}
+
 Vector3 Entity::getWorldCoordinates( Vector3 v )
 {
 	return getModelWorld() * v;
@@ -297,19 +364,42 @@ void Entity::setPositionAndYaw(Vector3 pos, float yaw_in_deg)
 	model.setIdentity();
 	model.rotate( (float)(yaw_in_deg * DEG2RAD), Vector3(0.0f,1.0f,0.0f) );
 	model.translateGlobal(pos.x, pos.y, pos.z);
+	markTransformDirty();
+}
+
+void Entity::markTransformDirty()
+{
+	if (transform_pending)
+		return;
+	std::lock_guard<std::mutex> lock(s_transform_mutex);
+	if (transform_pending)
+		return;
+	transform_pending = true;
+	s_transform_dirty.push_back(this);
 }
 
 void Entity::update(float seconds)
 {
 	//*
-	model.translate( velocity_vector.x * seconds, velocity_vector.y * seconds, velocity_vector.z * seconds);
+	if (velocity_vector.x || velocity_vector.y || velocity_vector.z) //translate marks it as moved even if it does not
+		model.translate( velocity_vector.x * seconds, velocity_vector.y * seconds, velocity_vector.z * seconds);
 	//model.rotateLocal( angular_speed * seconds, Vector3(0,1,0) );
 	//*/
 
 	if (controller)
 		controller->update(seconds);
 
+	//also the changes made to the model since the last frame, so it only has to be marked by hand after the update
+	if (model.dirty || bounding_dirty)
+		markTransformDirty();
+
 	//children propagation
+	if (parallel_update && children.size() > 1)
+	{
+		updateChildrenInParallel(seconds);
+		return;
+	}
+
 	for (tEntityList::iterator it = children.begin(); it != children.end(); it++)
 	{
 		if ((*it)->time_to_destroy != KEEP_ALIVE && (*it)->time_to_destroy < 0)
@@ -322,6 +412,29 @@ void Entity::update(float seconds)
 	}
 }
 
+void Entity::updateChildrenInParallel(float seconds)
+{
+	//the list is copied because the jobs need random access, the children to destroy are marked here
+	std::vector<Entity*> to_update;
+	to_update.reserve(children.size());
+	for (tEntityList::iterator it = children.begin(); it != children.end(); it++)
+	{
+		if ((*it)->time_to_destroy != KEEP_ALIVE && (*it)->time_to_destroy < 0)
+			(*it)->markToDestroy();
+		else
+			to_update.push_back(*it);
+	}
+
+	JobSystem::parallelFor(0, to_update.size(), ENTITY_CHILDREN_PER_JOB, [&](size_t start, size_t end) {
+		for (size_t i = start; i < end; ++i)
+			to_update[i]->update(seconds);
+	});
+
+	for (tEntityList::iterator it = children.begin(); it != children.end(); it++)
+		if ((*it)->time_to_destroy != KEEP_ALIVE)
+			(*it)->time_to_destroy -= seconds;
+}
+
 std::string Entity::toString() 
 { 
 	Vector3 pos = getWorldCoordinates( Vector3() );
@@ -332,82 +445,211 @@ std::string Entity::toString()
 
 void Entity::updateBoundingInfo()
 {
-	//compute modelworld
-	if (parent)
-		modelworld = model * parent->modelworld;
-	else
-		modelworld = model;
+	updateTransforms();
+}
 
+static void addTransformNodes(Entity* entity, int parent)
+{
+	sTransformNode node;
+	node.entity = entity;
+	node.parent = parent;
+	node.moved = node.bounding = node.children_bounding = node.ancestor = false;
+	s_transform_nodes.push_back(node);
+
+	int index = (int)s_transform_nodes.size() - 1;
+	entity->transform_index = index;
+	entity->transform_pending = false;
+	for (tEntityList::iterator it = entity->children.begin(); it != entity->children.end(); it++)
+		addTransformNodes(*it, index);
+	s_transform_nodes[index].end = (int)s_transform_nodes.size();
+}
 
-	//compute world bounding
-	const float max_float = 10000000;
-	const float min_float = -10000000;
-	Vector3 aabb_min(max_float,max_float,max_float);
-	Vector3 aabb_max(min_float,min_float,min_float);
+void Entity::rebuildTransformOrder()
+{
+	s_transform_nodes.clear(); //keeps the memory
+	for (tEntitySetIt it = s_entities_registered.begin(); it != s_entities_registered.end(); it++)
+		if ((*it)->parent == NULL)
+			addTransformNodes(*it, -1);
+	s_culler.resize(s_transform_nodes.size());
+	s_transform_order_dirty = false;
+	s_transform_dirty.clear(); //some of them could be deleted, all the nodes are updated now
+}
 
-	aabb.center = modelworld.getTranslation();
-	aabb.halfsize = Vector3(1,1,1) * radius;
-	//*
-	if (oobb.halfsize.length2() != 0.0)
-	{
-		Vector3 corners[8];
-		corners[0] = oobb.center + oobb.halfsize * Vector3(-1,-1,-1);
-		corners[1] = oobb.center + oobb.halfsize * Vector3(-1,-1,1);
-		corners[2] = oobb.center + oobb.halfsize * Vector3(-1,1,-1);
-		corners[3] = oobb.center + oobb.halfsize * Vector3(-1,1,1);
-		corners[4] = oobb.center + oobb.halfsize * Vector3(1,-1,-1);
-		corners[5] = oobb.center + oobb.halfsize * Vector3(1,-1,1);
-		corners[6] = oobb.center + oobb.halfsize * Vector3(1,1,-1);
-		corners[7] = oobb.center + oobb.halfsize * Vector3(1,1,1);
-		Vector3 v;
-		for (int i = 0; i < 8; i++)
+//the world matrices and boundings of the nodes [start,end), a whole subtree or all of them. The parent of start did not move
+void Entity::updateTransformRange(int start, int end, bool rebuilt)
+{
+	//parents first, so the modelworld of the parent is always updated when the children need it
+	for (int i = start; i < end; ++i)
+	{
+		sTransformNode& node = s_transform_nodes[i];
+		Entity* e = node.entity;
+		node.moved = e->model.dirty || (i != start && node.parent != -1 && s_transform_nodes[node.parent].moved);
+		if (node.moved)
 		{
-			v = modelworld * corners[i];
-			aabb_min.setMin( v );
-			aabb_max.setMax( v );
+			e->modelworld = ( node.parent != -1 ? e->model * e->parent->modelworld : e->model );
+			e->model.dirty = false;
+			s_entities_moved++;
 		}
-		aabb.center = (aabb_max + aabb_min) * 0.5;
-		aabb.halfsize = (aabb_max - aabb.center);
+
+		node.bounding = node.moved || e->bounding_dirty;
+		if (node.bounding)
+		{
+			e->updateBounding();
+			e->bounding_dirty = false;
+
+			//the tree only changes if it left its fattened box
+			if (e->radius == 0.0 && e->spatial_proxy != -1)
+			{
+				s_spatial_index.remove(e->spatial_proxy);
+				e->spatial_proxy = -1;
+			}
+			else if (e->radius != 0.0 && e->spatial_proxy == -1)
+				e->spatial_proxy = s_spatial_index.insert(e->aabb, e);
+			else if (e->radius != 0.0)
+				s_spatial_index.move(e->spatial_proxy, e->aabb);
+		}
+		if (node.bounding || rebuilt) //the entities without radius were never culled
+			s_culler.setSphere(i, e->modelworld.getTranslation(), e->radius != 0.0 ? e->aabb.halfsize.length() : CULLING_ALWAYS_VISIBLE);
 	}
-	//*/
 
-	//propagate
-	for (tEntityList::iterator it = children.begin(); it != children.end(); it++)
+	//children first, the aabb_children of an entity only changes if its aabb or the aabb_children of a child changed
+	for (int i = end; i-- > start; )
 	{
-		Entity* e = (*it);
-		e->updateBoundingInfo();
-		aabb_min.setMin( e->aabb.center + e->aabb.halfsize );
-		aabb_max.setMax( e->aabb.center + e->aabb.halfsize );
+		sTransformNode& node = s_transform_nodes[i];
+		if (node.bounding || node.children_bounding || rebuilt)
+		{
+			node.entity->updateChildrenBounding();
+			s_culler.setSubtree(i, node.end, node.entity->aabb_children);
+			if (node.parent != -1)
+				s_transform_nodes[node.parent].children_bounding = true;
+		}
+		node.moved = node.bounding = node.children_bounding = false;
 	}
+}
 
-	if (children.size() > 0)
+void Entity::updateTransforms()
+{
+	s_entities_moved = 0;
+	if (s_transform_order_dirty)
 	{
-		aabb_children.center = (aabb_max + aabb_min) * 0.5;
-		aabb_children.halfsize = (aabb_max - aabb.center) * 2;
+		rebuildTransformOrder();
+		updateTransformRange(0, (int)s_transform_nodes.size(), true); //the spheres of every node must be stored again
+		return;
+	}
+	if (s_transform_dirty.empty())
+		return;
+
+	//only the subtrees of the marked entities, sorted so a subtree inside another one that is updated is skipped
+	s_transform_roots.clear();
+	for (size_t i = 0; i < s_transform_dirty.size(); ++i)
+	{
+		Entity* e = s_transform_dirty[i];
+		e->transform_pending = false;
+		s_transform_roots.push_back(e->transform_index);
+	}
+	s_transform_dirty.clear();
+	std::sort(s_transform_roots.begin(), s_transform_roots.end());
+
+	s_transform_ancestors.clear();
+	int updated_end = 0;
+	for (size_t i = 0; i < s_transform_roots.size(); ++i)
+	{
+		int root = s_transform_roots[i];
+		if (root < updated_end)
+			continue;
+		updated_end = s_transform_nodes[root].end;
+		updateTransformRange(root, updated_end, false);
+
+		//the parents of the subtree are recomputed afterwards, once each
+		for (int parent = s_transform_nodes[root].parent; parent != -1 && s_transform_nodes[parent].children_bounding && !s_transform_nodes[parent].ancestor; parent = s_transform_nodes[parent].parent)
+		{
+			s_transform_nodes[parent].ancestor = true;
+			s_transform_ancestors.push_back(parent);
+			if (s_transform_nodes[parent].parent != -1)
+				s_transform_nodes[s_transform_nodes[parent].parent].children_bounding = true;
+		}
+	}
+
+	//children first
+	std::sort(s_transform_ancestors.begin(), s_transform_ancestors.end());
+	for (size_t i = s_transform_ancestors.size(); i-- > 0; )
+	{
+		int index = s_transform_ancestors[i];
+		sTransformNode& node = s_transform_nodes[index];
+		node.entity->updateChildrenBounding();
+		s_culler.setSubtree(index, node.end, node.entity->aabb_children);
+		node.children_bounding = node.ancestor = false;
 	}
-	else
-		aabb_children = aabb;
 }
 
-void Entity::updateCulling(Camera* camera)
+void Entity::updateBounding()
 {
-	if (radius != 0.0)
+	aabb.center = modelworld.getTranslation();
+	aabb.halfsize = Vector3(1,1,1) * radius;
+	if (oobb.halfsize.length2() == 0.0)
+		return;
+
+	const float max_float = 10000000;
+	const float min_float = -10000000;
+	Vector3 aabb_min(max_float,max_float,max_float);
+	Vector3 aabb_max(min_float,min_float,min_float);
+
+	Vector3 corners[8];
+	corners[0] = oobb.center + oobb.halfsize * Vector3(-1,-1,-1);
+	corners[1] = oobb.center + oobb.halfsize * Vector3(-1,-1,1);
+	corners[2] = oobb.center + oobb.halfsize * Vector3(-1,1,-1);
+	corners[3] = oobb.center + oobb.halfsize * Vector3(-1,1,1);
+	corners[4] = oobb.center + oobb.halfsize * Vector3(1,-1,-1);
+	corners[5] = oobb.center + oobb.halfsize * Vector3(1,-1,1);
+	corners[6] = oobb.center + oobb.halfsize * Vector3(1,1,-1);
+	corners[7] = oobb.center + oobb.halfsize * Vector3(1,1,1);
+	Vector3 v;
+	for (int i = 0; i < 8; i++)
 	{
-		distance_to_camera = camera->eye.distance( modelworld.getTranslation() );
-		if (distance_to_camera)
-			visibility = (10 * radius) / (camera->tan_fov * distance_to_camera); //average normalized screen space
-		else
-			visibility = 1.0;
+		v = modelworld * corners[i];
+		aabb_min.setMin( v );
+		aabb_max.setMax( v );
+	}
+	aabb.center = (aabb_max + aabb_min) * 0.5;
+	aabb.halfsize = (aabb_max - aabb.center);
+}
 
-			inside_frustum = camera->sphereInFrustum( modelworld.getTranslation().x, modelworld.getTranslation().y, modelworld.getTranslation().z, (float)aabb.halfsize.length() ) != Camera::OUTSIDE;
+//encloses the aabb and the culling sphere of the entity and the aabb_children of its children, so it contains the whole subtree
+void Entity::updateChildrenBounding()
+{
+	Vector3 aabb_min = aabb.center - aabb.halfsize;
+	Vector3 aabb_max = aabb.center + aabb.halfsize;
+	if (radius != 0.0)
+	{
+		Vector3 pos = modelworld.getTranslation();
+		float sphere_radius = aabb.halfsize.length();
+		aabb_min.setMin( pos - Vector3(1,1,1) * sphere_radius );
+		aabb_max.setMax( pos + Vector3(1,1,1) * sphere_radius );
 	}
 
-	//		inside_frustum = World::instance->current_camera->clipper.SphereInFrustum( aabb.center.x, aabb.center.y, aabb.center.z, aabb.halfsize.length() ) != Clipper::OUTSIDE;
+	for (tEntityList::iterator it = children.begin(); it != children.end(); it++)
+	{
+		Entity* e = (*it);
+		aabb_min.setMin( e->aabb_children.center - e->aabb_children.halfsize );
+		aabb_max.setMax( e->aabb_children.center + e->aabb_children.halfsize );
+	}
 
-		//inside_frustum = World::instance->current_camera->clipper.AABBInFrustrum( aabb.center - aabb.halfsize, aabb.center + aabb.halfsize ) != Clipper::OUTSIDE;
+	aabb_children.center = (aabb_max + aabb_min) * 0.5;
+	aabb_children.halfsize = aabb_max - aabb_children.center;
+}
 
-	for (tEntityList::iterator it = children.begin(); it != children.end(); it++)
-		(*it)->updateCulling(camera);
+//culls the spheres of the subtree all together, they are contiguous in the flat arrays
+void Entity::updateCulling(Camera* camera)
+{
+	updateTransforms(); //the spheres of this frame
+	if (transform_index == -1)
+		return;
+	int end = s_transform_nodes[transform_index].end;
+	if (s_hierarchical_culling)
+		s_entities_visible = s_culler.cullHierarchy( camera->frustum, transform_index, end );
+	else
+		s_entities_visible = s_culler.cull( camera->frustum, transform_index, end );
+	s_culling_plane_tests = s_culler.plane_tests;
 }
 
 void Entity::computeProjection(Camera* camera, bool recursive)
@@ -481,37 +723,13 @@ void Entity::updateCamera(char cam_mode, Vector3 controller, Camera* camera, flo
 	}
 }
 
-bool furtherFromCamera(const Entity* a, const Entity* b)
-{
-	if (a->distance_to_camera > b->distance_to_camera)
-		return true;
-	return false;
-}
-
+//the opaque entities were rendered in Entity::render, the transparent ones wait in the queue
 void Entity::renderAlphaEntities()
 {
-	s_entities_with_alpha.sort(furtherFromCamera);
-
-	glDepthMask(false); //moved to renderAllAlpha
-	glEnable( GL_BLEND );
-
 	s_rendering_alpha_entities = true;
-	std::list<Entity*>::iterator it = s_entities_with_alpha.begin();
-	while(it != s_entities_with_alpha.end())
-	{
-		Entity* entity = (*it);
-		glLoadMatrixf( (entity->modelworld * World::instance->current_camera->view_matrix).m );
-		glPushAttrib( GL_ALL_ATTRIB_BITS );
-		entity->renderEntity();
-		if (s_enable_debug_render)
-			entity->renderBounding();
-		glPopAttrib();
-		it++;
-	}
-	s_entities_with_alpha.clear();
+	s_render_queue.submit(true);
+	s_render_queue.clear();
 	s_rendering_alpha_entities = false;
-
-	glDisable( GL_BLEND );
 }
 
 //********************************************
@@ -526,6 +744,14 @@ EntityMesh::EntityMesh(Entity* parent) : Entity(parent)
 	EntityMesh::init();
 }
 
+//the entity holds a reference to its resources so the ResourceManager does not free them
+EntityMesh::~EntityMesh()
+{
+	setMesh( (Mesh*)NULL );
+	setLowPoly( NULL );
+	clearTextures();
+}
+
 void EntityMesh::init()
 {
 	this->mesh = NULL;
@@ -540,44 +766,105 @@ void EntityMesh::init()
 	mesh_lowpoly_flat = NULL;
 	texture_lowpoly_flat = NULL;
 	lod_factor = 1.0;
+	oobb_pending = false;
+	use_render_queue = false;
 }
 
 void EntityMesh::update(float seconds)
 {
+	if (oobb_pending && mesh && !mesh->is_loading)
+		updateOOBB();
+
 	Entity::update(seconds);
 }
 
 void EntityMesh::updateOOBB()
 {
+	oobb_pending = mesh->is_loading;
+	if (oobb_pending) //the mesh has no bounding yet
+		return;
+
 	radius = mesh->radius;
 	oobb.center = this->mesh->center;
 	oobb.halfsize = this->mesh->halfsize;
+	bounding_dirty = true;
+	markTransformDirty();
 }
 
 void EntityMesh::setMesh( const char* mesh_filename )
 {
-	Mesh* mesh = Mesh::Load( getResourceFilename(mesh_filename).c_str() );
+	std::string filename = getResourceFilename(mesh_filename);
+	Mesh* mesh = s_enable_async_loading ? Mesh::LoadAsync( filename.c_str() ) : Mesh::Load( filename.c_str() );
 	assert(mesh);
 	this->setMesh(mesh);
 }
 
 void EntityMesh::setMesh( Mesh* mesh )
 {
+	if (mesh)
+		mesh->addRef();
+	if (this->mesh)
+		this->mesh->removeRef();
 	this->mesh = mesh;
 }
 
+void EntityMesh::setLowPoly( Mesh* lowpoly, Mesh* lowpoly_flat, Texture* texture_flat )
+{
+	//the new references first, they could be the current ones
+	if (lowpoly)
+		lowpoly->addRef();
+	if (lowpoly_flat)
+		lowpoly_flat->addRef();
+	if (texture_flat)
+		texture_flat->addRef();
+	if (mesh_lowpoly)
+		mesh_lowpoly->removeRef();
+	if (mesh_lowpoly_flat)
+		mesh_lowpoly_flat->removeRef();
+	if (texture_lowpoly_flat)
+		texture_lowpoly_flat->removeRef();
+	mesh_lowpoly = lowpoly;
+	mesh_lowpoly_flat = lowpoly_flat;
+	texture_lowpoly_flat = texture_flat;
+}
+
+void EntityMesh::setTexture(Texture* texture, unsigned int i)
+{
+	if (textures.size() <= i+1)
+		textures.resize(i+1);
+	if (texture)
+		texture->addRef();
+	if (textures[i])
+		textures[i]->removeRef();
+	textures[i] = texture;
+}
+
+void EntityMesh::clearTextures()
+{
+	for (size_t i = 0; i < textures.size(); ++i)
+		if (textures[i])
+			textures[i]->removeRef();
+	textures.clear();
+}
+
 void EntityMesh::setTexture(const char* filename, unsigned int i)
 {
-	Texture* texture = Texture::Load( getResourceFilename(filename).c_str() );
+	std::string fullname = getResourceFilename(filename);
+	Texture* texture = s_enable_async_loading ? Texture::LoadAsync( fullname.c_str() ) : Texture::Load( fullname.c_str() );
 	assert( texture );
 	if (texture) 
+	{
+		texture->addRef();
 		textures.push_back(texture);
+	}
 }
 
 void EntityMesh::setData(Mesh* mesh, Texture* texture)
 {
-	this->mesh = mesh;
-	this->textures.clear();
+	setMesh(mesh);
+	clearTextures();
+	if (texture)
+		texture->addRef();
 	this->textures.push_back(texture);
 	updateOOBB();
 }
@@ -585,22 +872,31 @@ void EntityMesh::setData(Mesh* mesh, Texture* texture)
 void EntityMesh::setData(Mesh* mesh, std::vector<Texture*> textures)
 {
 	this->setMesh(mesh);
+	clearTextures();
+	for (size_t i = 0; i < textures.size(); ++i)
+		if (textures[i])
+			textures[i]->addRef();
 	this->textures = textures;
 }
 
 void EntityMesh::setData(const char* mesh_filename, const char* texture_filename)
 {
-	Mesh* mesh = Mesh::Load( getResourceFilename(mesh_filename).c_str(), texture_filename == NULL);
+	//without texture the names come from the mesh materials, so the mesh must be loaded now
+	bool async = s_enable_async_loading && texture_filename != NULL;
+
+	std::string filename = getResourceFilename(mesh_filename);
+	Mesh* mesh = async ? Mesh::LoadAsync( filename.c_str() ) : Mesh::Load( filename.c_str(), texture_filename == NULL);
 	assert(mesh);
 	setMesh( mesh );
 
-	textures.clear();
+	clearTextures();
 
 	if (texture_filename != NULL)
 	{
-		Texture* texture = Texture::Load( getResourceFilename(texture_filename).c_str());
+		std::string texture_fullname = getResourceFilename(texture_filename);
+		Texture* texture = async ? Texture::LoadAsync( texture_fullname.c_str() ) : Texture::Load( texture_fullname.c_str() );
 		assert(texture);
-		if (texture) textures.push_back(texture);
+		if (texture) { texture->addRef(); textures.push_back(texture); }
 	}
 	else
 	{
@@ -608,22 +904,24 @@ void EntityMesh::setData(const char* mesh_filename, const char* texture_filename
 		{
 			Texture* texture = Texture::Load( getResourceFilename(mesh->material_name[i].c_str()).c_str());
 			assert(texture);
-			if (texture) textures.push_back(texture);
+			if (texture) { texture->addRef(); textures.push_back(texture); }
 		}
 	}
 }
 
 void EntityMesh::setData(const char* mesh_filename, std::vector<std::string> textures_filename)
 {
-	Mesh* mesh = Mesh::Load( getResourceFilename(mesh_filename).c_str());
+	std::string filename = getResourceFilename(mesh_filename);
+	Mesh* mesh = s_enable_async_loading ? Mesh::LoadAsync( filename.c_str() ) : Mesh::Load( filename.c_str() );
 	assert(mesh);
 	setMesh(mesh);
 
 	for (unsigned int i = 0; i < textures_filename.size();i++)
 	{
-		Texture* texture = Texture::Load( getResourceFilename(textures_filename[i].c_str() ).c_str() );
+		std::string texture_fullname = getResourceFilename( textures_filename[i].c_str() );
+		Texture* texture = s_enable_async_loading ? Texture::LoadAsync( texture_fullname.c_str() ) : Texture::Load( texture_fullname.c_str() );
 		assert(texture);
-		if (texture) textures.push_back(texture);
+		if (texture) { texture->addRef(); textures.push_back(texture); }
 	}
 
 
@@ -669,7 +967,7 @@ void EntityMesh::renderEntity()
 		renderMesh(0,lod_level);
 		render_children = false;
 	}
-	else if (mesh)
+	else if (mesh && mesh->isReady())
 	{
 		for (unsigned int i = 0; i < mesh->getNumSubmeshes(); i++)
 			renderMesh(i);
@@ -679,6 +977,42 @@ void EntityMesh::renderEntity()
 	if (two_sided) glEnable( GL_CULL_FACE );
 }
 
+//the same that renderEntity does, but as draw items so the queue can sort them by state
+void EntityMesh::addToRenderQueue(RenderQueue& queue, float distance)
+{
+	//a subclass could have changed renderEntity, it is still called unless the subclass says it does not need it
+	if (!use_render_queue && typeid(*this) != typeid(EntityMesh) && typeid(*this) != typeid(EntityMeshCollide))
+	{
+		Entity::addToRenderQueue(queue, distance);
+		return;
+	}
+
+	s_entities_rendered++;
+	unsigned char flags = (alpha_test ? DRAW_ALPHA_TEST : 0) | (two_sided ? DRAW_TWO_SIDED : 0) | (additive_blend ? DRAW_ADDITIVE : 0);
+
+	//LOD computation
+	float lod_level = 1.0;
+	if ( visibility < (lod_factor * 0.05) )
+		lod_level = 0.0;
+	else if ( visibility < (lod_factor * 0.2) )
+		lod_level = 0.5;
+
+	render_children = true;
+	if (mesh_lowpoly && lod_level < 1.0)
+	{
+		render_children = false;
+		if (mesh_lowpoly_flat && lod_level == 0.0) //flatmode
+			queue.addMesh(this, mesh_lowpoly_flat, 0, texture_lowpoly_flat, NULL, flags | DRAW_ALPHA_TEST | DRAW_DEBUG, distance);
+		else if (mesh_lowpoly->isReady())
+			queue.addMesh(this, mesh_lowpoly, 0, getTexture(0), shader, flags | DRAW_DEBUG, distance);
+	}
+	else if (mesh && mesh->isReady())
+	{
+		for (unsigned int i = 0; i < mesh->getNumSubmeshes(); i++)
+			queue.addMesh(this, mesh, i, getTexture(i), shader, i == 0 ? flags | DRAW_DEBUG : flags, distance);
+	}
+}
+
 void EntityMesh::renderMesh(int submaterial_id, float lod )
 {
 	glColor4f( entity_color.x, entity_color.y, entity_color.z, alpha );
@@ -722,62 +1056,34 @@ void EntityMesh::uploadShaderParameters(unsigned int submaterial_id)
 	if (shader == NULL)
 		return;
 
-	Matrix44 mod = modelworld;
-	if (shader->IsVar("model"))
-		shader->setMatrix44("model", mod.m );
+	//the handles are resolved when the shader is linked, the setters skip the uniforms it does not use
+	shader->setMatrix44(UNIFORM_MODEL, modelworld.m );
 
-	mod.removeTranslation();
-	//mod.inverse();
-	if (shader->IsVar("modelt"))
-		shader->setMatrix44("modelt", mod.getRotationMatrix().m );
-
-	if (shader->IsVar("camera_pos"))
-		shader->setUniform3Array("camera_pos", World::instance->current_camera->eye.v, 1 );
-
-	if (shader->IsVar("light_color"))
-		shader->setUniform3Array("light_color", World::instance->sun_color.v, 1 );
-	if (shader->IsVar("light_dir"))
-		shader->setUniform3Array("light_dir", World::instance->sun_direction.v, 1 );
+	if (shader->IsVar(UNIFORM_MODELT))
+	{
+		Matrix44 mod = modelworld;
+		mod.removeTranslation();
+		//mod.inverse();
+		shader->setMatrix44(UNIFORM_MODELT, mod.getRotationMatrix().m );
+	}
 
-	if (shader->IsVar("fog_color"))
-		shader->setUniform4Array("fog_color", World::instance->fog_color.v, 1 );
-	if (shader->IsVar("fog_density"))
-		shader->setUniform1("fog_density", World::instance->fog_density  );
+	//the globals only when the world changed them since this shader got them
+	World::instance->uploadFrameUniforms(shader);
 
 	if (getTexture(submaterial_id))
-		shader->setTexture("texture", getTexture(submaterial_id)->texture_id );
-
-	if (shader->IsVar("time"))
-		shader->setUniform1("time",World::instance->global_time);
-
-	if (shader->IsVar("emissive_color"))
-		shader->setUniform3Array("emissive_color",emissive_color.v,1);
-
-	if (shader->IsVar("specular"))
-		shader->setUniform1("specular",specular);
-	if (shader->IsVar("specular_gloss"))
-		shader->setUniform1("specular_gloss",specular_gloss);
-	if (shader->IsVar("ground_color"))
-		shader->setUniform3Array("ground_color",World::instance->ground_color.v,1);
-	if (shader->IsVar("ambient_color"))
-		shader->setUniform3Array("ambient_color",World::instance->ambient_color.v,1);
+		shader->setTexture(UNIFORM_TEXTURE, getTexture(submaterial_id)->texture_id );
 
-	if (shader->IsVar("discard_up"))
-	{
-		if (World::instance->rendering_reflection)
-		{
-			//float f = World::instance->current_camera->eye.y < 0.0 ? 1.0f : -1.0f;
-			shader->setUniform1("discard_up", 1.0f);
-		}
-		else
-		{
-			shader->setUniform1("discard_up", 0.0f);
-		}
-	}
+	shader->setUniform3Array(UNIFORM_EMISSIVE_COLOR,emissive_color.v,1);
+	shader->setUniform1(UNIFORM_SPECULAR,specular);
+	shader->setUniform1(UNIFORM_SPECULAR_GLOSS,specular_gloss);
 }
 
 // *********************************
 std::list<EntityMeshCollide*> EntityMeshCollide::s_collision_entities_list;
+unsigned int EntityMeshCollide::s_broadphase_pairs = 0;
+unsigned int EntityMeshCollide::s_collisions = 0;
+float EntityMeshCollide::s_collision_time = 0;
+std::vector<CollisionContact> EntityMeshCollide::s_contacts;
 
 EntityMeshCollide::EntityMeshCollide() : EntityMesh()
 {
@@ -787,6 +1093,8 @@ EntityMeshCollide::EntityMeshCollide() : EntityMesh()
 	bullet_collision = false;
 	ground_collision = false;
 	yield = false;
+	collision_layer = 1;
+	collision_mask = 0xFFFFFFFF;
 
 	s_collision_entities_list.push_back(this);
 }
@@ -799,6 +1107,8 @@ EntityMeshCollide::EntityMeshCollide(Entity* parent) : EntityMesh(parent)
 	ground_collision = false;
 	is_entitymeshcollide = true;
 	yield = false;
+	collision_layer = 1;
+	collision_mask = 0xFFFFFFFF;
 
 	s_collision_entities_list.push_back(this);
 }
@@ -815,70 +1125,74 @@ EntityMeshCollide::~EntityMeshCollide()
 }
 
 bool EntityMeshCollide::testCollision(EntityMeshCollide* object)
+{
+	CollisionContact contact;
+	if (!findContact(object, contact))
+		return false;
+	onEntityCollision(object);
+	object->onEntityCollision(this);
+	return true;
+}
+
+bool EntityMeshCollide::findContact(EntityMeshCollide* object, CollisionContact& contact)
 {
 	assert(object != this);
 
 	if (!entity_collision || !object->entity_collision) return false;
 	if (yield && object->yield) return false; //static objects cant collide between them
+	if (!(collision_layer & object->collision_mask) || !(object->collision_layer & collision_mask)) return false;
 
 	//sphere
 	if (collision_mode == NULL_COLLISION || object->collision_mode == NULL_COLLISION )
 		return false;
 
+	contact.entity = this;
+	contact.other = object;
+	Vector3 pos = modelworld.getTranslation();
+	Vector3 object_pos = object->modelworld.getTranslation();
+	CollisionResult result; //ColDet keeps nothing in the models, they can be shared by entities tested in other threads
 
-	if (collision_mode == SPHERE_COLLISION && object->collision_mode == SPHERE_COLLISION && modelworld.getTranslation().distance( object->modelworld.getTranslation()) < (radius + object->radius) )
+	if (collision_mode == SPHERE_COLLISION && object->collision_mode == SPHERE_COLLISION && (pos - object_pos).length2() < (radius + object->radius) * (radius + object->radius) )
 	{
-		onEntityCollision(object);
-		object->onEntityCollision(this);
+		contact.point = pos + (object_pos - pos) * (radius / (radius + object->radius));
 		return true;
 	}
 	
-	if (collision_mode == SPHERE_COLLISION && object->collision_mode == PLANE_COLLISION && fabs(modelworld.getTranslation().y - object->modelworld.getTranslation().y) < radius)
+	if (collision_mode == SPHERE_COLLISION && object->collision_mode == PLANE_COLLISION && fabs(pos.y - object_pos.y) < radius)
 	{
-		onEntityCollision(object);
-		object->onEntityCollision(this);
+		contact.point.set(pos.x, object_pos.y, pos.z);
 		return true;
 	}
 
-	if (collision_mode == PLANE_COLLISION && object->collision_mode == SPHERE_COLLISION && fabs(modelworld.getTranslation().y - object->modelworld.getTranslation().y) < object->radius)
+	if (collision_mode == PLANE_COLLISION && object->collision_mode == SPHERE_COLLISION && fabs(pos.y - object_pos.y) < object->radius)
 	{
-		onEntityCollision(object);
-		object->onEntityCollision(this);
+		contact.point.set(object_pos.x, pos.y, object_pos.z);
 		return true;
 	}
 
 	if (collision_mode == MESH_COLLISION && object->collision_mode == SPHERE_COLLISION)
 	{
-		mesh->collision_model->setTransform( modelworld.m );
-		bool test = mesh->collision_model->sphereCollision( object->modelworld.getTranslation().v, object->radius );
-		if (test == true)
+		if (mesh->collision_model->sphereCollision( modelworld.m, object_pos.v, object->radius, &result ))
 		{
-			onEntityCollision(object);
-			object->onEntityCollision(this);
+			contact.point = modelworld * Vector3(result.point[0], result.point[1], result.point[2]);
 			return true;
 		}
 	}
 
 	if (collision_mode == SPHERE_COLLISION && object->collision_mode == MESH_COLLISION)
 	{
-		object->mesh->collision_model->setTransform( object->modelworld.m );
-		bool test = object->mesh->collision_model->sphereCollision( modelworld.getTranslation().v, radius );
-		if (test == true)
+		if (object->mesh->collision_model->sphereCollision( object->modelworld.m, pos.v, radius, &result ))
 		{
-			onEntityCollision(object);
-			object->onEntityCollision(this);
+			contact.point = object->modelworld * Vector3(result.point[0], result.point[1], result.point[2]);
 			return true;
 		}
 	}
 
 	if (collision_mode == MESH_COLLISION && object->collision_mode == MESH_COLLISION)
 	{
-		mesh->collision_model->setTransform( modelworld.m );
-		bool test = object->mesh->collision_model->collision(mesh->collision_model,-1,0, object->modelworld.m );
-		if (test == true)
+		if (object->mesh->collision_model->collision( mesh->collision_model, object->modelworld.m, modelworld.m, &result ))
 		{
-			onEntityCollision(object);
-			object->onEntityCollision(this);
+			contact.point = object->modelworld * Vector3(result.point[0], result.point[1], result.point[2]);
 			return true;
 		}
 	}
@@ -898,34 +1212,138 @@ void EntityMeshCollide::TestAllCollisions()
 }
 */
 
+void EntityMeshCollide::getBroadphaseBox(Vector3& min, Vector3& max)
+{
+	Vector3 pos = modelworld.getTranslation();
+	if (collision_mode == SPHERE_COLLISION)
+	{
+		min = pos - Vector3(radius, radius, radius);
+		max = pos + Vector3(radius, radius, radius);
+	}
+	else if (collision_mode == PLANE_COLLISION) //horizontal and infinite
+	{
+		min.set(-FLT_MAX, pos.y, -FLT_MAX);
+		max.set(FLT_MAX, pos.y, FLT_MAX);
+	}
+	else
+	{
+		min = aabb.center - aabb.halfsize;
+		max = aabb.center + aabb.halfsize;
+	}
+}
+
+struct sCollider
+{
+	Vector3 min;
+	Vector3 max;
+	EntityMeshCollide* entity;
+	bool group_b;
+};
+
+#define COLLISION_PAIRS_PER_JOB 16 //a mesh test can cost as much as thousands of sphere tests, small jobs let the idle threads steal them
+
+static int s_sweep_axis = 0;
+static std::vector<sCollider> s_colliders; //keeps the memory between frames
+static std::vector<CollisionContact> s_pairs; //the pairs of the broadphase, findContact fills them
+static std::vector<char> s_pair_hits; //one per pair, every worker writes only the ones it took
+
+static bool sortByMin(const sCollider& a, const sCollider& b)
+{
+	return a.min.v[s_sweep_axis] < b.min.v[s_sweep_axis];
+}
+
+static void addColliders(Entity* group, bool group_b)
+{
+	for (tEntityListIt it = group->children.begin(); it != group->children.end(); it++)
+	{
+		if ((*it)->is_entitymeshcollide == false)
+			continue;
+		EntityMeshCollide* entity = (EntityMeshCollide*)(*it);
+		if (!entity->entity_collision || entity->collision_mode == EntityMeshCollide::NULL_COLLISION)
+			continue;
+		sCollider collider;
+		entity->getBroadphaseBox(collider.min, collider.max);
+		collider.entity = entity;
+		collider.group_b = group_b;
+		s_colliders.push_back(collider);
+	}
+}
+
 void EntityMeshCollide::TestCollisions(Entity* group_a, Entity* group_b)
 {
-	if (group_a != group_b)
-		for (std::list<Entity*>::iterator it = group_a->children.begin(); it != group_a->children.end(); it++)
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	updateTransforms(); //the boxes where the entities are now, not in the last frame
+
+	bool same_group = group_a == group_b;
+	s_colliders.clear();
+	s_pairs.clear();
+	addColliders(group_a, false);
+	if (!same_group)
+		addColliders(group_b, true);
+
+	//sweep along the axis where the entities are more spread
+	Vector3 spread_min(FLT_MAX, FLT_MAX, FLT_MAX);
+	Vector3 spread_max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (size_t i = 0; i < s_colliders.size(); ++i)
+		if (s_colliders[i].entity->collision_mode != PLANE_COLLISION)
 		{
-			if ((*it)->is_entitymeshcollide == false) continue;
-
-			for (std::list<Entity*>::iterator it2 = group_b->children.begin(); it2 != group_b->children.end(); it2++)
-			{
-				if ((*it2)->is_entitymeshcollide == false) continue;
-				if (*it != *it2)
-					((EntityMeshCollide*)(*it))->testCollision( (EntityMeshCollide*)(*it2) );
-			}
+			spread_min.setMin( (s_colliders[i].min + s_colliders[i].max) * 0.5 );
+			spread_max.setMax( (s_colliders[i].min + s_colliders[i].max) * 0.5 );
 		}
-	else
+	Vector3 spread = spread_max - spread_min;
+	s_sweep_axis = spread.x >= spread.y && spread.x >= spread.z ? 0 : (spread.y >= spread.z ? 1 : 2);
+	std::sort(s_colliders.begin(), s_colliders.end(), sortByMin);
+
+	int axis = s_sweep_axis;
+	int other1 = (axis + 1) % 3;
+	int other2 = (axis + 2) % 3;
+	size_t num = s_colliders.size();
+	for (size_t i = 0; i < num; ++i)
 	{
-		for (std::list<Entity*>::iterator it = group_a->children.begin(); it != group_a->children.end(); it++)
+		const sCollider& a = s_colliders[i];
+		//only the next ones that start before this one ends can overlap it
+		for (size_t j = i + 1; j < num && s_colliders[j].min.v[axis] <= a.max.v[axis]; ++j)
 		{
-			if ((*it)->is_entitymeshcollide == false) continue;
-
-			for (std::list<Entity*>::iterator it2 = it; it2 != group_a->children.end(); it2++)
-			{
-				if ((*it2)->is_entitymeshcollide == false) continue;
-				if (*it != *it2)
-					((EntityMeshCollide*)(*it))->testCollision( (EntityMeshCollide*)(*it2) );
-			}
+			const sCollider& b = s_colliders[j];
+			if (!same_group && a.group_b == b.group_b)
+				continue;
+			if (a.entity->yield && b.entity->yield)
+				continue;
+			if (!(a.entity->collision_layer & b.entity->collision_mask) || !(b.entity->collision_layer & a.entity->collision_mask))
+				continue;
+			if (a.min.v[other1] > b.max.v[other1] || b.min.v[other1] > a.max.v[other1] || a.min.v[other2] > b.max.v[other2] || b.min.v[other2] > a.max.v[other2])
+				continue;
+
+			//the entity of group_a first, like before the broadphase
+			CollisionContact pair;
+			pair.entity = a.group_b ? b.entity : a.entity;
+			pair.other = a.group_b ? a.entity : b.entity;
+			s_pairs.push_back(pair);
 		}
 	}
+	s_broadphase_pairs = (unsigned int)s_pairs.size();
+
+	//narrowphase
+	s_pair_hits.assign(s_pairs.size(), 0);
+	JobSystem::parallelFor(0, s_pairs.size(), COLLISION_PAIRS_PER_JOB, [](size_t start, size_t end) {
+		for (size_t i = start; i < end; ++i)
+			s_pair_hits[i] = s_pairs[i].entity->findContact(s_pairs[i].other, s_pairs[i]);
+	});
+
+	//the callbacks change the game, only now and in the order of the pairs
+	s_contacts.clear();
+	for (size_t i = 0; i < s_pairs.size(); ++i)
+		if (s_pair_hits[i])
+			s_contacts.push_back(s_pairs[i]);
+	s_collisions = (unsigned int)s_contacts.size();
+	for (size_t i = 0; i < s_contacts.size(); ++i)
+	{
+		CollisionContact& contact = s_contacts[i];
+		contact.entity->onEntityCollision(contact.other);
+		contact.other->onEntityCollision(contact.entity);
+	}
+
+	s_collision_time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 }
 
 //**********************************
@@ -3,6 +3,7 @@
 
 #include "../includes.h"
 #include "../utils/math.h"
+#include "renderqueue.h"
 
 #include <string>
 #include <list>
@@ -15,6 +16,7 @@ class Mesh;
 class Camera;
 class Entity;
 class Controller;
+class AABBTree;
 
 #define KEEP_ALIVE -100
 
@@ -35,12 +37,17 @@ public:
 	//static std::map<std::string, Entity*> s_registered_entities;
 	static tEntitySet s_entities_to_destroy;
 	static tEntitySet s_entities_registered;
-	static tEntityList s_entities_with_alpha; //they must be rendered at the end
+	static RenderQueue s_render_queue; //filled by render, the alpha items wait for renderAlphaEntities
+	static AABBTree s_spatial_index; //the aabb of every entity with radius, updated by updateTransforms
 
 	static bool s_enable_culling;
 	static bool s_enable_debug_render;
 	static bool s_rendering_alpha_entities;
 	static unsigned int s_entities_rendered;
+	static unsigned int s_entities_moved; //world transforms recomputed in the last updateTransforms
+	static unsigned int s_entities_visible; //inside the frustum in the last updateCulling
+	static unsigned int s_culling_plane_tests; //in the last updateCulling
+	static bool s_hierarchical_culling; //rejects or accepts whole subtrees with aabb_children (the default), otherwise tests every sphere
 
 	//properties
 	Matrix44 model;
@@ -66,6 +73,11 @@ public:
 	bool render_children;
 	float alpha; //alpha changes the rendering flow so it needs to be here
 
+	bool bounding_dirty; //the oobb changed, the aabb must be recomputed even if it did not move
+	int transform_index; //position in the flat arrays of updateTransforms, -1 until the next one
+	bool transform_pending; //marked for the next updateTransforms
+	int spatial_proxy; //in s_spatial_index, -1 if it has no radius
+
 	//culling info
 	float max_visible_distance;
 	float distance_to_camera;
@@ -73,10 +85,11 @@ public:
 	bool inside_frustum;
 	AABB oobb;
 	AABB aabb;
-	AABB aabb_children;
+	AABB aabb_children; //the whole subtree, this entity included
 
 	//control flags
 	bool is_entitymeshcollide;
+	bool parallel_update; //the subtrees of the children are updated at the same time in jobs, their update must not touch other entities
 
 public:
 	//Ctor
@@ -106,9 +119,12 @@ public:
 
 	virtual bool processAction(const char* action, Vector3 params) { return false; }
 
-	virtual void render();
+	virtual void render(); //renders the entity and its children through the RenderQueue
 	virtual void renderEntity() {}
+	void fillRenderQueue(RenderQueue& queue); //adds the visible entities of the tree
+	virtual void addToRenderQueue(RenderQueue& queue, float distance); //by default the entity renders itself with renderEntity
 	virtual void update(float seconds);
+	void updateChildrenInParallel(float seconds); //used by update when parallel_update is set
 
 	virtual void renderDebug();
 	virtual void renderBounding();
@@ -119,14 +135,15 @@ public:
 	//transforms
 	inline Vector3 getLocalPosition() { return model.getTranslation(); }
 	inline Vector3 getWorldPosition() { return modelworld.getTranslation(); }
-	virtual Matrix44 getModelWorld();
+	virtual Matrix44 getModelWorld(); //only multiplies if something changed in the chain since the last updateTransforms
 	Vector3 getWorldCoordinates( Vector3 v );
 	Vector3 getVelocityWorld();
 	void setPositionAndYaw(Vector3 pos, float yaw_in_deg);
+	void markTransformDirty(); //update calls it when the model or the bounding changed, call it if they change after the update of the frame
 
 	//computations
-	void updateBoundingInfo(); //extract info about boundings and wolrd matrix
-	void updateCulling(Camera* camera); //compute if it is inside the camera
+	void updateBoundingInfo(); //world matrices and boundings of the entities that moved (of all the trees, see updateTransforms)
+	void updateCulling(Camera* camera); //culls the bounding spheres of the subtree (see FrustumCuller), fillRenderQueue sets inside_frustum
 	void computeProjection(Camera* cam, bool recursive = false); //project to camera space
 
 	//change the camera
@@ -139,18 +156,32 @@ public:
 
 	static void destroyPendingEntities();
 	static void renderAlphaEntities();
+
+	//the world transforms are computed in a flat array sorted parents first, rebuilt only when the trees change.
+	//Only the subtrees of the entities marked with markTransformDirty are walked, and the aabb_children of their parents
+	static void updateTransforms();
+
+private:
+	void updateBounding(); //aabb from the oobb and modelworld
+	void updateChildrenBounding(); //aabb_children from the aabb of the entity and the aabb_children of the children
+	bool isTransformDirty(); //the model of this entity or of any parent changed
+	static void rebuildTransformOrder();
+	static void updateTransformRange(int start, int end, bool rebuilt);
 };
 
 class EntityMesh : public Entity
 {
 protected:
 	Mesh* mesh;
-	Mesh* mesh_lowpoly;
+	Mesh* mesh_lowpoly; //the three hold references, change them with setLowPoly
 	Mesh* mesh_lowpoly_flat;
 	Texture* texture_lowpoly_flat;
 	std::vector<Texture*> textures;
+	bool oobb_pending; //the mesh was still loading when assigned, updateOOBB must wait
 
 public:
+	static bool s_enable_async_loading; //setMesh, setTexture and setData with filenames load in the ResourceLoader
+
 	Shader* shader;
 	bool additive_blend;
 	bool alpha_test;
@@ -160,14 +191,19 @@ public:
 	float specular_gloss;
 
 	float lod_factor;
+	bool use_render_queue; //the mesh is drawn by the RenderQueue without calling renderEntity, EntityMesh and EntityMeshCollide always are. Set it in the subclasses that do not change renderEntity
 
 	EntityMesh();
 	EntityMesh(Entity* parent);
+	virtual ~EntityMesh();
 	void init();
 	virtual const char* getClassName() { return "EntityMesh"; }
 
 	//virtual void render();
+	//the globals of the shader (camera, sun, fog, time...) are the World::frame_uniforms of the current pass. When it is called
+	//outside World::renderWorld, call World::instance->updateFrameUniforms() first if they changed since the last pass
 	virtual void renderEntity();
+	virtual void addToRenderQueue(RenderQueue& queue, float distance); //like Entity::addToRenderQueue in the subclasses, unless use_render_queue
 	//virtual void update(float seconds);
 
 	void update(float seconds);
@@ -176,9 +212,10 @@ public:
 	//Methods
 	void setMesh( const char* mesh_filename );
 	void setMesh( Mesh* mesh );
+	void setLowPoly( Mesh* lowpoly, Mesh* lowpoly_flat = NULL, Texture* texture_flat = NULL ); //used far away, flat is the billboard for the farthest
 
 	Texture* getTexture(unsigned int id = 0) { return (textures.size() > id ? textures[id] : NULL); }
-	void setTexture(Texture* texture, unsigned int i = 0) { if (textures.size() <= i+1) textures.resize(i+1); textures[i] = texture; }
+	void setTexture(Texture* texture, unsigned int i = 0);
 	void setTexture(const char* filename, unsigned int i = 0);
 
 	void setData(const char* mesh_filename, const char* texture_filename);
@@ -188,22 +225,38 @@ public:
 
 
 	Mesh* getMesh() { return mesh; }
-	virtual void uploadShaderParameters(unsigned int submaterial_id = 0);
+	virtual void uploadShaderParameters(unsigned int submaterial_id = 0); //the globals only if the shader does not have them, see renderEntity
 
 	private:
 	void updateOOBB();
+	void clearTextures(); //releases the references
 
 };
 
 //************** Colliding meshes ***********************
 
+class EntityMeshCollide;
+
+struct CollisionContact
+{
+	EntityMeshCollide* entity; //the one whose onEntityCollision is called first
+	EntityMeshCollide* other;
+	Vector3 point; //world space
+};
+
 class EntityMeshCollide : public EntityMesh
 {
 public:
 	enum { NULL_COLLISION, BOUNDING_COLLISION, SPHERE_COLLISION, PLANE_COLLISION, MESH_COLLISION };
 
 	static std::list<EntityMeshCollide*> s_collision_entities_list;
+	static unsigned int s_broadphase_pairs; //pairs whose boxes overlap in the last TestCollisions, only those reach findContact
+	static unsigned int s_collisions; //in the last TestCollisions
+	static float s_collision_time; //ms spent in the last TestCollisions
+	static std::vector<CollisionContact> s_contacts; //of the last TestCollisions, in the order they were dispatched
 	char collision_mode;
+	unsigned int collision_layer; //bits of the layers it belongs to
+	unsigned int collision_mask; //layers it collides with, both entities of a pair must accept the other
 
 	bool entity_collision;
 	bool bullet_collision;
@@ -214,13 +267,25 @@ public:
 	EntityMeshCollide(Entity* parent);
 	~EntityMeshCollide();
 
-	virtual bool testCollision(EntityMeshCollide* object);
+	//tests one pair now: findContact and then the onEntityCollision of both. It is not virtual because TestCollisions does not call it
+	//(it runs findContact in jobs and the callbacks afterwards), the entities change how they collide in findContact and onEntityCollision
+	bool testCollision(EntityMeshCollide* object);
+
+	//narrowphase, it only reads both entities and their collision models so several pairs can be tested at once from different threads.
+	//The transforms must be updated
+	virtual bool findContact(EntityMeshCollide* object, CollisionContact& contact);
 	virtual bool onEntityCollision(EntityMeshCollide* object) { return false; }
 	virtual bool onSpecialCollision(char type, float force, Vector3 collision_point, Vector3 params) { return false; }
 
 	//static void TestAllCollisions();
 
+	//the children of both groups (or every pair inside group_a if they are the same) that collide.
+	//A sweep and prune of their world boxes finds the pairs that can collide, the entities without entity_collision
+	//or collision_mode and the pairs of yield entities are skipped. The pairs are tested with findContact in jobs of the JobSystem
+	//and the callbacks are called afterwards from this thread, always in the same order (the one of the sweep)
 	static void TestCollisions(Entity* group_a, Entity* group_b);
+
+	virtual void getBroadphaseBox(Vector3& min, Vector3& max); //must contain everything findContact can touch
 };
 
 //********* SOME HELPFUL MACROS ***************************
@@ -243,6 +308,7 @@ public: \
 	T(Entity* parent); \
 	void update(float elapsed); \
 	void renderEntity(); \
+	void addToRenderQueue(RenderQueue& queue, float distance) { Entity::addToRenderQueue(queue, distance); } \
 	virtual const char* getClassName() { return #T; } \
 };
 
@@ -0,0 +1,368 @@
+#include "renderqueue.h"
+
+#include <cassert>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "../includes.h"
+#include "../gfx/mesh.h"
+#include "../gfx/texture.h"
+#include "../gfx/shader.h"
+#include "../gfx/camera.h"
+#include "../gfx/streambuffer.h"
+#include "entity.h"
+#include "world.h" //used for the global camera
+
+RenderQueueStats RenderQueue::stats = { 0 };
+RenderQueueStats RenderQueue::last_frame_stats = { 0 };
+bool RenderQueue::use_instancing = true;
+
+#define LAYER_SHIFT 62
+#define ID_BITS 14
+#define FLAGS_MASK (DRAW_ALPHA_TEST | DRAW_TWO_SIDED | DRAW_ADDITIVE) //the flags that change the GL state
+#define DEPTH_BITS 17
+#define INSTANCING_MIN_ITEMS 4 //smaller groups are not worth filling the instance attributes
+
+//small number to group the items that use the same resource, two resources with the same id only make the sorting worse
+static unsigned long long resourceId(const void* resource)
+{
+	if (!resource)
+		return 0;
+	unsigned long long value = (unsigned long long)(size_t)resource >> 4; //allocations are aligned
+	value ^= (value >> ID_BITS) ^ (value >> (ID_BITS * 2));
+	return 1 + value % ((1 << ID_BITS) - 1);
+}
+
+//what the submission has set, so only the differences are sent to OpenGL
+struct sSubmitState
+{
+	Shader* shader;
+	Texture* texture;
+	bool texture_known;
+	Mesh* mesh;
+	unsigned char flags;
+	int blend; //-1 unknown, otherwise DRAW_ADDITIVE or 0
+};
+
+//leaves OpenGL as it was before the submission: no shader, no texture, no alpha test and culling enabled
+static void resetState(sSubmitState& state)
+{
+	if (state.mesh)
+		state.mesh->unbind();
+	if (state.shader)
+		state.shader->disable();
+	if (state.flags & DRAW_ALPHA_TEST)
+		glDisable( GL_ALPHA_TEST );
+	if (state.flags & DRAW_TWO_SIDED)
+		glEnable( GL_CULL_FACE );
+	if (!state.texture_known || state.texture)
+		glDisable( GL_TEXTURE_2D );
+
+	state.shader = NULL;
+	state.texture = NULL;
+	state.texture_known = true;
+	state.mesh = NULL;
+	state.flags = 0;
+	state.blend = -1;
+}
+
+static bool sortByKey(const DrawItem& a, const DrawItem& b)
+{
+	if (a.key != b.key)
+		return a.key < b.key;
+	return a.sequence < b.sequence;
+}
+
+RenderQueue::RenderQueue()
+{
+	far_plane = 0;
+	first_alpha_item = 0;
+	submitting = false;
+}
+
+void RenderQueue::clear()
+{
+	items.clear(); //keeps the memory for the next frame
+	first_alpha_item = 0;
+}
+
+void RenderQueue::push(DrawItem& item, char layer, float distance)
+{
+	float depth = far_plane > 0 ? std::max(0.0f, std::min(1.0f, distance / far_plane)) : 0.0f;
+	item.sequence = (unsigned int)items.size();
+	item.key = (unsigned long long)layer << LAYER_SHIFT;
+
+	if (layer == QUEUE_ALPHA) //back to front
+		item.key |= (unsigned long long)((1.0f - depth) * 0x3fffffff) << 32;
+	else if (layer == QUEUE_OPAQUE) //by state, front to back inside the same state
+	{
+		item.key |= resourceId(item.shader) << (DEPTH_BITS + 3 + ID_BITS * 2);
+		item.key |= resourceId(item.texture) << (DEPTH_BITS + 3 + ID_BITS);
+		item.key |= resourceId(item.mesh) << (DEPTH_BITS + 3);
+		item.key |= (unsigned long long)(item.flags & FLAGS_MASK) << DEPTH_BITS;
+		item.key |= (unsigned long long)(depth * ((1 << DEPTH_BITS) - 1));
+	}
+	//custom items keep the order of the tree
+
+	items.push_back(item);
+}
+
+void RenderQueue::addEntity(Entity* entity, float distance)
+{
+	DrawItem item;
+	item.entity = entity;
+	item.model = &entity->modelworld;
+	item.mesh = NULL;
+	item.texture = NULL;
+	item.shader = NULL;
+	item.submesh = 0;
+	item.flags = 0;
+	push(item, entity->alpha < 1.0 ? QUEUE_ALPHA : QUEUE_CUSTOM, distance);
+}
+
+void RenderQueue::addMesh(Entity* entity, Mesh* mesh, unsigned int submesh, Texture* texture, Shader* shader, unsigned char flags, float distance)
+{
+	assert(mesh);
+	DrawItem item;
+	item.entity = entity;
+	item.model = &entity->modelworld;
+	item.mesh = mesh;
+	item.texture = texture;
+	item.shader = shader;
+	item.submesh = (unsigned short)submesh;
+	item.flags = flags;
+	push(item, entity->alpha < 1.0 ? QUEUE_ALPHA : QUEUE_OPAQUE, distance);
+}
+
+void RenderQueue::sort()
+{
+	std::sort(items.begin(), items.end(), sortByKey);
+}
+
+void RenderQueue::submit(bool alpha_layer)
+{
+	size_t start = alpha_layer ? first_alpha_item : 0;
+	size_t end = start;
+	while (end < items.size() && (alpha_layer || (items[end].key >> LAYER_SHIFT) != QUEUE_ALPHA))
+		end++;
+	if (!alpha_layer)
+		first_alpha_item = end;
+	if (start == end)
+		return;
+
+	submitting = true;
+	stats.items += end - start;
+	Matrix44 view = World::instance->current_camera->view_matrix;
+
+	if (alpha_layer)
+	{
+		glDepthMask(false);
+		glEnable( GL_BLEND );
+	}
+
+	sSubmitState state;
+	state.mesh = NULL;
+	state.shader = NULL;
+	state.texture = NULL;
+	state.texture_known = false;
+	state.flags = 0;
+	state.blend = -1;
+
+	for (size_t i = start; i < end; ++i)
+	{
+		DrawItem& item = items[i];
+		size_t group_end = alpha_layer ? i + 1 : instanceGroupEnd(i, end);
+		bool instanced = group_end - i >= INSTANCING_MIN_ITEMS;
+		glLoadMatrixf( instanced ? view.m : (*item.model * view).m ); //the instances multiply their model in the shader
+
+		//the entity renders itself, the state is isolated like before the queue existed
+		if (!item.mesh)
+		{
+			resetState(state);
+			glPushAttrib( GL_ALL_ATTRIB_BITS );
+			item.entity->renderEntity();
+			if (Entity::s_enable_debug_render)
+			{
+				item.entity->renderBounding();
+				if (!alpha_layer)
+					item.entity->renderDebug();
+			}
+			glPopAttrib();
+			stats.draws++;
+			continue;
+		}
+
+		Shader* shader = instanced ? Shader::getInstancingShader() : item.shader;
+		if (shader != state.shader)
+		{
+			if (state.shader)
+				state.shader->disable();
+			if (shader)
+				shader->enable();
+			state.shader = shader;
+			stats.shader_changes++;
+		}
+		else if (shader) //the textures of the previous item moved the active texture unit
+			shader->resetTextureSlots();
+
+		if (!state.texture_known || item.texture != state.texture)
+		{
+			if (item.texture)
+				item.texture->bind();
+			else
+				glDisable( GL_TEXTURE_2D );
+			state.texture = item.texture;
+			state.texture_known = true;
+			stats.texture_changes++;
+		}
+
+		if (item.mesh != state.mesh)
+		{
+			if (state.mesh)
+				state.mesh->unbind();
+			state.mesh = item.mesh->bind() ? item.mesh : NULL;
+			stats.mesh_changes++;
+			if (!state.mesh) //the rest of the group uses the same mesh
+			{
+				i = group_end - 1;
+				continue;
+			}
+		}
+
+		unsigned char changed = (item.flags ^ state.flags) & FLAGS_MASK;
+		if (changed & DRAW_ALPHA_TEST)
+		{
+			if (item.flags & DRAW_ALPHA_TEST)
+			{
+				glEnable( GL_ALPHA_TEST );
+				glAlphaFunc( GL_GEQUAL, 0.5 );
+			}
+			else
+				glDisable( GL_ALPHA_TEST );
+			stats.state_changes++;
+		}
+		if (changed & DRAW_TWO_SIDED)
+		{
+			if (item.flags & DRAW_TWO_SIDED)
+				glDisable( GL_CULL_FACE );
+			else
+				glEnable( GL_CULL_FACE );
+			stats.state_changes++;
+		}
+		if (alpha_layer && state.blend != (item.flags & DRAW_ADDITIVE))
+		{
+			if (item.flags & DRAW_ADDITIVE)
+				glBlendFunc( GL_SRC_ALPHA, GL_ONE );
+			else
+				glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+			state.blend = item.flags & DRAW_ADDITIVE;
+			stats.state_changes++;
+		}
+		state.flags = item.flags;
+
+		if (instanced)
+		{
+			drawInstances(i, group_end, shader);
+			i = group_end - 1;
+			continue;
+		}
+
+		EntityMesh* entity = (EntityMesh*)item.entity;
+		glColor4f( entity->entity_color.x, entity->entity_color.y, entity->entity_color.z, entity->alpha );
+		if (item.shader)
+			entity->uploadShaderParameters(item.submesh);
+		item.mesh->draw(item.submesh);
+		stats.draws++;
+	}
+
+	resetState(state);
+	if (alpha_layer)
+	{
+		glDepthMask(true);
+		glDisable( GL_BLEND );
+	}
+
+	renderDebug(start, end, alpha_layer);
+	submitting = false;
+}
+
+//the end of the items after start that can be drawn with it in a single instanced call, start + 1 if there are none
+size_t RenderQueue::instanceGroupEnd(size_t start, size_t end) const
+{
+	const DrawItem& first = items[start];
+	if (!use_instancing || !first.mesh || first.shader || !Mesh::supportsInstancing() || !Shader::getInstancingShader())
+		return start + 1;
+
+	size_t i = start + 1;
+	while (i < end && items[i].mesh == first.mesh && items[i].submesh == first.submesh && items[i].texture == first.texture
+		&& !items[i].shader && ((items[i].flags ^ first.flags) & FLAGS_MASK) == 0)
+		i++;
+	return i;
+}
+
+//the state of the first item is set, the model and color of every item go to the instance attributes
+void RenderQueue::drawInstances(size_t start, size_t end, Shader* shader)
+{
+	DrawItem& first = items[start];
+	Vector3 bias;
+	float scale;
+	first.mesh->getPositionDecode(bias, scale);
+	static UniformHandle u_position_bias = Shader::getUniformHandle("position_bias");
+	static UniformHandle u_position_scale = Shader::getUniformHandle("position_scale");
+	static UniformHandle u_textured = Shader::getUniformHandle("textured");
+	shader->setUniform3(u_position_bias, bias);
+	shader->setUniform1(u_position_scale, scale);
+	shader->setUniform1(u_textured, first.texture ? 1.0f : 0.0f);
+
+	unsigned int num = (unsigned int)(end - start);
+	InstanceData* instances = (InstanceData*)StreamBuffer::mapData(num * sizeof(InstanceData));
+	for (size_t i = start; i < end; ++i)
+	{
+		EntityMesh* entity = (EntityMesh*)items[i].entity;
+		InstanceData& instance = instances[i - start];
+		memcpy(instance.model, items[i].model->m, sizeof(instance.model));
+		instance.color.set( entity->entity_color.x, entity->entity_color.y, entity->entity_color.z, entity->alpha );
+	}
+	const char* data = StreamBuffer::unmapData(num * sizeof(InstanceData));
+	first.mesh->drawInstanced(first.submesh, num, (const InstanceData*)data);
+	StreamBuffer::unbind();
+
+	stats.draws++;
+	stats.instanced_draws++;
+	stats.instances += num;
+}
+
+//the boundings of the entities drawn with meshes, after all of them so the state changes do not break the batches
+void RenderQueue::renderDebug(size_t start, size_t end, bool alpha_layer)
+{
+	if (!Entity::s_enable_debug_render)
+		return;
+
+	Matrix44 view = World::instance->current_camera->view_matrix;
+	for (size_t i = start; i < end; ++i)
+	{
+		DrawItem& item = items[i];
+		if (!item.mesh || !(item.flags & DRAW_DEBUG))
+			continue;
+		glLoadMatrixf( (*item.model * view).m );
+		glPushAttrib( GL_ALL_ATTRIB_BITS );
+		item.entity->renderBounding();
+		if (!alpha_layer)
+			item.entity->renderDebug();
+		glPopAttrib();
+	}
+}
+
+void RenderQueue::endFrame()
+{
+	last_frame_stats = stats;
+	memset(&stats, 0, sizeof(RenderQueueStats));
+}
+
+void RenderQueue::dumpStats()
+{
+	const RenderQueueStats& s = last_frame_stats;
+	std::cout << "RenderQueue: items " << s.items << " draws " << s.draws << " (instanced " << s.instanced_draws << " with " << s.instances << " items) shader changes " << s.shader_changes << " texture changes " << s.texture_changes
+		<< " mesh changes " << s.mesh_changes << " state changes " << s.state_changes << std::endl;
+}
@@ -0,0 +1,84 @@
+/*  by Javi Agenjo 2013 UPF  javi.agenjo@gmail.com
+	Renders the entities in two steps. The traversal of the tree only stores small draw items in the queue,
+	then they are sorted by the state they need (shader, texture, mesh) and the submission only changes the
+	OpenGL state that differs from the previous item.
+	Entities with their own renderEntity are drawn first, in the order of the tree and with their state isolated.
+	Transparent items are drawn at the end, from back to front.
+	Consecutive opaque items that only differ in the model are drawn with one instanced call when the card supports it,
+	otherwise the mesh stays bound and only the matrix changes between them.
+*/
+
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <cstddef>
+#include <vector>
+
+class Entity;
+class Mesh;
+class Texture;
+class Shader;
+class Matrix44;
+
+enum { QUEUE_CUSTOM, QUEUE_OPAQUE, QUEUE_ALPHA }; //layers, in submission order
+enum { DRAW_ALPHA_TEST = 1, DRAW_TWO_SIDED = 2, DRAW_ADDITIVE = 4, DRAW_DEBUG = 8 };
+
+struct DrawItem
+{
+	unsigned long long key; //layer, then shader, texture, mesh, flags and depth (only depth for the alpha layer)
+	unsigned int sequence; //order in the traversal, for the items with the same key
+	Entity* entity;
+	const Matrix44* model; //the modelworld of the entity
+	Mesh* mesh; //NULL when the entity renders itself with renderEntity
+	Texture* texture;
+	Shader* shader;
+	unsigned short submesh;
+	unsigned char flags;
+};
+
+struct RenderQueueStats
+{
+	unsigned int items;
+	unsigned int draws;
+	unsigned int instanced_draws; //included in draws
+	unsigned int instances; //items drawn by the instanced draws
+	unsigned int shader_changes;
+	unsigned int texture_changes;
+	unsigned int mesh_changes; //bind of the arrays of a mesh
+	unsigned int state_changes; //alpha test, face culling and blending
+};
+
+class RenderQueue
+{
+public:
+	static RenderQueueStats stats; //of the frame being rendered
+	static RenderQueueStats last_frame_stats;
+	static bool use_instancing; //groups of opaque items without shader that share mesh, texture and state go in a single draw
+
+	std::vector<DrawItem> items;
+	float far_plane; //to quantize the distances in the keys
+
+	RenderQueue();
+
+	void clear();
+	void addEntity(Entity* entity, float distance); //it will call renderEntity
+	void addMesh(Entity* entity, Mesh* mesh, unsigned int submesh, Texture* texture, Shader* shader, unsigned char flags, float distance);
+
+	void sort();
+	void submit(bool alpha_layer); //the custom and opaque items or the alpha ones
+	bool isSubmitting() const { return submitting; }
+
+	static void endFrame(); //moves stats to last_frame_stats
+	static void dumpStats();
+
+private:
+	size_t first_alpha_item; //set by submit(false)
+	bool submitting;
+
+	void push(DrawItem& item, char layer, float distance);
+	size_t instanceGroupEnd(size_t start, size_t end) const;
+	void drawInstances(size_t start, size_t end, Shader* shader);
+	void renderDebug(size_t start, size_t end, bool alpha_layer);
+};
+
+#endif
@@ -2,8 +2,11 @@
 
 #include <cassert>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 
 #include "../utils/utils.h"
+#include "../utils/aabbtree.h"
 
 #include "../gfx/texture.h"
 #include "../gfx/mesh.h"
@@ -32,6 +35,9 @@ World::World()
 	fog_color.set(0.5,0.5,0.5,1.0);
 
 	skybox = NULL;
+
+	frame_uniforms = FrameUniforms(); //value initialized, the floats too
+	frame_uniforms_version = 1; //the shaders start with 0
 }
 
 
@@ -57,14 +63,15 @@ void World::renderWorld(Camera* cam)
 
 	current_camera = cam;
 	current_camera->set();
+	updateFrameUniforms();
 
 	if (!freeze_culling)
 	{
 		frustum_mvp = (current_camera->view_matrix * current_camera->projection_matrix);
-		updateCulling(current_camera);
+		updateCulling(current_camera); //it updates the transforms too
 	}
-
-	updateBoundingInfo();
+	else
+		updateBoundingInfo();
 
 	glDisable( GL_BLEND );
 	glEnable( GL_DEPTH_TEST );
@@ -103,6 +110,44 @@ void World::renderDebug()
 	glPopMatrix();
 }
 
+void World::updateFrameUniforms()
+{
+	FrameUniforms u = FrameUniforms(); //compared with memcmp, nothing can be left uninitialized
+	if (current_camera)
+		u.camera_pos = current_camera->eye;
+	u.sun_color = sun_color;
+	u.sun_direction = sun_direction;
+	u.ground_color = ground_color;
+	u.ambient_color = ambient_color;
+	u.fog_color = fog_color;
+	u.fog_density = fog_density;
+	u.time = global_time;
+	u.discard_up = rendering_reflection ? 1.0f : 0.0f;
+
+	if (memcmp(&u, &frame_uniforms, sizeof(u)) == 0)
+		return;
+	frame_uniforms = u;
+	frame_uniforms_version++;
+}
+
+void World::uploadFrameUniforms(Shader* shader)
+{
+	if (shader->frame_uniforms_version == frame_uniforms_version)
+		return;
+	shader->frame_uniforms_version = frame_uniforms_version;
+
+	const FrameUniforms& u = frame_uniforms;
+	shader->setUniform3Array(UNIFORM_CAMERA_POS, u.camera_pos.v, 1 );
+	shader->setUniform3Array(UNIFORM_LIGHT_COLOR, u.sun_color.v, 1 );
+	shader->setUniform3Array(UNIFORM_LIGHT_DIR, u.sun_direction.v, 1 );
+	shader->setUniform4Array(UNIFORM_FOG_COLOR, u.fog_color.v, 1 );
+	shader->setUniform1(UNIFORM_FOG_DENSITY, u.fog_density );
+	shader->setUniform1(UNIFORM_TIME, u.time );
+	shader->setUniform3Array(UNIFORM_GROUND_COLOR, u.ground_color.v, 1 );
+	shader->setUniform3Array(UNIFORM_AMBIENT_COLOR, u.ambient_color.v, 1 );
+	shader->setUniform1(UNIFORM_DISCARD_UP, u.discard_up );
+}
+
 void World::update(float elapsed)
 {
 	if (elapsed == 0) return;
@@ -150,3 +195,55 @@ Entity* World::searchEntityByTag(const char* tag, int num)
 	return NULL;
 }
 
+//the tree returns the data pointers, they are the entities
+static std::vector<Entity*> toEntities(const std::vector<void*>& found)
+{
+	std::vector<Entity*> entities(found.size());
+	for (size_t i = 0; i < found.size(); ++i)
+		entities[i] = (Entity*)found[i];
+	return entities;
+}
+
+std::vector<Entity*> World::getEntitiesInBox(const AABB& box)
+{
+	std::vector<void*> found;
+	Entity::s_spatial_index.queryBox(box, found);
+	return toEntities(found);
+}
+
+std::vector<Entity*> World::getEntitiesInSphere(const Vector3& center, float radius)
+{
+	std::vector<void*> found;
+	Entity::s_spatial_index.querySphere(center, radius, found);
+	return toEntities(found);
+}
+
+std::vector<Entity*> World::getEntitiesInFrustum(Camera* camera)
+{
+	std::vector<void*> found;
+	Entity::s_spatial_index.queryFrustum(camera->frustum, found);
+	return toEntities(found);
+}
+
+static bool sortByFirst(const std::pair<float, Entity*>& a, const std::pair<float, Entity*>& b)
+{
+	return a.first < b.first;
+}
+
+std::vector<Entity*> World::getEntitiesInRay(const Vector3& origin, const Vector3& direction, float max_distance)
+{
+	std::vector<void*> found;
+	std::vector<float> distances;
+	Entity::s_spatial_index.queryRay(origin, direction, max_distance, found, &distances);
+
+	//by the distance where the ray enters the box, the center of a big box can be farther than a small box behind it
+	std::vector< std::pair<float, Entity*> > hits(found.size());
+	for (size_t i = 0; i < found.size(); ++i)
+		hits[i] = std::make_pair(distances[i], (Entity*)found[i]);
+	std::stable_sort(hits.begin(), hits.end(), sortByFirst);
+
+	std::vector<Entity*> entities(hits.size());
+	for (size_t i = 0; i < hits.size(); ++i)
+		entities[i] = hits[i].second;
+	return entities;
+}
@@ -4,6 +4,22 @@
 #include "entity.h"
 
 class Camera;
+class Shader;
+
+//the uniforms that are the same for every object in a render pass
+struct FrameUniforms
+{
+	Vector3 camera_pos;
+	Vector3 sun_color;
+	Vector3 sun_direction;
+	Vector3 ground_color;
+	Vector3 ambient_color;
+	Vector4 fog_color;
+	float fog_density;
+	float time;
+	float discard_up;
+};
+static_assert(sizeof(FrameUniforms) == 22 * sizeof(float), "it is compared with memcmp, it cannot have padding");
 
 class World : public Entity
 {
@@ -34,17 +50,30 @@ class World : public Entity
 	bool render_wireframe;
 	bool freeze_culling;
 
+	FrameUniforms frame_uniforms;
+	unsigned int frame_uniforms_version; //changes when any of the frame_uniforms changes
+
 	World();
 
 	virtual void renderWorld(Camera* camera);
 	void renderEntity();
 	void renderDebug();
 
+	void updateFrameUniforms(); //from the values above, renderWorld calls it for every pass, call it before rendering entities outside renderWorld
+	void uploadFrameUniforms(Shader* shader); //only if the shader does not have this version yet
+
 	void update(float elapsed);
 
 	void switchFreeCamera();
 	Entity* searchEntityByTag(const char* tag, int num);
 	std::vector<Entity*> getEntitiesByTag(const char* tag);
+
+	//spatial queries, they use Entity::s_spatial_index so they find any entity with radius, also outside the world.
+	//The boundings are the ones of the last updateTransforms (every renderWorld does it)
+	std::vector<Entity*> getEntitiesInBox(const AABB& box);
+	std::vector<Entity*> getEntitiesInSphere(const Vector3& center, float radius);
+	std::vector<Entity*> getEntitiesInFrustum(Camera* camera);
+	std::vector<Entity*> getEntitiesInRay(const Vector3& origin, const Vector3& direction, float max_distance = 100000); //sorted by the distance where the ray enters their box
 };
 
 #endif //WORLD_H
\ No newline at end of file